@@ -8,9 +8,36 @@ import argparse
 parser = argparse.ArgumentParser()
 parser.add_argument('-o', '--output')
 parser.add_argument('-v', dest='verbose', action='store_true')
+parser.add_argument('-i', '--id', type=int,
+                    help='object (or call site) to plot when the .timeline.csv file contains several ones')
 parser.add_argument('inputFile')
 args = parser.parse_args()
 
+if args.inputFile.endswith('.timeline.csv'):
+    # aggregate computed by numamma-report: plot the weight of the accesses
+    # to each page during each time interval
+    df = pd.read_csv(args.inputFile)
+    # the first column is the object (or call site) id
+    id_name = df.columns[0]
+    if args.id != None:
+        df = df[df[id_name] == args.id]
+    elif df[id_name].nunique() > 1:
+        sys.exit("{} contains several ids: select one {} with -i".format(args.inputFile, id_name))
+    if df.empty:
+        sys.exit("no sample to plot in {}".format(args.inputFile))
+    df['time'] = df['time']/1e9
+    df = df.groupby(['time', 'page'], as_index=False)[['count', 'weight']].sum()
+    fig = px.density_heatmap(df, x='time', y='page', z='weight', histfunc='sum',
+                             nbinsx=df['time'].nunique(), nbinsy=min(df['page'].nunique(), 1000),
+                             labels={'time': 'time (s)'})
+    fig.update_layout(title_text='Memory access to {} {} of {}'.format(id_name, df[id_name].iloc[0], args.inputFile))
+    if args.output != None:
+        print("Saving plot as "+args.output)
+        plotly.offline.plot(fig, filename=args.output, auto_open=False)
+    else:
+        fig.show()
+    sys.exit(0)
+
 #load the data
 df = pd.read_csv(args.inputFile, delimiter=' ')
 
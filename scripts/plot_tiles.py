@@ -0,0 +1,130 @@
+#!/usr/bin/python3
+# Plot the accesses to an object from the tiles written by numamma-report -T.
+# Only the index and the tiles that are displayed are read, so the tiles
+# file can be much larger than the memory.
+import struct
+import sys
+import argparse
+import plotly
+import plotly.graph_objects as go
+
+TILES_MAGIC = b'NMMTILES'
+TILES_VERSION = 2
+HEADER = struct.Struct('=8sIIQQQIIII')
+CELL = struct.Struct('=BBHIQ')
+INDEX_ENTRY = struct.Struct('=IIIIQQ')
+TILES_NAME_LEN = 32
+
+TILE_CHANNEL_ALL = 0
+TILE_CHANNEL_THREAD = 0x4000
+TILE_CHANNEL_LEVEL = 0x8000
+
+parser = argparse.ArgumentParser()
+parser.add_argument('-i', dest='id', type=int, required=True,
+                    help='object (or call site) to plot')
+parser.add_argument('-l', dest='level', type=int,
+                    help='level of the pyramid (default: the finest level with at most MAX_TILES tiles)')
+parser.add_argument('-m', dest='max_tiles', type=int, default=16)
+parser.add_argument('-c', dest='channel', default='all',
+                    help='all, thread:RANK or level:NAME (eg. level:L1_Hit)')
+parser.add_argument('-b', dest='begin', type=float, help='start time (s)')
+parser.add_argument('-e', dest='end', type=float, help='end time (s)')
+parser.add_argument('-z', dest='z', choices=['count', 'weight'], default='weight')
+parser.add_argument('-o', '--output')
+parser.add_argument('inputFile')
+args = parser.parse_args()
+
+f = open(args.inputFile, 'rb')
+(magic, version, tile_size, interval, page_size, start_time,
+ nb_levels, by_site, channel_level, reserved) = HEADER.unpack(f.read(HEADER.size))
+f.seek(-16, 2)
+footer_offset, end_magic = struct.unpack('=Q8s', f.read(16))
+if magic != TILES_MAGIC or end_magic != TILES_MAGIC:
+    sys.exit(args.inputFile + ' is not a tiles file')
+if version != TILES_VERSION:
+    sys.exit(args.inputFile + ' has version ' + str(version) + ' (expected ' + str(TILES_VERSION) + ')')
+
+f.seek(footer_offset)
+nb_tiles, = struct.unpack('=Q', f.read(8))
+index = [INDEX_ENTRY.unpack(f.read(INDEX_ENTRY.size)) for i in range(nb_tiles)]
+nb_mem_levels, = struct.unpack('=I', f.read(4))
+mem_levels = [f.read(TILES_NAME_LEN).rstrip(b'\0').decode() for i in range(nb_mem_levels)]
+
+if args.channel == 'all':
+    channel = TILE_CHANNEL_ALL
+elif args.channel.startswith('thread:'):
+    channel = TILE_CHANNEL_THREAD | int(args.channel[len('thread:'):])
+elif args.channel.startswith('level:') and args.channel[len('level:'):] in mem_levels:
+    channel = TILE_CHANNEL_LEVEL | mem_levels.index(args.channel[len('level:'):])
+else:
+    sys.exit('unknown channel ' + args.channel + ' (memory levels: ' + ', '.join(mem_levels) + ')')
+
+tiles = [e for e in index if e[0] == args.id]
+if not tiles:
+    sys.exit('no access to ' + ('call site ' if by_site else 'object ') + str(args.id))
+
+# the tiles in the time range [begin, end[ (in cells of level 0)
+def in_range(e):
+    first = e[2] * tile_size << e[1]
+    last = (e[2] + 1) * tile_size << e[1]
+    if args.begin is not None and last * interval <= args.begin * 1e9:
+        return False
+    if args.end is not None and first * interval >= args.end * 1e9:
+        return False
+    return True
+tiles = [e for e in tiles if in_range(e)]
+# the thread and memory level channels are only stored from channel_level
+if channel != TILE_CHANNEL_ALL:
+    if args.level is not None and args.level < channel_level:
+        sys.exit('channel ' + args.channel + ' is only stored from level ' + str(channel_level))
+    tiles = [e for e in tiles if e[1] >= channel_level]
+
+level = args.level
+if level is None:
+    levels = sorted({e[1] for e in tiles})
+    level = levels[-1]
+    for l in levels:
+        if sum(1 for e in tiles if e[1] == l) <= args.max_tiles:
+            level = l
+            break
+tiles = [e for e in tiles if e[1] == level]
+if len(tiles) > args.max_tiles and args.level is None:
+    print('warning: displaying ' + str(len(tiles)) + ' tiles', file=sys.stderr)
+
+# read the cells of the displayed tiles
+cell_duration = (interval << level) / 1e9
+cell_pages = 1 << level
+def in_time_range(x):
+    if args.begin is not None and (x + 1) * cell_duration <= args.begin:
+        return False
+    if args.end is not None and x * cell_duration >= args.end:
+        return False
+    return True
+cells = {}
+for (oid, l, tx, ty, offset, nb_cells) in tiles:
+    f.seek(offset)
+    data = f.read(nb_cells * CELL.size)
+    for (x, y, ch, count, weight) in CELL.iter_unpack(data):
+        if ch == channel and in_time_range(tx * tile_size + x):
+            cells[(tx * tile_size + x, ty * tile_size + y)] = count if args.z == 'count' else weight
+f.close()
+
+if not cells:
+    sys.exit('no access in channel ' + args.channel)
+
+xs = sorted({x for (x, y) in cells})
+ys = range(min(y for (x, y) in cells), max(y for (x, y) in cells) + 1)
+z = [[cells.get((x, y)) for x in xs] for y in ys]
+heatmap = go.Heatmap(x=[x * cell_duration for x in xs],
+                     y=[y * cell_pages for y in ys],
+                     z=z, colorbar={'title': args.z})
+fig = go.Figure(heatmap)
+fig.update_layout(title_text=('Call site ' if by_site else 'Object ') + str(args.id) +
+                  ' (' + args.channel + ', ' + str(cell_pages) + ' pages x ' +
+                  str(cell_duration) + ' s per cell)',
+                  xaxis_title='time (s)', yaxis_title='page')
+if args.output != None:
+    print("Saving plot as "+args.output)
+    plotly.offline.plot(fig, filename=args.output, auto_open=False)
+else:
+    fig.show()
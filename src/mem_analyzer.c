@@ -14,18 +14,31 @@
 #include <unistd.h>
 #include <gelf.h>
 #include <stddef.h>
+#include <math.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <sys/syscall.h>
+#include <numaif.h>
 
 #include "mem_intercept.h"
 #include "mem_analyzer.h"
 #include "mem_tools.h"
 #include "mem_sampling.h"
+#include "mem_arena.h"
+#include "mem_threads.h"
+#include "mem_dump.h"
+#include "mem_report.h"
+#include "mem_snapshot.h"
+#include "mem_control.h"
+#include "hash.h"
+#include "tools_allocator.h"
 
 #define USE_HASHTABLE
 #define WARN_NON_FREED 0
 
 #ifdef USE_HASHTABLE
-#include "hash.h"
-typedef struct ht_node* mem_info_node_t;
+#include "btree.h"
+typedef struct btree* mem_info_node_t;
 #else
 struct memory_info_list {
   struct memory_info_list* next;
@@ -35,14 +48,24 @@ struct memory_info_list {
 typedef struct memory_info_list* mem_info_node_t;
 #endif
 
+#ifdef USE_HASHTABLE
+/* all the buffers (freed or not) indexed by their address */
+static struct btree mem_index = BTREE_INITIALIZER;
+/* stays empty: freed buffers are kept in mem_index */
+static struct btree past_mem_index = BTREE_INITIALIZER;
+static mem_info_node_t mem_list = &mem_index;
+static mem_info_node_t past_mem_list = &past_mem_index;
+#else
 static mem_info_node_t mem_list = NULL; // malloc'd buffers currently in use
 static mem_info_node_t past_mem_list = NULL; // malloc'd buffers that were freed
+#endif
 static pthread_mutex_t mem_list_lock;
 
 extern struct mem_counters global_counters[2];
 
 __thread unsigned thread_rank;
-unsigned next_thread_rank = 0;
+/* the stack of the current thread */
+static __thread struct memory_info* thread_stack_info = NULL;
 #define PROGRAM_FILE_LEN 4096 // used for readlink cmd
 static char program_file[PROGRAM_FILE_LEN];
 
@@ -60,13 +83,114 @@ static __thread int is_record_safe = 1;
   } while(0)
 
 __thread struct mem_allocator* mem_info_allocator = NULL;
-struct mem_allocator* string_allocator = NULL;
 
 __thread struct tick tick_array[NTICKS];
 
 date_t origin_date;
 #define DATE(d) ((d)-origin_date)
 
+__thread struct alloc_sampler alloc_sampler = {.min_addr = UINTPTR_MAX};
+
+/* statistics on the allocations that were not recorded */
+static _Atomic uint64_t nb_untracked_allocs = 0;
+static _Atomic uint64_t untracked_alloc_size = 0;
+static _Atomic uintptr_t small_heap_start = UINTPTR_MAX;
+static _Atomic uintptr_t small_heap_end = 0;
+/* the object that stands for all the allocations that were not recorded */
+static struct memory_info* small_heap_info = NULL;
+
+static void _init_mem_info(struct memory_info* mem_info,
+			   enum mem_type mem_type,
+			   date_t alloc_date,
+			   size_t initial_buffer_size,
+			   void* buffer_addr,
+			   void** callstack_rip,
+			   int callstack_size,
+			   void* caller_rip,
+			   string_id_t caller_id);
+static void __ma_insert_buffer(struct memory_info* mem_info);
+static void __set_mem_info_free(struct memory_info* mem_info);
+static void __ma_register_thread_stack();
+static void __ma_register_thread_tls();
+static void __ma_retire_thread_tls();
+
+/* xorshift64* */
+static uint64_t __alloc_sampling_random() {
+  if(!alloc_sampler.seed)
+    alloc_sampler.seed = ((uintptr_t)&alloc_sampler ^ new_date()) | 1;
+  alloc_sampler.seed ^= alloc_sampler.seed >> 12;
+  alloc_sampler.seed ^= alloc_sampler.seed << 25;
+  alloc_sampler.seed ^= alloc_sampler.seed >> 27;
+  return alloc_sampler.seed * 0x2545f4914f6cdd1dULL;
+}
+
+/* return the number of allocations (or bytes) until the next recorded allocation */
+static int64_t __alloc_sampling_interval() {
+  if(settings.alloc_sampling == ALLOC_SAMPLING_NONE)
+    return INT64_MAX;
+  if(settings.alloc_sampling_period <= 1)
+    return 1;
+  /* exponentially distributed intervals: the recorded allocations form a
+   * Poisson process, so that allocation patterns can't synchronize with the sampler
+   */
+  double u = ((__alloc_sampling_random() >> 11) + 1) * 0x1.0p-53;
+  double interval = ceil(-log(u) * settings.alloc_sampling_period);
+  if(interval >= INT64_MAX)
+    return INT64_MAX;
+  return interval;
+}
+
+/* report the allocations that were not recorded by the current thread */
+static void __alloc_sampling_flush() {
+  struct alloc_sampler* s = &alloc_sampler;
+  if(!s->nb_untracked)
+    return;
+  nb_untracked_allocs += s->nb_untracked;
+  untracked_alloc_size += s->untracked_size;
+
+  uintptr_t start = small_heap_start;
+  while(s->min_addr < start &&
+	!atomic_compare_exchange_weak(&small_heap_start, &start, s->min_addr)) ;
+  uintptr_t end = small_heap_end;
+  while(s->max_addr > end &&
+	!atomic_compare_exchange_weak(&small_heap_end, &end, s->max_addr)) ;
+
+  s->nb_untracked = 0;
+  s->untracked_size = 0;
+  s->min_addr = UINTPTR_MAX;
+  s->max_addr = 0;
+}
+
+unsigned ma_alloc_sampling_next(void* ptr, size_t size) {
+  struct alloc_sampler* s = &alloc_sampler;
+  if(!s->started) {
+    /* first small allocation of this thread */
+    s->started = 1;
+    s->countdown = __alloc_sampling_interval();
+    s->nb_untracked++;
+    s->untracked_size += size;
+    if((uintptr_t)ptr < s->min_addr)
+      s->min_addr = (uintptr_t)ptr;
+    if((uintptr_t)ptr + size > s->max_addr)
+      s->max_addr = (uintptr_t)ptr + size;
+    return 0;
+  }
+
+  /* this allocation is recorded */
+  s->countdown = __alloc_sampling_interval();
+  __alloc_sampling_flush();
+
+  if(settings.alloc_sampling == ALLOC_SAMPLING_BYTES) {
+    /* an allocation of size bytes is recorded with probability 1-exp(-size/period) */
+    double proba = -expm1(-(double)size / settings.alloc_sampling_period);
+    if(proba <= 0)
+      return UINT_MAX;
+    double weight = 1 / proba;
+    return weight >= UINT_MAX ? UINT_MAX : (unsigned)(weight + 0.5);
+  }
+  return settings.alloc_sampling_period;
+}
+
 /* todo:
  * - set an alarm every 1ms to collect the sampling info
  * - choose the buffer size
@@ -77,26 +201,34 @@ void ma_init() {
   pthread_mutex_init(&mem_list_lock, NULL);
   origin_date = new_date();
 
-  mem_allocator_init(&string_allocator,
-		     sizeof(char)*1024,
-		     16*1024);
+  /* the nodes of the trees are allocated in the arenas of the analyzer */
+  tools_set_allocator(mem_arena_alloc, mem_arena_free);
 
   mem_sampling_init();
   ma_thread_init();
+
+  if(settings.alloc_threshold > 0) {
+    small_heap_info = mem_allocator_alloc(mem_info_allocator);
+    _init_mem_info(small_heap_info, small_heap, 0, 0, NULL, NULL, 0, NULL, string_intern("[small heap]"));
+    small_heap_info->weight = 0;
+  }
+
+  snapshot_init();
+  control_init();
   UNPROTECT_RECORD;
 }
 
 void ma_thread_init() {
-  thread_rank = __sync_fetch_and_add( &next_thread_rank, 1 );
+  thread_rank = thread_registry_add(syscall(SYS_gettid))->rank;
 
 #ifdef USE_HASHTABLE
-  mem_allocator_init(&mem_info_allocator,
-		     sizeof(struct memory_info),
-		     16*1024);
+  mem_allocator_init_local(&mem_info_allocator,
+			   sizeof(struct memory_info),
+			   16*1024);
 #else
-  mem_allocator_init(&mem_info_allocator,
-		     sizeof(struct memory_info_list),
-		     16*1024);
+  mem_allocator_init_local(&mem_info_allocator,
+			   sizeof(struct memory_info_list),
+			   16*1024);
 #endif
 
   for(int i=0; i<NTICKS; i++) {
@@ -104,12 +236,29 @@ void ma_thread_init() {
   }
 
   mem_sampling_thread_init();
+
+  __ma_register_thread_stack();
+  /* the modules of the main thread are registered later by ma_get_variables */
+  if(thread_rank > 0)
+    __ma_register_thread_tls();
 }
 
 void ma_thread_finalize() {
   PROTECT_RECORD;
 
+  __alloc_sampling_flush();
+
+  if(thread_stack_info) {
+    /* the stack is about to be released */
+    thread_stack_info->free_date = new_date();
+    __set_mem_info_free(thread_stack_info);
+    thread_stack_info = NULL;
+  }
+  __ma_retire_thread_tls();
+
   mem_sampling_thread_finalize();
+  /* the metadata of the thread can be reused by the threads created later */
+  mem_arena_thread_release();
 
   pid_t tid = syscall(SYS_gettid);
 #if  ENABLE_TICKS
@@ -129,6 +278,20 @@ void ma_thread_finalize() {
   UNPROTECT_RECORD;
 }
 
+/* write the ticks of the current thread in the report */
+static void __report_ticks() {
+  report_begin("ticks");
+  for(int i=0; i<NTICKS; i++) {
+    if(tick_array[i].nb_calls>0) {
+      report_object_begin(tick_array[i].tick_name);
+      report_u64("nb_calls", tick_array[i].nb_calls);
+      report_double("total_duration_ns", tick_array[i].total_duration);
+      report_object_end();
+    }
+  }
+  report_end();
+}
+
 static
 int is_address_in_buffer(uint64_t addr, struct memory_info *buffer){
   void* addr_ptr = (void*)addr;
@@ -156,8 +319,8 @@ int is_sample_in_buffer(struct mem_sample *sample, struct memory_info *buffer){
 
 void ma_print_mem_info(FILE*f, struct memory_info *mem) {
   if(mem) {
-    if(!mem->caller) {
-      mem->caller = get_caller_function_from_rip(mem->caller_rip);
+    if(!mem->caller_id) {
+      mem->caller_id = get_caller_function_from_rip(mem->caller_rip);
     }
 
     char callstack_rip_str[1024];
@@ -175,16 +338,15 @@ void ma_print_mem_info(FILE*f, struct memory_info *mem) {
 
     fprintf(f, "mem %p = {.addr=0x%" PRIxPTR ", .alloc_date=%" PRIu64 ", .free_date=%" PRIu64 ", size=%zu, callstack_rip=%s, alloc_site=%p / %s}\n", mem,
 	   (uintptr_t) mem->buffer_addr /* cast to avoid "(nil)" */, mem->alloc_date?DATE(mem->alloc_date):0, mem->free_date?DATE(mem->free_date):0,
-	   mem->buffer_size, callstack_rip_str, mem->caller_rip, mem->caller?mem->caller:"");
+	   mem->buffer_size, callstack_rip_str, mem->caller_rip, string_get(mem->caller_id));
   }
 }
 
 static void __ma_print_buffers_generic(FILE*f, mem_info_node_t list) {
 #ifdef USE_HASHTABLE
-  /* todo */
-  struct ht_node*p_node = NULL;
-  FOREACH_HASH(mem_list, p_node) {
-    struct ht_entry*e = p_node->entries;
+  struct bt_iter it;
+  FOREACH_BTREE(list, it) {
+    struct bt_entry*e = bt_iter_entries(&it);
     while(e) {
       struct memory_info* mem_info = e->value;
       ma_print_mem_info(f, mem_info);
@@ -209,19 +371,19 @@ void ma_print_past_buffers() {
   __ma_print_buffers_generic(stdout, past_mem_list);
 }
 
-static mem_info_node_t
+static struct memory_info*
 __ma_find_mem_info_from_addr_generic(mem_info_node_t list,
 				     uint64_t ptr) {
-  mem_info_node_t retval = NULL;
+  struct memory_info* retval = NULL;
   int n=0;
   pthread_mutex_lock(&mem_list_lock);
 #ifdef USE_HASHTABLE
-  mem_info_node_t p_node =  ht_lower_key(list, ptr);
-  if(p_node) {
-    struct ht_entry*e = p_node->entries;
+  struct bt_iter it;
+  if(bt_lower_key(list, ptr, &it)) {
+    struct bt_entry*e = bt_iter_entries(&it);
     while(e) {
       if(is_address_in_buffer(ptr, e->value)) {
-	retval = p_node;
+	retval = e->value;
       }
       e = e->next;
     }
@@ -230,7 +392,7 @@ __ma_find_mem_info_from_addr_generic(mem_info_node_t list,
   struct memory_info_list * p_node = list;
   while(p_node) {
     if(is_address_in_buffer(ptr, &p_node->mem_info)) {
-      retval = p_node;
+      retval = &p_node->mem_info;
       goto out;
     }
     n++;
@@ -253,9 +415,9 @@ __ma_find_mem_info_from_sample_generic(mem_info_node_t list,
   int n=0;
   pthread_mutex_lock(&mem_list_lock);
 #ifdef USE_HASHTABLE
-  mem_info_node_t p_node =  ht_lower_key(list, sample->addr);
-  if(p_node) {
-    struct ht_entry*e = p_node->entries;
+  struct bt_iter it;
+  if(bt_lower_key(list, sample->addr, &it)) {
+    struct bt_entry*e = bt_iter_entries(&it);
     while(e) {
       struct memory_info*val = e->value;   
       if(is_sample_in_buffer(sample, e->value)) {
@@ -289,20 +451,18 @@ __ma_find_mem_info_from_sample_generic(mem_info_node_t list,
 struct memory_info*
 ma_find_mem_info_from_addr(uint64_t ptr) {
   /* todo: a virer */
-  mem_info_node_t ret = __ma_find_mem_info_from_addr_generic(mem_list, ptr);
-  if(ret) {
-#ifdef USE_HASHTABLE
-    return ret->entries->value;
-#else
-    return &ret->mem_info;
-#endif
-  }
-  return NULL;
+  return __ma_find_mem_info_from_addr_generic(mem_list, ptr);
 }
 
 struct memory_info*
 ma_find_mem_info_from_sample(struct mem_sample* sample) {
-  return __ma_find_mem_info_from_sample_generic(mem_list, sample);
+  struct memory_info* retval = __ma_find_mem_info_from_sample_generic(mem_list, sample);
+  if(!retval && small_heap_info &&
+     small_heap_start <= sample->addr && sample->addr < small_heap_end) {
+    /* the sample probably corresponds to an allocation that was not recorded */
+    retval = small_heap_info;
+  }
+  return retval;
 }
 
 uint64_t avg_pos = 0;
@@ -372,22 +532,20 @@ ma_find_past_mem_info_from_addr(uint64_t ptr,
 				date_t stop_date) {
   /* todo: a virer */
 #ifdef USE_HASHTABLE
-  mem_info_node_t ret = __ma_find_mem_info_from_addr_generic(past_mem_list, ptr);
+  struct memory_info* retval = __ma_find_mem_info_from_addr_generic(past_mem_list, ptr);
 #else
   mem_info_node_t ret = __ma_find_mem_info_in_list(&past_mem_list, ptr, start_date, stop_date);
+  struct memory_info* retval = ret ? &ret->mem_info : NULL;
 #endif
 
-  if(ret) {
-    struct memory_info* retval = NULL;
+  if(retval) {
 #ifdef USE_HASHTABLE
-    retval = ret->entries->value;
     if((retval->alloc_date >= start_date &&
 	retval->alloc_date <= stop_date) ||
        (retval->free_date >= start_date &&
 	retval->free_date <= stop_date))    
 #else
-      retval = &ret->mem_info;
-    if(1) 
+    if(1)
 #endif
       {
 	/* the buffer existed during the timeframe. It may have been allocated or
@@ -403,13 +561,78 @@ ma_find_past_mem_info_from_addr(uint64_t ptr,
   return NULL;
 }
 
+void init_mem_counter(struct mem_counters* counters);
+
+/* allocate a table of size block lists. The lists of old (if any) are reused */
+static struct block_table* __new_block_table(unsigned size, struct block_table* old) {
+  struct block_table* table = mem_arena_alloc(sizeof(struct block_table) +
+					      sizeof(struct block_info*) * size);
+  table->size = size;
+  unsigned i = 0;
+  if(old) {
+    for(; i<old->size; i++)
+      table->blocks[i] = old->blocks[i];
+  }
+  for(; i<size; i++) {
+    table->blocks[i] = mem_arena_alloc(sizeof(struct block_info));
+    table->blocks[i]->block_id = 0;
+    table->blocks[i]->next = 0;
+    for(int j=0; j<ACCESS_MAX; j++)
+      init_mem_counter(&table->blocks[i]->counters[j]);
+  }
+  return table;
+}
+
+/* free a table allocated by __new_block_table, except the lists it shares with old */
+static void __free_block_table(struct block_table* table, struct block_table* old) {
+  for(unsigned i = old ? old->size : 0; i<table->size; i++)
+    mem_arena_free(table->blocks[i], sizeof(struct block_info));
+  mem_arena_free(table, sizeof(struct block_table) + sizeof(struct block_info*) * table->size);
+}
+
+/* allocate the (initialized) counters of mem_info, unless another thread
+ * already did
+ */
 static void __allocate_counters(struct memory_info* mem_info) {
-  mem_info->blocks = malloc(sizeof(struct block_info*) * MAX_THREADS);
-  for(int i=0; i<MAX_THREADS; i++) {
-    mem_info->blocks[i] = malloc(sizeof(struct block_info));
-    mem_info->blocks[i]->block_id = 0;
-    mem_info->blocks[i]->next = 0;
+  unsigned size = thread_registry_size();
+  if(size == 0)
+    size = 1;
+  struct block_table* table = __new_block_table(size, NULL);
+  struct block_table* expected = NULL;
+  if(!atomic_compare_exchange_strong_explicit(&mem_info->blocks, &expected, table,
+					      memory_order_acq_rel, memory_order_acquire))
+    __free_block_table(table, NULL);
+}
+
+/* return the list of blocks of thread rank. The table of mem_info grows if needed.
+ * Since the tables are never modified in place, the threads that are still using
+ * the previous table access the same lists
+ */
+static struct block_info* __ma_thread_blocks(struct memory_info* mem_info, unsigned rank) {
+  struct block_table* table = atomic_load_explicit(&mem_info->blocks, memory_order_acquire);
+  while(rank >= table->size) {
+    unsigned size = table->size * 2;
+    if(size <= rank)
+      size = rank + 1;
+    struct block_table* new_table = __new_block_table(size, table);
+    if(atomic_compare_exchange_strong_explicit(&mem_info->blocks, &table, new_table,
+					       memory_order_acq_rel, memory_order_acquire)) {
+      /* old tables are not freed since other threads may still read them */
+      table = new_table;
+    } else {
+      /* another thread grew the table. table now points to its version */
+      __free_block_table(new_table, table);
+    }
   }
+  return table->blocks[rank];
+}
+
+/* return the list of blocks of thread rank, or NULL if this thread did not access mem_info */
+static struct block_info* __ma_search_thread_blocks(struct memory_info* mem_info, unsigned rank) {
+  struct block_table* table = atomic_load_explicit(&mem_info->blocks, memory_order_acquire);
+  if(!table || rank >= table->size)
+    return NULL;
+  return table->blocks[rank];
 }
 
 #define INIT_COUNTER(c) do {		\
@@ -447,9 +670,11 @@ void init_mem_counter(struct mem_counters* counters) {
 
 /* initialize the counters of a mem_info structure */
 static void __init_counters(struct memory_info* mem_info) {
-  int i, j;
-  for(i=0; i<MAX_THREADS; i++) {
-    struct block_info*block = mem_info->blocks[i];
+  unsigned i;
+  int j;
+  struct block_table* table = mem_info->blocks;
+  for(i=0; i<table->size; i++) {
+    struct block_info*block = table->blocks[i];
     while(block) {
       for(j=0; j<ACCESS_MAX; j++) {
 	init_mem_counter(&block->counters[j]);
@@ -504,7 +729,7 @@ struct block_info* __ma_get_block(struct block_info* block,
     if((! block->next) ||	/* we are on the last block */
        (block->next->block_id > page_no)) { /* the next block is too high  */
       /* insert a new block after the current block */
-      struct block_info *new_block = malloc(sizeof(struct block_info));
+      struct block_info *new_block = mem_arena_alloc(sizeof(struct block_info));
 
       /* initialize the block */
       new_block->block_id = page_no;
@@ -512,9 +737,11 @@ struct block_info* __ma_get_block(struct block_info* block,
 	init_mem_counter(&new_block->counters[j]);
       }
 
-      /* enqueue it after block */
-      new_block->next = block->next;
-      block->next = new_block;
+      /* enqueue it after block. The block is initialized before it is
+       * published, so that concurrent readers see its counters
+       */
+      atomic_store_explicit(&new_block->next, block->next, memory_order_relaxed);
+      atomic_store_explicit(&block->next, new_block, memory_order_release);
     }
 
     block = block->next;
@@ -525,15 +752,92 @@ struct block_info* __ma_get_block(struct block_info* block,
 struct block_info* ma_get_block(struct memory_info* mem_info,
 				int thread_rank,
 				uintptr_t ptr) {
+  if(mem_info->mem_type == small_heap) {
+    /* the small heap spans unrelated buffers and keeps growing, so don't split it into pages */
+    return __ma_thread_blocks(mem_info, thread_rank);
+  }
   assert(ptr <= ((uintptr_t)mem_info->buffer_addr) + mem_info->buffer_size);
 
   size_t offset = ptr - (uintptr_t)mem_info->buffer_addr;
   int page_no = offset / PAGE_SIZE;
-  struct block_info* block = mem_info->blocks[thread_rank];
+  struct block_info* block = __ma_thread_blocks(mem_info, thread_rank);
   return __ma_get_block(block, page_no);
 }
 
 
+/* number of allocations of each object key, split into shards in order to
+ * reduce contention
+ */
+#define OBJECT_KEY_SHARDS 64
+struct object_key_shard {
+  pthread_mutex_t lock;
+  struct btree counts;
+} __attribute__ ((aligned (64)));
+
+static struct object_key_shard object_key_counts[OBJECT_KEY_SHARDS];
+static pthread_once_t object_key_counts_once = PTHREAD_ONCE_INIT;
+
+static void __init_object_key_counts() {
+  for(int i=0; i<OBJECT_KEY_SHARDS; i++) {
+    pthread_mutex_init(&object_key_counts[i].lock, NULL);
+    bt_init(&object_key_counts[i].counts);
+  }
+}
+
+/* empty the object key counts (before the arenas are released) */
+static void __release_object_key_counts() {
+  pthread_once(&object_key_counts_once, __init_object_key_counts);
+  for(int i=0; i<OBJECT_KEY_SHARDS; i++) {
+    pthread_mutex_lock(&object_key_counts[i].lock);
+    bt_init(&object_key_counts[i].counts);
+    pthread_mutex_unlock(&object_key_counts[i].lock);
+  }
+}
+
+/* compute the stable key of a new object: the key of its allocation site
+ * (the frames of the call stack that belong to the application, or the name
+ * of the object) and its size, and the number of objects that were
+ * allocated with the same key before it. The allocations smaller than
+ * alloc_threshold are sampled, so their rank is unknown
+ */
+static void __ma_set_object_key(struct memory_info* mem_info) {
+  if(mem_info->callstack_rip) {
+    /* frames 0 to 2 belong to numamma (see __call_site_frames) */
+    int nb_frames = mem_info->callstack_size > 3 ? mem_info->callstack_size - 3 : 0;
+    mem_info->key = get_callstack_key(&mem_info->callstack_rip[3], nb_frames, mem_info->initial_buffer_size);
+  } else if(mem_info->caller_id) {
+    mem_info->key = hash_combine(hash_string(0, string_get(mem_info->caller_id)), mem_info->initial_buffer_size);
+    if(!mem_info->key)
+      mem_info->key = 1;
+  } else {
+    return;
+  }
+
+  if(mem_info->mem_type == dynamic_allocation &&
+     mem_info->initial_buffer_size < settings.alloc_threshold)
+    return;
+
+  pthread_once(&object_key_counts_once, __init_object_key_counts);
+  struct object_key_shard* shard = &object_key_counts[mem_info->key % OBJECT_KEY_SHARDS];
+  pthread_mutex_lock(&shard->lock);
+  struct bt_entry* e = bt_get_entry(&shard->counts, mem_info->key);
+  if(e) {
+    e->value = (void*)((uintptr_t)e->value + 1);
+    mem_info->key_ordinal = (uintptr_t)e->value;
+  } else {
+    bt_insert(&shard->counts, mem_info->key, (void*)(uintptr_t)1);
+    mem_info->key_ordinal = 1;
+  }
+  pthread_mutex_unlock(&shard->lock);
+}
+
+const char* ma_object_key(struct memory_info* mem_info, char* key) {
+  if(!mem_info->key)
+    return NULL;
+  snprintf(key, OBJECT_KEY_LEN, OBJECT_KEY_FORMAT, mem_info->key, mem_info->key_ordinal);
+  return key;
+}
+
 static void _init_mem_info(struct memory_info* mem_info,
 			   enum mem_type mem_type,
 			   date_t alloc_date,
@@ -542,7 +846,7 @@ static void _init_mem_info(struct memory_info* mem_info,
                void** callstack_rip,
                int callstack_size,
 			   void* caller_rip,
-			   const char* caller) {
+			   string_id_t caller_id) {
 
   mem_info->mem_type = mem_type;
   mem_info->alloc_date = alloc_date;
@@ -553,15 +857,18 @@ static void _init_mem_info(struct memory_info* mem_info,
   mem_info->callstack_rip = callstack_rip;
   mem_info->callstack_size = callstack_size;
   mem_info->caller_rip = caller_rip;
-  if(caller) {
-    mem_info->caller = mem_allocator_alloc(string_allocator);
-    snprintf(mem_info->caller, 1024, "%s", caller);
-  } else {
-    mem_info->caller = NULL;
-  }
+  mem_info->caller_id = caller_id;
 
   mem_info->call_site = NULL;
   mem_info->blocks = NULL;
+  mem_info->weight = 1;
+  mem_info->parent_id = 0;
+  mem_info->key = 0;
+  mem_info->key_ordinal = 0;
+  mem_info->numa_policy = NUMA_POLICY_NONE;
+  mem_info->numa_nodemask = 0;
+  mem_info->observed_node = -1;
+  mem_info->observed_nodemask = 0;
 
   static _Atomic int next_mem_info_id = 1;
   mem_info->id = next_mem_info_id++;
@@ -586,8 +893,9 @@ extern void unset_ld_preload();
 extern void reset_ld_preload();
 
 /* find the address range of the stack and add a mem_info record */
-static void __ma_register_stack_range(uintptr_t stack_base_addr,
-				      uintptr_t stack_end_addr) {
+static struct memory_info* __ma_register_stack_range(uintptr_t stack_base_addr,
+						     uintptr_t stack_end_addr,
+						     const char* name) {
   size_t stack_size = stack_end_addr - stack_base_addr;
 
   debug_printf("Stack address range: 0x%"PRIxPTR"-0x%"PRIxPTR" (stack size: %zu bytes)\n",
@@ -602,82 +910,38 @@ static void __ma_register_stack_range(uintptr_t stack_base_addr,
   mem_info = &p_node->mem_info;
 #endif
 
-#if 0
-  mem_info->mem_type=stack;
-  mem_info->alloc_date = 0;
-  mem_info->free_date = 0;
-  mem_info->initial_buffer_size = stack_size;
-  mem_info->buffer_size = stack_size;
-  mem_info->buffer_addr = (void*)stack_base_addr;
-  mem_info->caller = mem_allocator_alloc(string_allocator);
-  snprintf(mem_info->caller, 1024, "[stack]");
-  if(settings.online_analysis) {
-    __allocate_counters(mem_info);
-    __init_counters(mem_info);
-  }
-#else
-  _init_mem_info(mem_info, stack, 0, stack_size, (void*)stack_base_addr, NULL, 0, NULL, "[stack]");
-#endif
+  /* the stack of a thread that terminated may be reused by another thread,
+   * so the dates are needed to tell them apart
+   */
+  _init_mem_info(mem_info, stack, new_date(), stack_size, (void*)stack_base_addr, NULL, 0, NULL, string_intern(name));
+  __ma_set_object_key(mem_info);
 
-  pthread_mutex_lock(&mem_list_lock);
-#ifdef USE_HASHTABLE
-  mem_list = ht_insert(mem_list, (uint64_t) mem_info->buffer_addr, mem_info);
-#else
-  p_node->next = mem_list;
-  p_node->prev = NULL;
-  if(p_node->next)
-    p_node->next->prev = p_node;
-  mem_list = p_node;
-#endif
-  pthread_mutex_unlock(&mem_list_lock);
+  __ma_insert_buffer(mem_info);
+  return mem_info;
 }
 
-void ma_register_stack() {
-  char cmd[4096];
-  char line[4096];
+/* register the stack of the current thread as a memory object */
+static void __ma_register_thread_stack() {
+  pthread_attr_t attr;
+  void* stack_addr = NULL;
+  size_t stack_size = 0;
+  if(pthread_getattr_np(pthread_self(), &attr) != 0)
+    return;
+  int ret = pthread_attr_getstack(&attr, &stack_addr, &stack_size);
+  pthread_attr_destroy(&attr);
+  if(ret != 0)
+    return;
 
-  uintptr_t stack_base_addr= (uintptr_t)0x7fa000000000;
-  uintptr_t stack_end_addr= (uintptr_t)0x7fffffffffff;
-  __ma_register_stack_range(stack_base_addr, stack_end_addr);
-  return;
-  
-  FILE* f=fopen("/proc/self/maps", "r");
-  if(!f) {
-    perror("fopen failed");
-    abort();
-  }
-  while(fgets(line, 4096, f) != NULL) {
-    /* extract start/end addresses */
-    // each line is in the form:
-    // <start_addr>-<end_addr> <permission> <offset> <device> <inode> <file>
-
-    uintptr_t stack_base_addr = 0;
-    uintptr_t stack_end_addr = 0;
-    char permission[10];
-    size_t offset=0;
-    int device1;
-    int device2;
-    int inode;
-    char file[4096];
-      
-    int nfields = sscanf(line, "%"SCNxPTR"-%"SCNxPTR" %s %zx %x:%x %d %s",
-		     &stack_base_addr, &stack_end_addr, permission, &offset,
-		     &device1, &device2, &inode, file);
-    if(nfields == 7 || (inode == 0 && strcmp(file, "[stack]")==0)) {
-      if(stack_base_addr > 0x7f0000000000) {
-	/* let's assume this is a stack region */
-	printf("While reading '%s', found %d fields. inode=%d, file='%s'\n", line, nfields, inode, file);
-
-	__ma_register_stack_range(stack_base_addr, stack_end_addr);
-      }
-    }
-  }
-  fclose(f);
+  char name[64];
+  snprintf(name, sizeof(name), "[stack of thread %u]", thread_rank);
+  thread_stack_info = __ma_register_stack_range((uintptr_t) stack_addr,
+						(uintptr_t) stack_addr + stack_size,
+						name);
 }
 
-
 /* writes given information into a new memory_info struct and adds it to list or hashtable, and returns the inserted element */
 struct memory_info* insert_memory_info(enum mem_type mem_type,
+				       date_t alloc_date,
 				       size_t initial_buffer_size,
 				       void* buffer_addr,
 				       const char* caller)
@@ -701,20 +965,20 @@ struct memory_info* insert_memory_info(enum mem_type mem_type,
 	mem_info->buffer_size = mem_info->initial_buffer_size;
 
 	mem_info->buffer_addr = buffer_addr;
-	mem_info->caller = mem_allocator_alloc(string_allocator);
-	snprintf(mem_info->caller, 1024, "%s", caller);
+	mem_info->caller_id = string_intern(caller);
 
 	if(settings.online_analysis) {
 	  __allocate_counters(mem_info);
 	  __init_counters(mem_info);
 	}
 #else
-	_init_mem_info(mem_info, mem_type, 0, initial_buffer_size, buffer_addr, NULL, 0, NULL, caller);
+	_init_mem_info(mem_info, mem_type, alloc_date, initial_buffer_size, buffer_addr, NULL, 0, NULL, string_intern(caller));
 #endif
+	__ma_set_object_key(mem_info);
 
 	pthread_mutex_lock(&mem_list_lock);
 #ifdef USE_HASHTABLE
-	mem_list = ht_insert(mem_list, (uint64_t) mem_info->buffer_addr, mem_info);
+	bt_insert(mem_list, (uint64_t) mem_info->buffer_addr, mem_info);
 #else
 	/* todo: insert large buffers at the beginning of the list since
 	 * their are more likely to be accessed often (this will speed
@@ -730,98 +994,29 @@ struct memory_info* insert_memory_info(enum mem_type mem_type,
 	return mem_info;
 }
 
-// a file can appear several times in maps, and thus we need to track the several ranges it has
-struct maps_addr_ranges {
-  uintptr_t addr_begin;
-  uintptr_t addr_end;
-  char permissions[16];
-  uintptr_t offset;
-  struct maps_addr_ranges* next;
+/* a thread-local variable. Each thread has its own copy */
+struct tls_variable {
+  char* name;
+  uintptr_t offset;		/* offset of the variable in the TLS block of the module */
+  size_t size;
 };
 
-struct maps_file_list {
-  struct maps_addr_ranges *addr_ranges;
-  char device[1024];
-  uint64_t inode;
-  char pathname[1024];
-  struct maps_file_list *next;
+/* a module (the program or a shared library) whose global variables are registered */
+struct module_info {
+  char path[PATH_MAX];
+  uintptr_t load_base;		/* dlpi_addr: offset between the addresses in the ELF file and in memory */
+  size_t tls_modid;		/* TLS module index (0 if the module has no TLS block) */
+  int loaded;			/* set to 0 when the module is unloaded */
+  /* the objects registered for this module (including the TLS objects of each thread) */
+  struct memory_info** variables;
+  int nb_variables;
+  int max_variables;
+  struct tls_variable* tls_variables;
+  int nb_tls_variables;
+  struct module_info* next;
 };
-
-// insert the maps file described in line into current_list, or create a new one if is NULL, and returns the new list
-// the file appened may just add a new addr_range into current_list->maps_addr_ranges, or even just update an existing range
-struct maps_file_list* insert_new_maps_file_from_line(char *line, struct maps_file_list* current_list)
-{
-  uintptr_t addr_begin;
-  uintptr_t addr_end;
-  char permissions[16];
-  uintptr_t offset;
-  char device[1024];
-  uint64_t inode;
-  char pathname[1024];
-
-  sscanf(line, "%"SCNxPTR"-%"SCNxPTR" %s %"SCNxPTR" %s %"SCNu64" %s\n", &addr_begin, &addr_end, permissions, &offset, device, &inode, pathname);
-  if (pathname[0] == '\0') return current_list;
-  struct maps_file_list* current_file = current_list;
-  while (current_file != NULL) {
-    if (strcmp(current_file->pathname, pathname) == 0) {
-      struct maps_addr_ranges* current_range = current_file->addr_ranges;
-      do {
-        if (strcmp(current_range->permissions, permissions) == 0 &&
-            current_range->addr_begin == addr_begin &&
-            current_range->addr_end == addr_end &&
-            current_range->offset == offset) {
-          return current_list;
-        }
-      } while ((current_range = current_range->next) != NULL);
-      // this range has to be added on its own but is in a known file
-      current_range = malloc(sizeof(struct maps_addr_ranges));
-      current_range->addr_begin = addr_begin;
-      current_range->addr_end = addr_end;
-      current_range->offset = offset;
-      strncpy(current_range->permissions, permissions, 16);
-      current_range->next = current_file->addr_ranges;
-      current_file->addr_ranges = current_range;
-      return current_list;
-    }
-    current_file = current_file->next;
-  }
-  // the file is not in the list, add it
-  struct maps_file_list* new_file;
-  new_file = malloc(sizeof(struct maps_file_list));
-  new_file->addr_ranges = malloc(sizeof(struct maps_addr_ranges));
-  new_file->addr_ranges->addr_begin = addr_begin;
-  new_file->addr_ranges->addr_end = addr_end;
-  new_file->addr_ranges->offset = offset;
-  new_file->addr_ranges->next = NULL;
-  strncpy(new_file->addr_ranges->permissions, permissions, 16);
-  strncpy(new_file->device, device, 1024);
-  new_file->inode = inode;
-  strncpy(new_file->pathname, pathname, 1024);
-  new_file->next = current_list;
-  return new_file;
-}
-
-void fprint_maps_file(FILE *f, struct maps_file_list* list) {
-  fprintf(f, "%s :\n", list->pathname);
-  fprintf(f, "\tdevice : %s\n", list->device);
-  fprintf(f, "\tinode : %ld\n", list->inode);
-  struct maps_addr_ranges* current_range = list->addr_ranges;
-  do {
-    fprintf(f, "\t0x%" PRIxPTR "-0x%" PRIxPTR " (0x%" PRIxPTR ") : 0x%" PRIxPTR " : %s\n",
-	    current_range->addr_begin,
-	    current_range->addr_end,
-	    current_range->addr_end - current_range->addr_begin,
-	    current_range->offset,
-	    current_range->permissions);
-  } while((current_range = current_range->next) != NULL);
-}
-
-void fprint_maps_file_list(FILE *f, struct maps_file_list* list) {
-  while (list != NULL) {
-    fprint_maps_file(f, list);
-    list = list->next;
-  }
-}
+static struct module_info* modules = NULL;
+static pthread_mutex_t modules_lock = PTHREAD_MUTEX_INITIALIZER;
 
 void print_elf_header(GElf_Ehdr header) {
   printf("ehdr :\n");
@@ -962,169 +1157,468 @@ void print_section_header(GElf_Shdr shdr, const char* spacing)
   printf("%ssh_entsize : %" PRIu64 "\n", spacing, shdr.sh_entsize);
 }
 
-static void __ma_parse_elf(struct maps_file_list maps_file) {
+static void __ma_add_module_variable(struct module_info* module, struct memory_info* mem_info) {
+  if(module->nb_variables == module->max_variables) {
+    module->max_variables = module->max_variables ? module->max_variables * 2 : 64;
+    module->variables = realloc(module->variables, sizeof(struct memory_info*) * module->max_variables);
+  }
+  module->variables[module->nb_variables++] = mem_info;
+}
+
+/* register the global variables defined in a module */
+static void __ma_parse_elf(struct module_info* module, date_t alloc_date) {
   elf_version(EV_CURRENT); // has to be called before elf_begin
 
-  
   Elf *elf = NULL;
   GElf_Ehdr header;
-  int fd = open(maps_file.pathname, O_RDONLY);
+  int fd = open(module->path, O_RDONLY);
   if (fd == -1 && errno == ENOENT) {
-    /* file does not exist. It's probably a pseudo-files like [stack] or [heap] */
+    /* file does not exist. It's probably a pseudo-file like the vdso */
     return;
   }
 
   if (fd == -1) {
-    fprintf(stderr, "open %s failed : (%d) %s\n", maps_file.pathname, errno, strerror(errno));
+    fprintf(stderr, "open %s failed : (%d) %s\n", module->path, errno, strerror(errno));
     return;
   }
 
   if(settings.verbose)
-    printf("Exploring %s\n", maps_file.pathname);
+    printf("Exploring %s (loaded at 0x%"PRIxPTR")\n", module->path, module->load_base);
   elf = elf_begin(fd, ELF_C_READ, NULL); // obtain ELF descriptor
   if (elf == NULL) {
-    fprintf(stderr, "elf_begin failed on %s : (%d) %s\n", maps_file.pathname, errno, strerror(errno));
+    fprintf(stderr, "elf_begin failed on %s : (%d) %s\n", module->path, errno, strerror(errno));
+    close(fd);
     return;
   }
 
   if (gelf_getehdr(elf, &header) == NULL) {
-    fprintf(stderr, "elf_getehdr failed on %s : (%d) %s\n", maps_file.pathname, errno, strerror(errno));
-    return;
+    fprintf(stderr, "elf_getehdr failed on %s : (%d) %s\n", module->path, errno, strerror(errno));
+    goto out;
   }
 
+  /* use the full symbol table if the module is not stripped, and the dynamic
+   * symbol table otherwise (the dynamic symbols also appear in the full table)
+   */
   Elf_Scn *scn = NULL; // section
+  Elf_Scn *symtab = NULL;
   GElf_Shdr shdr; // section header
-  Elf_Data *data; // section data
   while ((scn=elf_nextscn(elf, scn)) != NULL) { // iterate through sections
     if (gelf_getshdr(scn, &shdr) == NULL) continue;
-    if (shdr.sh_entsize == 0) continue;
-    data = elf_getdata(scn, NULL);
-    if (shdr.sh_entsize == 0) continue; // can't explore this one
-    int count = (shdr.sh_size / shdr.sh_entsize);
-
-    uintptr_t section_alignment = shdr.sh_addralign;
-
-    /* iterate over the section's symbols */
-    for (int index = 0; index < count ; index++) {
-      GElf_Sym sym;
-      if (gelf_getsym(data, index, &sym) == NULL) continue;
-      char *symbol = elf_strptr(elf, shdr.sh_link, sym.st_name);
-      if (symbol == NULL) continue;      
-      uintptr_t value = sym.st_value;
-      size_t size = sym.st_size;
-
-
-      // we want objects with a non zero size, and that are global objects 
-      // see elf.h for type and bind values
-      if (size != 0 && GELF_ST_BIND(sym.st_info) == STB_GLOBAL
-		      && (GELF_ST_TYPE(sym.st_info) == STT_OBJECT
-			      || GELF_ST_TYPE(sym.st_info) == STT_TLS)
-			      )
-      {
+    if (shdr.sh_type == SHT_SYMTAB ||
+	(shdr.sh_type == SHT_DYNSYM && !symtab))
+      symtab = scn;
+  }
+  if(!symtab || gelf_getshdr(symtab, &shdr) == NULL || shdr.sh_entsize == 0)
+    goto out;
 
-        struct maps_addr_ranges* current_range = maps_file.addr_ranges;
+  Elf_Data *data = elf_getdata(symtab, NULL); // section data
+  int count = (shdr.sh_size / shdr.sh_entsize);
+
+  /* iterate over the section's symbols */
+  for (int index = 0; index < count ; index++) {
+    GElf_Sym sym;
+    if (gelf_getsym(data, index, &sym) == NULL) continue;
+    char *symbol = elf_strptr(elf, shdr.sh_link, sym.st_name);
+    if (symbol == NULL) continue;
+    uintptr_t value = sym.st_value;
+    size_t size = sym.st_size;
+
+    // we want objects with a non zero size, and that are global objects defined in this module
+    // see elf.h for type and bind values.
+    if (size == 0 || GELF_ST_BIND(sym.st_info) != STB_GLOBAL || sym.st_shndx == SHN_UNDEF)
+      continue;
+
+    if (GELF_ST_TYPE(sym.st_info) == STT_TLS) {
+      /* the value of a TLS symbol is its offset in the TLS block of the
+       * module. The variable is registered for each thread (see __ma_register_tls)
+       */
+      module->tls_variables = realloc(module->tls_variables,
+				      sizeof(struct tls_variable) * (module->nb_tls_variables + 1));
+      struct tls_variable* var = &module->tls_variables[module->nb_tls_variables++];
+      var->name = strdup(symbol);
+      var->offset = value;
+      var->size = size;
+    } else if (GELF_ST_TYPE(sym.st_info) == STT_OBJECT) {
+      /* the symbol values are virtual addresses in the ELF file. They are relocated by the load base */
+      uintptr_t addr = module->load_base + value;
+      struct memory_info *mem_info = insert_memory_info(lib, alloc_date, size, (void*)addr, symbol);
+      __ma_add_module_variable(module, mem_info);
+      if(settings.verbose)
+	printf("Found a lib variable (defined at %s). addr=%p, size=%zu, symbol=%s, value=0x%"PRIxPTR"\n",
+	       module->path, mem_info->buffer_addr, mem_info->buffer_size, string_get(mem_info->caller_id), value);
+    }
+  }
 
-#if 0
-	// compute the address of the symbol
-        // what is done here is a replica of what was done in ma_get_lib_variables :
-        //   take the address of the first entry in maps and suppose you just have to add the symbol value
-        //   this seemed to work with most symbols
-	//        struct maps_addr_ranges* first_maps_entry = maps_file.addr_ranges;
-	//        while (first_maps_entry->next != NULL) first_maps_entry = first_maps_entry->next;
-	
-        // check if the address is within a range of maps
-        // note : when the address computation is done, maybe consider doing this check based on section address or something like that
-
-	// while this *should* work, the computed address does not correspond to the actual address. This should be investigated !
-#warning TODO: fix the symbol address computation
-	do {
-	  uintptr_t addr = value + current_range->addr_begin - current_range->offset;
-
-	  size_t range_size = current_range->addr_end - current_range->addr_begin;
-	  if (addr >= current_range->addr_begin &&
-	      addr + size <= current_range->addr_end) {
-
-            // the symbol fits in the range, add it
-            struct memory_info *mem_info = insert_memory_info(lib, size, addr, symbol);
-	    if(settings.verbose) {
-	      printf("Found a variable (defined at %s). addr=%p, size=%zu, symbol=%s, value=%p\n",
-		     maps_file.pathname, mem_info->buffer_addr, mem_info->buffer_size, mem_info->caller, value);
-	    }
-	    break;
-          }
-        } while ((current_range = current_range->next) != NULL);
-#else
-	/* since the proper */
+ out:
+  elf_end(elf);
+  close(fd);
+}
 
-	/* find the lowest address where the binary is mmapped and assume the whole binary is mapped here.
-	 */
-	uintptr_t addr_begin = (uintptr_t)(current_range ? current_range->addr_begin : 0);
-	while(current_range) {
-	  if(current_range->addr_begin < addr_begin)
-	    addr_begin=current_range->addr_begin;
-	  current_range = current_range->next;
-	}
-	
-	uintptr_t addr = value + addr_begin;
-	struct memory_info *mem_info = insert_memory_info(lib, size, (void*)addr, symbol);
-	if(settings.verbose)
-	  printf("Found a lib variable (defined at %s). addr=%p, size=%zu, symbol=%s, value=0x%"PRIxPTR"\n",
-		 maps_file.pathname, mem_info->buffer_addr, mem_info->buffer_size, mem_info->caller, value);
-#endif
-      }
+/* the global variables of a module that was unloaded are not valid anymore */
+static void __ma_retire_module(struct module_info* module, date_t date) {
+  if(settings.verbose)
+    printf("Module %s was unloaded\n", module->path);
+  for(int i = 0; i < module->nb_variables; i++) {
+    /* the TLS objects of the threads that terminated are already retired */
+    if(!module->variables[i]->free_date) {
+      module->variables[i]->free_date = date;
+      __set_mem_info_free(module->variables[i]);
     }
   }
+  free(module->variables);
+  module->variables = NULL;
+  module->nb_variables = module->max_variables = 0;
+  module->loaded = 0;
 }
 
-void free_maps_file_list(struct maps_file_list* list) {
-  while (list != NULL)
-  {
-    struct maps_addr_ranges* current_range = list->addr_ranges;
-    while (current_range != NULL)
-    {
-      struct maps_addr_ranges* old = current_range;
-      current_range = current_range->next;
-      free(old);
-    }
-    struct maps_file_list* old_file = list;
-    list = list->next;
-    free(old_file);
+/* the TLS objects of the current thread */
+static __thread struct memory_info** thread_tls_variables = NULL;
+static __thread int nb_thread_tls_variables = 0;
+
+struct loaded_module;
+static void __ma_register_tls(struct module_info* module, struct loaded_module* loaded, date_t date);
+
+/* a module that is currently loaded */
+struct loaded_module {
+  char path[PATH_MAX];
+  uintptr_t load_base;
+  size_t tls_modid;
+  void* tls_data;		/* TLS block of the current thread (NULL if not allocated yet) */
+};
+
+struct loaded_module_list {
+  struct loaded_module* modules;
+  int nb_modules;
+  int max_modules;
+};
+
+static int __list_loaded_module(struct dl_phdr_info *info, size_t size, void *data) {
+  struct loaded_module_list* list = data;
+  if(list->nb_modules == list->max_modules) {
+    list->max_modules = list->max_modules ? list->max_modules * 2 : 32;
+    list->modules = realloc(list->modules, sizeof(struct loaded_module) * list->max_modules);
+  }
+  struct loaded_module* module = &list->modules[list->nb_modules];
+
+  if(info->dlpi_name && info->dlpi_name[0]) {
+    snprintf(module->path, PATH_MAX, "%s", info->dlpi_name);
+  } else if(list->nb_modules == 0) {
+    /* the first module is the program itself */
+    ssize_t len = readlink("/proc/self/exe", module->path, PATH_MAX - 1);
+    if(len <= 0)
+      return 0;
+    module->path[len] = '\0';
+  } else {
+    return 0;
+  }
+  module->load_base = info->dlpi_addr;
+  module->tls_modid = 0;
+  module->tls_data = NULL;
+  if(size >= offsetof(struct dl_phdr_info, dlpi_tls_data) + sizeof(void*)) {
+    module->tls_modid = info->dlpi_tls_modid;
+    module->tls_data = info->dlpi_tls_data;
+  }
+  list->nb_modules++;
+  return 0;
+}
+
+static int __is_module_loaded(struct loaded_module_list* list, struct module_info* module) {
+  for(int i = 0; i < list->nb_modules; i++) {
+    if(list->modules[i].load_base == module->load_base &&
+       strcmp(list->modules[i].path, module->path) == 0)
+      return 1;
+  }
+  return 0;
+}
+
+static struct module_info* __ma_find_module(struct loaded_module* loaded) {
+  for(struct module_info* module = modules; module; module = module->next) {
+    if(module->loaded && module->load_base == loaded->load_base &&
+       strcmp(module->path, loaded->path) == 0)
+      return module;
   }
+  return NULL;
 }
 
+#if defined(__GLIBC__) && defined(__x86_64__)
+/* argument of __tls_get_addr (see the ELF TLS ABI) */
+struct __tls_index {
+  unsigned long ti_module;
+  unsigned long ti_offset;
+};
+extern void *__tls_get_addr(struct __tls_index *ti);
+#endif
 
-/* get the list of global/static variables with their address and size */
+/* register the copy of the TLS variables of module that belongs to the current thread */
+static void __ma_register_tls(struct module_info* module, struct loaded_module* loaded, date_t date) {
+  if(!module->nb_tls_variables || !module->tls_modid)
+    return;
+
+  void* tls_block = loaded->tls_data;
+#if defined(__GLIBC__) && defined(__x86_64__)
+  if(!tls_block) {
+    /* the TLS block was not allocated yet: let the dynamic linker allocate
+     * it from the module TLS index (this updates the DTV of the thread)
+     */
+    struct __tls_index index = {module->tls_modid, 0};
+    tls_block = __tls_get_addr(&index);
+  }
+#endif
+  if(!tls_block)
+    return;
+
+  for(int i = 0; i < module->nb_tls_variables; i++) {
+    struct tls_variable* var = &module->tls_variables[i];
+    char name[1024];
+    snprintf(name, sizeof(name), "%s [thread %u]", var->name, thread_rank);
+    struct memory_info *mem_info = insert_memory_info(lib, date, var->size,
+						      (char*) tls_block + var->offset, name);
+    __ma_add_module_variable(module, mem_info);
+
+    thread_tls_variables = realloc(thread_tls_variables,
+				   sizeof(struct memory_info*) * (nb_thread_tls_variables + 1));
+    thread_tls_variables[nb_thread_tls_variables++] = mem_info;
+    if(settings.verbose)
+      printf("Found a TLS variable (defined at %s). addr=%p, size=%zu, symbol=%s\n",
+	     module->path, mem_info->buffer_addr, mem_info->buffer_size, string_get(mem_info->caller_id));
+  }
+}
+
+/* number of modules loaded and unloaded by the process (dlpi_adds and
+ * dlpi_subs) when the registry was last updated
+ */
+static _Atomic unsigned long long modules_adds = 0;
+static _Atomic unsigned long long modules_subs = 0;
+
+static int __get_module_counts(struct dl_phdr_info *info, size_t size, void *data) {
+  unsigned long long* counts = data;
+  counts[0] = info->dlpi_adds;
+  counts[1] = info->dlpi_subs;
+  return 1;
+}
+
+/* get the list of global/static variables with their address and size.
+ * This can be called several times (eg. after dlopen/dlclose): only the
+ * modules that were loaded or unloaded since the previous call are processed
+ */
 void ma_get_variables () {
-  char line[4096];
-  char maps_path[1024];
-  FILE *f = NULL;
-  sprintf(maps_path, "/proc/%d/maps", getpid());
-  f = fopen(maps_path, "r");
-  if (f == NULL) {
-    fprintf(stderr, "Could not open %s (reading mode)\n", maps_path);
-    abort();
+  unsigned long long counts[2] = {0, 0};
+  dl_iterate_phdr(__get_module_counts, counts);
+  struct loaded_module_list list = {NULL, 0, 0};
+  dl_iterate_phdr(__list_loaded_module, &list);
+
+  pthread_mutex_lock(&modules_lock);
+  modules_adds = counts[0];
+  modules_subs = counts[1];
+  /* the modules loaded at startup contain variables that exist since the
+   * beginning of the execution
+   */
+  static int modules_scanned = 0;
+  date_t date = modules_scanned ? new_date() : 0;
+  modules_scanned = 1;
+
+  for(struct module_info* module = modules; module; module = module->next) {
+    if(module->loaded && !__is_module_loaded(&list, module))
+      __ma_retire_module(module, date);
   }
-  struct maps_file_list* list = NULL;
-  while (!feof(f)) {
-    fgets(line, sizeof(line), f);
-    list = insert_new_maps_file_from_line(line, list);
+
+  for(int i = 0; i < list.nb_modules; i++) {
+    if(__ma_find_module(&list.modules[i]))
+      continue;
+    struct module_info* module = malloc(sizeof(struct module_info));
+    snprintf(module->path, PATH_MAX, "%s", list.modules[i].path);
+    module->load_base = list.modules[i].load_base;
+    module->tls_modid = list.modules[i].tls_modid;
+    module->loaded = 1;
+    module->variables = NULL;
+    module->nb_variables = module->max_variables = 0;
+    module->tls_variables = NULL;
+    module->nb_tls_variables = 0;
+    module->next = modules;
+    modules = module;
+    __ma_parse_elf(module, date);
+    /* the threads that start later register their own copy of the TLS
+     * variables. The TLS blocks of a library loaded by dlopen are allocated
+     * lazily, so they are only registered for the current thread
+     */
+    __ma_register_tls(module, &list.modules[i], date);
   }
-  fclose(f);
-  struct maps_file_list *current_file = list;
+  pthread_mutex_unlock(&modules_lock);
+  free(list.modules);
+}
+
+/* dl_iterate_phdr takes the lock of the dynamic loader, so each thread
+ * only checks the modules every MODULES_CHECK_PERIOD calls
+ */
+#define MODULES_CHECK_PERIOD 1024
+
+void ma_update_variables() {
+  static __thread unsigned countdown = 0;
+  if(countdown) {
+    countdown--;
+    return;
+  }
+  countdown = MODULES_CHECK_PERIOD - 1;
+
+  unsigned long long counts[2] = {0, 0};
+  dl_iterate_phdr(__get_module_counts, counts);
+  if(counts[0] != modules_adds || counts[1] != modules_subs)
+    ma_get_variables();
+}
+
+/* register the TLS variables of the current thread */
+static void __ma_register_thread_tls() {
+  struct loaded_module_list list = {NULL, 0, 0};
+  dl_iterate_phdr(__list_loaded_module, &list);
+
+  pthread_mutex_lock(&modules_lock);
+  date_t date = new_date();
+  for(int i = 0; i < list.nb_modules; i++) {
+    struct module_info* module = __ma_find_module(&list.modules[i]);
+    if(module)
+      __ma_register_tls(module, &list.modules[i], date);
+  }
+  pthread_mutex_unlock(&modules_lock);
+  free(list.modules);
+}
+
+/* retire the TLS variables of the current thread */
+static void __ma_retire_thread_tls() {
+  pthread_mutex_lock(&modules_lock);
+  date_t date = new_date();
+  for(int i = 0; i < nb_thread_tls_variables; i++) {
+    if(!thread_tls_variables[i]->free_date) {
+      thread_tls_variables[i]->free_date = date;
+      __set_mem_info_free(thread_tls_variables[i]);
+    }
+  }
+  pthread_mutex_unlock(&modules_lock);
+  free(thread_tls_variables);
+  thread_tls_variables = NULL;
+  nb_thread_tls_variables = 0;
+}
+
+/* NUMA policy set by the current thread with set_mempolicy */
+static __thread int thread_numa_policy = NUMA_POLICY_NONE;
+static __thread uint64_t thread_numa_nodemask = 0;
+
+/* maximum number of pages whose location is checked for each object */
+#define NUMA_PLACEMENT_MAX_PAGES 64
+
+/* find the NUMA nodes that hold the pages of an object.
+ * This is only done for the objects with an explicit NUMA policy since it
+ * costs a system call
+ */
+static void __ma_observe_numa_placement(struct memory_info* mem_info) {
+  if(mem_info->numa_policy == NUMA_POLICY_NONE || !mem_info->buffer_size)
+    return;
+
+  uintptr_t page_size = getpagesize();
+  uintptr_t first_page = (uintptr_t) mem_info->buffer_addr & ~(page_size - 1);
+  uintptr_t last_page = ((uintptr_t) mem_info->buffer_addr + mem_info->buffer_size - 1) & ~(page_size - 1);
+  size_t nb_pages = (last_page - first_page) / page_size + 1;
+  int nb_checked = nb_pages < NUMA_PLACEMENT_MAX_PAGES ? nb_pages : NUMA_PLACEMENT_MAX_PAGES;
+
+  /* check pages evenly spread over the object */
+  void* pages[NUMA_PLACEMENT_MAX_PAGES];
+  int status[NUMA_PLACEMENT_MAX_PAGES];
+  for(int i = 0; i < nb_checked; i++)
+    pages[i] = (void*) (first_page + (nb_pages * i / nb_checked) * page_size);
+
+  /* call the system call directly: move_pages may be intercepted */
+  if(syscall(SYS_move_pages, 0, nb_checked, pages, NULL, status, 0) < 0)
+    return;
+
+  int nb_pages_per_node[64] = {0};
+  for(int i = 0; i < nb_checked; i++) {
+    /* a negative status means that the page is not allocated yet */
+    if(status[i] >= 0 && status[i] < 64) {
+      nb_pages_per_node[status[i]]++;
+      mem_info->observed_nodemask |= 1ULL << status[i];
+    }
+  }
+  for(int node = 0; node < 64; node++) {
+    if(nb_pages_per_node[node] &&
+       (mem_info->observed_node < 0 ||
+	nb_pages_per_node[node] > nb_pages_per_node[mem_info->observed_node]))
+      mem_info->observed_node = node;
+  }
+}
+
+void ma_record_thread_numa_policy(int policy, uint64_t nodemask) {
+  if(policy == MPOL_DEFAULT)
+    policy = NUMA_POLICY_NONE;
+  thread_numa_policy = policy;
+  thread_numa_nodemask = nodemask;
+}
 
-  while (current_file != NULL) {
-    __ma_parse_elf(*current_file);
-    current_file = current_file->next;
+static void __ma_set_numa_policy(struct memory_info* mem_info, int policy, uint64_t nodemask) {
+  if(policy == NUMA_POLICY_MOVE_PAGES && mem_info->numa_policy == NUMA_POLICY_MOVE_PAGES) {
+    /* the pages of the object were moved to several nodes */
+    mem_info->numa_nodemask |= nodemask;
+  } else {
+    mem_info->numa_policy = policy;
+    mem_info->numa_nodemask = nodemask;
   }
-  free_maps_file_list(list);
 }
 
-void ma_record_malloc(struct mem_block_info* info) {
+void ma_record_numa_policy(void* addr, size_t len, int policy, uint64_t nodemask) {
+  if(!IS_RECORD_SAFE)
+    return;
+  PROTECT_RECORD;
+
+  uintptr_t start = (uintptr_t) addr;
+  uintptr_t end = start + len;
+  pthread_mutex_lock(&mem_list_lock);
+#ifdef USE_HASHTABLE
+  /* browse the objects that overlap [start, end[, starting from the one that contains start */
+  struct bt_iter it;
+  int found = bt_lower_key(mem_list, start, &it) || bt_first(mem_list, &it);
+  for(; found && bt_iter_key(&it) < end; found = bt_next(&it)) {
+    for(struct bt_entry* e = bt_iter_entries(&it); e; e = e->next) {
+      struct memory_info* mem_info = e->value;
+      if(!mem_info->free_date &&
+	 (uintptr_t) mem_info->buffer_addr + mem_info->buffer_size > start)
+	__ma_set_numa_policy(mem_info, policy, nodemask);
+    }
+  }
+#else
+  for(struct memory_info_list* p_node = mem_list; p_node; p_node = p_node->next) {
+    struct memory_info* mem_info = &p_node->mem_info;
+    if((uintptr_t) mem_info->buffer_addr < end &&
+       (uintptr_t) mem_info->buffer_addr + mem_info->buffer_size > start)
+      __ma_set_numa_policy(mem_info, policy, nodemask);
+  }
+#endif
+  pthread_mutex_unlock(&mem_list_lock);
+
+  UNPROTECT_RECORD;
+}
+
+/* add a dynamically allocated buffer to the list of buffers */
+static void __ma_insert_buffer(struct memory_info* mem_info) {
+  pthread_mutex_lock(&mem_list_lock);
+#ifdef USE_HASHTABLE
+  bt_insert(mem_list, (uint64_t) mem_info->buffer_addr, mem_info);
+#else
+  struct memory_info_list * p_node = (struct memory_info_list *)
+    ((char*) mem_info - offsetof(struct memory_info_list, mem_info));
+  p_node->next = mem_list;
+  p_node->prev = NULL;
+  if(p_node->next)
+    p_node->next->prev = NULL;
+  mem_list = p_node;
+#endif
+  pthread_mutex_unlock(&mem_list_lock);
+}
+
+void ma_record_malloc(struct mem_block_info* info, unsigned weight) {
   if(!IS_RECORD_SAFE)
     return;
   PROTECT_RECORD;
 
   start_tick(record_malloc);
+  ma_update_variables();
 
   mem_sampling_collect_samples();
 
@@ -1158,9 +1652,9 @@ void ma_record_malloc(struct mem_block_info* info) {
    *
    * So, we need to get the name of the function in frame 3.
    */
-  //  mem_info->caller = get_caller_function(3);
+  //  mem_info->caller_id = get_caller_function(3);
   mem_info->call_site = NULL;
-  mem_info->caller = NULL;
+  mem_info->caller_id = STRING_ID_NONE;
   mem_info->caller_rip = get_caller_rip(3);
   if(settings.online_analysis) {
     /* todo: when implementing offline analysis, make sure counters are initialized */
@@ -1171,25 +1665,21 @@ void ma_record_malloc(struct mem_block_info* info) {
   void* caller_rip;
   int callstack_size;
   void** callstack_rip = get_caller_rip(3, &callstack_size, &caller_rip);
-  _init_mem_info(mem_info, dynamic_allocation, new_date(), info->size, info->u_ptr, callstack_rip, callstack_size, caller_rip, NULL);
+  _init_mem_info(mem_info, dynamic_allocation, new_date(), info->size, info->u_ptr, callstack_rip, callstack_size, caller_rip, STRING_ID_NONE);
 #endif
+  __ma_set_object_key(mem_info);
+  mem_info->weight = weight;
+  if(thread_numa_policy != NUMA_POLICY_NONE) {
+    /* the buffer is allocated with the policy of the thread */
+    mem_info->numa_policy = thread_numa_policy;
+    mem_info->numa_nodemask = thread_numa_nodemask;
+  }
   info->record_info = mem_info;
   
   stop_tick(init_block);
 
   start_tick(insert_in_tree);
-  pthread_mutex_lock(&mem_list_lock);
-#ifdef USE_HASHTABLE
-  mem_list = ht_insert(mem_list, (uint64_t) mem_info->buffer_addr, mem_info);
-#else
-  p_node->next = mem_list;
-  p_node->prev = NULL;
-  if(p_node->next)
-    p_node->next->prev = NULL;
-  mem_list = p_node;
-#endif
-  pthread_mutex_unlock(&mem_list_lock);
-
+  __ma_insert_buffer(mem_info);
   stop_tick(insert_in_tree);
 
   start_tick(sampling_resume);
@@ -1201,6 +1691,39 @@ void ma_record_malloc(struct mem_block_info* info) {
   UNPROTECT_RECORD;
 }
 
+/* create a new object that derives from orig (eg. after a realloc). It
+ * inherits the allocation site of orig, and does not count as a new
+ * allocation of the call site
+ */
+static struct memory_info* __ma_new_version(struct memory_info* orig_info, void* addr, size_t size) {
+  struct memory_info * mem_info = NULL;
+#ifdef USE_HASHTABLE
+  mem_info = mem_allocator_alloc(mem_info_allocator);
+#else
+  struct memory_info_list * p_node = mem_allocator_alloc(mem_info_allocator);
+  mem_info = &p_node->mem_info;
+#endif
+  _init_mem_info(mem_info, orig_info->mem_type, new_date(), size, addr,
+		 orig_info->callstack_rip, orig_info->callstack_size,
+		 orig_info->caller_rip, orig_info->caller_id);
+  mem_info->weight = 0;
+  mem_info->parent_id = orig_info->id;
+  /* the call site is identified by the size requested when the object was
+   * allocated, not by the size of this version. Otherwise, with
+   * --callsite-key=stack_size, a reallocated buffer would end up in a call
+   * site of its own
+   */
+  mem_info->initial_buffer_size = orig_info->initial_buffer_size;
+  mem_info->call_site = orig_info->call_site;
+  /* the new version keeps the key of the allocation */
+  mem_info->key = orig_info->key;
+  mem_info->key_ordinal = orig_info->key_ordinal;
+  mem_info->numa_policy = orig_info->numa_policy;
+  mem_info->numa_nodemask = orig_info->numa_nodemask;
+  __ma_insert_buffer(mem_info);
+  return mem_info;
+}
+
 void ma_update_buffer_address(struct mem_block_info* info, void *old_addr, void *new_addr) {
   if(!IS_RECORD_SAFE)
     return;
@@ -1213,7 +1736,38 @@ void ma_update_buffer_address(struct mem_block_info* info, void *old_addr, void
 
   struct memory_info* mem_info = info->record_info;
   assert(mem_info);
-  mem_info->buffer_addr = new_addr;
+  if(old_addr == new_addr) {
+    /* the buffer was resized in place */
+    mem_info->buffer_size = info->size;
+  } else {
+    /* the buffer was moved: the old version is freed, and a new version
+     * is allocated at the new address
+     */
+    mem_info->free_date = new_date();
+    __set_mem_info_free(mem_info);
+    info->record_info = __ma_new_version(mem_info, new_addr, info->size);
+  }
+
+  start_tick(sampling_resume);
+  mem_sampling_resume();
+  stop_tick(sampling_resume);
+
+  UNPROTECT_RECORD;
+}
+
+void ma_record_split(struct mem_block_info* orig, struct mem_block_info* piece) {
+  piece->record_info = NULL;
+  if(!IS_RECORD_SAFE)
+    return;
+  struct memory_info* orig_info = orig->record_info;
+  if(!orig_info)
+    return;
+
+  PROTECT_RECORD;
+  mem_sampling_collect_samples();
+
+  /* the piece was allocated by the same call site as the original buffer */
+  piece->record_info = __ma_new_version(orig_info, piece->u_ptr, piece->size);
 
   start_tick(sampling_resume);
   mem_sampling_resume();
@@ -1225,14 +1779,13 @@ void ma_update_buffer_address(struct mem_block_info* info, void *old_addr, void
 /*
  * remove mem_info from the list of active buffers and add it to the list of inactive buffers
  */
-void set_buffer_free(struct mem_block_info* p_block) {
+static void __set_mem_info_free(struct memory_info* mem_info) {
   pthread_mutex_lock(&mem_list_lock);
 #ifdef USE_HASHTABLE
   /* nothing to do here: we keep all buffers in the same hashmap. We'll use the timestamps to differenciate them  */
-  struct memory_info* mem_info = p_block->record_info;
 #else
   struct memory_info_list * p_node = mem_list;
-  if(p_block->record_info == &p_node->mem_info) {
+  if(mem_info == &p_node->mem_info) {
     /* the first record is the one we're looking for */
     mem_list = p_node->next;
     if(p_node->next)
@@ -1247,7 +1800,7 @@ void set_buffer_free(struct mem_block_info* p_block) {
 
   /* browse the list of malloc'd buffers */
   while(p_node->next) {
-    if(&p_node->next->mem_info == p_block->record_info) {
+    if(&p_node->next->mem_info == mem_info) {
       struct memory_info_list *to_move = p_node->next;
       /* remove to_move from the list of malloc'd buffers */
       p_node->next = to_move->next;
@@ -1264,13 +1817,17 @@ void set_buffer_free(struct mem_block_info* p_block) {
     p_node = p_node->next;
   }
   /* couldn't find p_block in the list of malloc'd buffers */
-  fprintf(stderr, "Error: I tried to free block %p, but I could'nt find it in the list of malloc'd buffers\n", p_block);
+  fprintf(stderr, "Error: I tried to free buffer %p, but I could'nt find it in the list of malloc'd buffers\n", mem_info->buffer_addr);
   abort();
 #endif
  out:
   pthread_mutex_unlock(&mem_list_lock);
 }
 
+void set_buffer_free(struct mem_block_info* p_block) {
+  __set_mem_info_free(p_block->record_info);
+}
+
 void ma_record_free(struct mem_block_info* info) {
   if(!IS_RECORD_SAFE)
     return;
@@ -1279,12 +1836,15 @@ void ma_record_free(struct mem_block_info* info) {
 
   PROTECT_RECORD;
   start_tick(record_free);
+  ma_update_variables();
   mem_sampling_collect_samples();
 
 
   struct memory_info* mem_info = info->record_info;
   assert(mem_info);
   mem_info->buffer_size = info->size;
+  /* the pages are about to be released, this is our last chance to see where they are */
+  __ma_observe_numa_placement(mem_info);
   mem_info->free_date = new_date();
 
   set_buffer_free(info);
@@ -1298,42 +1858,110 @@ void ma_record_free(struct mem_block_info* info) {
 }
 
 struct call_site* call_sites = NULL;
+/* call sites indexed by the hash of their key (see __call_site_key) */
+static struct ht_node* call_site_index = NULL;
+static pthread_mutex_t call_sites_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned nb_call_sites = 0;
 
-struct call_site *find_call_site(struct memory_info* mem_info) {
-//  if(mem_info->mem_type != dynamic_allocation)
-//    return NULL;
-
-  struct call_site * cur_site = call_sites;
-  while(cur_site) {
-    if(cur_site->buffer_size == mem_info->initial_buffer_size) {
-        if(cur_site->callstack_rip) {
-            if(cur_site->callstack_size == mem_info->callstack_size) {
-                int match = 1;
-                for(int i = 3; i < cur_site->callstack_size; i++) {
-                    if(cur_site->callstack_rip[i] != mem_info->callstack_rip[i]) {
-                        match = 0;
-                        break;
-                    }
-                }
-                if(match) {
-                    return cur_site;
-                }
-            }
-        } else {
-            if(cur_site->caller_rip == mem_info->caller_rip) {
-                return cur_site;
-            }
-        }
+/* compute the range [*first, *last[ of the call stack frames that identify a call site.
+ * Frames 0 to 2 belong to numamma (get_caller_rip, ma_record_malloc, malloc)
+ */
+static void __call_site_frames(int callstack_size, int* first, int* last) {
+  *first = 3;
+  *last = callstack_size;
+  switch(settings.callsite_key) {
+  case CALLSITE_KEY_TOP_FRAMES:
+    if(*last > *first + settings.callsite_depth)
+      *last = *first + settings.callsite_depth;
+    break;
+  case CALLSITE_KEY_CALLER:
+    if(*last > *first + 1)
+      *last = *first + 1;
+    break;
+  default:
+    break;
+  }
+}
+
+/* return 1 if the buffer size is part of the key of the call site of mem_info.
+ * Objects that don't have a call stack (global variables, stacks, ...) are always
+ * identified by their name and size
+ */
+static int __call_site_uses_size(struct memory_info* mem_info) {
+  return settings.callsite_key == CALLSITE_KEY_STACK_SIZE || !mem_info->callstack_rip;
+}
+
+/* return 1 if the call site of mem_info is identified by its name */
+static int __call_site_uses_name(struct memory_info* mem_info) {
+  return !mem_info->callstack_rip && mem_info->mem_type != dynamic_allocation && mem_info->caller_id;
+}
+
+/* compute the hash of the key that identifies the call site of mem_info */
+static uint64_t __call_site_key(struct memory_info* mem_info) {
+  uint64_t key = mem_info->mem_type;
+  if(mem_info->callstack_rip) {
+    int first, last;
+    __call_site_frames(mem_info->callstack_size, &first, &last);
+    for(int i = first; i < last; i++)
+      key = hash_combine(key, (uint64_t) mem_info->callstack_rip[i]);
+  } else if(__call_site_uses_name(mem_info)) {
+    key = hash_combine(key, mem_info->caller_id);
+  } else {
+    key = hash_combine(key, (uint64_t) mem_info->caller_rip);
+  }
+
+  if(__call_site_uses_size(mem_info))
+    key = hash_combine(key, mem_info->initial_buffer_size);
+  return key;
+}
+
+/* return 1 if mem_info belongs to site */
+static int __call_site_match(struct call_site* site, struct memory_info* mem_info) {
+  if(site->mem_info.mem_type != mem_info->mem_type)
+    return 0;
+  if(__call_site_uses_size(mem_info) &&
+     site->mem_info.initial_buffer_size != mem_info->initial_buffer_size)
+    return 0;
+
+  if(mem_info->callstack_rip) {
+    if(!site->callstack_rip)
+      return 0;
+    int first, last, site_first, site_last;
+    __call_site_frames(mem_info->callstack_size, &first, &last);
+    __call_site_frames(site->callstack_size, &site_first, &site_last);
+    if(last - first != site_last - site_first)
+      return 0;
+    for(int i = 0; i < last - first; i++) {
+      if(site->callstack_rip[site_first + i] != mem_info->callstack_rip[first + i])
+	return 0;
     }
-    cur_site = cur_site->next;
+    return 1;
+  }
+
+  if(site->callstack_rip)
+    return 0;
+  if(__call_site_uses_name(mem_info))
+    /* interned strings are equal iff their ids are equal */
+    return site->caller_id == mem_info->caller_id;
+  return site->caller_rip == mem_info->caller_rip;
+}
+
+/* search for the call site of mem_info. call_sites_lock must be held */
+static struct call_site *__find_call_site(struct memory_info* mem_info, uint64_t key) {
+  struct ht_entry* e = ht_get_entry(call_site_index, key);
+  while(e) {
+    if(__call_site_match(e->value, mem_info))
+      return e->value;
+    e = e->next;
   }
   return NULL;
 }
 
-struct call_site * new_call_site(struct memory_info* mem_info) {
-  struct call_site * site = libmalloc(sizeof(struct call_site));
-  if(!mem_info->caller) {
-    mem_info->caller = get_caller_function_from_rip(mem_info->caller_rip);
+/* create the call site of mem_info. call_sites_lock must be held */
+static struct call_site * __new_call_site(struct memory_info* mem_info, uint64_t key) {
+  struct call_site * site = mem_arena_alloc(sizeof(struct call_site));
+  if(!mem_info->caller_id) {
+    mem_info->caller_id = get_caller_function_from_rip(mem_info->caller_rip);
   }
 
   static _Atomic uint32_t next_call_site_id = 1;
@@ -1342,11 +1970,10 @@ struct call_site * new_call_site(struct memory_info* mem_info) {
   site->callstack_rip = mem_info->callstack_rip;
   site->callstack_size = mem_info->callstack_size;
   site->caller_rip = mem_info->caller_rip;
-  site->caller = mem_allocator_alloc(string_allocator);
-  strcpy(site->caller, mem_info->caller);
+  site->caller_id = mem_info->caller_id;
   site->buffer_size =  mem_info->initial_buffer_size;
   site->nb_mallocs = 0;
-  site->dump_file = NULL;
+  site->dumped = 0;
 
 #if 0
   site->mem_info.mem_type = mem_info->mem_type;
@@ -1355,11 +1982,11 @@ struct call_site * new_call_site(struct memory_info* mem_info) {
   site->mem_info.initial_buffer_size = mem_info->initial_buffer_size;
   site->mem_info.buffer_size = mem_info->buffer_size;
   site->mem_info.buffer_addr = mem_info->buffer_addr;
-  site->mem_info.caller = site->caller;
+  site->mem_info.caller_id = site->caller_id;
   site->mem_info.caller_rip = site->caller_rip;
 #else
   _init_mem_info(&site->mem_info, mem_info->mem_type, 0, mem_info->initial_buffer_size,
-		 mem_info->buffer_addr, site->callstack_rip, site->callstack_size, site->caller_rip, site->caller);
+		 mem_info->buffer_addr, site->callstack_rip, site->callstack_size, site->caller_rip, site->caller_id);
   site->mem_info.buffer_size = mem_info->buffer_size;
 #endif
   ma_allocate_counters(&site->mem_info);
@@ -1374,21 +2001,59 @@ struct call_site * new_call_site(struct memory_info* mem_info) {
 
   site->next = call_sites;
   call_sites = site;
+  call_site_index = ht_insert(call_site_index, key, site);
+  nb_call_sites++;
+  return site;
+}
+
+struct call_site *find_call_site(struct memory_info* mem_info) {
+  pthread_mutex_lock(&call_sites_lock);
+  struct call_site* site = __find_call_site(mem_info, __call_site_key(mem_info));
+  pthread_mutex_unlock(&call_sites_lock);
+  return site;
+}
+
+struct call_site * new_call_site(struct memory_info* mem_info) {
+  pthread_mutex_lock(&call_sites_lock);
+  struct call_site* site = __new_call_site(mem_info, __call_site_key(mem_info));
+  pthread_mutex_unlock(&call_sites_lock);
+  return site;
+}
+
+struct call_site * ma_get_call_site(struct memory_info* mem_info) {
+  uint64_t key = __call_site_key(mem_info);
+  pthread_mutex_lock(&call_sites_lock);
+  struct call_site* site = __find_call_site(mem_info, key);
+  if(!site) {
+    site = __new_call_site(mem_info, key);
+  }
+  pthread_mutex_unlock(&call_sites_lock);
   return site;
 }
 
 struct call_site*  update_call_sites(struct memory_info* mem_info) {
-  struct call_site* site = find_call_site(mem_info);
+  struct call_site* site = mem_info->call_site;
   if(!site) {
-    site = new_call_site(mem_info);
+    site = ma_get_call_site(mem_info);
+    mem_info->call_site = site;
   }
 
-  site->nb_mallocs++;
-  int i, j;
-  for(i = 0; i<MAX_THREADS; i++) {
-    struct block_info *block = mem_info->blocks[i];
+  site->nb_mallocs += mem_info->weight;
+  if(mem_info->buffer_size > site->mem_info.buffer_size) {
+    /* depending on settings.callsite_key, the objects of a call site may have
+     * different sizes. Keep track of the largest one
+     */
+    site->mem_info.buffer_size = mem_info->buffer_size;
+    site->buffer_size = mem_info->buffer_size;
+  }
+  unsigned i;
+  int j;
+  struct block_table* table = mem_info->blocks;
+  for(i = 0; i<table->size; i++) {
+    struct block_info *block = table->blocks[i];
     while(block) {
-      struct block_info* mem_block = __ma_get_block(site->mem_info.blocks[i], block->block_id);
+      struct block_info* mem_block = __ma_get_block(__ma_thread_blocks(&site->mem_info, i),
+						    block->block_id);
       struct block_info* site_block = __ma_get_block(&site->cumulated_counters, 0);
 
       for(j = 0; j<ACCESS_MAX; j++) {
@@ -1486,6 +2151,128 @@ static void __print_counters(FILE*f, struct mem_counters* counters) {
   }
 }
 
+/* write the read and write counters in the current line of the report */
+static void __report_counters(struct mem_counters* counters) {
+  for(int i=0; i< ACCESS_MAX; i++){
+    report_object_begin(i == ACCESS_READ ? "read" : "write");
+    report_u64("total_count", counters[i].total_count);
+    report_u64("total_weight", counters[i].total_weight);
+    report_u64("na_miss_count", counters[i].na_miss_count);
+
+#define REPORT_COUNTER(__c) do {					\
+      if(counters[i].__c.count) {					\
+	report_object_begin(#__c);					\
+	report_u64("count", counters[i].__c.count);			\
+	report_u64("min_weight", counters[i].__c.min_weight);		\
+	report_u64("max_weight", counters[i].__c.max_weight);		\
+	report_u64("sum_weight", counters[i].__c.sum_weight);		\
+	report_object_end();						\
+      }									\
+    } while(0)
+
+    REPORT_COUNTER(cache1_hit);
+    REPORT_COUNTER(cache2_hit);
+    REPORT_COUNTER(cache3_hit);
+    REPORT_COUNTER(lfb_hit);
+    REPORT_COUNTER(local_ram_hit);
+    REPORT_COUNTER(remote_ram_hit);
+    REPORT_COUNTER(remote_cache_hit);
+    REPORT_COUNTER(io_memory_hit);
+    REPORT_COUNTER(uncached_memory_hit);
+    REPORT_COUNTER(cache1_miss);
+    REPORT_COUNTER(cache2_miss);
+    REPORT_COUNTER(cache3_miss);
+    REPORT_COUNTER(lfb_miss);
+    REPORT_COUNTER(local_ram_miss);
+    REPORT_COUNTER(remote_ram_miss);
+    REPORT_COUNTER(remote_cache_miss);
+    REPORT_COUNTER(io_memory_miss);
+    REPORT_COUNTER(uncached_memory_miss);
+#undef REPORT_COUNTER
+    report_object_end();
+  }
+}
+
+static const char* mem_type_names[] = {
+  "none", "global_symbol", "stack", "dynamic_allocation", "lib", "small_heap"
+};
+
+void ma_object_counters(struct memory_info* mem_info, struct mem_counters* counters) {
+  for(int j = 0; j < ACCESS_MAX; j++)
+    init_mem_counter(&counters[j]);
+  struct block_table* table = atomic_load_explicit(&mem_info->blocks, memory_order_acquire);
+  if(!table)
+    return;
+  for(unsigned i = 0; i < table->size; i++) {
+    for(struct block_info* block = table->blocks[i]; block; block = block->next) {
+      for(int j = 0; j < ACCESS_MAX; j++)
+	ACC_COUNTERS(counters[j], block->counters[j]);
+    }
+  }
+}
+
+/* write the line of an object that was accessed in the report */
+static void __report_object(struct memory_info* mem_info, struct mem_counters* counters) {
+  report_begin("object");
+  report_u64("id", mem_info->id);
+  report_int("call_site", mem_info->call_site ? (int64_t)mem_info->call_site->id : -1);
+  report_string("mem_type", mem_type_names[mem_info->mem_type]);
+  report_hex("address", (uintptr_t)mem_info->buffer_addr);
+  report_u64("size", mem_info->buffer_size);
+  report_u64("alloc_date", mem_info->alloc_date);
+  report_u64("free_date", mem_info->free_date);
+  report_hex("caller_rip", (uintptr_t)mem_info->caller_rip);
+  report_string("caller", string_get(mem_info->caller_id));
+  char key[OBJECT_KEY_LEN];
+  report_string("key", ma_object_key(mem_info, key));
+  __report_counters(counters);
+  report_end();
+}
+
+/* write the symbolized frames that identify a call site (innermost first,
+ * separated by ';') in the current line of the report. The call sites
+ * that don't have a call stack are identified by their name
+ */
+static void __report_call_site_stack(struct call_site* site) {
+  if(!site->callstack_rip) {
+    report_string("callstack", string_get(site->caller_id));
+    return;
+  }
+
+  int first, last;
+  __call_site_frames(site->callstack_size, &first, &last);
+  int nb_frames = last > first ? last - first : 0;
+  string_id_t symbols[nb_frames + 1];
+  get_caller_functions_from_rips(&site->callstack_rip[first], nb_frames, symbols);
+
+  char callstack[16384];
+  size_t len = 0;
+  callstack[0] = '\0';
+  for(int i = 0; i < nb_frames && len < sizeof(callstack); i++)
+    len += snprintf(&callstack[len], sizeof(callstack) - len, "%s%s",
+		    i ? ";" : "", string_get(symbols[i]));
+  report_string("callstack", callstack);
+}
+
+/* write the stable key of a call site in key: the key of the frames and
+ * of the size that identify the call site (see get_callstack_key)
+ */
+static const char* __call_site_stable_key(struct call_site* site, char* key) {
+  uint64_t site_key;
+  size_t size = __call_site_uses_size(&site->mem_info) ? site->mem_info.initial_buffer_size : 0;
+  if(site->callstack_rip) {
+    int first, last;
+    __call_site_frames(site->callstack_size, &first, &last);
+    site_key = get_callstack_key(&site->callstack_rip[first], last > first ? last - first : 0, size);
+  } else if(site->caller_id) {
+    site_key = hash_combine(hash_string(0, string_get(site->caller_id)), size);
+  } else {
+    return NULL;
+  }
+  snprintf(key, OBJECT_KEY_LEN, "%016"PRIx64, site_key);
+  return key;
+}
+
 static void __print_call_site_stats(struct call_site*site) {
 
   char filename[4096];
@@ -1502,58 +2289,52 @@ static void __print_call_site_stats(struct call_site*site) {
   fclose(f);
 }
 
-/* remove site from the list of callsites */
-static void __remove_site(struct call_site*site) {
-  struct call_site*cur_site = call_sites;
-  if(cur_site == site) {
-    /* remove the first site */
-    call_sites = cur_site->next;
-    goto out;
+/* write the summary of a call site whose samples were dumped */
+static void __close_site_dump(struct call_site*site) {
+  if(site->dumped) {
+    __print_call_site_stats(site);
+    site->dumped = 0;
   }
+}
 
-  while(cur_site->next) {
-    if(cur_site->next == site) {
-      /* remove cur_site->next */
-      cur_site->next = site->next;
-      goto out;
-    }
-    cur_site = cur_site->next;
-  }
- out:
-  if(cur_site &&cur_site->dump_file) {
-    __print_call_site_stats(cur_site);
-    fclose(cur_site->dump_file);
-    cur_site->dump_file = NULL;
-  }
+static int __compare_site_weight(const void* a, const void* b) {
+  const struct call_site* site_a = *(struct call_site* const*)a;
+  const struct call_site* site_b = *(struct call_site* const*)b;
+  uint64_t weight_a = site_a->cumulated_counters.counters[ACCESS_READ].total_weight;
+  uint64_t weight_b = site_b->cumulated_counters.counters[ACCESS_READ].total_weight;
+  if(weight_a > weight_b)
+    return -1;
+  if(weight_a < weight_b)
+    return 1;
+  return 0;
 }
 
 /* sort sites depending on their total weight */
 static void __sort_sites() {
-  struct call_site* head = NULL;
   printf("Sorting call sites\n");
+  if(!call_sites)
+    return;
 
-  while(call_sites) {
-    struct call_site* cur_site = call_sites;
-    struct call_site*min_weight_site  = cur_site;
-    /* todo: for now, the sites are sorted according to the number of
-     * access to the first block.
-     * This should be changed so that they
-     * are sorted based on the total number of access (to any block)
-     */
+  /* todo: for now, the sites are sorted according to the weight of the
+   * read accesses.
+   * This should be changed so that they
+   * are sorted based on the total weight of access (read and write)
+   */
+  struct call_site** sites = libmalloc(sizeof(struct call_site*) * nb_call_sites);
+  unsigned nb_sites = 0;
+  for(struct call_site* cur_site = call_sites; cur_site; cur_site = cur_site->next) {
+    assert(nb_sites < nb_call_sites);
+    sites[nb_sites++] = cur_site;
+    __close_site_dump(cur_site);
+  }
+  qsort(sites, nb_sites, sizeof(struct call_site*), __compare_site_weight);
 
-    int min_weight = cur_site->cumulated_counters.counters[ACCESS_READ].total_weight;
-    while (cur_site) {
-      if(cur_site->cumulated_counters.counters[ACCESS_READ].total_weight < min_weight) {
-	min_weight = cur_site->cumulated_counters.counters[ACCESS_READ].total_weight;
-	min_weight_site = cur_site;
-      }
-      cur_site = cur_site->next;
-    }
-    __remove_site(min_weight_site);
-    min_weight_site->next = head;
-    head = min_weight_site;
+  for(unsigned i = 0; i+1 < nb_sites; i++) {
+    sites[i]->next = sites[i+1];
   }
-  call_sites = head;
+  sites[nb_sites-1]->next = NULL;
+  call_sites = sites[0];
+  libfree(sites);
 }
 
 static void __plot_counters(struct memory_info *mem_info,
@@ -1568,7 +2349,7 @@ static void __plot_counters(struct memory_info *mem_info,
       size_t start_offset = i*PAGE_SIZE;
       size_t stop_offset = (i+1)*PAGE_SIZE;
       for(int th=0; th< nb_threads; th++) {
-	struct block_info* block =  __ma_search_block(mem_info->blocks[th], i);
+	struct block_info* block =  __ma_search_block(__ma_search_thread_blocks(mem_info, th), i);
 	int total_access = 0;
 	if(block) {
 	  total_access += block->counters[ACCESS_READ].total_count;
@@ -1599,7 +2380,7 @@ void print_call_site_summary() {
   printf("--------------------------\n");
   __sort_sites();
   struct call_site* site = call_sites;
-  int nb_threads = next_thread_rank;
+  int nb_threads = thread_registry_size();
 
   char callsite_filename[1024];
   create_log_filename("call_sites.log", callsite_filename, 1024);
@@ -1615,18 +2396,31 @@ void print_call_site_summary() {
       }
 
       fprintf(callsite_file, "%d\t%s (size=%zu) - %d buffers. %zu read access (total weight: %"PRIu64", avg weight: %f). %"PRIu64" wr_access\n",
-	      site->id, site->caller, site->buffer_size, site->nb_mallocs,
+	      site->id, string_get(site->caller_id), site->buffer_size, site->nb_mallocs,
 	      site->cumulated_counters.counters[ACCESS_READ].total_count,
 	      site->cumulated_counters.counters[ACCESS_READ].total_weight,
 	      avg_read_weight,
 	      site->cumulated_counters.counters[ACCESS_WRITE].total_count);
       printf("%d\t%s (size=%zu) - %d buffers. %zu read access (total weight: %"PRIu64", avg weight: %f). %"PRIu64" wr_access\n",
-	     site->id, site->caller, site->buffer_size, site->nb_mallocs,
+	     site->id, string_get(site->caller_id), site->buffer_size, site->nb_mallocs,
 	     site->cumulated_counters.counters[ACCESS_READ].total_count,
 	     site->cumulated_counters.counters[ACCESS_READ].total_weight,
 	     avg_read_weight,
 	     site->cumulated_counters.counters[ACCESS_WRITE].total_count);
 
+      char key[OBJECT_KEY_LEN];
+      report_begin("call_site");
+      report_u64("id", site->id);
+      report_string("caller", string_get(site->caller_id));
+      report_hex("caller_rip", (uintptr_t)site->caller_rip);
+      __report_call_site_stack(site);
+      report_string("key", __call_site_stable_key(site, key));
+      report_string("mem_type", mem_type_names[site->mem_info.mem_type]);
+      report_u64("size", site->buffer_size);
+      report_u64("nb_mallocs", site->nb_mallocs);
+      __report_counters(site->cumulated_counters.counters);
+      report_end();
+
       if(settings.dump_single_items && site->mem_info.mem_type != stack) {
 	char filename[1024];
 	sprintf(filename, "%s/callsite_counters_%d.dat", get_log_dir(), site->id);
@@ -1643,14 +2437,11 @@ static void _print_object_summary(FILE* f, struct memory_info* mem_info) {
   long long rd_count = 0;
   long long wr_count = 0;
 
-  if(!mem_info->caller) {
-    mem_info->caller = get_caller_function_from_rip(mem_info->caller_rip);
+  if(!mem_info->caller_id) {
+    mem_info->caller_id = get_caller_function_from_rip(mem_info->caller_rip);
   }
 
-  char* caller = NULL;
-  if(mem_info->caller) {
-    caller = mem_info->caller;
-  }
+  const char* caller = string_get(mem_info->caller_id);
 
   char callstack_rip_str[1024];
   char callstack_offset_str[16384];
@@ -1696,19 +2487,19 @@ static void _print_object_summary(FILE* f, struct memory_info* mem_info) {
     strcat(callstack_offset_str, "NULL");
   }
 
-  fprintf(f, "%d\t0x%"PRIxPTR"\t%ld\t%"PRIu64"\t%"PRIu64"\t%s\t%s\t0x%"PRIxPTR"\t%s\n",
+  char key[OBJECT_KEY_LEN];
+  fprintf(f, "%d\t0x%"PRIxPTR"\t%ld\t%"PRIu64"\t%"PRIu64"\t%s\t%s\t0x%"PRIxPTR"\t%s\t%u\t%s\n",
 	  mem_info->id, (uintptr_t) mem_info->buffer_addr, // Cast to avoid using %p which changes "0x0" for "(nil)"
 	  mem_info->buffer_size, mem_info->alloc_date, mem_info->free_date, callstack_rip_str,
 	  callstack_offset_str, (uintptr_t) mem_info->caller_rip, // Cast to avoid %p too
-	  caller);
+	  caller, mem_info->parent_id, ma_object_key(mem_info, key) ? key : "-");
 }
 
 static void print_object_summary_from_list(FILE* f, mem_info_node_t list) {
 #ifdef USE_HASHTABLE
-  /* todo */
-  struct ht_node*p_node = NULL;
-  FOREACH_HASH(mem_list, p_node) {
-    struct ht_entry*e = p_node->entries;
+  struct bt_iter it;
+  FOREACH_BTREE(list, it) {
+    struct bt_entry*e = bt_iter_entries(&it);
     while(e) {
       struct memory_info* mem_info = e->value;
       _print_object_summary(f, mem_info);
@@ -1725,8 +2516,49 @@ static void print_object_summary_from_list(FILE* f, mem_info_node_t list) {
 #endif
 }
 
+/* resolve the callers of all the memory objects at once */
+static void __symbolize_objects() {
+#ifdef USE_HASHTABLE
+  int nb_objects = 0;
+  struct bt_iter it;
+  FOREACH_BTREE(mem_list, it) {
+    for(struct bt_entry*e = bt_iter_entries(&it); e; e = e->next) {
+      struct memory_info* mem_info = e->value;
+      if(!mem_info->caller_id)
+	nb_objects++;
+    }
+  }
+  if(!nb_objects)
+    return;
+
+  struct memory_info** objects = libmalloc(sizeof(struct memory_info*) * nb_objects);
+  void** rips = libmalloc(sizeof(void*) * nb_objects);
+  string_id_t* symbols = libmalloc(sizeof(string_id_t) * nb_objects);
+  int i = 0;
+  FOREACH_BTREE(mem_list, it) {
+    for(struct bt_entry*e = bt_iter_entries(&it); e; e = e->next) {
+      struct memory_info* mem_info = e->value;
+      if(!mem_info->caller_id) {
+	objects[i] = mem_info;
+	rips[i] = mem_info->caller_rip;
+	i++;
+      }
+    }
+  }
+
+  get_caller_functions_from_rips(rips, nb_objects, symbols);
+  for(i = 0; i < nb_objects; i++) {
+    objects[i]->caller_id = symbols[i];
+  }
+  libfree(objects);
+  libfree(rips);
+  libfree(symbols);
+#endif
+}
+
 void print_object_summary() {
   if(settings.dump_all) {
+    __symbolize_objects();
 
     char filename[4096];
     char file_basename[STRING_LEN];
@@ -1740,7 +2572,7 @@ void print_object_summary() {
 
     /* write the content of the sample to a file */
     fprintf(all_objects_file,
-	    "#object_id\taddress\tsize\tallocation_date\tdeallocation_date\tcallstack_rip\tcallstack_offsets\tcallsite_rip\tcallsite\n");
+	    "#object_id\taddress\tsize\tallocation_date\tdeallocation_date\tcallstack_rip\tcallstack_offsets\tcallsite_rip\tcallsite\tparent_id\tkey\n");
 
     print_object_summary_from_list(all_objects_file, mem_list);
     print_object_summary_from_list(all_objects_file, past_mem_list);
@@ -1754,9 +2586,9 @@ void warn_non_freed_buffers() {
 
   struct memory_info* mem_info = NULL;
 #ifdef USE_HASHTABLE
-  struct ht_node*p_node = NULL;
-  FOREACH_HASH(mem_list, p_node) {
-    struct ht_entry*e = p_node->entries;
+  struct bt_iter it;
+  FOREACH_BTREE(mem_list, it) {
+    struct bt_entry*e = bt_iter_entries(&it);
     while(e) {
       mem_info = e->value;
       if(! mem_info->free_date) {
@@ -1764,6 +2596,7 @@ void warn_non_freed_buffers() {
 	printf("Warning: buffer %p (size=%lu bytes) was not freed\n",
 	       mem_info->buffer_addr, mem_info->buffer_size);
 #endif
+	__ma_observe_numa_placement(mem_info);
 	mem_info->free_date = new_date();
       }
 
@@ -1780,6 +2613,7 @@ void warn_non_freed_buffers() {
 	   mem_info->buffer_addr, mem_info->buffer_size);
 #endif
 
+    __ma_observe_numa_placement(mem_info);
     mem_info->free_date = new_date();
 
     /* remove the record from the list of malloc'd buffers */
@@ -1799,8 +2633,319 @@ void warn_non_freed_buffers() {
 }
 
 
+static struct ht_node* __add_deferred_rip(struct ht_node* rips, void* rip) {
+  if(rip && !ht_contains_key(rips, (uint64_t) rip))
+    rips = ht_insert(rips, (uint64_t) rip, rip);
+  return rips;
+}
+
+static struct ht_node* __add_deferred_rips(struct ht_node* rips, struct memory_info* mem_info) {
+  rips = __add_deferred_rip(rips, mem_info->caller_rip);
+  if(mem_info->callstack_rip) {
+    for(int i = 3; i < mem_info->callstack_size; i++)
+      rips = __add_deferred_rip(rips, mem_info->callstack_rip[i]);
+  }
+  return rips;
+}
+
+/* write the module map and the addresses that numamma-symbolize has to resolve */
+static void print_deferred_symbols() {
+  char filename[4096];
+  create_log_filename("modules.dat", filename, 4096);
+  FILE* f = fopen(filename, "w");
+  if(!f) {
+    fprintf(stderr, "failed to open %s for writing: %s\n", filename, strerror(errno));
+    return;
+  }
+  print_module_map(f);
+  fclose(f);
+
+  struct ht_node* rips = NULL;
+  for(struct call_site* site = call_sites; site; site = site->next)
+    rips = __add_deferred_rips(rips, &site->mem_info);
+#ifdef USE_HASHTABLE
+  if(settings.dump_all) {
+    struct bt_iter it;
+    FOREACH_BTREE(mem_list, it) {
+      for(struct bt_entry*e = bt_iter_entries(&it); e; e = e->next) {
+	rips = __add_deferred_rips(rips, e->value);
+      }
+    }
+  }
+#endif
+
+  create_log_filename("rips.dat", filename, 4096);
+  f = fopen(filename, "w");
+  if(!f) {
+    fprintf(stderr, "failed to open %s for writing: %s\n", filename, strerror(errno));
+    ht_release(rips);
+    return;
+  }
+  struct ht_node*p_node = NULL;
+  FOREACH_HASH(rips, p_node) {
+    fprintf(f, "0x%"PRIxPTR"\n", (uintptr_t) p_node->key);
+  }
+  fclose(f);
+  ht_release(rips);
+  printf("Symbols were not resolved. Run numamma-symbolize %s to resolve them\n", settings.output_dir);
+}
+
+static const char* __numa_policy_name(int policy) {
+  static const char* names[] = {"default", "preferred", "bind", "interleave", "local",
+				"preferred_many", "weighted_interleave"};
+  if(policy == NUMA_POLICY_NONE)
+    return "none";
+  if(policy == NUMA_POLICY_MOVE_PAGES)
+    return "move_pages";
+  if(policy >= 0 && policy < (int)(sizeof(names)/sizeof(names[0])))
+    return names[policy];
+  return "unknown";
+}
+
+/* print a node mask as a list of nodes (eg. 0,2,3) */
+static void __print_nodemask(FILE* f, uint64_t nodemask) {
+  if(nodemask == UINT64_MAX) {
+    fprintf(f, "all");
+    return;
+  }
+  if(!nodemask) {
+    fprintf(f, "-");
+    return;
+  }
+  const char* sep = "";
+  for(int node = 0; node < 64; node++) {
+    if(nodemask & (1ULL << node)) {
+      fprintf(f, "%s%d", sep, node);
+      sep = ",";
+    }
+  }
+}
+
+/* return 1 if the pages of an object were not placed where the application requested */
+static int __numa_placement_mismatch(struct memory_info* mem_info) {
+  if(mem_info->observed_node < 0)
+    return 0;
+  switch(mem_info->numa_policy) {
+  case MPOL_BIND:
+  case MPOL_INTERLEAVE:
+  case NUMA_POLICY_MOVE_PAGES:
+    /* all the pages should be on the requested nodes */
+    return (mem_info->observed_nodemask & ~mem_info->numa_nodemask) != 0;
+  case MPOL_PREFERRED:
+    /* most of the pages should be on the preferred node */
+    return !(mem_info->numa_nodemask & (1ULL << mem_info->observed_node));
+  default:
+    return 0;
+  }
+}
+
+/* print the objects whose NUMA placement was requested by the application */
+static void print_numa_policies() {
+  char filename[4096];
+  create_log_filename("numa_policies.log", filename, 4096);
+  FILE* f = fopen(filename, "w");
+  if(!f) {
+    fprintf(stderr, "failed to open %s for writing: %s\n", filename, strerror(errno));
+    return;
+  }
+  fprintf(f, "#object_id\taddress\tsize\trequested_policy\trequested_nodes\tobserved_node\tobserved_nodes\tmismatch\tcallsite_rip\n");
+
+  int nb_objects = 0;
+  int nb_mismatches = 0;
+#ifdef USE_HASHTABLE
+  struct bt_iter it;
+  FOREACH_BTREE(mem_list, it) {
+    for(struct bt_entry* e = bt_iter_entries(&it); e; e = e->next) {
+      struct memory_info* mem_info = e->value;
+#else
+  for(struct memory_info_list* p_node = past_mem_list; p_node; p_node = p_node->next) {
+    {
+      struct memory_info* mem_info = &p_node->mem_info;
+#endif
+      if(mem_info->numa_policy == NUMA_POLICY_NONE)
+	continue;
+      int mismatch = __numa_placement_mismatch(mem_info);
+      nb_objects++;
+      nb_mismatches += mismatch;
+
+      fprintf(f, "%u\t%p\t%zu\t%s\t", mem_info->id, mem_info->buffer_addr,
+	      mem_info->initial_buffer_size, __numa_policy_name(mem_info->numa_policy));
+      __print_nodemask(f, mem_info->numa_nodemask);
+      fprintf(f, "\t%d\t", mem_info->observed_node);
+      __print_nodemask(f, mem_info->observed_nodemask);
+      fprintf(f, "\t%s\t%p\n", mismatch? "yes": "no", mem_info->caller_rip);
+    }
+  }
+  fclose(f);
+
+  if(nb_objects)
+    printf("%d objects have an explicit NUMA policy (%d of them are not placed as requested). See %s\n",
+	   nb_objects, nb_mismatches, filename);
+}
+
+/* number of keys of the object index copied at a time by ma_foreach_object */
+#define FOREACH_BATCH 64
+
+void ma_foreach_object(void (*callback)(struct memory_info* mem_info, void* arg), void* arg) {
+#ifdef USE_HASHTABLE
+  /* the objects are never removed from the index, their counters are
+   * updated with relaxed atomic operations, and their blocks are published
+   * with release stores (see update_counters and __ma_get_block). Thus,
+   * mem_list_lock is only held while copying a few pointers from the index,
+   * and the counters are read without lock. The counters of an object may
+   * miss the samples that are being analyzed, but each value is consistent
+   */
+  size_t max_batch = FOREACH_BATCH;
+  struct memory_info** batch = libmalloc(sizeof(struct memory_info*) * max_batch);
+  uint64_t next_key = 0;
+  int more = 1;
+  while(more) {
+    size_t n = 0;
+    pthread_mutex_lock(&mem_list_lock);
+    struct bt_iter it;
+    more = bt_upper_key(mem_list, next_key, &it);
+    for(int nb_keys = 0; more && nb_keys < FOREACH_BATCH; nb_keys++) {
+      for(struct bt_entry* e = bt_iter_entries(&it); e; e = e->next) {
+	if(n == max_batch) {
+	  max_batch *= 2;
+	  batch = librealloc(batch, sizeof(struct memory_info*) * max_batch);
+	}
+	batch[n++] = e->value;
+      }
+      next_key = bt_iter_key(&it) + 1;
+      more = bt_next(&it) && next_key != 0;
+    }
+    pthread_mutex_unlock(&mem_list_lock);
+
+    for(size_t i = 0; i < n; i++)
+      callback(batch[i], arg);
+  }
+  libfree(batch);
+#endif
+}
+
+/* state of the previous snapshot (used with SNAPSHOT_MODE_INTERVAL) */
+static struct btree snapshot_counters = BTREE_INITIALIZER; /* counters of each object id */
+static struct mem_counters snapshot_global_counters[ACCESS_MAX];
+static uint64_t snapshot_nb_samples = 0;
+static uint64_t snapshot_nb_found_samples = 0;
+static date_t snapshot_date = 0;
+
+/* replace counters with the difference between counters and prev. The
+ * minimum and maximum weights remain cumulative
+ */
+static void __diff_counters(struct mem_counters* counters, struct mem_counters* prev) {
+#define DIFF_COUNTER(_c) do {				\
+    counters->_c.count -= prev->_c.count;		\
+    counters->_c.sum_weight -= prev->_c.sum_weight;	\
+  } while(0)
+  counters->total_count -= prev->total_count;
+  counters->total_weight -= prev->total_weight;
+  counters->na_miss_count -= prev->na_miss_count;
+  DIFF_COUNTER(cache1_hit);
+  DIFF_COUNTER(cache2_hit);
+  DIFF_COUNTER(cache3_hit);
+  DIFF_COUNTER(lfb_hit);
+  DIFF_COUNTER(local_ram_hit);
+  DIFF_COUNTER(remote_ram_hit);
+  DIFF_COUNTER(remote_cache_hit);
+  DIFF_COUNTER(io_memory_hit);
+  DIFF_COUNTER(uncached_memory_hit);
+  DIFF_COUNTER(cache1_miss);
+  DIFF_COUNTER(cache2_miss);
+  DIFF_COUNTER(cache3_miss);
+  DIFF_COUNTER(lfb_miss);
+  DIFF_COUNTER(local_ram_miss);
+  DIFF_COUNTER(remote_ram_miss);
+  DIFF_COUNTER(remote_cache_miss);
+  DIFF_COUNTER(io_memory_miss);
+  DIFF_COUNTER(uncached_memory_miss);
+#undef DIFF_COUNTER
+}
+
+/* in SNAPSHOT_MODE_INTERVAL, turn the counters into the counters since the
+ * previous snapshot, and remember the current ones in prev
+ */
+static void __snapshot_interval(struct mem_counters* counters, struct mem_counters* prev) {
+  if(settings.snapshot_mode != SNAPSHOT_MODE_INTERVAL)
+    return;
+  struct mem_counters current[ACCESS_MAX];
+  memcpy(current, counters, sizeof(current));
+  for(int j = 0; j < ACCESS_MAX; j++)
+    __diff_counters(&counters[j], &prev[j]);
+  memcpy(prev, current, sizeof(current));
+}
+
+static void __snapshot_object(struct memory_info* mem_info, void* arg) {
+  if(!atomic_load_explicit(&mem_info->blocks, memory_order_acquire))
+    return;
+  struct mem_counters counters[ACCESS_MAX];
+  ma_object_counters(mem_info, counters);
+
+  if(settings.snapshot_mode == SNAPSHOT_MODE_INTERVAL) {
+    struct mem_counters* prev = bt_get_value(&snapshot_counters, mem_info->id);
+    if(!prev) {
+      prev = mem_arena_alloc(sizeof(struct mem_counters) * ACCESS_MAX);
+      memset(prev, 0, sizeof(struct mem_counters) * ACCESS_MAX);
+      bt_insert(&snapshot_counters, mem_info->id, prev);
+    }
+    __snapshot_interval(counters, prev);
+  }
+
+  if(counters[ACCESS_READ].total_count || counters[ACCESS_WRITE].total_count)
+    __report_object(mem_info, counters);
+}
+
+void ma_snapshot(const char* filename, unsigned index) {
+  /* the samples that were copied at runtime have not been analyzed yet */
+  mem_sampling_analyze_pending();
+
+  if(report_open(filename) < 0)
+    return;
+  date_t now = new_date();
+  report_begin("snapshot");
+  report_u64("index", index);
+  report_string("mode", snapshot_mode_names[settings.snapshot_mode]);
+  report_u64("start_date", settings.snapshot_mode == SNAPSHOT_MODE_INTERVAL ? snapshot_date : origin_date);
+  report_u64("date", now);
+  report_end();
+  snapshot_date = now;
+
+  uint64_t nb_samples = nb_samples_total;
+  uint64_t nb_found_samples = nb_found_samples_total;
+  if(settings.snapshot_mode == SNAPSHOT_MODE_INTERVAL) {
+    nb_samples -= snapshot_nb_samples;
+    nb_found_samples -= snapshot_nb_found_samples;
+    snapshot_nb_samples = nb_samples_total;
+    snapshot_nb_found_samples = nb_found_samples_total;
+  }
+  report_begin("samples");
+  report_u64("nb_samples", nb_samples);
+  report_u64("nb_found_samples", nb_found_samples);
+  report_u64("nb_unmatched_samples", nb_samples - nb_found_samples);
+  report_end();
+
+  report_begin("threads");
+  report_u64("nb_threads", thread_registry_size());
+  report_end();
+
+  struct mem_counters counters[ACCESS_MAX];
+  memcpy(counters, global_counters, sizeof(counters));
+  __snapshot_interval(counters, snapshot_global_counters);
+  report_begin("counters");
+  __report_counters(counters);
+  report_end();
+
+  ma_foreach_object(__snapshot_object, NULL);
+
+  report_close();
+}
+
 void ma_finalize() {
 
+  /* no snapshot or query can run during the final analysis */
+  snapshot_finalize();
+  control_finalize();
   ma_thread_finalize();
   PROTECT_RECORD;
   warn_non_freed_buffers();
@@ -1810,19 +2955,24 @@ void ma_finalize() {
   printf("         MEM ANALYZER\n");
   printf("---------------------------------\n");
 
+  char report_filename[4096];
+  create_log_filename("report.jsonl", report_filename, 4096);
+  report_open(report_filename);
+  report_settings();
+
   pthread_mutex_lock(&mem_list_lock);
 
-  mem_info_node_t p_node = NULL;
   struct memory_info* mem_info = NULL;
 
   /* browse the list of memory buffers  */
 #ifdef USE_HASHTABLE
-  FOREACH_HASH(mem_list, p_node) {
-    struct ht_entry*e = p_node->entries;
+  struct bt_iter it;
+  FOREACH_BTREE(mem_list, it) {
+    struct bt_entry*e = bt_iter_entries(&it);
     while(e) {
       mem_info = e->value;
 #else
-    for(p_node = past_mem_list;
+    for(mem_info_node_t p_node = past_mem_list;
 	p_node;
 	p_node = p_node->next) {
       mem_info = &p_node->mem_info;
@@ -1831,17 +2981,20 @@ void ma_finalize() {
       if(mem_info->blocks) {
 	/* at least one memory access was detected */
 	update_call_sites(mem_info);
+	struct mem_counters counters[ACCESS_MAX];
+	ma_object_counters(mem_info, counters);
+	__report_object(mem_info, counters);
 
 	uint64_t duration = mem_info->free_date?
 	  mem_info->free_date-mem_info->alloc_date:
 	  0;
 
-	int nb_threads = next_thread_rank;
+	struct block_table* table = mem_info->blocks;
 	uint64_t total_read_count = 0;
 	uint64_t total_write_count = 0;
 	size_t nb_blocks_with_samples = 0;
-	for(int i=0; i<nb_threads; i++) {
-	  struct block_info* block = mem_info->blocks[i];
+	for(unsigned i=0; i<table->size; i++) {
+	  struct block_info* block = table->blocks[i];
 	  while (block) {
 	    total_read_count += block->counters[ACCESS_READ].total_count;
 	    total_write_count += block->counters[ACCESS_WRITE].total_count;
@@ -1874,12 +3027,51 @@ void ma_finalize() {
 #endif
     }
 
+    if(small_heap_info) {
+      printf("%"PRIu64" allocations (%"PRIu64" bytes) smaller than %zu bytes were not recorded\n",
+	     (uint64_t)nb_untracked_allocs, (uint64_t)untracked_alloc_size, settings.alloc_threshold);
+      if(small_heap_info->blocks) {
+	small_heap_info->buffer_addr = (void*)small_heap_start;
+	small_heap_info->buffer_size = small_heap_end - small_heap_start;
+	small_heap_info->free_date = new_date();
+	small_heap_info->weight = nb_untracked_allocs;
+	update_call_sites(small_heap_info);
+	struct mem_counters counters[ACCESS_MAX];
+	ma_object_counters(small_heap_info, counters);
+	__report_object(small_heap_info, counters);
+      }
+    }
+
     __print_counters(stdout, global_counters);
+    report_begin("counters");
+    __report_counters(global_counters);
+    report_end();
+
+    report_begin("threads");
+    report_u64("nb_threads", thread_registry_size());
+    report_end();
+
     print_call_site_summary();
     print_object_summary();
+    print_numa_policies();
+    if(settings.defer_symbols)
+      print_deferred_symbols();
 
     mem_sampling_statistics();
+    __report_ticks();
+    report_close();
     pthread_mutex_unlock(&mem_list_lock);
+
+    /* the buffers of the dump writer are in the arena */
+    dump_writer_finalize();
+    /* all the metadata is released at once. The caches that outlive the
+     * analysis are emptied first, so that they do not point to unmapped
+     * memory
+     */
+    symbol_cache_release();
+    string_release();
+    __release_object_key_counts();
+    mem_arena_release_all();
     UNPROTECT_RECORD;
   }
 
@@ -4,6 +4,7 @@
 #include <perfmon/pfmlib_perf_event.h>
 #include <stdint.h>
 #include "mem_intercept.h"
+#include "mem_strings.h"
 
 typedef uint64_t date_t;
 
@@ -47,12 +48,22 @@ enum access_type {
 };
 
 extern __thread unsigned thread_rank;
-extern unsigned next_thread_rank;
 
 struct block_info {
   unsigned block_id;
   struct mem_counters counters[ACCESS_MAX];
-  struct block_info *next;
+  /* the blocks are inserted with a release store, so that the lists can be
+   * read while they grow
+   */
+  struct block_info * _Atomic next;
+};
+
+/* the lists of blocks of an object, indexed by thread rank.
+ * The table is replaced by a larger copy when a new thread accesses the object
+ */
+struct block_table {
+  unsigned size;
+  struct block_info* blocks[];
 };
 
 enum mem_type {
@@ -61,6 +72,7 @@ enum mem_type {
   stack,
   dynamic_allocation,
   lib,
+  small_heap,			/* the allocations that were not recorded (allocation sampling) */
 };
 
 struct call_site;
@@ -77,14 +89,27 @@ struct memory_info {
   void** callstack_rip;
   int callstack_size;
   void* caller_rip;		/* adress of the instruction that called malloc */
-  char* caller;			/* callsite (function name+line) of the instruction that called malloc */
+  string_id_t caller_id;	/* callsite (function name+line) of the instruction that called malloc */
   struct call_site* call_site;
   /* TODO: numa node ? thread that allocates */
-  struct block_info **blocks;
-  //  struct mem_counters count[MAX_THREADS][ACCESS_MAX];
+  struct block_table* _Atomic blocks;
   unsigned int id;
+  unsigned int parent_id;	/* id of the previous version of the object (eg. before a realloc), or 0 */
+  unsigned weight;		/* number of allocations this object stands for (allocation sampling) */
+  uint64_t key;			/* stable key of the allocation site (see get_callstack_key), or 0 */
+  unsigned key_ordinal;		/* rank of the object among the allocations with the same key, or 0 */
+
+  /* NUMA placement requested by the application (mbind, numa_alloc_*, etc.) */
+  int numa_policy;		/* MPOL_* mode, or NUMA_POLICY_NONE */
+  uint64_t numa_nodemask;	/* requested nodes (bit i is set for node i) */
+  int observed_node;		/* node that holds most of the pages, or -1 if unknown */
+  uint64_t observed_nodemask;	/* nodes that hold at least one page */
 };
 
+/* values of numa_policy that are not MPOL_* modes */
+#define NUMA_POLICY_NONE       -1 /* no explicit request */
+#define NUMA_POLICY_MOVE_PAGES -2 /* pages were migrated with move_pages */
+
 
 /**
  * Structure collecting statistics on samples
@@ -108,14 +133,87 @@ void ma_init();
 void ma_get_global_variables();
 void ma_get_lib_variables();
 void ma_get_variables ();
-void ma_record_malloc(struct mem_block_info* info);
+/* update the global variables if libraries were loaded or unloaded (eg.
+ * with dlopen/dlclose) since the last call to ma_get_variables. The check
+ * is only done every MODULES_CHECK_PERIOD calls of a thread
+ */
+void ma_update_variables();
+void ma_record_malloc(struct mem_block_info* info, unsigned weight);
 void ma_update_buffer_address(struct mem_block_info* info, void *old_addr, void *new_addr);
 void ma_record_free(struct mem_block_info* info);
+/* record piece (a part of the buffer described by orig that remains
+ * allocated when the rest of orig is released, eg. after a partial munmap).
+ * The new object inherits the allocation site of orig
+ */
+void ma_record_split(struct mem_block_info* orig, struct mem_block_info* piece);
+
+/* record that the application requested a NUMA policy for the range [addr, addr+len[
+ * (only the first 64 nodes of the mask are kept)
+ */
+void ma_record_numa_policy(void* addr, size_t len, int policy, uint64_t nodemask);
+/* record the NUMA policy of the current thread (set_mempolicy). The buffers
+ * allocated by the thread inherit it
+ */
+void ma_record_thread_numa_policy(int policy, uint64_t nodemask);
+
+/* per-thread state of the allocation sampler */
+struct alloc_sampler {
+  int64_t countdown;		/* number of allocations (or bytes) before the next recorded allocation */
+  int started;
+  uint64_t seed;
+  /* statistics on the allocations that were not recorded since the last flush */
+  uint64_t nb_untracked;
+  uint64_t untracked_size;
+  uintptr_t min_addr;
+  uintptr_t max_addr;
+};
+extern __thread struct alloc_sampler alloc_sampler;
+
+/* slow path of ma_alloc_sampling_weight */
+unsigned ma_alloc_sampling_next(void* ptr, size_t size);
+
+/* decide whether an allocation of size bytes located at ptr should be recorded.
+ * return the number of allocations it stands for, or 0 if it should not be recorded
+ */
+static inline unsigned ma_alloc_sampling_weight(void* ptr, size_t size) {
+  if(size >= settings.alloc_threshold)
+    return 1;
+
+  alloc_sampler.countdown -= settings.alloc_sampling == ALLOC_SAMPLING_BYTES ? size : 1;
+  if(__builtin_expect(alloc_sampler.countdown <= 0, 0))
+    return ma_alloc_sampling_next(ptr, size);
+
+  alloc_sampler.nb_untracked++;
+  alloc_sampler.untracked_size += size;
+  if((uintptr_t)ptr < alloc_sampler.min_addr)
+    alloc_sampler.min_addr = (uintptr_t)ptr;
+  if((uintptr_t)ptr + size > alloc_sampler.max_addr)
+    alloc_sampler.max_addr = (uintptr_t)ptr + size;
+  return 0;
+}
 
 void ma_thread_init();
 void ma_thread_finalize();
 void ma_finalize();
-void ma_register_stack();
+
+/* write a snapshot of the report to filename while the application runs
+ * (see mem_snapshot.h)
+ */
+void ma_snapshot(const char* filename, unsigned index);
+
+/* call callback on each object of the index while the application runs.
+ * The index is only locked while a few objects are collected, and
+ * callback is called without the lock
+ */
+void ma_foreach_object(void (*callback)(struct memory_info* mem_info, void* arg), void* arg);
+
+/* write the stable key of mem_info (see OBJECT_KEY_FORMAT) in key, which
+ * has OBJECT_KEY_LEN bytes. Return key, or NULL if the object has no key
+ */
+const char* ma_object_key(struct memory_info* mem_info, char* key);
+
+/* sum the counters of all the blocks of an object */
+void ma_object_counters(struct memory_info* mem_info, struct mem_counters* counters);
 
 void ma_allocate_counters(struct memory_info* mem_info);
 void ma_init_counters(struct memory_info* mem_info);
@@ -139,7 +237,7 @@ void ma_print_mem_info(FILE*f, struct memory_info*mem);
 
 struct call_site {
   uint32_t id;
-  char* caller;
+  string_id_t caller_id;
   void* caller_rip;
   void** callstack_rip;
   int callstack_size;
@@ -147,12 +245,14 @@ struct call_site {
   unsigned nb_mallocs;
   struct memory_info mem_info;
   struct block_info cumulated_counters;
-  FILE* dump_file;
+  int dumped;			/* set if samples of the call site were dumped */
   struct call_site *next;
 };
 
 struct call_site*  update_call_sites(struct memory_info* mem_info);
 struct call_site *find_call_site(struct memory_info* mem_info);
 struct call_site * new_call_site(struct memory_info* mem_info);
+/* return the call site of mem_info. The call site is created if needed */
+struct call_site * ma_get_call_site(struct memory_info* mem_info);
 
 #endif	/* MEM_ANALYZER */
@@ -0,0 +1,251 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <numaif.h>
+
+#include "mem_arena.h"
+
+/* size classes: 16, 32, ..., 32768 bytes */
+#define ARENA_MIN_SHIFT 4
+#define ARENA_NB_CLASSES 12
+#define ARENA_MAX_SIZE ((size_t)1 << (ARENA_MIN_SHIFT + ARENA_NB_CLASSES - 1))
+/* size of the chunks that are split into objects */
+#define ARENA_CHUNK_SIZE (256*1024)
+/* the header of a region occupies one cache line so that objects stay aligned */
+#define ARENA_HEADER_SIZE 64
+
+#ifndef MPOL_LOCAL
+#define MPOL_LOCAL 4
+#endif
+
+/* a memory region mapped by the arenas: either a chunk, or an object that
+ * is larger than ARENA_MAX_SIZE
+ */
+struct arena_region {
+  struct arena_region* prev;
+  struct arena_region* next;
+  size_t size;
+};
+
+struct arena_class {
+  void* free_list;		/* objects that were freed */
+  char* cursor;			/* next object in the current chunk */
+  char* end;			/* end of the current chunk */
+};
+
+struct arena {
+  unsigned generation;		/* value of arena_generation when the classes were emptied */
+  struct arena_class classes[ARENA_NB_CLASSES];
+};
+
+/* zero-initialized: all the classes are empty */
+static __thread struct arena thread_arena;
+
+/* the end of a chunk that a terminated thread did not use */
+struct arena_spare {
+  struct arena_spare* next;
+  char* end;
+};
+
+/* the objects and parts of chunks left by the threads that terminated
+ * (see mem_arena_thread_release). A thread takes them before mapping a new
+ * chunk
+ */
+struct arena_pool_class {
+  void* free_list;
+  struct arena_spare* spares;
+};
+
+static struct arena_pool_class pool[ARENA_NB_CLASSES];
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* incremented by mem_arena_release_all. The arena of a thread is emptied
+ * the next time the thread uses it, so that it does not use the chunks of
+ * the released regions
+ */
+static _Atomic unsigned arena_generation = 0;
+
+/* all the regions mapped by all the threads. Regions are mapped rarely, so
+ * a lock is enough
+ */
+static struct arena_region* regions = NULL;
+static pthread_mutex_t regions_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline struct arena* __get_arena() {
+  unsigned generation = atomic_load_explicit(&arena_generation, memory_order_acquire);
+  if(thread_arena.generation != generation) {
+    memset(thread_arena.classes, 0, sizeof(thread_arena.classes));
+    thread_arena.generation = generation;
+  }
+  return &thread_arena;
+}
+
+static inline int __size_class(size_t size) {
+  if(size <= ((size_t)1 << ARENA_MIN_SHIFT))
+    return 0;
+  return 64 - __builtin_clzl(size - 1) - ARENA_MIN_SHIFT;
+}
+
+/* map a region of size bytes (including its header). The application may
+ * have changed the NUMA policy of the thread (or may intercept mmap), so the
+ * region is mapped and bound with raw system calls
+ */
+static struct arena_region* __map_region(size_t size) {
+  size_t page_size = sysconf(_SC_PAGESIZE);
+  size = (size + page_size - 1) & ~(page_size - 1);
+  void* addr = (void*) syscall(SYS_mmap, NULL, size, PROT_READ | PROT_WRITE,
+			       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(addr == MAP_FAILED) {
+    fprintf(stderr, "numamma: failed to allocate %zu bytes of metadata\n", size);
+    abort();
+  }
+  /* the pages are allocated on the node of the thread that touches them first */
+  syscall(SYS_mbind, addr, size, MPOL_LOCAL, NULL, 0, 0);
+
+  struct arena_region* region = addr;
+  region->size = size;
+  region->prev = NULL;
+  pthread_mutex_lock(&regions_lock);
+  region->next = regions;
+  if(regions)
+    regions->prev = region;
+  regions = region;
+  pthread_mutex_unlock(&regions_lock);
+  return region;
+}
+
+/* give the objects left by the terminated threads to class. Return 0 if
+ * there are none
+ */
+static int __take_from_pool(struct arena_class* class, int class_id) {
+  int found = 1;
+  pthread_mutex_lock(&pool_lock);
+  struct arena_pool_class* pooled = &pool[class_id];
+  if(pooled->free_list) {
+    class->free_list = pooled->free_list;
+    pooled->free_list = NULL;
+  } else if(pooled->spares) {
+    struct arena_spare* spare = pooled->spares;
+    pooled->spares = spare->next;
+    class->cursor = (char*)spare;
+    class->end = spare->end;
+  } else {
+    found = 0;
+  }
+  pthread_mutex_unlock(&pool_lock);
+  return found;
+}
+
+static void __unmap_region(struct arena_region* region) {
+  pthread_mutex_lock(&regions_lock);
+  if(region->prev)
+    region->prev->next = region->next;
+  else
+    regions = region->next;
+  if(region->next)
+    region->next->prev = region->prev;
+  pthread_mutex_unlock(&regions_lock);
+  syscall(SYS_munmap, region, region->size);
+}
+
+void* mem_arena_alloc(size_t size) {
+  if(size > ARENA_MAX_SIZE) {
+    struct arena_region* region = __map_region(size + ARENA_HEADER_SIZE);
+    return (char*)region + ARENA_HEADER_SIZE;
+  }
+
+  int class_id = __size_class(size);
+  size_t object_size = (size_t)1 << (class_id + ARENA_MIN_SHIFT);
+  struct arena_class* class = &__get_arena()->classes[class_id];
+
+  if(!class->free_list && class->cursor + object_size > class->end &&
+     !__take_from_pool(class, class_id)) {
+    /* the current chunk is full */
+    struct arena_region* chunk = __map_region(ARENA_CHUNK_SIZE);
+    class->cursor = (char*)chunk + ARENA_HEADER_SIZE;
+    class->end = (char*)chunk + ARENA_CHUNK_SIZE;
+  }
+
+  if(class->free_list) {
+    void* retval = class->free_list;
+    class->free_list = *(void**)retval;
+    return retval;
+  }
+  void* retval = class->cursor;
+  class->cursor += object_size;
+  return retval;
+}
+
+void mem_arena_free(void* ptr, size_t size) {
+  if(!ptr)
+    return;
+  if(atomic_load_explicit(&arena_generation, memory_order_acquire))
+    /* the arenas were released: ptr may belong to a region that is not
+     * mapped anymore, so it can't be reused. Since this only happens while
+     * the application terminates, the object is leaked
+     */
+    return;
+  if(size > ARENA_MAX_SIZE) {
+    __unmap_region((struct arena_region*)((char*)ptr - ARENA_HEADER_SIZE));
+    return;
+  }
+
+  /* objects of a class are interchangeable, so the object is given to the
+   * arena of the current thread
+   */
+  struct arena_class* class = &__get_arena()->classes[__size_class(size)];
+  *(void**)ptr = class->free_list;
+  class->free_list = ptr;
+}
+
+void mem_arena_thread_release(void) {
+  struct arena* arena = __get_arena();
+  pthread_mutex_lock(&pool_lock);
+  /* after mem_arena_release_all, the arena may contain objects of
+   * the released regions
+   */
+  if(arena->generation == atomic_load_explicit(&arena_generation, memory_order_acquire)) {
+    for(int i = 0; i < ARENA_NB_CLASSES; i++) {
+      struct arena_class* class = &arena->classes[i];
+      struct arena_pool_class* pooled = &pool[i];
+      size_t object_size = (size_t)1 << (i + ARENA_MIN_SHIFT);
+      if(class->free_list) {
+	void* last = class->free_list;
+	while(*(void**)last)
+	  last = *(void**)last;
+	*(void**)last = pooled->free_list;
+	pooled->free_list = class->free_list;
+      }
+      if(class->cursor + object_size <= class->end) {
+	struct arena_spare* spare = (struct arena_spare*)class->cursor;
+	spare->end = class->end;
+	spare->next = pooled->spares;
+	pooled->spares = spare;
+      }
+    }
+  }
+  pthread_mutex_unlock(&pool_lock);
+  memset(arena->classes, 0, sizeof(arena->classes));
+}
+
+void mem_arena_release_all(void) {
+  pthread_mutex_lock(&regions_lock);
+  /* the other threads empty their arena before allocating again */
+  atomic_fetch_add_explicit(&arena_generation, 1, memory_order_release);
+  /* the pool points to the regions that are released */
+  pthread_mutex_lock(&pool_lock);
+  memset(pool, 0, sizeof(pool));
+  pthread_mutex_unlock(&pool_lock);
+  while(regions) {
+    struct arena_region* region = regions;
+    regions = region->next;
+    syscall(SYS_munmap, region, region->size);
+  }
+  pthread_mutex_unlock(&regions_lock);
+}
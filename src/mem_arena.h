@@ -0,0 +1,40 @@
+#ifndef MEM_ARENA_H
+#define MEM_ARENA_H
+
+/* Per-thread arenas for the analyzer metadata.
+ *
+ * Each thread allocates its metadata from its own arena, split into size
+ * classes (powers of 2). Allocating and freeing an object do not take any
+ * lock, and do not go through the allocator of the application. The arenas
+ * are mapped directly from the kernel with a local NUMA policy, so that the
+ * metadata is placed on the NUMA node of the thread that allocates it.
+ * When a thread terminates, the unused part of its arena is given to the
+ * threads that allocate afterwards (see mem_arena_thread_release).
+ *
+ * All the arenas are released at once by mem_arena_release_all.
+ */
+#include <stddef.h>
+
+/* allocate size bytes */
+void* mem_arena_alloc(size_t size);
+
+/* free an object. size is the size that was passed to mem_arena_alloc.
+ * The object may be freed by another thread than the one that allocated it
+ */
+void mem_arena_free(void* ptr, size_t size);
+
+/* give the arena of the current thread to the threads that allocate
+ * afterwards. Called when the thread terminates, so that the arenas of
+ * short-lived threads are reused. If the thread allocates again, it gets a
+ * new arena
+ */
+void mem_arena_thread_release(void);
+
+/* release the arenas of all the threads. The objects they contain must
+ * not be used anymore: the data structures that point to them must be
+ * emptied first. Each thread gets a new arena the next time it allocates,
+ * and the objects that are freed afterwards are ignored
+ */
+void mem_arena_release_all(void);
+
+#endif	/* MEM_ARENA_H */
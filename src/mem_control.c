@@ -0,0 +1,475 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "mem_control.h"
+#include "mem_intercept.h"
+#include "mem_analyzer.h"
+#include "mem_sampling.h"
+#include "mem_tools.h"
+#include "mem_threads.h"
+#include "mem_strings.h"
+#include "mem_report.h"
+
+/* maximum length of a query */
+#define CONTROL_QUERY_LEN 256
+/* a client that does not send its query within CONTROL_TIMEOUT seconds is disconnected */
+#define CONTROL_TIMEOUT 5
+/* default number of objects reported by 'top' */
+#define CONTROL_TOP_DEFAULT 10
+/* the blocks of the objects are pages (see ma_get_block) */
+#define CONTROL_PAGE_SIZE 4096
+
+static int listen_fd = -1;
+static struct sockaddr_un control_addr;
+static pthread_t control_thread;
+static _Atomic int control_running = 0;
+static _Atomic int control_stop = 0;
+
+/* the memory levels that a query can select */
+struct control_level {
+  const char* name;
+  size_t offset;		/* offset of the struct count in struct mem_counters */
+};
+
+#define LEVEL(_c) { #_c, offsetof(struct mem_counters, _c) }
+static const struct control_level levels[] = {
+  LEVEL(cache1_hit),
+  LEVEL(cache2_hit),
+  LEVEL(cache3_hit),
+  LEVEL(lfb_hit),
+  LEVEL(local_ram_hit),
+  LEVEL(remote_ram_hit),
+  LEVEL(remote_cache_hit),
+  LEVEL(io_memory_hit),
+  LEVEL(uncached_memory_hit),
+  LEVEL(cache1_miss),
+  LEVEL(cache2_miss),
+  LEVEL(cache3_miss),
+  LEVEL(lfb_miss),
+  LEVEL(local_ram_miss),
+  LEVEL(remote_ram_miss),
+  LEVEL(remote_cache_miss),
+  LEVEL(io_memory_miss),
+  LEVEL(uncached_memory_miss),
+};
+#undef LEVEL
+#define NB_LEVELS (sizeof(levels) / sizeof(levels[0]))
+/* all the accesses, whatever their memory level */
+#define LEVEL_TOTAL -1
+
+/* return the index of a level in levels (or LEVEL_TOTAL), or -2 if the name is invalid */
+static int __level_from_string(const char* str) {
+  if(!str || strcmp(str, "total") == 0)
+    return LEVEL_TOTAL;
+  for(int i = 0; i < (int)NB_LEVELS; i++)
+    if(strcmp(str, levels[i].name) == 0)
+      return i;
+  return -2;
+}
+
+static const char* __level_name(int level) {
+  return level == LEVEL_TOTAL ? "total" : levels[level].name;
+}
+
+/* number of accesses and total weight of the accesses to a level */
+static void __level_counters(struct mem_counters* counters, int level,
+			     uint64_t* count, uint64_t* weight) {
+  if(level == LEVEL_TOTAL) {
+    *count = counters->total_count;
+    *weight = counters->total_weight;
+  } else {
+    struct count* c = (struct count*)((char*)counters + levels[level].offset);
+    *count = c->count;
+    *weight = c->sum_weight;
+  }
+}
+
+static void __report_error(const char* message) {
+  report_begin("error");
+  report_string("message", message);
+  report_end();
+}
+
+/* sleep for a few seconds. Return -1 if the control thread is stopped meanwhile */
+static int __sleep(int seconds) {
+  for(int i = 0; i < seconds * 10; i++) {
+    if(atomic_load(&control_stop))
+      return -1;
+    struct timespec t = { .tv_sec = 0, .tv_nsec = 100 * 1000 * 1000 };
+    nanosleep(&t, NULL);
+  }
+  return 0;
+}
+
+static void __status(void) {
+  report_begin("status");
+  report_int("pid", getpid());
+  report_bool("paused", mem_sampling_is_paused());
+  report_u64("nb_threads", thread_registry_size());
+  report_u64("nb_samples", nb_samples_total);
+  report_u64("nb_found_samples", nb_found_samples_total);
+  report_end();
+}
+
+struct top_entry {
+  struct memory_info* mem_info;
+  uint64_t count;
+  uint64_t weight;
+};
+
+struct top_list {
+  int level;
+  size_t nb_entries;
+  size_t max_entries;
+  struct top_entry* entries;
+};
+
+static void __top_collect(struct memory_info* mem_info, void* arg) {
+  struct top_list* list = arg;
+  if(!atomic_load_explicit(&mem_info->blocks, memory_order_acquire))
+    return;
+
+  struct mem_counters counters[ACCESS_MAX];
+  ma_object_counters(mem_info, counters);
+  struct top_entry e = { .mem_info = mem_info, .count = 0, .weight = 0 };
+  for(int j = 0; j < ACCESS_MAX; j++) {
+    uint64_t count, weight;
+    __level_counters(&counters[j], list->level, &count, &weight);
+    e.count += count;
+    e.weight += weight;
+  }
+
+  if(list->nb_entries == list->max_entries) {
+    list->max_entries = list->max_entries ? list->max_entries * 2 : 1024;
+    list->entries = librealloc(list->entries, sizeof(struct top_entry) * list->max_entries);
+  }
+  list->entries[list->nb_entries++] = e;
+}
+
+static int __compare_mem_info(const void* a, const void* b) {
+  const struct top_entry* ea = a;
+  const struct top_entry* eb = b;
+  if(ea->mem_info < eb->mem_info) return -1;
+  if(ea->mem_info > eb->mem_info) return 1;
+  return 0;
+}
+
+static int __compare_weight(const void* a, const void* b) {
+  const struct top_entry* ea = a;
+  const struct top_entry* eb = b;
+  if(ea->weight > eb->weight) return -1;
+  if(ea->weight < eb->weight) return 1;
+  return 0;
+}
+
+static void __top(int n, int level, int seconds) {
+  struct top_list list = { .level = level, .nb_entries = 0, .max_entries = 0, .entries = NULL };
+  struct top_list before = list;
+
+  if(seconds > 0) {
+    mem_sampling_analyze_pending();
+    ma_foreach_object(__top_collect, &before);
+    qsort(before.entries, before.nb_entries, sizeof(struct top_entry), __compare_mem_info);
+    if(__sleep(seconds) < 0) {
+      __report_error("interrupted");
+      goto out;
+    }
+  }
+
+  mem_sampling_analyze_pending();
+  ma_foreach_object(__top_collect, &list);
+
+  if(seconds > 0) {
+    /* only keep the accesses that occurred during the interval */
+    for(size_t i = 0; i < list.nb_entries; i++) {
+      struct top_entry* prev = bsearch(&list.entries[i], before.entries, before.nb_entries,
+				       sizeof(struct top_entry), __compare_mem_info);
+      if(prev) {
+	list.entries[i].count -= prev->count;
+	list.entries[i].weight -= prev->weight;
+      }
+    }
+  }
+
+  qsort(list.entries, list.nb_entries, sizeof(struct top_entry), __compare_weight);
+  for(size_t i = 0; i < list.nb_entries && i < (size_t)n; i++) {
+    struct top_entry* e = &list.entries[i];
+    char key[OBJECT_KEY_LEN];
+    if(!e->count)
+      break;
+    report_begin("top");
+    report_u64("rank", i + 1);
+    report_u64("id", e->mem_info->id);
+    report_int("call_site", e->mem_info->call_site ? (int64_t)e->mem_info->call_site->id : -1);
+    report_hex("address", (uintptr_t)e->mem_info->buffer_addr);
+    report_u64("size", e->mem_info->buffer_size);
+    report_string("caller", string_get(e->mem_info->caller_id));
+    report_string("key", ma_object_key(e->mem_info, key));
+    report_string("level", __level_name(level));
+    report_int("seconds", seconds);
+    report_u64("count", e->count);
+    report_u64("weight", e->weight);
+    report_end();
+  }
+
+ out:
+  libfree(before.entries);
+  libfree(list.entries);
+}
+
+struct find_object {
+  unsigned id;
+  struct memory_info* mem_info;
+};
+
+static void __find_object(struct memory_info* mem_info, void* arg) {
+  struct find_object* f = arg;
+  if(!f->mem_info && mem_info->id == f->id)
+    f->mem_info = mem_info;
+}
+
+static int __compare_block(const void* a, const void* b) {
+  const struct block_info* ba = *(struct block_info* const*)a;
+  const struct block_info* bb = *(struct block_info* const*)b;
+  if(ba->block_id < bb->block_id) return -1;
+  if(ba->block_id > bb->block_id) return 1;
+  return 0;
+}
+
+static void __report_page(struct block_info** blocks, size_t nb_blocks, int level) {
+  uint64_t count[ACCESS_MAX] = {0};
+  uint64_t weight[ACCESS_MAX] = {0};
+  for(size_t i = 0; i < nb_blocks; i++) {
+    for(int j = 0; j < ACCESS_MAX; j++) {
+      uint64_t c, w;
+      __level_counters(&blocks[i]->counters[j], level, &c, &w);
+      count[j] += c;
+      weight[j] += w;
+    }
+  }
+  if(!count[ACCESS_READ] && !count[ACCESS_WRITE])
+    return;
+
+  report_begin("page");
+  report_u64("page", blocks[0]->block_id);
+  report_u64("offset", (uint64_t)blocks[0]->block_id * CONTROL_PAGE_SIZE);
+  report_u64("read_count", count[ACCESS_READ]);
+  report_u64("read_weight", weight[ACCESS_READ]);
+  report_u64("write_count", count[ACCESS_WRITE]);
+  report_u64("write_weight", weight[ACCESS_WRITE]);
+  report_end();
+}
+
+static void __heatmap(unsigned id, int level) {
+  mem_sampling_analyze_pending();
+  struct find_object f = { .id = id, .mem_info = NULL };
+  ma_foreach_object(__find_object, &f);
+  if(!f.mem_info) {
+    __report_error("no such object");
+    return;
+  }
+  struct memory_info* mem_info = f.mem_info;
+  char key[OBJECT_KEY_LEN];
+
+  report_begin("heatmap");
+  report_u64("id", mem_info->id);
+  report_hex("address", (uintptr_t)mem_info->buffer_addr);
+  report_u64("size", mem_info->buffer_size);
+  report_string("caller", string_get(mem_info->caller_id));
+  report_string("key", ma_object_key(mem_info, key));
+  report_string("level", __level_name(level));
+  report_u64("page_size", CONTROL_PAGE_SIZE);
+  report_end();
+
+  struct block_table* table = atomic_load_explicit(&mem_info->blocks, memory_order_acquire);
+  if(!table)
+    return;
+
+  /* each thread has its own list of blocks: gather them and sort them by page */
+  size_t nb_blocks = 0;
+  size_t max_blocks = 1024;
+  struct block_info** blocks = libmalloc(sizeof(struct block_info*) * max_blocks);
+  for(unsigned i = 0; i < table->size; i++) {
+    for(struct block_info* block = table->blocks[i]; block; block = block->next) {
+      if(nb_blocks == max_blocks) {
+	max_blocks *= 2;
+	blocks = librealloc(blocks, sizeof(struct block_info*) * max_blocks);
+      }
+      blocks[nb_blocks++] = block;
+    }
+  }
+  qsort(blocks, nb_blocks, sizeof(struct block_info*), __compare_block);
+
+  size_t first = 0;
+  for(size_t i = 1; i <= nb_blocks; i++) {
+    if(i == nb_blocks || blocks[i]->block_id != blocks[first]->block_id) {
+      __report_page(&blocks[first], i - first, level);
+      first = i;
+    }
+  }
+  libfree(blocks);
+}
+
+static void __sampling(int paused) {
+  mem_sampling_pause(paused);
+  report_begin("sampling");
+  report_bool("paused", paused);
+  report_end();
+}
+
+/* answer a query. The answer is written to the current report */
+static void __handle_query(char* query) {
+  char* saveptr = NULL;
+  char* command = strtok_r(query, " \t\r\n", &saveptr);
+  char* args[3];
+  int nb_args = 0;
+  char* arg;
+  while(nb_args < 3 && (arg = strtok_r(NULL, " \t\r\n", &saveptr)))
+    args[nb_args++] = arg;
+
+  if(!command) {
+    __report_error("empty query");
+  } else if(strcmp(command, "status") == 0) {
+    __status();
+  } else if(strcmp(command, "top") == 0) {
+    int n = nb_args > 0 ? atoi(args[0]) : CONTROL_TOP_DEFAULT;
+    int level = __level_from_string(nb_args > 1 ? args[1] : NULL);
+    int seconds = nb_args > 2 ? atoi(args[2]) : 0;
+    if(level < LEVEL_TOTAL)
+      __report_error("invalid memory level");
+    else
+      __top(n > 0 ? n : CONTROL_TOP_DEFAULT, level, seconds);
+  } else if(strcmp(command, "heatmap") == 0) {
+    int level = __level_from_string(nb_args > 1 ? args[1] : NULL);
+    if(nb_args < 1)
+      __report_error("usage: heatmap ID [LEVEL]");
+    else if(level < LEVEL_TOTAL)
+      __report_error("invalid memory level");
+    else
+      __heatmap(strtoul(args[0], NULL, 0), level);
+  } else if(strcmp(command, "start") == 0) {
+    __sampling(0);
+  } else if(strcmp(command, "stop") == 0) {
+    __sampling(1);
+  } else {
+    __report_error("unknown command (status, top, heatmap, start, stop)");
+  }
+}
+
+/* read a query (a single line) from a client */
+static int __read_query(int fd, char* query, size_t len) {
+  size_t n = 0;
+  while(n < len - 1) {
+    ssize_t ret = read(fd, &query[n], len - 1 - n);
+    if(ret < 0 && errno == EINTR)
+      continue;
+    if(ret <= 0)
+      break;
+    n += ret;
+    if(memchr(query, '\n', n))
+      break;
+  }
+  query[n] = '\0';
+  return n > 0 ? 0 : -1;
+}
+
+static void* __control_function(void* arg) {
+  /* the allocations of the control thread are not recorded, and the
+   * signals are handled by the application threads
+   */
+  is_recurse_unsafe++;
+  sigset_t mask;
+  sigfillset(&mask);
+  pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+  while(!atomic_load(&control_stop)) {
+    int fd = accept(listen_fd, NULL, NULL);
+    if(fd < 0) {
+      if(errno == EINTR || errno == ECONNABORTED)
+	continue;
+      /* control_finalize shut the socket down */
+      break;
+    }
+
+    struct timeval timeout = { .tv_sec = CONTROL_TIMEOUT, .tv_usec = 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    char query[CONTROL_QUERY_LEN];
+    if(__read_query(fd, query, sizeof(query)) < 0 || report_open_fd(fd) < 0) {
+      close(fd);
+      continue;
+    }
+    __handle_query(query);
+    /* this also closes fd */
+    report_close();
+  }
+  return NULL;
+}
+
+void control_init(void) {
+  if(!settings.control_socket)
+    return;
+
+  memset(&control_addr, 0, sizeof(control_addr));
+  control_addr.sun_family = AF_UNIX;
+  snprintf(control_addr.sun_path, sizeof(control_addr.sun_path),
+	   CONTROL_SOCKET_PATH_FORMAT, getpid());
+
+  listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if(listen_fd < 0) {
+    fprintf(stderr, "[NumaMMA] cannot create the control socket: %s\n", strerror(errno));
+    return;
+  }
+  /* a previous process with the same pid may have left its socket */
+  unlink(control_addr.sun_path);
+  /* only the user that runs the application can query it. The socket is
+   * created with these permissions, so that nobody can connect before they
+   * are set. This runs while numamma initializes, before the application
+   * creates threads that could create files meanwhile
+   */
+  mode_t old_umask = umask(S_IRWXG | S_IRWXO | S_IXUSR);
+  int ret = bind(listen_fd, (struct sockaddr*)&control_addr, sizeof(control_addr));
+  umask(old_umask);
+  if(ret < 0 || listen(listen_fd, 4) < 0) {
+    fprintf(stderr, "[NumaMMA] cannot create %s: %s\n", control_addr.sun_path, strerror(errno));
+    goto err;
+  }
+
+  /* libpthread_create: the control thread is not an application thread */
+  if(libpthread_create(&control_thread, NULL, __control_function, NULL) != 0) {
+    fprintf(stderr, "[NumaMMA] cannot create the control thread\n");
+    unlink(control_addr.sun_path);
+    goto err;
+  }
+  atomic_store(&control_running, 1);
+  return;
+
+ err:
+  close(listen_fd);
+  listen_fd = -1;
+}
+
+void control_finalize(void) {
+  if(!atomic_load(&control_running))
+    return;
+  atomic_store(&control_stop, 1);
+  /* wake up the control thread if it waits in accept */
+  shutdown(listen_fd, SHUT_RDWR);
+  pthread_join(control_thread, NULL);
+  close(listen_fd);
+  listen_fd = -1;
+  unlink(control_addr.sun_path);
+  atomic_store(&control_running, 0);
+}
@@ -0,0 +1,27 @@
+#ifndef MEM_CONTROL_H
+#define MEM_CONTROL_H
+
+/* Control socket (settings.control_socket).
+ *
+ * A background thread listens on a Unix socket (CONTROL_SOCKET_PATH_FORMAT)
+ * and answers the queries sent by 'numamma ctl <pid> <command>'. A query is
+ * a single line, and the answer is written in the format of report.jsonl
+ * (see mem_report.h) before the connection is closed. The queries read the
+ * counters while the analysis updates them with relaxed atomic operations,
+ * so the application threads are not paused:
+ *   status                        sampling status and number of samples
+ *   top [N] [LEVEL] [SECONDS]     the N objects with the highest weight in
+ *                                 LEVEL (eg. remote_ram_miss, or total). If
+ *                                 SECONDS is set, only the accesses during
+ *                                 the next SECONDS seconds are accounted
+ *   heatmap ID [LEVEL]            the accesses to each page of object ID
+ *   start|stop                    resume/pause the sampling
+ */
+
+/* start the control thread if settings.control_socket is set */
+void control_init(void);
+
+/* stop the control thread and remove the socket */
+void control_finalize(void);
+
+#endif	/* MEM_CONTROL_H */
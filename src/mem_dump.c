@@ -0,0 +1,271 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "mem_dump.h"
+#include "mem_intercept.h"
+#include "mem_arena.h"
+
+/* number of samples in a producer buffer */
+#define DUMP_BUFFER_ENTRIES 8192
+
+struct dump_sink {
+  enum trace_kind kind;
+  int format;
+  struct trace_writer* trace;	/* binary dumps */
+  struct trace_output* output;	/* text dumps */
+};
+
+struct dump_entry {
+  struct dump_sink* sink;
+  uint32_t stream;
+  struct trace_record record;
+};
+
+struct dump_buffer {
+  struct dump_buffer* next;	/* in the list of submitted buffers */
+  _Atomic int busy;		/* set until the writer thread has written the buffer */
+  size_t nb_entries;
+  struct dump_entry entries[DUMP_BUFFER_ENTRIES];
+};
+
+/* each thread that appends samples has two buffers: it fills one of them
+ * while the writer thread writes the other one
+ */
+struct dump_producer {
+  struct dump_buffer* active;
+  struct dump_buffer* buffers[2];
+  struct dump_producer* next;
+};
+
+static __thread struct dump_producer* producer = NULL;
+static struct dump_producer* _Atomic producers = NULL;
+
+/* buffers waiting for the writer thread (most recent first) */
+static struct dump_buffer* _Atomic submitted = NULL;
+static sem_t writer_sem;
+static pthread_t writer_thread;
+static _Atomic int writer_running = 0;
+static _Atomic int writer_stop = 0;
+
+static void __write_text(struct dump_sink* sink, uint32_t stream, const struct trace_record* r) {
+  char line[256];
+  int len = 0;
+  const char* level = trace_level_name(r->level);
+  char access = r->access_type == 0 ? 'r' : 'w';
+  switch(sink->kind) {
+  case TRACE_KIND_OBJECTS:
+    len = snprintf(line, sizeof(line), "%u %" PRIu64 " %u %" PRIu64 " %s %u %c\n",
+		   r->thread_rank, r->timestamp, r->object_id, r->offset, level, r->weight, access);
+    break;
+  case TRACE_KIND_CALL_SITE:
+    len = snprintf(line, sizeof(line), "%u %u %" PRIu64 " %" PRIu64 " %s %u %c\n",
+		   stream, r->thread_rank, r->timestamp, r->offset, level, r->weight, access);
+    break;
+  case TRACE_KIND_UNMATCHED:
+    len = snprintf(line, sizeof(line), "%u %" PRIu64 " 0x%" PRIx64 " %s %u %c\n",
+		   r->thread_rank, r->timestamp, r->offset, level, r->weight, access);
+    break;
+  default:
+    break;
+  }
+  if(len >= (int)sizeof(line)) {
+    /* the line was truncated: keep its end of line */
+    len = sizeof(line) - 1;
+    line[len - 1] = '\n';
+  }
+  trace_output_write(sink->output, line, len);
+}
+
+static void __write_buffer(struct dump_buffer* buffer) {
+  for(size_t i = 0; i < buffer->nb_entries; i++) {
+    struct dump_entry* e = &buffer->entries[i];
+    if(e->sink->format == DUMP_FORMAT_BINARY)
+      trace_writer_append(e->sink->trace, e->stream, &e->record);
+    else
+      __write_text(e->sink, e->stream, &e->record);
+  }
+  buffer->nb_entries = 0;
+  atomic_store_explicit(&buffer->busy, 0, memory_order_release);
+}
+
+static void* __writer_function(void* arg) {
+  /* the allocations of the writer thread are not recorded, and the signals
+   * are handled by the application threads
+   */
+  is_recurse_unsafe++;
+  sigset_t mask;
+  sigfillset(&mask);
+  pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+  for(;;) {
+    while(sem_wait(&writer_sem) < 0 && errno == EINTR)
+      ;
+    struct dump_buffer* list = atomic_exchange_explicit(&submitted, NULL, memory_order_acquire);
+
+    /* write the buffers in the order they were submitted */
+    struct dump_buffer* reversed = NULL;
+    while(list) {
+      struct dump_buffer* next = list->next;
+      list->next = reversed;
+      reversed = list;
+      list = next;
+    }
+    while(reversed) {
+      struct dump_buffer* next = reversed->next;
+      __write_buffer(reversed);
+      reversed = next;
+    }
+
+    if(atomic_load_explicit(&writer_stop, memory_order_acquire) &&
+       !atomic_load_explicit(&submitted, memory_order_acquire))
+      break;
+  }
+  return NULL;
+}
+
+void dump_writer_init(void) {
+  sem_init(&writer_sem, 0, 0);
+  /* libpthread_create: the writer thread is not an application thread */
+  if(libpthread_create(&writer_thread, NULL, __writer_function, NULL) != 0) {
+    fprintf(stderr, "[NumaMMA] cannot create the dump writer thread\n");
+    abort();
+  }
+  atomic_store(&writer_running, 1);
+}
+
+/* hand a buffer to the writer thread */
+static void __submit(struct dump_buffer* buffer) {
+  atomic_store_explicit(&buffer->busy, 1, memory_order_relaxed);
+  buffer->next = atomic_load_explicit(&submitted, memory_order_relaxed);
+  while(!atomic_compare_exchange_weak_explicit(&submitted, &buffer->next, buffer,
+					       memory_order_release, memory_order_relaxed))
+    ;
+  /* sem_post is async-signal-safe */
+  sem_post(&writer_sem);
+}
+
+static void __wait_buffer(struct dump_buffer* buffer) {
+  while(atomic_load_explicit(&buffer->busy, memory_order_acquire))
+    sched_yield();
+}
+
+static struct dump_producer* __new_producer(void) {
+  struct dump_producer* p = mem_arena_alloc(sizeof(struct dump_producer));
+  for(int i = 0; i < 2; i++) {
+    p->buffers[i] = mem_arena_alloc(sizeof(struct dump_buffer));
+    p->buffers[i]->nb_entries = 0;
+    atomic_init(&p->buffers[i]->busy, 0);
+  }
+  p->active = p->buffers[0];
+
+  p->next = atomic_load_explicit(&producers, memory_order_relaxed);
+  while(!atomic_compare_exchange_weak_explicit(&producers, &p->next, p,
+					       memory_order_release, memory_order_relaxed))
+    ;
+  return p;
+}
+
+void dump_append(struct dump_sink* sink, uint32_t stream, const struct trace_record* record) {
+  if(!producer)
+    producer = __new_producer();
+
+  struct dump_buffer* buffer = producer->active;
+  if(buffer->nb_entries == DUMP_BUFFER_ENTRIES) {
+    __submit(buffer);
+    buffer = (buffer == producer->buffers[0]) ? producer->buffers[1] : producer->buffers[0];
+    /* usually, the writer thread is done with this buffer */
+    __wait_buffer(buffer);
+    producer->active = buffer;
+  }
+  struct dump_entry* e = &buffer->entries[buffer->nb_entries];
+  e->sink = sink;
+  e->stream = stream;
+  memcpy(&e->record, record, sizeof(struct trace_record));
+  buffer->nb_entries++;
+}
+
+void dump_writer_drain(void) {
+  if(!atomic_load(&writer_running))
+    return;
+  struct dump_producer* p;
+  for(p = atomic_load_explicit(&producers, memory_order_acquire); p; p = p->next) {
+    if(p->active->nb_entries && !atomic_load_explicit(&p->active->busy, memory_order_acquire))
+      __submit(p->active);
+  }
+  for(p = atomic_load_explicit(&producers, memory_order_acquire); p; p = p->next) {
+    __wait_buffer(p->buffers[0]);
+    __wait_buffer(p->buffers[1]);
+  }
+}
+
+void dump_writer_finalize(void) {
+  if(!atomic_load(&writer_running))
+    return;
+  dump_writer_drain();
+  atomic_store_explicit(&writer_stop, 1, memory_order_release);
+  sem_post(&writer_sem);
+  pthread_join(writer_thread, NULL);
+  atomic_store(&writer_running, 0);
+  /* the producers are allocated in the arena, that is released at the end of the analysis */
+  atomic_store(&producers, NULL);
+  producer = NULL;
+}
+
+static const char* dump_headers[] = {
+  "#thread_rank timestamp object_id offset mem_level access_weight access_type\n",
+  "#site_id thread_rank timestamp offset mem_level access_weight access_type\n",
+  "#thread_rank timestamp address mem_level access_weight access_type\n",
+};
+
+struct dump_sink* dump_sink_open(const char* filename,
+				 enum trace_kind kind,
+				 int format,
+				 size_t chunk_records) {
+  int flags = settings.dump_direct_io ? TRACE_DIRECT_IO : 0;
+  struct dump_sink* sink = malloc(sizeof(struct dump_sink));
+  sink->kind = kind;
+  sink->format = format;
+  sink->trace = NULL;
+  sink->output = NULL;
+  if(format == DUMP_FORMAT_BINARY) {
+    sink->trace = trace_writer_open(filename, kind, chunk_records, flags);
+    if(!sink->trace)
+      goto err;
+  } else {
+    sink->output = trace_output_open(filename, flags);
+    if(!sink->output)
+      goto err;
+    trace_output_write(sink->output, dump_headers[kind], strlen(dump_headers[kind]));
+  }
+  return sink;
+ err:
+  free(sink);
+  return NULL;
+}
+
+struct dump_sink* dump_sink_open_fd(int fd, enum trace_kind kind) {
+  struct dump_sink* sink = malloc(sizeof(struct dump_sink));
+  sink->kind = kind;
+  sink->format = DUMP_FORMAT_TEXT;
+  sink->trace = NULL;
+  sink->output = trace_output_open_fd(fd);
+  trace_output_write(sink->output, dump_headers[kind], strlen(dump_headers[kind]));
+  return sink;
+}
+
+void dump_sink_close(struct dump_sink* sink) {
+  if(sink->trace)
+    trace_writer_close(sink->trace);
+  if(sink->output)
+    trace_output_close(sink->output);
+  free(sink);
+}
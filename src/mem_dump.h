@@ -0,0 +1,51 @@
+#ifndef MEM_DUMP_H
+#define MEM_DUMP_H
+
+/* Asynchronous writer for the sample dumps.
+ *
+ * The threads that analyze samples (possibly application threads, in a
+ * signal handler) only copy the samples to dump in a thread-local buffer.
+ * When the buffer is full, it is handed to a background writer thread that
+ * formats (or encodes) the samples and writes them to the dump files by
+ * large blocks, while the analyzing thread fills its second buffer.
+ */
+#include "mem_trace.h"
+
+/* a dump file (text or binary, see enum dump_format) */
+struct dump_sink;
+
+/* start the writer thread */
+void dump_writer_init(void);
+
+/* wait until all the samples appended so far are written.
+ * No thread may append samples while this function runs
+ */
+void dump_writer_drain(void);
+
+/* stop the writer thread. The sinks must be closed */
+void dump_writer_finalize(void);
+
+/* create a dump file. format is DUMP_FORMAT_TEXT or DUMP_FORMAT_BINARY,
+ * chunk_records is the size of the chunks of binary dumps.
+ * return NULL (and set errno) if the file cannot be created
+ */
+struct dump_sink* dump_sink_open(const char* filename,
+				 enum trace_kind kind,
+				 int format,
+				 size_t chunk_records);
+
+/* create a text dump that writes at the end of an already open file */
+struct dump_sink* dump_sink_open_fd(int fd, enum trace_kind kind);
+
+/* write the pending samples of sink and close it. dump_writer_drain must be
+ * called before
+ */
+void dump_sink_close(struct dump_sink* sink);
+
+/* add a sample to a stream of a dump (see trace_writer_append). In text
+ * dumps of call sites, the stream is written as the first column.
+ * This only copies the record
+ */
+void dump_append(struct dump_sink* sink, uint32_t stream, const struct trace_record* record);
+
+#endif	/* MEM_DUMP_H */
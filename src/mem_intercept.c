@@ -13,11 +13,17 @@
 #include <errno.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/mman.h>
+#include <stdarg.h>
+#include <numa.h>
+#include <numaif.h>
 
 #include "numamma.h"
 #include "mem_intercept.h"
 #include "mem_analyzer.h"
 #include "mem_tools.h"
+#include "mem_side_table.h"
+#include "hash.h"
 
 struct numamma_settings settings;
 static char dump_filename[STRING_LEN];
@@ -40,20 +46,26 @@ int  (*libpthread_create) (pthread_t * thread, const pthread_attr_t * attr,
 void (*libpthread_exit) (void *thread_return) = NULL;
 void* (*lib_Znwm)(size_t size) = NULL; /* the "new" operator in c++ 64bits  */
 void* (*lib_Znwj)(size_t size) = NULL; /* the "new" operator in c++ 32bits  */
+void* (*libmemalign)(size_t alignment, size_t size) = NULL;
+void* (*libmmap)(void *addr, size_t length, int prot, int flags, int fd, off_t offset) = NULL;
+int (*libmunmap)(void *addr, size_t length) = NULL;
+void* (*libmremap)(void *old_address, size_t old_size, size_t new_size, int flags, ...) = NULL;
+
+/* buffer used by hand_made_malloc */
+#define POOL_SIZE (1024 * 1024)
+static char hand_made_pool[POOL_SIZE] = {'\0'};
+
+#define IS_HAND_MADE(ptr) ((char*)(ptr) >= hand_made_pool && (char*)(ptr) < hand_made_pool + POOL_SIZE)
 
 /* Custom malloc function. It is used when libmalloc=NULL (e.g. during startup)
  * This function is not thread-safe and is very likely to be bogus, so use with
  * caution
  */
 static void* hand_made_malloc(size_t size) {
-  /* allocate a 1MB buffer */
-#define POOL_SIZE (1024 * 1024)
-  static char mem[POOL_SIZE] = {'\0'};
-
   /* since this function is only used before we found libmalloc, there's no
    * fancy memory management mechanism (block reuse, etc.)
    */
-  static char* next_slot = &mem[0];
+  static char* next_slot = &hand_made_pool[0];
   static int total_alloc = 0;
 
   if (libmalloc)
@@ -71,6 +83,90 @@ static void* hand_made_malloc(size_t size) {
 }
 
 
+/* set to 1 if the block infos are stored in a side table instead of a
+ * header. Since the first allocations happen before read_settings is called,
+ * the environment variable is read at the first allocation.
+ */
+static int side_table_mode = -1;
+
+static inline int __side_table_enabled() {
+  if(__builtin_expect(side_table_mode < 0, 0)) {
+    char* str = getenv("NUMAMMA_SIDE_TABLE");
+    side_table_mode = (str && atoi(str)) ? 1 : 0;
+  }
+  return side_table_mode;
+}
+
+/* The recording functions below are called by the interposed functions.
+ * ma_record_malloc expects the application to be 3 frames above it, so these
+ * functions must always be inlined
+ */
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+
+/* record a buffer that has a header (or flag it if it should not be recorded) */
+static ALWAYS_INLINE void __record_header_block(struct mem_block_info *p_block,
+						 enum __memory_type mem_type) {
+  if(__memory_initialized && IS_RECURSE_SAFE) {
+    unsigned weight = ma_alloc_sampling_weight(p_block->u_ptr, p_block->size);
+    if(weight) {
+      PROTECT_FROM_RECURSION;
+      p_block->mem_type = mem_type;
+      /* let the analysis module record information on the malloc */
+      ma_record_malloc(p_block, weight);
+      UNPROTECT_FROM_RECURSION;
+    } else {
+      /* allocation sampling decided not to record this buffer */
+      p_block->mem_type = MEM_TYPE_UNTRACKED_MALLOC;
+    }
+  } else {
+    /* we are already processing a malloc/free function, so don't try to record information,
+     * just call the function
+     */
+    p_block->mem_type = MEM_TYPE_INTERNAL_MALLOC;
+  }
+}
+
+/* register p_block in the side table. If the table still held a buffer at
+ * the same address, this buffer was freed without us noticing: record its
+ * deallocation so that the object does not stay alive forever
+ */
+static void __side_table_insert(struct mem_block_info *p_block) {
+  struct mem_block_info *stale = side_table_insert(p_block);
+  if(!stale)
+    return;
+  if(__memory_initialized) {
+    PROTECT_FROM_RECURSION;
+    ma_record_free(stale);
+    UNPROTECT_FROM_RECURSION;
+  }
+  side_table_free_block(stale);
+}
+
+/* record a buffer allocated in side table mode */
+static ALWAYS_INLINE void __side_table_record(void* ptr, size_t size, enum __memory_type mem_type) {
+  if(!ptr || !__memory_initialized || !IS_RECURSE_SAFE)
+    return;
+  unsigned weight = ma_alloc_sampling_weight(ptr, size);
+  if(!weight)
+    return;
+
+  PROTECT_FROM_RECURSION;
+  struct mem_block_info *p_block = side_table_new_block(ptr, size);
+  p_block->mem_type = mem_type;
+  __side_table_insert(p_block);
+  ma_record_malloc(p_block, weight);
+  UNPROTECT_FROM_RECURSION;
+}
+
+/* allocate a buffer in side table mode: the application gets the address returned by the libc */
+static ALWAYS_INLINE void* __side_table_malloc(void* (*callback)(size_t), size_t size, enum __memory_type mem_type) {
+  PROTECT_FROM_RECURSION;
+  void* ptr = callback(size);
+  UNPROTECT_FROM_RECURSION;
+  __side_table_record(ptr, size, mem_type);
+  return ptr;
+}
+
 #define STRINGIFY(x) #x
 #define GENERIC_MALLOC(FNAME, MALLOC_TYPE, CALLBACK)			\
   void* FNAME(size_t size) {						\
@@ -103,35 +199,112 @@ static void* hand_made_malloc(size_t size) {
       UNPROTECT_FROM_RECURSION;						\
     }									\
 									\
+    if(__side_table_enabled())						\
+      return __side_table_malloc(CALLBACK, size, MALLOC_TYPE);		\
+									\
     /* allocate a buffer */						\
     PROTECT_FROM_RECURSION;						\
     void* pptr = CALLBACK(size + HEADER_SIZE + TAIL_SIZE);		\
     UNPROTECT_FROM_RECURSION;						\
+    if(!pptr)								\
+      return NULL;							\
     /* fill the information on the malloc'd buffer */			\
     struct mem_block_info *p_block = NULL;				\
     INIT_MEM_INFO(p_block, pptr, size, 1);				\
-									\
-    if(__memory_initialized && IS_RECURSE_SAFE) {			\
-      PROTECT_FROM_RECURSION;						\
-									\
-      p_block->mem_type = MALLOC_TYPE;					\
-									\
-      /* let the analysis module record information on the malloc */	\
-      ma_record_malloc(p_block);					\
-									\
-      UNPROTECT_FROM_RECURSION;						\
-    } else {								\
-      /* we are already processing a malloc/free function, so don't try to record information, \
-       * just call the function						\
-       */								\
-      p_block->mem_type = MEM_TYPE_INTERNAL_MALLOC;			\
-    }									\
-    return p_block->u_ptr;		\
+    __record_header_block(p_block, MALLOC_TYPE);			\
+    return p_block->u_ptr;						\
   }									\
 
 GENERIC_MALLOC(malloc, MEM_TYPE_MALLOC, libmalloc);
 GENERIC_MALLOC(_Znwj, MEM_TYPE_NEW, libmalloc);
 GENERIC_MALLOC(_Znwm, MEM_TYPE_NEW, libmalloc);
+GENERIC_MALLOC(_Znaj, MEM_TYPE_NEW, libmalloc); /* new[] */
+GENERIC_MALLOC(_Znam, MEM_TYPE_NEW, libmalloc);
+/* the nothrow variants take an additional std::nothrow_t parameter that is
+ * simply ignored
+ */
+GENERIC_MALLOC(_ZnwmRKSt9nothrow_t, MEM_TYPE_NEW, libmalloc);
+GENERIC_MALLOC(_ZnamRKSt9nothrow_t, MEM_TYPE_NEW, libmalloc);
+
+/* allocate a buffer whose address is a multiple of alignment */
+static ALWAYS_INLINE void* __aligned_malloc(size_t alignment, size_t size,
+					    enum __memory_type mem_type) {
+  if(!libmemalign) {
+    PROTECT_FROM_RECURSION;
+    libmemalign = dlsym(RTLD_NEXT, "memalign");
+    UNPROTECT_FROM_RECURSION;
+  }
+  if(alignment < sizeof(void*))
+    alignment = sizeof(void*);
+  /* like the libc memalign, round the alignment up to a power of 2, so
+   * that the padded header keeps the user buffer aligned
+   */
+  while(alignment & (alignment - 1))
+    alignment = (alignment | (alignment - 1)) + 1;
+
+  if(__side_table_enabled()) {
+    PROTECT_FROM_RECURSION;
+    void* ptr = libmemalign(alignment, size);
+    UNPROTECT_FROM_RECURSION;
+    __side_table_record(ptr, size, mem_type);
+    return ptr;
+  }
+
+  /* the header is padded so that the user buffer stays aligned */
+  size_t header_size = (HEADER_SIZE + alignment - 1) & ~(alignment - 1);
+  PROTECT_FROM_RECURSION;
+  void* pptr = libmemalign(alignment, header_size + size + TAIL_SIZE);
+  UNPROTECT_FROM_RECURSION;
+  if(!pptr)
+    return NULL;
+
+  struct mem_block_info *p_block = NULL;
+  INIT_ALIGNED_MEM_INFO(p_block, pptr, size, header_size);
+  __record_header_block(p_block, mem_type);
+  return p_block->u_ptr;
+}
+
+void* memalign(size_t alignment, size_t size) {
+  return __aligned_malloc(alignment, size, MEM_TYPE_MALLOC);
+}
+
+void* aligned_alloc(size_t alignment, size_t size) {
+  if(alignment == 0 || (alignment & (alignment - 1)) != 0) {
+    errno = EINVAL;
+    return NULL;
+  }
+  return __aligned_malloc(alignment, size, MEM_TYPE_MALLOC);
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size) {
+  if(alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0)
+    return EINVAL;
+  void* ptr = __aligned_malloc(alignment, size, MEM_TYPE_MALLOC);
+  if(!ptr)
+    return ENOMEM;
+  *memptr = ptr;
+  return 0;
+}
+
+void* valloc(size_t size) {
+  return __aligned_malloc(getpagesize(), size, MEM_TYPE_MALLOC);
+}
+
+void* pvalloc(size_t size) {
+  size_t page_size = getpagesize();
+  return __aligned_malloc(page_size, (size + page_size - 1) & ~(page_size - 1), MEM_TYPE_MALLOC);
+}
+
+/* aligned new operators (C++17) */
+#define GENERIC_ALIGNED_NEW(FNAME)					\
+  void* FNAME(size_t size, size_t alignment) {				\
+    return __aligned_malloc(alignment, size, MEM_TYPE_NEW);		\
+  }
+
+GENERIC_ALIGNED_NEW(_ZnwmSt11align_val_t);
+GENERIC_ALIGNED_NEW(_ZnamSt11align_val_t);
+GENERIC_ALIGNED_NEW(_ZnwmSt11align_val_tRKSt9nothrow_t);
+GENERIC_ALIGNED_NEW(_ZnamSt11align_val_tRKSt9nothrow_t);
 
 void* realloc(void *ptr, size_t size) {
 
@@ -156,6 +329,33 @@ void* realloc(void *ptr, size_t size) {
     }
   }
 
+  if(__side_table_enabled() && !IS_HAND_MADE(ptr)) {
+    struct mem_block_info *p_block = side_table_remove(ptr);
+    PROTECT_FROM_RECURSION;
+    void *new_ptr = librealloc(ptr, size);
+    UNPROTECT_FROM_RECURSION;
+    if(!p_block)
+      /* this buffer was not recorded */
+      return new_ptr;
+    if(!new_ptr) {
+      /* realloc failed, ptr is still valid */
+      __side_table_insert(p_block);
+      return NULL;
+    }
+
+    p_block->u_ptr = new_ptr;
+    p_block->p_ptr = new_ptr;
+    p_block->size = size;
+    p_block->total_size = size;
+    __side_table_insert(p_block);
+    if(__memory_initialized && IS_RECURSE_SAFE) {
+      PROTECT_FROM_RECURSION;
+      ma_update_buffer_address(p_block, ptr, new_ptr);
+      UNPROTECT_FROM_RECURSION;
+    }
+    return new_ptr;
+  }
+
   if (!CANARY_OK(ptr)) {
     /* we didn't malloc'ed this buffer */
     fprintf(stderr,"%s(%p). I can't find this pointer !\n", __FUNCTION__, ptr);
@@ -179,21 +379,53 @@ void* realloc(void *ptr, size_t size) {
     memcpy(pptr, p_block->u_ptr, p_block->size);
     return pptr;
   }
-  void *old_addr= p_block->u_ptr;
-  void *pptr = librealloc(p_block->p_ptr, size + header_size);
-  INIT_MEM_INFO(p_block, pptr, size, 1);
 
-  if(__memory_initialized && IS_RECURSE_SAFE) {
+  void *old_addr= p_block->u_ptr;
+  enum __memory_type old_type = p_block->mem_type;
+  void *record_info = p_block->record_info;
+  if((uintptr_t)p_block->u_ptr - (uintptr_t)p_block->p_ptr != HEADER_SIZE) {
+    /* the header was padded (calloc or aligned allocation), so the libc
+     * realloc would not keep the user data at the same offset: move the
+     * data to a buffer with a regular header. Like the other paths, the
+     * object keeps its allocation site
+     */
+    void *old_pptr = p_block->p_ptr;
     PROTECT_FROM_RECURSION;
-    /* retrieve the malloc information from the pointer */
-
+    if(!libmalloc)
+      libmalloc = dlsym(RTLD_NEXT, "malloc");
+    void *pptr = libmalloc(size + HEADER_SIZE + TAIL_SIZE);
+    UNPROTECT_FROM_RECURSION;
+    if (!pptr)
+      return NULL;
+    INIT_MEM_INFO(p_block, pptr, size, 1);
+    memcpy(p_block->u_ptr, old_addr, old_size < size ? old_size : size);
+    PROTECT_FROM_RECURSION;
+    if(!libfree)
+      libfree = dlsym(RTLD_NEXT, "free");
+    libfree(old_pptr);
+    UNPROTECT_FROM_RECURSION;
+  } else {
+    void *pptr = librealloc(p_block->p_ptr, size + header_size);
     if (!pptr) {
-      /* realloc failed */
-      UNPROTECT_FROM_RECURSION;
+      /* realloc failed, the buffer is unchanged */
       return NULL;
     }
+    INIT_MEM_INFO(p_block, pptr, size, 1);
+  }
+  /* the new header still describes the same object */
+  p_block->record_info = record_info;
+
+  if(old_type == MEM_TYPE_UNTRACKED_MALLOC) {
+    /* the buffer was not recorded, there is nothing to update */
+    p_block->mem_type = MEM_TYPE_UNTRACKED_MALLOC;
+    return p_block->u_ptr;
+  }
+
+  if(__memory_initialized && IS_RECURSE_SAFE) {
+    PROTECT_FROM_RECURSION;
+    /* retrieve the malloc information from the pointer */
 
-    p_block->mem_type = MEM_TYPE_MALLOC;
+    p_block->mem_type = (old_type == MEM_TYPE_NEW) ? MEM_TYPE_NEW : MEM_TYPE_MALLOC;
     void *new_addr= p_block->u_ptr;
     ma_update_buffer_address(p_block, old_addr, new_addr);
     UNPROTECT_FROM_RECURSION;
@@ -213,6 +445,14 @@ void* calloc(size_t nmemb, size_t size) {
     return ret;
   }
 
+  if(__side_table_enabled()) {
+    PROTECT_FROM_RECURSION;
+    void* ptr = libcalloc(nmemb, size);
+    UNPROTECT_FROM_RECURSION;
+    __side_table_record(ptr, nmemb * size, MEM_TYPE_MALLOC);
+    return ptr;
+  }
+
   /* compute the number of blocks for header */
   int nb_memb_header = (HEADER_SIZE)/ size;
   if (size * nb_memb_header < HEADER_SIZE)
@@ -227,19 +467,12 @@ void* calloc(size_t nmemb, size_t size) {
   void* p_ptr = libcalloc(nmemb + nb_memb_header + nb_memb_tail, size);
   UNPROTECT_FROM_RECURSION;
   
+  if(!p_ptr)
+    return NULL;
+
   struct mem_block_info *p_block = NULL;
   INIT_MEM_INFO(p_block, p_ptr, nmemb, size);
-
-  if(__memory_initialized && IS_RECURSE_SAFE) {
-    PROTECT_FROM_RECURSION;
-    p_block->mem_type = MEM_TYPE_MALLOC;
-
-    ma_record_malloc(p_block);
-    UNPROTECT_FROM_RECURSION;
-  } else {
-    p_block->mem_type = MEM_TYPE_INTERNAL_MALLOC;
-  }
-
+  __record_header_block(p_block, MEM_TYPE_MALLOC);
   return p_block->u_ptr;
 }
 
@@ -262,6 +495,22 @@ void free(void* ptr) {
     return;
   }
 
+  if(__side_table_enabled() && !IS_HAND_MADE(ptr)) {
+    struct mem_block_info *p_block = side_table_remove(ptr);
+    if(p_block) {
+      if(__memory_initialized && IS_RECURSE_SAFE) {
+	PROTECT_FROM_RECURSION;
+	ma_record_free(p_block);
+	UNPROTECT_FROM_RECURSION;
+      }
+      side_table_free_block(p_block);
+    }
+    PROTECT_FROM_RECURSION;
+    libfree(ptr);
+    UNPROTECT_FROM_RECURSION;
+    return;
+  }
+
   /* first, check wether we malloc'ed the buffer */
   if (!CANARY_OK(ptr)) {
     /* we didn't malloc this buffer */
@@ -298,13 +547,354 @@ void free(void* ptr) {
   }
 }
 
+/* the delete operators (including the sized and aligned C++14/17 variants)
+ * release buffers allocated by the new operators
+ */
+#define GENERIC_DELETE(FNAME)			\
+  void FNAME(void* ptr) {			\
+    free(ptr);					\
+  }
+#define GENERIC_DELETE_ARG(FNAME, ARG_TYPE)	\
+  void FNAME(void* ptr, ARG_TYPE arg) {		\
+    free(ptr);					\
+  }
+#define GENERIC_DELETE_ARGS(FNAME)				\
+  void FNAME(void* ptr, size_t size, size_t alignment) {	\
+    free(ptr);							\
+  }
+
+GENERIC_DELETE(_ZdlPv);
+GENERIC_DELETE(_ZdaPv);
+GENERIC_DELETE_ARG(_ZdlPvm, size_t);
+GENERIC_DELETE_ARG(_ZdaPvm, size_t);
+GENERIC_DELETE_ARG(_ZdlPvSt11align_val_t, size_t);
+GENERIC_DELETE_ARG(_ZdaPvSt11align_val_t, size_t);
+GENERIC_DELETE_ARGS(_ZdlPvmSt11align_val_t);
+GENERIC_DELETE_ARGS(_ZdaPvmSt11align_val_t);
+
+/* Anonymous memory mappings are recorded like malloc'd buffers. Since they
+ * can't have a header, their mem_block_info is stored in mmap_regions
+ * (indexed by the start address of the mapping)
+ */
+static struct ht_node* mmap_regions = NULL;
+static pthread_mutex_t mmap_regions_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline uintptr_t __page_round_up(uintptr_t addr) {
+  uintptr_t page_size = getpagesize();
+  return (addr + page_size - 1) & ~(page_size - 1);
+}
+
+static void __mmap_init() {
+  PROTECT_FROM_RECURSION;
+  if(!libmmap)
+    libmmap = dlsym(RTLD_NEXT, "mmap");
+  if(!libmunmap)
+    libmunmap = dlsym(RTLD_NEXT, "munmap");
+  if(!libmremap)
+    libmremap = dlsym(RTLD_NEXT, "mremap");
+  UNPROTECT_FROM_RECURSION;
+}
+
+static ALWAYS_INLINE void __mmap_record(void* addr, size_t length) {
+  if(addr == MAP_FAILED || !__memory_initialized || !IS_RECURSE_SAFE)
+    return;
+  unsigned weight = ma_alloc_sampling_weight(addr, length);
+  if(!weight)
+    return;
+
+  PROTECT_FROM_RECURSION;
+  struct mem_block_info *p_block = side_table_new_block(addr, length);
+  p_block->mem_type = MEM_TYPE_MMAP;
+  /* the object is published and inserted in mmap_regions under the same
+   * lock, so that a concurrent munmap of the range finds it
+   */
+  pthread_mutex_lock(&mmap_regions_lock);
+  ma_record_malloc(p_block, weight);
+  mmap_regions = ht_insert(mmap_regions, (uint64_t) addr, p_block);
+  pthread_mutex_unlock(&mmap_regions_lock);
+  UNPROTECT_FROM_RECURSION;
+}
+
+/* return the piece [start, end[ of the mapping orig as a new mapping */
+static struct mem_block_info* __mmap_split(struct mem_block_info* orig,
+					   uintptr_t start, uintptr_t end) {
+  struct mem_block_info *piece = side_table_new_block((void*) start, end - start);
+  piece->mem_type = MEM_TYPE_MMAP;
+  if(__memory_initialized)
+    ma_record_split(orig, piece);
+  mmap_regions = ht_insert(mmap_regions, (uint64_t) start, piece);
+  return piece;
+}
+
+/* stop tracking the range [addr, addr+length[. The parts of the overlapping
+ * mappings that remain mapped are recorded as new objects.
+ * Return the number of mappings that overlapped the range
+ */
+static int __mmap_unmap_range(void* addr, size_t length) {
+  uintptr_t start = (uintptr_t) addr;
+  uintptr_t end = __page_round_up(start + length);
+  int nb_regions = 0;
+  if(!__memory_initialized || !mmap_regions || end <= start)
+    return 0;
+
+  PROTECT_FROM_RECURSION;
+  pthread_mutex_lock(&mmap_regions_lock);
+  for(;;) {
+    /* mappings don't overlap, so if the last mapping that starts before the
+     * end of the range doesn't overlap it, no other mapping does
+     */
+    struct ht_node* node = ht_lower_key(mmap_regions, end - 1);
+    if(!node)
+      break;
+    struct mem_block_info* region = node->entries->value;
+    uintptr_t region_start = (uintptr_t) region->u_ptr;
+    uintptr_t region_end = __page_round_up(region_start + region->size);
+    if(region_end <= start)
+      break;
+
+    mmap_regions = ht_remove_key_value(mmap_regions, region_start, region);
+    if(region_start < start)
+      __mmap_split(region, region_start, start);
+    if(region_end > end)
+      __mmap_split(region, end, region_end);
+
+    if(__memory_initialized)
+      ma_record_free(region);
+    side_table_free_block(region);
+    nb_regions++;
+  }
+  pthread_mutex_unlock(&mmap_regions_lock);
+  UNPROTECT_FROM_RECURSION;
+  return nb_regions;
+}
+
+static ALWAYS_INLINE void* __mmap_generic(void *addr, size_t length, int prot,
+					  int flags, int fd, off_t offset) {
+  if(!libmmap)
+    __mmap_init();
+  if(!IS_RECURSE_SAFE)
+    return libmmap(addr, length, prot, flags, fd, offset);
+
+  if(flags & MAP_FIXED)
+    /* the new mapping replaces the previous ones */
+    __mmap_unmap_range(addr, length);
+
+  PROTECT_FROM_RECURSION;
+  void* retval = libmmap(addr, length, prot, flags, fd, offset);
+  UNPROTECT_FROM_RECURSION;
+
+  if(flags & MAP_ANONYMOUS)
+    __mmap_record(retval, length);
+  return retval;
+}
+
+void* mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset) {
+  return __mmap_generic(addr, length, prot, flags, fd, offset);
+}
+
+void* mmap64(void *addr, size_t length, int prot, int flags, int fd, off64_t offset) {
+  return __mmap_generic(addr, length, prot, flags, fd, offset);
+}
+
+int munmap(void *addr, size_t length) {
+  if(!libmunmap)
+    __mmap_init();
+  if(IS_RECURSE_SAFE)
+    __mmap_unmap_range(addr, length);
+
+  PROTECT_FROM_RECURSION;
+  int retval = libmunmap(addr, length);
+  UNPROTECT_FROM_RECURSION;
+  return retval;
+}
+
+void* mremap(void *old_address, size_t old_size, size_t new_size, int flags, ...) {
+  void* new_address = NULL;
+  if(flags & MREMAP_FIXED) {
+    va_list ap;
+    va_start(ap, flags);
+    new_address = va_arg(ap, void*);
+    va_end(ap);
+  }
+
+  if(!libmremap)
+    __mmap_init();
+  if(!__memory_initialized || !IS_RECURSE_SAFE)
+    return libmremap(old_address, old_size, new_size, flags, new_address);
+
+  if(flags & MREMAP_FIXED)
+    __mmap_unmap_range(new_address, new_size);
+
+  PROTECT_FROM_RECURSION;
+  void* retval = libmremap(old_address, old_size, new_size, flags, new_address);
+  UNPROTECT_FROM_RECURSION;
+  if(retval == MAP_FAILED)
+    return retval;
+
+  /* if the whole mapping was remapped, it is the same object */
+  struct mem_block_info* region = NULL;
+  PROTECT_FROM_RECURSION;
+  pthread_mutex_lock(&mmap_regions_lock);
+  struct ht_node* node = ht_lower_key(mmap_regions, (uint64_t) old_address);
+  if(node && node->key == (uint64_t) old_address) {
+    region = node->entries->value;
+    if(__page_round_up((uintptr_t) old_address + region->size) ==
+       __page_round_up((uintptr_t) old_address + old_size)) {
+      mmap_regions = ht_remove_key_value(mmap_regions, node->key, region);
+      region->u_ptr = retval;
+      region->p_ptr = retval;
+      region->size = new_size;
+      region->total_size = new_size;
+      mmap_regions = ht_insert(mmap_regions, (uint64_t) retval, region);
+    } else {
+      region = NULL;
+    }
+  }
+  pthread_mutex_unlock(&mmap_regions_lock);
+
+  if(region) {
+    if(__memory_initialized)
+      ma_update_buffer_address(region, old_address, retval);
+    UNPROTECT_FROM_RECURSION;
+    return retval;
+  }
+  UNPROTECT_FROM_RECURSION;
+
+  /* a part of a mapping was remapped: it becomes a new object */
+  if(__mmap_unmap_range(old_address, old_size))
+    __mmap_record(retval, new_size);
+  return retval;
+}
+
+/* NUMA placement requested by the application. The libnuma functions are
+ * looked up when they are first called (numamma does not depend on libnuma)
+ */
+#define NUMA_FUNCTION(fname) ({						\
+      static void* __fn = NULL;						\
+      if(!__fn) {							\
+	PROTECT_FROM_RECURSION;						\
+	__fn = dlsym(RTLD_NEXT, #fname);				\
+	UNPROTECT_FROM_RECURSION;					\
+      }									\
+      (__typeof__(&fname)) __fn;					\
+    })
+
+/* strip the mode flags (MPOL_F_STATIC_NODES, etc.) from a NUMA policy */
+#define NUMA_MODE(mode) ((mode) & 0xff)
+
+/* convert a node mask to a 64-bit mask (the nodes beyond 64 are ignored) */
+static uint64_t __nodemask_to_u64(const unsigned long *nodemask, unsigned long maxnode) {
+  if(!nodemask || !maxnode)
+    return 0;
+  uint64_t mask = nodemask[0];
+  if(maxnode < 64)
+    mask &= (1ULL << maxnode) - 1;
+  return mask;
+}
+
+static void __record_numa_policy(void* addr, size_t len, int policy, uint64_t nodemask) {
+  if(!__memory_initialized || !IS_RECURSE_SAFE)
+    return;
+  PROTECT_FROM_RECURSION;
+  ma_record_numa_policy(addr, len, policy, nodemask);
+  UNPROTECT_FROM_RECURSION;
+}
+
+long mbind(void *start, unsigned long len, int mode,
+	   const unsigned long *nmask, unsigned long maxnode, unsigned flags) {
+  PROTECT_FROM_RECURSION;
+  long retval = NUMA_FUNCTION(mbind)(start, len, mode, nmask, maxnode, flags);
+  UNPROTECT_FROM_RECURSION;
+  if(retval == 0)
+    __record_numa_policy(start, len, NUMA_MODE(mode), __nodemask_to_u64(nmask, maxnode));
+  return retval;
+}
+
+long set_mempolicy(int mode, const unsigned long *nmask, unsigned long maxnode) {
+  PROTECT_FROM_RECURSION;
+  long retval = NUMA_FUNCTION(set_mempolicy)(mode, nmask, maxnode);
+  UNPROTECT_FROM_RECURSION;
+  if(retval == 0 && __memory_initialized && IS_RECURSE_SAFE) {
+    PROTECT_FROM_RECURSION;
+    ma_record_thread_numa_policy(NUMA_MODE(mode), __nodemask_to_u64(nmask, maxnode));
+    UNPROTECT_FROM_RECURSION;
+  }
+  return retval;
+}
+
+long move_pages(int pid, unsigned long count, void **pages,
+		const int *nodes, int *status, int flags) {
+  PROTECT_FROM_RECURSION;
+  long retval = NUMA_FUNCTION(move_pages)(pid, count, pages, nodes, status, flags);
+  UNPROTECT_FROM_RECURSION;
+  /* when nodes is NULL, move_pages only queries the location of the pages */
+  if(retval >= 0 && nodes && (pid == 0 || pid == getpid())) {
+    for(unsigned long i = 0; i < count; i++) {
+      if(nodes[i] >= 0 && nodes[i] < 64)
+	__record_numa_policy(pages[i], 1, NUMA_POLICY_MOVE_PAGES, 1ULL << nodes[i]);
+    }
+  }
+  return retval;
+}
+
+/* the numa_alloc_* functions allocate memory mappings */
+static ALWAYS_INLINE void __numa_alloc_record(void* ptr, size_t size,
+					      int policy, uint64_t nodemask) {
+  if(!ptr)
+    return;
+  __mmap_record(ptr, size);
+  if(policy != NUMA_POLICY_NONE)
+    __record_numa_policy(ptr, size, policy, nodemask);
+}
+
+void *numa_alloc_onnode(size_t size, int node) {
+  PROTECT_FROM_RECURSION;
+  void* retval = NUMA_FUNCTION(numa_alloc_onnode)(size, node);
+  UNPROTECT_FROM_RECURSION;
+  __numa_alloc_record(retval, size, MPOL_BIND, node < 64 ? 1ULL << node : 0);
+  return retval;
+}
+
+void *numa_alloc_interleaved(size_t size) {
+  PROTECT_FROM_RECURSION;
+  void* retval = NUMA_FUNCTION(numa_alloc_interleaved)(size);
+  UNPROTECT_FROM_RECURSION;
+  __numa_alloc_record(retval, size, MPOL_INTERLEAVE, UINT64_MAX);
+  return retval;
+}
+
+void *numa_alloc_interleaved_subset(size_t size, struct bitmask *nodemask) {
+  PROTECT_FROM_RECURSION;
+  void* retval = NUMA_FUNCTION(numa_alloc_interleaved_subset)(size, nodemask);
+  UNPROTECT_FROM_RECURSION;
+  __numa_alloc_record(retval, size, MPOL_INTERLEAVE,
+		      nodemask ? __nodemask_to_u64(nodemask->maskp, nodemask->size) : 0);
+  return retval;
+}
+
+void *numa_alloc_local(size_t size) {
+  PROTECT_FROM_RECURSION;
+  void* retval = NUMA_FUNCTION(numa_alloc_local)(size);
+  UNPROTECT_FROM_RECURSION;
+  __numa_alloc_record(retval, size, MPOL_LOCAL, 0);
+  return retval;
+}
+
+void *numa_alloc(size_t size) {
+  PROTECT_FROM_RECURSION;
+  void* retval = NUMA_FUNCTION(numa_alloc)(size);
+  UNPROTECT_FROM_RECURSION;
+  __numa_alloc_record(retval, size, NUMA_POLICY_NONE, 0);
+  return retval;
+}
+
 /* Internal structure used for transmitting the function and argument
  * during pthread_create.
  */
 struct __pthread_create_info_t {
   void *(*func)(void *);
   void *arg;
-  int thread_rank;
+  struct thread_info* info;
 };
 
 enum thread_status_t {
@@ -315,10 +905,33 @@ enum thread_status_t {
 
 struct thread_info {
   pthread_t tid;
-  enum thread_status_t status;
+  int id;			/* creation order, only used for display */
+  _Atomic enum thread_status_t status;
+  struct thread_info* next;
 };
-struct thread_info thread_array[MAX_THREADS];
-int nb_threads = 0;
+/* the threads created by the application (most recent first). The records
+ * are never removed from the list: the record of a thread that terminated
+ * is reused by the next pthread_create
+ */
+static struct thread_info* _Atomic thread_list = NULL;
+static _Atomic int nb_threads = 0;
+/* number of records of terminated threads that can be reused */
+static _Atomic int nb_finalized_threads = 0;
+
+/* find the record of a terminated thread and reserve it, or return NULL */
+static struct thread_info* __reuse_thread_info() {
+  if(atomic_load_explicit(&nb_finalized_threads, memory_order_relaxed) == 0)
+    return NULL;
+  struct thread_info* info;
+  for(info = atomic_load_explicit(&thread_list, memory_order_acquire); info; info = info->next) {
+    enum thread_status_t status = thread_status_finalized;
+    if(atomic_compare_exchange_strong(&info->status, &status, thread_status_none)) {
+      atomic_fetch_sub_explicit(&nb_finalized_threads, 1, memory_order_relaxed);
+      return info;
+    }
+  }
+  return NULL;
+}
 
 static void __thread_cleanup_function(void* arg);
 /* Invoked by pthread_create on the new thread */
@@ -329,23 +942,22 @@ __pthread_new_thread(void *arg) {
   struct __pthread_create_info_t *p_arg = (struct __pthread_create_info_t*) arg;
   void *(*f)(void *) = p_arg->func;
   void *__arg = p_arg->arg;
-  int thread_rank = p_arg->thread_rank;
+  struct thread_info* me = p_arg->info;
   libfree(p_arg);
   ma_thread_init();
-  thread_array[thread_rank].status = thread_status_created;
+  me->status = thread_status_created;
 
   UNPROTECT_FROM_RECURSION;
   int oldtype;
   pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, &oldtype);
 
-  pthread_cleanup_push(__thread_cleanup_function,
-		       &thread_array[thread_rank]);
+  pthread_cleanup_push(__thread_cleanup_function, me);
 
   res = (*f)(__arg);
 
   pthread_cleanup_pop(0);
-  fprintf(stderr, "End of thread [%d] %lu\n", thread_rank, thread_array[thread_rank].tid);
-  __thread_cleanup_function(&thread_array[thread_rank]);
+  fprintf(stderr, "End of thread [%d] %lu\n", me->id, me->tid);
+  __thread_cleanup_function(me);
   return res;
 }
 
@@ -353,8 +965,11 @@ __pthread_new_thread(void *arg) {
 static void __thread_cleanup_function(void* arg) {
   struct thread_info* me = arg;
   is_recurse_unsafe ++;
-  ma_thread_finalize();
+  /* the metadata of the analyzer is released when numamma terminates */
+  if(__memory_initialized)
+    ma_thread_finalize();
   me->status = thread_status_finalized;
+  atomic_fetch_add_explicit(&nb_finalized_threads, 1, memory_order_relaxed);
   is_recurse_unsafe --;
 }
 
@@ -373,23 +988,48 @@ pthread_create (pthread_t *__restrict thread,
     libpthread_create = dlsym(RTLD_NEXT, "pthread_create");
   }
 
-  int thread_rank = __sync_fetch_and_add( &nb_threads, 1 );
-  __args->thread_rank = thread_rank;
+  struct thread_info* info = __reuse_thread_info();
+  int new_info = (info == NULL);
+  if(new_info) {
+    info = libmalloc(sizeof(struct thread_info));
+    atomic_init(&info->status, thread_status_none);
+  }
+  info->id = atomic_fetch_add(&nb_threads, 1);
+  __args->info = info;
 
   /* We do not call directly start_routine since we want to initialize stuff at the thread startup.
    * Instead, let's invoke __pthread_new_thread that initialize the thread-specific things and call
    * start_routine.
    */
-  int retval = libpthread_create(&thread_array[thread_rank].tid, attr, __pthread_new_thread, __args);
-  memcpy(thread, &thread_array[thread_rank].tid, sizeof(pthread_t));
+  int retval = libpthread_create(&info->tid, attr, __pthread_new_thread, __args);
+  if(retval != 0) {
+    libfree(__args);
+    if(new_info) {
+      libfree(info);
+    } else {
+      /* the record is still in thread_list: give it back */
+      info->status = thread_status_finalized;
+      atomic_fetch_add_explicit(&nb_finalized_threads, 1, memory_order_relaxed);
+    }
+    return retval;
+  }
+  memcpy(thread, &info->tid, sizeof(pthread_t));
+  if(!new_info)
+    /* the record is already in thread_list */
+    return retval;
 
+  /* make the thread visible to wait_for_other_threads */
+  info->next = atomic_load_explicit(&thread_list, memory_order_relaxed);
+  while(!atomic_compare_exchange_weak_explicit(&thread_list, &info->next, info,
+					       memory_order_release, memory_order_relaxed))
+    ;
   return retval;
 }
 
 void pthread_exit(void *thread_return) {
   FUNCTION_ENTRY;
   PROTECT_FROM_RECURSION;
-  {
+  if(__memory_initialized) {
     ma_thread_finalize();
   }
   UNPROTECT_FROM_RECURSION;
@@ -442,6 +1082,63 @@ static void read_settings() {
   getenv_int(settings.dump, "NUMAMMA_DUMP", SETTINGS_DUMP_DEFAULT);
   getenv_int(settings.dump_unmatched, "NUMAMMA_DUMP_UNMATCHED", SETTINGS_DUMP_UNMATCHED_DEFAULT);
   getenv_int(settings.dump_single_items, "NUMAMMA_DUMP_SINGLE_ITEMS", SETTINGS_DUMP_SINGLE_ITEMS);
+  settings.dump_format = SETTINGS_DUMP_FORMAT_DEFAULT;
+  str = getenv("NUMAMMA_DUMP_FORMAT");
+  if(str) {
+    settings.dump_format = dump_format_from_string(str);
+    if(settings.dump_format < 0) {
+      fprintf(stderr, "Invalid NUMAMMA_DUMP_FORMAT value: %s\n", str);
+      abort();
+    }
+  }
+  getenv_int(settings.dump_direct_io, "NUMAMMA_DUMP_DIRECT_IO", SETTINGS_DUMP_DIRECT_IO_DEFAULT);
+
+  settings.callsite_key = SETTINGS_CALLSITE_KEY_DEFAULT;
+  str = getenv("NUMAMMA_CALLSITE_KEY");
+  if(str) {
+    settings.callsite_key = callsite_key_from_string(str);
+    if(settings.callsite_key < 0) {
+      fprintf(stderr, "Invalid NUMAMMA_CALLSITE_KEY value: %s\n", str);
+      abort();
+    }
+  }
+  getenv_int(settings.callsite_depth, "NUMAMMA_CALLSITE_DEPTH", SETTINGS_CALLSITE_DEPTH_DEFAULT);
+  if(settings.callsite_depth < 1)
+    settings.callsite_depth = 1;
+  getenv_int(settings.defer_symbols, "NUMAMMA_DEFER_SYMBOLS", SETTINGS_DEFER_SYMBOLS_DEFAULT);
+
+  settings.side_table = __side_table_enabled();
+  if(settings.side_table && settings.canary_check) {
+    fprintf(stderr, "Warning: canaries are not checked in side table mode\n");
+    settings.canary_check = 0;
+  }
+
+  getenv_int(settings.alloc_threshold, "NUMAMMA_ALLOC_THRESHOLD", SETTINGS_ALLOC_THRESHOLD_DEFAULT);
+  settings.alloc_sampling = SETTINGS_ALLOC_SAMPLING_DEFAULT;
+  str = getenv("NUMAMMA_ALLOC_SAMPLING");
+  if(str) {
+    settings.alloc_sampling = alloc_sampling_from_string(str);
+    if(settings.alloc_sampling < 0) {
+      fprintf(stderr, "Invalid NUMAMMA_ALLOC_SAMPLING value: %s\n", str);
+      abort();
+    }
+  }
+  getenv_int(settings.alloc_sampling_period, "NUMAMMA_ALLOC_SAMPLING_PERIOD", SETTINGS_ALLOC_SAMPLING_PERIOD_DEFAULT);
+  if(settings.alloc_sampling_period < 1)
+    settings.alloc_sampling_period = 1;
+
+  getenv_int(settings.snapshot_interval, "NUMAMMA_SNAPSHOT_INTERVAL", SETTINGS_SNAPSHOT_INTERVAL_DEFAULT);
+  getenv_int(settings.snapshot_signal, "NUMAMMA_SNAPSHOT_SIGNAL", SETTINGS_SNAPSHOT_SIGNAL_DEFAULT);
+  settings.snapshot_mode = SETTINGS_SNAPSHOT_MODE_DEFAULT;
+  str = getenv("NUMAMMA_SNAPSHOT_MODE");
+  if(str) {
+    settings.snapshot_mode = snapshot_mode_from_string(str);
+    if(settings.snapshot_mode < 0) {
+      fprintf(stderr, "Invalid NUMAMMA_SNAPSHOT_MODE value: %s\n", str);
+      abort();
+    }
+  }
+  getenv_int(settings.control_socket, "NUMAMMA_CONTROL_SOCKET", SETTINGS_CONTROL_SOCKET_DEFAULT);
 }
 
 static void print_settings() {
@@ -460,6 +1157,25 @@ static void print_settings() {
   printf("dump              : %s\n", settings.dump? "yes":"no");
   printf("dump_unmatched    : %s\n", settings.dump_unmatched? "yes":"no");
   printf("dump_single_items : %s\n", settings.dump_single_items? "yes":"no");
+  printf("dump_format       : %s\n", dump_format_names[settings.dump_format]);
+  printf("dump_direct_io    : %s\n", settings.dump_direct_io? "yes":"no");
+  printf("callsite_key      : %s\n", callsite_key_names[settings.callsite_key]);
+  if(settings.callsite_key == CALLSITE_KEY_TOP_FRAMES)
+    printf("callsite_depth    : %d\n", settings.callsite_depth);
+  printf("defer_symbols     : %s\n", settings.defer_symbols? "yes":"no");
+  printf("side_table        : %s\n", settings.side_table? "yes":"no");
+  printf("alloc_threshold   : %zu bytes\n", settings.alloc_threshold);
+  if(settings.alloc_threshold > 0) {
+    printf("alloc_sampling    : %s\n", alloc_sampling_names[settings.alloc_sampling]);
+    if(settings.alloc_sampling != ALLOC_SAMPLING_NONE)
+      printf("alloc_sampling_period : %zu\n", settings.alloc_sampling_period);
+  }
+  if(settings.snapshot_interval > 0)
+    printf("snapshot_interval : %d s\n", settings.snapshot_interval);
+  printf("snapshot_signal   : %s\n", settings.snapshot_signal? "yes":"no");
+  if(settings.snapshot_interval > 0 || settings.snapshot_signal)
+    printf("snapshot_mode     : %s\n", snapshot_mode_names[settings.snapshot_mode]);
+  printf("control_socket    : %s\n", settings.control_socket? "yes":"no");
   printf("-----------------------------------\n");
 }
 
@@ -543,12 +1259,12 @@ static void __memory_init(void) {
 }
 
 void wait_for_other_threads() {
-  int i;
-  for(i=0; i<nb_threads; i++) {
+  struct thread_info* info;
+  for(info = atomic_load_explicit(&thread_list, memory_order_acquire); info; info = info->next) {
     /* the thread is still running */
-    if(thread_array[i].status == thread_status_created) {
+    if(info->status == thread_status_created) {
       /* ask the thread to stop */
-      int retval = pthread_cancel(thread_array[i].tid);
+      int retval = pthread_cancel(info->tid);
       if(retval != 0) {
 	fprintf(stderr, "pthread_cancel failed (%s)\n", strerror(errno));
 	abort();
@@ -559,7 +1275,7 @@ void wait_for_other_threads() {
       /* we could use pthread_join, but join may fail if the thread is not joinable (OpenMP
        * thread for instance)
        */
-      while(thread_array[i].status == thread_status_created) {
+      while(info->status == thread_status_created) {
 	sched_yield();
       }
 
@@ -572,6 +1288,10 @@ static void __memory_conclude(void) {
 
   wait_for_other_threads();
   __memory_initialized = 0;
+  /* the nodes of mmap_regions are released with the analyzer metadata */
+  pthread_mutex_lock(&mmap_regions_lock);
+  mmap_regions = NULL;
+  pthread_mutex_unlock(&mmap_regions_lock);
 
   printf("\n\n");
   printf("-----------------------------------\n");
@@ -26,7 +26,9 @@ typedef uint64_t canary_t;
  * (if not aligned, some weird bugs may happen when using -O3)
  */
 enum __memory_type {
-  MEM_TYPE_MALLOC, MEM_TYPE_NEW, MEM_TYPE_HAND_MADE_MALLOC, MEM_TYPE_INTERNAL_MALLOC
+  MEM_TYPE_MALLOC, MEM_TYPE_NEW, MEM_TYPE_HAND_MADE_MALLOC, MEM_TYPE_INTERNAL_MALLOC,
+  MEM_TYPE_UNTRACKED_MALLOC,	/* allocated by the application, but not recorded (allocation sampling) */
+  MEM_TYPE_MMAP			/* anonymous memory mapping (never has a header) */
 };
 
 
@@ -94,6 +96,27 @@ struct mem_block_info {
     (p_ptr) = b_ptr->p_ptr;			\
   } while(0)
 
+/* fill a mem_info structure for a buffer whose header is padded to header_size bytes
+ * (eg. for aligned allocations)
+ * @param p_mem the mem_info* structure to fill
+ * @param ptr the address returned by memalign
+ * @param buffer_size the size of the user buffer
+ * @param header_size the size of the header (including padding)
+ */
+#define INIT_ALIGNED_MEM_INFO(p_mem, ptr, buffer_size, header_size)	\
+  do {									\
+    void* u_ptr = (ptr) + (header_size);				\
+    p_mem = u_ptr - sizeof(struct mem_block_info);			\
+    p_mem->p_ptr = ptr;							\
+    p_mem->total_size = (header_size) + (buffer_size) + TAIL_SIZE;	\
+    p_mem->size = buffer_size;						\
+    p_mem->tail_block = u_ptr + p_mem->size;				\
+    p_mem->tail_block->canary = CANARY_PATTERN;				\
+    p_mem->record_info = NULL;						\
+    p_mem->u_ptr = u_ptr;						\
+    p_mem->canary = CANARY_PATTERN;					\
+  } while(0)
+
 /* fill a mem_info structure
  * @param p_mem the mem_info* structure to fill
  * @param ptr the address returned by (m,c,re)alloc
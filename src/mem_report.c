@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <math.h>
+
+#include "mem_report.h"
+#include "numamma.h"
+
+/* maximum nesting of objects in a line */
+#define REPORT_MAX_DEPTH 8
+/* size of the stdio buffer of the report */
+#define REPORT_BUFFER_SIZE (1024*1024)
+
+/* the snapshot and control threads write reports while the application
+ * runs, so each thread has its own report
+ */
+static __thread FILE* report_file = NULL;
+static __thread char* report_buffer = NULL;
+static __thread int depth = 0;
+/* has_fields[i] is set if the object at depth i already has a field */
+static __thread int has_fields[REPORT_MAX_DEPTH];
+
+int report_open(const char* filename) {
+  report_file = fopen(filename, "w");
+  if(!report_file) {
+    fprintf(stderr, "failed to open %s for writing\n", filename);
+    return -1;
+  }
+  /* the report may have one line per call site and per object */
+  report_buffer = malloc(REPORT_BUFFER_SIZE);
+  if(report_buffer)
+    setvbuf(report_file, report_buffer, _IOFBF, REPORT_BUFFER_SIZE);
+  return 0;
+}
+
+int report_open_fd(int fd) {
+  report_file = fdopen(fd, "w");
+  if(!report_file) {
+    fprintf(stderr, "failed to open file descriptor %d for writing\n", fd);
+    return -1;
+  }
+  return 0;
+}
+
+void report_close(void) {
+  if(!report_file)
+    return;
+  fclose(report_file);
+  report_file = NULL;
+  free(report_buffer);
+  report_buffer = NULL;
+}
+
+/* write the separator and the key of a new field */
+static void __key(const char* key) {
+  if(has_fields[depth])
+    fputc(',', report_file);
+  has_fields[depth] = 1;
+  fprintf(report_file, "\"%s\":", key);
+}
+
+static void __escape(const char* str) {
+  fputc('"', report_file);
+  report_escape(report_file, str);
+  fputc('"', report_file);
+}
+
+void report_begin(const char* type) {
+  if(!report_file)
+    return;
+  depth = 0;
+  has_fields[0] = 0;
+  fputc('{', report_file);
+  report_string("type", type);
+}
+
+void report_end(void) {
+  if(!report_file)
+    return;
+  while(depth > 0)
+    report_object_end();
+  fputs("}\n", report_file);
+}
+
+void report_object_begin(const char* key) {
+  if(!report_file)
+    return;
+  __key(key);
+  fputc('{', report_file);
+  if(depth + 1 < REPORT_MAX_DEPTH)
+    depth++;
+  has_fields[depth] = 0;
+}
+
+void report_object_end(void) {
+  if(!report_file || depth == 0)
+    return;
+  fputc('}', report_file);
+  depth--;
+}
+
+void report_u64(const char* key, uint64_t value) {
+  if(!report_file)
+    return;
+  __key(key);
+  fprintf(report_file, "%" PRIu64, value);
+}
+
+void report_int(const char* key, int64_t value) {
+  if(!report_file)
+    return;
+  __key(key);
+  fprintf(report_file, "%" PRId64, value);
+}
+
+void report_double(const char* key, double value) {
+  if(!report_file)
+    return;
+  __key(key);
+  /* JSON has no representation for nan or inf */
+  if(isfinite(value))
+    fprintf(report_file, "%.17g", value);
+  else
+    fputs("null", report_file);
+}
+
+void report_bool(const char* key, int value) {
+  if(!report_file)
+    return;
+  __key(key);
+  fputs(value ? "true" : "false", report_file);
+}
+
+void report_string(const char* key, const char* value) {
+  if(!report_file)
+    return;
+  __key(key);
+  if(value)
+    __escape(value);
+  else
+    fputs("null", report_file);
+}
+
+void report_hex(const char* key, uint64_t value) {
+  char str[32];
+  snprintf(str, sizeof(str), "0x%" PRIx64, value);
+  report_string(key, str);
+}
+
+void report_settings(void) {
+  report_begin("settings");
+  report_int("verbose", settings.verbose);
+  report_int("sampling_rate", settings.sampling_rate);
+  report_int("alarm", settings.alarm);
+  report_bool("flush", settings.flush);
+  report_u64("buffer_size", settings.buffer_size);
+  report_int("canary_check", settings.canary_check);
+  report_string("output_dir", settings.output_dir);
+  report_bool("match_samples", settings.match_samples);
+  report_bool("online_analysis", settings.online_analysis);
+  report_bool("dump_all", settings.dump_all);
+  report_bool("dump", settings.dump);
+  report_bool("dump_unmatched", settings.dump_unmatched);
+  report_bool("dump_single_items", settings.dump_single_items);
+  report_string("dump_format", dump_format_names[settings.dump_format]);
+  report_bool("dump_direct_io", settings.dump_direct_io);
+  report_string("callsite_key", callsite_key_names[settings.callsite_key]);
+  report_int("callsite_depth", settings.callsite_depth);
+  report_bool("defer_symbols", settings.defer_symbols);
+  report_bool("side_table", settings.side_table);
+  report_u64("alloc_threshold", settings.alloc_threshold);
+  report_string("alloc_sampling", alloc_sampling_names[settings.alloc_sampling]);
+  report_u64("alloc_sampling_period", settings.alloc_sampling_period);
+  report_int("snapshot_interval", settings.snapshot_interval);
+  report_bool("snapshot_signal", settings.snapshot_signal);
+  report_string("snapshot_mode", snapshot_mode_names[settings.snapshot_mode]);
+  report_bool("control_socket", settings.control_socket);
+  report_end();
+}
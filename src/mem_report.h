@@ -0,0 +1,72 @@
+#ifndef MEM_REPORT_H
+#define MEM_REPORT_H
+
+/* Machine-readable report (report.jsonl in the output directory).
+ *
+ * The report is a JSON Lines file: each line is a JSON object whose "type"
+ * field tells what it describes ("settings", "threads", "samples", "ticks",
+ * "counters", "call_site", "object"). The lines are written as the
+ * analysis proceeds, so the report does not have to be built in memory.
+ *
+ * Each thread writes its own report.
+ *
+ * A line is written with:
+ *   report_begin("call_site");
+ *   report_u64("id", 12);
+ *   report_object_begin("read");
+ *   ...
+ *   report_object_end();
+ *   report_end();
+ */
+#include <stdio.h>
+#include <stdint.h>
+
+/* create the report. Return -1 if it cannot be created (the other
+ * functions then do nothing)
+ */
+int report_open(const char* filename);
+/* write the report to an open file descriptor (eg. a socket). fd is
+ * closed by report_close
+ */
+int report_open_fd(int fd);
+void report_close(void);
+
+/* start/terminate a line */
+void report_begin(const char* type);
+void report_end(void);
+
+/* start/terminate a nested object */
+void report_object_begin(const char* key);
+void report_object_end(void);
+
+void report_u64(const char* key, uint64_t value);
+void report_int(const char* key, int64_t value);
+void report_double(const char* key, double value);
+void report_bool(const char* key, int value);
+/* value is escaped. A NULL value is written as null */
+void report_string(const char* key, const char* value);
+void report_hex(const char* key, uint64_t value);
+
+/* write the settings line */
+void report_settings(void);
+
+/* write str in f, escaped so that it can be part of a JSON string (the
+ * quotes are not written)
+ */
+static inline void report_escape(FILE* f, const char* str) {
+  for(const unsigned char* c = (const unsigned char*)str; *c; c++) {
+    switch(*c) {
+    case '"':  fputs("\\\"", f); break;
+    case '\\': fputs("\\\\", f); break;
+    case '\n': fputs("\\n", f); break;
+    case '\t': fputs("\\t", f); break;
+    default:
+      if(*c < 0x20)
+	fprintf(f, "\\u%04x", *c);
+      else
+	fputc(*c, f);
+    }
+  }
+}
+
+#endif	/* MEM_REPORT_H */
@@ -15,6 +15,7 @@
 #include <sys/time.h>
 #include <pthread.h>
 #include <errno.h>
+#include <stdatomic.h>
 #include <numaif.h>
 #include <numa.h>
 #include <sys/types.h>
@@ -65,11 +66,21 @@ struct mbind_directive {
   size_t buffer_len;
   size_t nb_blocks;
   void* base_addr;
-  enum {type_global, type_malloc} buffer_type;
+  enum {type_global, type_malloc, type_malloc_key} buffer_type;
+  uint64_t key;			/* for type_malloc_key: key of the allocation site */
+  unsigned ordinal;		/* for type_malloc_key: allocation to bind (0 means all of them) */
   struct block_bind *blocks;
   struct mbind_directive *next;
 };
 struct mbind_directive *directives = NULL;;
+
+/* number of allocations of each allocation site that has a type_malloc_key directive */
+struct key_counter {
+  uint64_t key;
+  _Atomic unsigned nb_allocs;
+  struct key_counter *next;
+};
+struct key_counter *key_counters = NULL;
   
 struct block_bind {
   int start_page;
@@ -91,7 +102,8 @@ int  (*libpthread_create) (pthread_t * thread, const pthread_attr_t * attr,
 void (*libpthread_exit) (void *thread_return) = NULL;
 
 static void bind_buffer(void* buffer, size_t len, char* buffer_id);
-static void bind_malloced_buffer(void* buffer, size_t len, char* buffer_id);
+static struct mbind_directive* bind_malloced_buffer(void* buffer, size_t len);
+static void rebind_malloced_buffer(struct mbind_directive* dir, void* buffer, size_t len);
 
 /* Custom malloc function. It is used when libmalloc=NULL (e.g. during startup)
  * This function is not thread-safe and is very likely to be bogus, so use with
@@ -180,8 +192,7 @@ void* malloc(size_t size) {
   if(__memory_initialized && IS_RECURSE_SAFE) {
     PROTECT_FROM_RECURSION;
     p_block->mem_type = MEM_TYPE_MALLOC;
-    /* TODO: use the callsite to generate a buffer_id */
-    bind_malloced_buffer(p_block->u_ptr, size, NULL);
+    p_block->record_info = bind_malloced_buffer(p_block->u_ptr, size);
     UNPROTECT_FROM_RECURSION;
     //    return p_block->u_ptr;
   } else {
@@ -236,6 +247,8 @@ void* realloc(void *ptr, size_t size) {
     fprintf(stderr, "Warning: realloc a ptr that was allocated by hand_made_malloc\n");
   }
   void *old_addr= p_block->u_ptr;
+  /* the directive that was applied to the buffer (see bind_malloced_buffer) */
+  struct mbind_directive* dir = p_block->record_info;
   void *pptr = librealloc(p_block->p_ptr, size + header_size);
   INIT_MEM_INFO(p_block, pptr, size, 1);
 
@@ -250,6 +263,13 @@ void* realloc(void *ptr, size_t size) {
     }
 
     p_block->mem_type = MEM_TYPE_MALLOC;
+    p_block->record_info = dir;
+    if(dir && p_block->u_ptr != old_addr && size >= old_size) {
+      /* the buffer moved to pages that are not bound: bind them like the
+       * original buffer
+       */
+      rebind_malloced_buffer(dir, p_block->u_ptr, size);
+    }
     UNPROTECT_FROM_RECURSION;
   } else {
     /* it is not safe to record information */
@@ -287,8 +307,7 @@ void* calloc(size_t nmemb, size_t size) {
   if(__memory_initialized && IS_RECURSE_SAFE) {
     PROTECT_FROM_RECURSION;
     p_block->mem_type = MEM_TYPE_MALLOC;
-    /* todo: call mbind ? */
-    bind_malloced_buffer(p_block->u_ptr, size*nmemb, NULL);
+    p_block->record_info = bind_malloced_buffer(p_block->u_ptr, size*nmemb);
     UNPROTECT_FROM_RECURSION;
   } else {
     p_block->mem_type = MEM_TYPE_INTERNAL_MALLOC;
@@ -521,6 +540,37 @@ static void get_thread_binding() {
   }
 }
 
+/* parse an object key (as reported by numamma: KEY-ORDINAL) or the key of a
+ * call site (KEY). Return 0 if block_identifier is not a key
+ */
+static int parse_object_key(const char* block_identifier, uint64_t* key, unsigned* ordinal) {
+  int len = 0;
+  if(strspn(block_identifier, "0123456789abcdef") != 16 ||
+     sscanf(block_identifier, "%16"SCNx64"%n", key, &len) != 1)
+    return 0;
+  *ordinal = 0;
+  if(block_identifier[len] == '\0')
+    return 1;
+  int end = 0;
+  if(block_identifier[len] != '-' ||
+     sscanf(&block_identifier[len+1], "%u%n", ordinal, &end) != 1 ||
+     block_identifier[len+1+end] != '\0')
+    return 0;
+  return 1;
+}
+
+static void add_key_counter(uint64_t key) {
+  for(struct key_counter *c = key_counters; c; c = c->next) {
+    if(c->key == key)
+      return;
+  }
+  struct key_counter *c = malloc(sizeof(struct key_counter));
+  c->key = key;
+  c->nb_allocs = 0;
+  c->next = key_counters;
+  key_counters = c;
+}
+
 static void load_custom_block(FILE*f) {
   struct mbind_directive *dir=malloc(sizeof(struct mbind_directive));
 
@@ -531,6 +581,9 @@ static void load_custom_block(FILE*f) {
 
   if(strcmp(dir->block_identifier, "malloc") == 0) {
     dir->buffer_type=type_malloc;
+  } else if(parse_object_key(dir->block_identifier, &dir->key, &dir->ordinal)) {
+    dir->buffer_type=type_malloc_key;
+    add_key_counter(dir->key);
   } else {
     dir->buffer_type=type_global;
   }
@@ -838,15 +891,60 @@ static void bind_custom(void* buffer, size_t len, char* buffer_id) {
   printf("\t%s not found\n", buffer_id);
 }
 
-static void bind_malloced_buffer(void* buffer, size_t len, char* buffer_id) {
+/* search for the type_malloc_key directive that corresponds to the
+ * allocation site key, and bind the buffer. Return the directive, or NULL
+ * if none was found
+ */
+static struct mbind_directive* bind_keyed_buffer(void* buffer, size_t len, uint64_t key) {
+  struct key_counter *c = key_counters;
+  while(c && c->key != key)
+    c = c->next;
+  if(!c)
+    return NULL;
+  unsigned ordinal = atomic_fetch_add(&c->nb_allocs, 1) + 1;
+
+  for(struct mbind_directive* dir = directives; dir; dir = dir->next) {
+    if(dir->buffer_type == type_malloc_key && dir->key == key &&
+       (dir->ordinal == 0 || dir->ordinal == ordinal)) {
+      dir->base_addr = buffer;
+      if(_verbose) {
+	printf("Binding malloced buffer %s (len=%zu, allocation #%u)\n", dir->block_identifier, len, ordinal);
+      }
+      bind_buffer_blocks(buffer, len, dir->nb_blocks, dir->blocks);
+      return dir;
+    }
+  }
+  return NULL;
+}
+
+/* The allocation site key must be computed the same way as numamma does, so
+ * this function must not be inlined and the call stack looks like:
+ * 0 - get_caller_rip()
+ * 1 - bind_malloced_buffer()
+ * 2 - malloc()
+ * 3 - caller_function()
+ *
+ * Return the directive that was applied to the buffer, or NULL
+ */
+static __attribute__((noinline)) struct mbind_directive* bind_malloced_buffer(void* buffer, size_t len) {
+  if(key_counters) {
+    void* caller_rip;
+    int callstack_size;
+    void** callstack_rip = get_caller_rip(3, &callstack_size, &caller_rip);
+    if(callstack_rip) {
+      uint64_t key = get_callstack_key(&callstack_rip[3], callstack_size-3, len);
+      free(callstack_rip);
+      struct mbind_directive* dir = bind_keyed_buffer(buffer, len, key);
+      if(dir)
+	return dir;
+    }
+  }
+
   struct mbind_directive* dir = directives;
   while(dir) {
     /* search for the directive corresponding to this malloc */
 
-    /* todo:
-     * - take the buffer_id into account
-     * - don't apply a directive several times
-     */
+    /* todo: don't apply a directive several times */
     if(dir->buffer_type == type_malloc &&
        dir->buffer_len == len) {
 
@@ -855,11 +953,21 @@ static void bind_malloced_buffer(void* buffer, size_t len, char* buffer_id) {
 	printf("Binding malloced buffer(len=%zu)\n", len);
       }
       bind_buffer_blocks(buffer, len, dir->nb_blocks, dir->blocks);
-      return;
+      return dir;
     }
 
     dir = dir->next;
   }
+  return NULL;
+}
+
+/* apply dir again to a buffer that was moved by realloc */
+static void rebind_malloced_buffer(struct mbind_directive* dir, void* buffer, size_t len) {
+  dir->base_addr = buffer;
+  if(_verbose) {
+    printf("Binding realloced buffer %s (len=%zu)\n", dir->block_identifier, len);
+  }
+  bind_buffer_blocks(buffer, len, dir->nb_blocks, dir->blocks);
 }
 
 static void bind_buffer(void* buffer, size_t len, char* buffer_id) {
@@ -5,12 +5,18 @@
 #include <signal.h>
 #include <linux/version.h>
 #include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <dlfcn.h>
 #include <link.h>
 
 #include "mem_sampling.h"
 #include "mem_analyzer.h"
 #include "mem_tools.h"
+#include "mem_threads.h"
+#include "mem_trace.h"
+#include "mem_dump.h"
+#include "mem_report.h"
 
 // if > 0, ma_get_*_variables functions are called before analysis, and do_get_at_analysis is decremented
 int do_get_at_analysis = 0;
@@ -18,10 +24,34 @@ int do_get_at_analysis = 0;
 /* number of memory pages for numap buffer  */
 size_t numap_page_count = 32;
 
-uint64_t nb_samples_total = 0;
-uint64_t nb_found_samples_total = 0;
+/* read by the snapshots and the control queries while they are updated */
+_Atomic uint64_t nb_samples_total = 0;
+_Atomic uint64_t nb_found_samples_total = 0;
 
-static FILE* dump_all_file = NULL;
+/* serializes the analysis of the copied sample buffers. The analysis can be
+ * triggered by the end of the execution, a snapshot, or a control query at
+ * the same time, and it inserts blocks in the same lists
+ */
+static pthread_mutex_t analysis_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* dumps of the samples (see mem_dump.h). Each sink is opened by the first
+ * sample that it dumps (under dump_sink_lock), and published with a release
+ * store, so that the threads that see the pointer see the sink initialized
+ */
+static struct dump_sink* _Atomic dump_all_sink = NULL;
+static struct dump_sink* _Atomic dump_unmatched_sink = NULL;
+/* the samples of all the call sites (one stream per site) */
+static struct dump_sink* _Atomic dump_sites_sink = NULL;
+static pthread_mutex_t dump_sink_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* number of samples per chunk in the binary dumps */
+#define TRACE_CHUNK_RECORDS 65536
+/* the call sites are numerous, and most of them have few samples: each site
+ * buffers up to TRACE_SITE_CHUNK_RECORDS samples */
+#define TRACE_SITE_CHUNK_RECORDS 4096
+
+/* if set, the collected samples are discarded (see mem_sampling_pause) */
+static _Atomic int sampling_paused = 0;
 
 /* set to 1 if we are currently sampling memory accesses */
 static __thread volatile int is_sampling = 0;
@@ -74,47 +104,39 @@ pthread_mutex_t sample_list_lock;
 static int nb_sample_buffers = 0;
 
 
-struct thread_info {
-  struct numap_sampling_measure *sm;
-  struct numap_sampling_measure* sm_wr;
-  pid_t tid;
-  int rank;
-};
-
-struct thread_info *thread_ranks = NULL;
-_Atomic int nthreads = 0;
-int allocated_threads = 0;
-
-static struct thread_info * get_thread_info(pid_t pid) {
-  for(int i=0; i<nthreads; i++)
-    if(thread_ranks[i].tid == pid)
-      return &thread_ranks[i];
-  return NULL;
+/* publish the sampling buffers of the current thread so that other threads
+ * can collect its samples (see numap_generic_handler)
+ */
+static void register_thread_measures(struct numap_sampling_measure *sm,
+				     struct numap_sampling_measure *sm_wr) {
+  struct thread_record* record = thread_registry_get(thread_rank);
+  assert(record);
+  /* sequentially consistent, so that a collector either sees NULL, or is
+   * counted in nb_collectors (see mem_sampling_thread_finalize)
+   */
+  atomic_store(&record->sm, sm);
+  atomic_store(&record->sm_wr, sm_wr);
 }
 
-static void register_thread_pid(pid_t pid,
-				struct numap_sampling_measure *sm,
-				struct numap_sampling_measure *sm_wr) {
-  if(allocated_threads == 0) {
-    thread_ranks = malloc(sizeof(struct thread_info)* 128);
-    allocated_threads = 128;
-  }
-  while(nthreads >= allocated_threads) {
-    allocated_threads *= 2;
-    thread_ranks = realloc(thread_ranks, sizeof(struct thread_info)*allocated_threads);
+/* stop the sampling of a thread if it was paused meanwhile. Called
+ * after resuming the sampling: either mem_sampling_pause sees the sampling
+ * resumed, and stops it, or we see sampling_paused
+ */
+static void __stop_if_paused(struct numap_sampling_measure *sm,
+			     struct numap_sampling_measure *sm_wr) {
+  if(atomic_load(&sampling_paused)) {
+    numap_sampling_read_stop(sm);
+    if (numap_sampling_write_supported())
+      numap_sampling_write_stop(sm_wr);
   }
-  int rank = nthreads++;
-  thread_ranks[rank].tid = pid;
-  thread_ranks[rank].rank = rank;
-  thread_ranks[rank].sm = sm;
-  thread_ranks[rank].sm_wr = sm_wr;
 }
 
 /* called at runtime when the sample buffer has to be emptied
  * depending on the settings, it either calls __copy_buffer, or __analyze_buffer
  */
 static void __process_samples(struct numap_sampling_measure *sm,
-			      enum access_type access_type);
+			      enum access_type access_type,
+			      unsigned thread_rank);
 
 static void __analyze_buffer(struct sample_list* samples,
 			     int *nb_samples,
@@ -208,6 +230,9 @@ void mem_sampling_init() {
 
   pthread_mutex_init(&sample_list_lock, NULL);
 
+  if(settings.dump || settings.dump_all || settings.dump_unmatched)
+    dump_writer_init();
+
   mem_allocator_init(&sample_mem, sizeof(struct sample_list), 1024);
   init_mem_counter(&global_counters[0]);
   init_mem_counter(&global_counters[1]);
@@ -223,32 +248,48 @@ void numap_generic_handler(struct numap_sampling_measure *m,
   if(IS_RECURSE_SAFE) {
     PROTECT_FROM_RECURSION;
     pid_t tid =  syscall(SYS_gettid);
-    debug_printf("[%d] [%lf] %s starts\n", get_thread_info(tid)->rank, get_cur_date(), __func__);
+    debug_printf("[%d] [%lf] %s starts\n", tid, get_cur_date(), __func__);
 #if 1
     /* collect samples for all the threads */
-    for(int i=0; i<nthreads; i++) {
+    unsigned nthreads = thread_registry_size();
+    for(unsigned i=0; i<nthreads; i++) {
+      struct thread_record* record = thread_registry_get(i);
+      /* the thread cannot release its buffers while we use them (see
+       * mem_sampling_thread_finalize)
+       */
+      atomic_fetch_add(&record->nb_collectors, 1);
+      struct numap_sampling_measure* t_sm = atomic_load(&record->sm);
+      struct numap_sampling_measure* t_sm_wr = atomic_load(&record->sm_wr);
+      if(!t_sm || !t_sm_wr) {
+	/* the thread is not sampled (yet, or anymore) */
+	atomic_fetch_sub_explicit(&record->nb_collectors, 1, memory_order_release);
+	continue;
+      }
+
       size_t read_size, write_size;
       copied_size = 0;
-      numap_sampling_read_stop(thread_ranks[i].sm);
-      __process_samples(thread_ranks[i].sm, ACCESS_READ);
+      numap_sampling_read_stop(t_sm);
+      __process_samples(t_sm, ACCESS_READ, record->rank);
       read_size = copied_size;
-      numap_sampling_resume(thread_ranks[i].sm);
+      numap_sampling_resume(t_sm);
 
 
       copied_size = 0;
-      numap_sampling_write_stop(thread_ranks[i].sm_wr);
-      __process_samples(thread_ranks[i].sm_wr, ACCESS_WRITE);
-      numap_sampling_resume(thread_ranks[i].sm_wr);
+      numap_sampling_write_stop(t_sm_wr);
+      __process_samples(t_sm_wr, ACCESS_WRITE, record->rank);
+      numap_sampling_resume(t_sm_wr);
+      __stop_if_paused(t_sm, t_sm_wr);
 
+      atomic_fetch_sub_explicit(&record->nb_collectors, 1, memory_order_release);
       write_size = copied_size;
       debug_printf("\tThread %d: %zu bytes read, %zu bytes write\n", i, read_size, write_size);
     }
 #else
     /* collect samples from the buffer that was signaled */
     numap_sampling_read_stop(m);
-    __process_samples(m, access_type);
+    __process_samples(m, access_type, thread_registry_find(m->tids[0])->rank);
     numap_sampling_resume(m);
-    debug_printf("\tThread %d: %llu bytes read\n", get_thread_info(m->tids[0])->rank, copied_size);
+    debug_printf("\tThread %d: %llu bytes read\n", thread_registry_find(m->tids[0])->rank, copied_size);
     copied_size = 0;
 #endif
     UNPROTECT_FROM_RECURSION;
@@ -265,7 +306,6 @@ void numap_write_handler(struct numap_sampling_measure *m, int fd) {
 
 void mem_sampling_thread_init() {
   pid_t tid = syscall(SYS_gettid);
-  register_thread_pid(tid, &sm, &sm_wr);
 
   int res = numap_sampling_init_measure(&sm, 1, settings.sampling_rate, numap_page_count);
   if(res < 0) {
@@ -301,6 +341,7 @@ void mem_sampling_thread_init() {
     if(numap_sampling_set_measure_handler(&sm_wr, numap_write_handler, nsamples) != 0)
       printf("numap_sampling_set_measure_handler failed\n");
   }
+  register_thread_measures(&sm, &sm_wr);
 
   status_initialized = 1;
   __set_alarm();
@@ -308,6 +349,68 @@ void mem_sampling_thread_init() {
 }
 
 
+void mem_sampling_pause(int paused) {
+  atomic_store(&sampling_paused, paused);
+
+  /* stop (or resume) the hardware sampling of all the threads */
+  unsigned nthreads = thread_registry_size();
+  for(unsigned i=0; i<nthreads; i++) {
+    struct thread_record* record = thread_registry_get(i);
+    /* the thread cannot release its buffers while we use them (see
+     * mem_sampling_thread_finalize)
+     */
+    atomic_fetch_add(&record->nb_collectors, 1);
+    struct numap_sampling_measure* t_sm = atomic_load(&record->sm);
+    struct numap_sampling_measure* t_sm_wr = atomic_load(&record->sm_wr);
+    if(t_sm && t_sm_wr) {
+      if(paused) {
+	numap_sampling_read_stop(t_sm);
+	if (numap_sampling_write_supported())
+	  numap_sampling_write_stop(t_sm_wr);
+      } else {
+	numap_sampling_resume(t_sm);
+	if (numap_sampling_write_supported())
+	  numap_sampling_resume(t_sm_wr);
+	/* the sampling may have been paused again meanwhile */
+	__stop_if_paused(t_sm, t_sm_wr);
+      }
+    }
+    atomic_fetch_sub_explicit(&record->nb_collectors, 1, memory_order_release);
+  }
+}
+
+int mem_sampling_is_paused() {
+  return atomic_load(&sampling_paused);
+}
+
+void mem_sampling_analyze_pending() {
+  if(settings.online_analysis)
+    return;
+
+  /* the buffers are removed from the list, so that mem_sampling_finalize
+   * does not analyze them again
+   */
+  pthread_mutex_lock(&analysis_lock);
+  pthread_mutex_lock(&sample_list_lock);
+  struct sample_list* pending = samples;
+  samples = NULL;
+  nb_sample_buffers = 0;
+  pthread_mutex_unlock(&sample_list_lock);
+
+  while(pending) {
+    int nb_samples = 0;
+    int found_samples = 0;
+    __analyze_buffer(pending, &nb_samples, &found_samples);
+    nb_samples_total += nb_samples;
+    nb_found_samples_total += found_samples;
+    struct sample_list *prev = pending;
+    pending = pending->next;
+    free(prev->buffer);
+    mem_allocator_free(sample_mem, prev);
+  }
+  pthread_mutex_unlock(&analysis_lock);
+}
+
 void mem_sampling_finalize() {
 
   if(!settings.online_analysis) {
@@ -316,8 +419,7 @@ void mem_sampling_finalize() {
       do_get_at_analysis--;
     }
     /* analyze the samples that were copied at runtime */
-    ma_register_stack();
-
+    pthread_mutex_lock(&analysis_lock);
     printf("Analyzing %d sample buffers\n", nb_sample_buffers);
     int nb_blocks = 0;
     size_t total_buffer_size = 0;
@@ -340,15 +442,40 @@ void mem_sampling_finalize() {
       free(prev->buffer);
       mem_allocator_free(sample_mem, prev);
     }
+    pthread_mutex_unlock(&analysis_lock);
     printf("\n");
     printf("%zu bytes processed\n", total_buffer_size);
   }
+
+  /* all the samples were analyzed: wait for the writer thread, and write
+   * the footer of the binary dumps */
+  dump_writer_drain();
+  if(dump_all_sink) {
+    dump_sink_close(dump_all_sink);
+    dump_all_sink = NULL;
+  }
+  if(dump_unmatched_sink) {
+    dump_sink_close(dump_unmatched_sink);
+    dump_unmatched_sink = NULL;
+  }
+  if(dump_sites_sink) {
+    dump_sink_close(dump_sites_sink);
+    dump_sites_sink = NULL;
+  }
 }
 
 void mem_sampling_thread_finalize() {
   if(!status_initialized)
     return;
   mem_sampling_collect_samples();
+  /* other threads must not collect our samples once the buffers are
+   * released: unpublish the buffers, and wait for the threads that are
+   * collecting them
+   */
+  register_thread_measures(NULL, NULL);
+  struct thread_record* record = thread_registry_get(thread_rank);
+  while(atomic_load(&record->nb_collectors))
+    sched_yield();
   numap_sampling_end(&sm);
   numap_sampling_end(&sm_wr);
   status_finalized = 1;
@@ -358,6 +485,12 @@ void mem_sampling_statistics() {
   float percent = 100.0*(nb_samples_total-nb_found_samples_total)/nb_samples_total;
   printf("%"PRIu64" samples (including %"PRIu64" samples that do not match a known memory buffer / %f%%)\n",
 	 nb_samples_total, nb_samples_total-nb_found_samples_total, percent);
+
+  report_begin("samples");
+  report_u64("nb_samples", nb_samples_total);
+  report_u64("nb_found_samples", nb_found_samples_total);
+  report_u64("nb_unmatched_samples", nb_samples_total-nb_found_samples_total);
+  report_end();
 }
 
 /* make sure this function is not called by collect_samples or start_sampling.
@@ -402,6 +535,7 @@ void mem_sampling_resume() {
       abort();
     }
   }
+  __stop_if_paused(&sm, &sm_wr);
 
   setting_sampling_stuff=0;
 #endif	/* USE_NUMAP */
@@ -451,6 +585,7 @@ void mem_sampling_start() {
       abort();
     }
   }
+  __stop_if_paused(&sm, &sm_wr);
   setting_sampling_stuff=0;
 #endif	/* USE_NUMAP */
 }
@@ -492,9 +627,9 @@ void mem_sampling_collect_samples() {
 
   // Analyze samples
   start_tick(analyze_samples);
-  __process_samples(&sm, ACCESS_READ);
+  __process_samples(&sm, ACCESS_READ, thread_rank);
   if (numap_sampling_write_supported()) {
-    __process_samples(&sm_wr, ACCESS_WRITE);
+    __process_samples(&sm_wr, ACCESS_WRITE, thread_rank);
   }
   stop_tick(analyze_samples);
 
@@ -505,24 +640,47 @@ void mem_sampling_collect_samples() {
 extern date_t origin_date;
 #define DATE(d) ((d)-origin_date)
 
-#define UPDATE_COUNTER(counter, sample) do {	\
-    counter.count++;				\
-    if(sample->weight < counter.min_weight)	\
-      counter.min_weight = sample->weight;	\
-    if(sample->weight > counter.max_weight)	\
-      counter.max_weight = sample->weight;	\
-    counter.sum_weight += sample->weight;	\
+/* The counters may be read (eg. by a snapshot or a control query) while
+ * they are updated. Each counter is updated with a relaxed atomic operation:
+ * a reader may see the counters of a sample partially updated, but it never
+ * sees a torn value
+ */
+static inline void __counter_add(_Atomic uint64_t* counter, uint64_t value) {
+  atomic_fetch_add_explicit(counter, value, memory_order_relaxed);
+}
+
+static inline void __counter_min(_Atomic uint64_t* counter, uint64_t value) {
+  uint64_t cur = atomic_load_explicit(counter, memory_order_relaxed);
+  while(value < cur &&
+	!atomic_compare_exchange_weak_explicit(counter, &cur, value,
+					       memory_order_relaxed, memory_order_relaxed))
+    ;
+}
+
+static inline void __counter_max(_Atomic uint64_t* counter, uint64_t value) {
+  uint64_t cur = atomic_load_explicit(counter, memory_order_relaxed);
+  while(value > cur &&
+	!atomic_compare_exchange_weak_explicit(counter, &cur, value,
+					       memory_order_relaxed, memory_order_relaxed))
+    ;
+}
+
+#define UPDATE_COUNTER(counter, sample) do {		\
+    __counter_add(&counter.count, 1);			\
+    __counter_min(&counter.min_weight, sample->weight);	\
+    __counter_max(&counter.max_weight, sample->weight);	\
+    __counter_add(&counter.sum_weight, sample->weight);	\
   } while(0)
 
 void update_counters(struct mem_counters* counters,
 		     struct mem_sample *sample,
 		     enum access_type access_type) {
 
-  counters[access_type].total_count++;
-  counters[access_type].total_weight += sample->weight;
+  __counter_add(&counters[access_type].total_count, 1);
+  __counter_add(&counters[access_type].total_weight, sample->weight);
 
   if(sample->data_src.mem_lvl & PERF_MEM_LVL_NA) {
-    counters[access_type].na_miss_count++;
+    __counter_add(&counters[access_type].na_miss_count, 1);
   }
 
   if(sample->data_src.mem_lvl & PERF_MEM_LVL_L1) {
@@ -591,6 +749,53 @@ void update_counters(struct mem_counters* counters,
   }
 }
 
+/* return the name of a memory level (used for building the dictionary of the binary dumps) */
+static const char* __level_name(uint32_t mem_lvl) {
+  union perf_mem_data_src data_src;
+  data_src.val = 0;
+  data_src.mem_lvl = mem_lvl;
+  return get_data_src_level(data_src);
+}
+
+/* create a dump named basename (.trace or .dat, depending on
+ * settings.dump_format) in the output directory */
+static struct dump_sink* __open_dump(const char* basename,
+				     enum trace_kind kind,
+				     size_t chunk_records) {
+  char file_basename[STRING_LEN];
+  char filename[4096];
+  snprintf(file_basename, STRING_LEN, "%s.%s", basename,
+	   settings.dump_format == DUMP_FORMAT_BINARY ? "trace" : "dat");
+  create_log_filename(file_basename, filename, 4096);
+  struct dump_sink* sink = dump_sink_open(filename, kind, settings.dump_format, chunk_records);
+  if(!sink) {
+    fprintf(stderr, "failed to open %s for writing: %s\n", filename, strerror(errno));
+    abort();
+  }
+  return sink;
+}
+
+/* append a sample to a stream of a dump */
+static void __dump_sample(struct dump_sink* sink,
+			  uint32_t stream,
+			  struct mem_sample *sample,
+			  enum access_type access_type,
+			  unsigned thread_rank,
+			  uint32_t object_id,
+			  uint64_t offset) {
+  struct trace_record record = {
+    .timestamp = sample->timestamp,
+    .offset = offset,
+    .thread_rank = thread_rank,
+    .object_id = object_id,
+    /* the weight is a latency in cycles, it fits in 32 bits */
+    .weight = sample->weight > UINT32_MAX ? UINT32_MAX : sample->weight,
+    .level = trace_level_code(sample->data_src.mem_lvl, __level_name),
+    .access_type = access_type,
+  };
+  dump_append(sink, stream, &record);
+}
+
 static struct memory_info* __match_sample(struct mem_sample *sample,
 					  enum access_type access_type,
 					  int thread_rank) {
@@ -605,56 +810,58 @@ static struct memory_info* __match_sample(struct mem_sample *sample,
       char maps_path[1024];
       sprintf(maps_path, "/proc/%d/maps", getpid());
 
-      static int maps_read = 0;	/* only read the maps file once */
-      if(!maps_read) {
-	// trying to find where the address is located in maps file
-	FILE *maps = fopen(maps_path, "r");
-	if (maps == NULL)	{
-	  fprintf(stderr, "Could not read %s\n", maps_path);
-	  abort();
-	}
-	fprintf(dump_unmatched_file, "# %s content:\n", maps_path);
-	void *addr = (void*)sample->addr;
-	while (!feof(maps)) {
-	  fgets(line, sizeof(line), maps);
-	  fprintf(dump_unmatched_file, "# %s", line);
+      /* only read the maps file once, when the first unmatched sample is dumped */
+      struct dump_sink* sink = atomic_load_explicit(&dump_unmatched_sink, memory_order_acquire);
+      if(!sink) {
+	pthread_mutex_lock(&dump_sink_lock);
+	sink = atomic_load_explicit(&dump_unmatched_sink, memory_order_relaxed);
+	if(!sink) {
+	  // trying to find where the address is located in maps file
+	  FILE *maps = fopen(maps_path, "r");
+	  if (maps == NULL)	{
+	    fprintf(stderr, "Could not read %s\n", maps_path);
+	    abort();
+	  }
+	  fprintf(dump_unmatched_file, "# %s content:\n", maps_path);
+	  void *addr = (void*)sample->addr;
+	  while (!feof(maps)) {
+	    fgets(line, sizeof(line), maps);
+	    fprintf(dump_unmatched_file, "# %s", line);
 #if 0
-	  char cut_line[1024];
-	  strncpy(cut_line, line, sizeof(cut_line));
-	  void *begin = NULL;
-	  void *end = NULL;
-	  sscanf(strtok(cut_line, " "), "%p-%p", &begin, &end);
-	  if (addr >= begin && addr <= end)
-	    found = 1;
+	    char cut_line[1024];
+	    strncpy(cut_line, line, sizeof(cut_line));
+	    void *begin = NULL;
+	    void *end = NULL;
+	    sscanf(strtok(cut_line, " "), "%p-%p", &begin, &end);
+	    if (addr >= begin && addr <= end)
+	      found = 1;
 #endif
+	  }
+	  fclose(maps);
+	  fprintf(dump_unmatched_file, "#\n#\n#\n");
+
+	  if(settings.dump_format == DUMP_FORMAT_BINARY) {
+	    fprintf(dump_unmatched_file, "# the samples are in unmatched_samples.trace\n");
+	    fflush(dump_unmatched_file);
+	    sink = __open_dump("unmatched_samples", TRACE_KIND_UNMATCHED, TRACE_CHUNK_RECORDS);
+	  } else {
+	    /* the samples are written after the content of the maps file */
+	    fflush(dump_unmatched_file);
+	    sink = dump_sink_open_fd(fileno(dump_unmatched_file), TRACE_KIND_UNMATCHED);
+	  }
+	  atomic_store_explicit(&dump_unmatched_sink, sink, memory_order_release);
 	}
-	fclose(maps);
-	fprintf(dump_unmatched_file, "#\n#\n#\n");
-
-	maps_read = 1;
-
-	fprintf(dump_unmatched_file,
-		"#thread_rank timestamp address mem_level access_weight access_type\n");
+	pthread_mutex_unlock(&dump_sink_lock);
       }
-      
-      /* write the content of the sample to a file */
-      fprintf(dump_unmatched_file,
-	      // thread_rank timestamp address mem_level access_weight access_type
-	      "%u %" PRIu64 " 0x%"PRIxPTR" %s %" PRIu64 " %c\n",
-		  samples->thread_rank,
-		  sample->timestamp,
-		  sample->addr,
-		  get_data_src_level(sample->data_src),
-		  sample->weight,
-		  access_type==ACCESS_READ?'r':'w');
+
+      __dump_sample(sink, 0, sample, access_type, thread_rank, 0, sample->addr);
     }
   } else {
 
     /* we found a memory object that corresponds to the sample */
-    if(!mem_info->blocks) {
+    if(!atomic_load_explicit(&mem_info->blocks, memory_order_acquire)) {
       /* this is the first time a sample matches this object, initialize a few things */
       ma_allocate_counters(mem_info);
-      ma_init_counters(mem_info);
     }
 
     /* find the memory pages in the object that corresponds to the sample address */
@@ -663,10 +870,7 @@ static struct memory_info* __match_sample(struct mem_sample *sample,
     update_counters(block->counters, sample, access_type);
 
     if(!mem_info->call_site) {
-      mem_info->call_site = find_call_site(mem_info);
-      if(!mem_info->call_site) {
-	mem_info->call_site = new_call_site(mem_info);
-      }
+      mem_info->call_site = ma_get_call_site(mem_info);
     }
   }
   return mem_info;
@@ -739,72 +943,44 @@ static void __copy_buffer(struct sample_list* sample_list,
 
 static void _dump_mem_info(struct mem_sample *sample,
 			   enum access_type access_type,
+			   unsigned thread_rank,
 			   struct memory_info* mem_info,
 			   uintptr_t offset) {
   if(settings.dump_all && mem_info->mem_type != stack) {
-    if(!dump_all_file) {
-      char filename[4096];
-      char file_basename[STRING_LEN];
-      snprintf(file_basename, STRING_LEN, "all_memory_accesses.dat");
-      create_log_filename(file_basename, filename, 4096);
-      dump_all_file=fopen(filename, "w");
-      if(!dump_all_file) {
-	fprintf(stderr, "failed to open %s for writing: %s\n", filename, strerror(errno));
-	abort();
+    struct dump_sink* sink = atomic_load_explicit(&dump_all_sink, memory_order_acquire);
+    if(!sink) {
+      pthread_mutex_lock(&dump_sink_lock);
+      sink = atomic_load_explicit(&dump_all_sink, memory_order_relaxed);
+      if(!sink) {
+	sink = __open_dump("all_memory_accesses", TRACE_KIND_OBJECTS, TRACE_CHUNK_RECORDS);
+	atomic_store_explicit(&dump_all_sink, sink, memory_order_release);
       }
-
-      /* write the content of the sample to a file */
-      fprintf(dump_all_file,
-	      "#thread_rank timestamp object_id offset mem_level access_weight access_type\n");
+      pthread_mutex_unlock(&dump_sink_lock);
     }
-
-    /* write the content of the sample to a file */
-    fprintf(dump_all_file,
-	    "%u %" PRIu64 " %u %" PRIu64 " %s %" PRIu64 " %c\n",
-	    samples->thread_rank,
-	    sample->timestamp,
-	    mem_info->id,
-	    offset,
-	    get_data_src_level(sample->data_src),
-	    sample->weight,
-	    access_type==ACCESS_READ?'r':'w');
-
+    __dump_sample(sink, 0, sample, access_type, thread_rank, mem_info->id, offset);
   }
 }
 
 static void _dump_call_site(struct mem_sample *sample,
 			    enum access_type access_type,
+			    unsigned thread_rank,
 			    struct memory_info* mem_info,
 			    uintptr_t offset) {
   if(mem_info && mem_info->call_site && mem_info->mem_type != stack) {
-    if(!mem_info->call_site->dump_file) {
-      char filename[4096];
-      char file_basename[STRING_LEN];
-      snprintf(file_basename, STRING_LEN, "callsite_dump_%d.dat", mem_info->call_site->id);
-      create_log_filename(file_basename, filename, 4096);
-      mem_info->call_site->dump_file=fopen(filename, "w");
-      if(!mem_info->call_site->dump_file) {
-	fprintf(stderr, "failed to open %s for writing: %s\n", filename, strerror(errno));
-	abort();
+    struct call_site* site = mem_info->call_site;
+    struct dump_sink* sink = atomic_load_explicit(&dump_sites_sink, memory_order_acquire);
+    if(!sink) {
+      pthread_mutex_lock(&dump_sink_lock);
+      sink = atomic_load_explicit(&dump_sites_sink, memory_order_relaxed);
+      if(!sink) {
+	sink = __open_dump("callsite_dumps", TRACE_KIND_CALL_SITE, TRACE_SITE_CHUNK_RECORDS);
+	atomic_store_explicit(&dump_sites_sink, sink, memory_order_release);
       }
-
-      /* write the content of the sample to a file */
-      fprintf(mem_info->call_site->dump_file,
-	      "#thread_rank timestamp offset mem_level access_weight access_type\n");
+      pthread_mutex_unlock(&dump_sink_lock);
     }
-	  
-    /* write the content of the sample to a file */
-    fprintf(mem_info->call_site->dump_file,
-	    "%u %" PRIu64 " %" PRIuPTR " %s %" PRIu64 " %c\n",
-	    samples->thread_rank,
-	    sample->timestamp,
-	    offset,
-	    get_data_src_level(sample->data_src),
-	    sample->weight,
-	    access_type==ACCESS_READ?'r':'w');
-
+    site->dumped = 1;
+    __dump_sample(sink, site->id, sample, access_type, thread_rank, mem_info->id, offset);
   }
-
 }
 
 /* This function analyzes a set of samples
@@ -900,15 +1076,10 @@ static void __analyze_buffer(struct sample_list* samples,
 	  /* compute the offset of the sample adress in the memory object */
 	  offset = (uintptr_t)sample->addr - (uintptr_t)mem_info->buffer_addr;
 
-	  if(!mem_info->caller) {
-	    /* search for the function that allocated the memory object */
-	    mem_info->caller = get_caller_function_from_rip(mem_info->caller_rip);
-	  }
-
 	  /* if needed, write the sample into files */
-	  _dump_mem_info(sample, access_type, mem_info, offset);
+	  _dump_mem_info(sample, access_type, samples->thread_rank, mem_info, offset);
 	  if (settings.dump_single_items) {
-		_dump_call_site(sample, access_type, mem_info, offset);
+		_dump_call_site(sample, access_type, samples->thread_rank, mem_info, offset);
 	  }
 	}
       }
@@ -927,7 +1098,8 @@ static void __analyze_buffer(struct sample_list* samples,
 }
 
 void __process_samples(struct numap_sampling_measure *sm,
-			enum access_type access_type) {
+			enum access_type access_type,
+			unsigned thread_rank) {
   int thread;
   int nb_samples = 0;
   int found_samples = 0;
@@ -936,8 +1108,6 @@ void __process_samples(struct numap_sampling_measure *sm,
     uint64_t data_head = metadata_page->data_head % metadata_page->data_size;
     rmb();
 
-    int rank = get_thread_info(sm->tids[thread])->rank;
-    assert(rank >=0);
     struct sample_list samples = {
       .next = NULL,
       .buffer = (struct perf_event_header *)((uint8_t *)metadata_page+metadata_page->data_offset),
@@ -947,10 +1117,12 @@ void __process_samples(struct numap_sampling_measure *sm,
       .access_type = access_type,
       .start_date = start_date,
       .stop_date = new_date(),
-      .thread_rank = rank,
+      .thread_rank = thread_rank,
     };
 
-    if(settings.online_analysis) {
+    if(atomic_load_explicit(&sampling_paused, memory_order_relaxed)) {
+      /* drop the samples */
+    } else if(settings.online_analysis) {
       __analyze_buffer(&samples, &nb_samples, &found_samples);
     } else {
       __copy_buffer(&samples, &nb_samples, &found_samples);
@@ -17,4 +17,19 @@ void mem_sampling_resume();
 
 void mem_sampling_statistics();
 
+/* analyze the samples that were copied so far (when online_analysis is
+ * disabled), so that the counters are up to date
+ */
+void mem_sampling_analyze_pending();
+
+/* if paused is set, stop the hardware sampling of all the threads until
+ * mem_sampling_pause(0) is called. The samples that were collected before
+ * the pause and are not analyzed yet are discarded
+ */
+void mem_sampling_pause(int paused);
+int mem_sampling_is_paused();
+
+extern _Atomic uint64_t nb_samples_total;
+extern _Atomic uint64_t nb_found_samples_total;
+
 #endif /* MEM_SAMPLING_H */
@@ -0,0 +1,197 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <sched.h>
+
+#include "mem_side_table.h"
+#include "mem_tools.h"
+
+#define SIDE_TABLE_SHARDS 256
+#define SIDE_TABLE_MIN_CAPACITY 64
+/* number of mem_block_info allocated at once */
+#define SIDE_TABLE_BLOCK_CHUNK 64
+
+#define EMPTY_KEY     ((uintptr_t) 0)
+#define TOMBSTONE_KEY ((uintptr_t) 1)
+
+struct side_table_entry {
+  uintptr_t key;
+  struct mem_block_info* block;
+};
+
+/* each shard is an open addressing hash table (with linear probing) */
+struct side_table_shard {
+  _Atomic int lock;
+  size_t capacity;		/* always a power of 2 */
+  size_t nb_entries;
+  size_t nb_tombstones;
+  struct side_table_entry* entries;
+  struct mem_block_info* free_blocks; /* linked through their u_ptr field */
+} __attribute__ ((aligned (64)));
+
+/* zero-initialized: all the shards are empty and unlocked */
+static struct side_table_shard shards[SIDE_TABLE_SHARDS];
+
+static inline uint64_t __hash(void* ptr) {
+  return hash_combine(0, (uint64_t) ptr);
+}
+
+static inline struct side_table_shard* __get_shard(uint64_t hash) {
+  return &shards[hash % SIDE_TABLE_SHARDS];
+}
+
+/* number of spins before yielding the CPU (the lock owner may have been preempted) */
+#define SIDE_TABLE_SPINS 128
+
+static inline void __shard_lock(struct side_table_shard* shard) {
+  while(atomic_exchange_explicit(&shard->lock, 1, memory_order_acquire)) {
+    int spins = 0;
+    while(atomic_load_explicit(&shard->lock, memory_order_relaxed)) {
+      if(++spins > SIDE_TABLE_SPINS) {
+	sched_yield();
+	spins = 0;
+      }
+#if defined(__x86_64__) || defined(__i386)
+      __builtin_ia32_pause();
+#endif
+    }
+  }
+}
+
+static inline void __shard_unlock(struct side_table_shard* shard) {
+  atomic_store_explicit(&shard->lock, 0, memory_order_release);
+}
+
+/* return the slot that contains key, or NULL */
+static struct side_table_entry* __find_entry(struct side_table_shard* shard,
+					     uint64_t hash, uintptr_t key) {
+  if(!shard->capacity)
+    return NULL;
+  size_t mask = shard->capacity - 1;
+  size_t i = (hash / SIDE_TABLE_SHARDS) & mask;
+  while(shard->entries[i].key != EMPTY_KEY) {
+    if(shard->entries[i].key == key)
+      return &shard->entries[i];
+    i = (i + 1) & mask;
+  }
+  return NULL;
+}
+
+/* insert (key, block) in a table that contains neither key nor tombstones */
+static void __insert_entry(struct side_table_entry* entries, size_t capacity,
+			   uint64_t hash, uintptr_t key, struct mem_block_info* block) {
+  size_t mask = capacity - 1;
+  size_t i = (hash / SIDE_TABLE_SHARDS) & mask;
+  while(entries[i].key != EMPTY_KEY && entries[i].key != TOMBSTONE_KEY)
+    i = (i + 1) & mask;
+  entries[i].key = key;
+  entries[i].block = block;
+}
+
+/* grow the table (or purge its tombstones) so that one more entry fits */
+static void __resize_shard(struct side_table_shard* shard) {
+  size_t new_capacity = shard->capacity ? shard->capacity : SIDE_TABLE_MIN_CAPACITY;
+  if((shard->nb_entries + 1) * 2 > new_capacity)
+    new_capacity *= 2;
+
+  struct side_table_entry* new_entries = libmalloc(sizeof(struct side_table_entry) * new_capacity);
+  memset(new_entries, 0, sizeof(struct side_table_entry) * new_capacity);
+  for(size_t i = 0; i < shard->capacity; i++) {
+    uintptr_t key = shard->entries[i].key;
+    if(key != EMPTY_KEY && key != TOMBSTONE_KEY)
+      __insert_entry(new_entries, new_capacity, __hash((void*)key), key, shard->entries[i].block);
+  }
+  if(shard->entries)
+    libfree(shard->entries);
+  shard->entries = new_entries;
+  shard->capacity = new_capacity;
+  shard->nb_tombstones = 0;
+}
+
+static void __free_block_locked(struct side_table_shard* shard, struct mem_block_info* block) {
+  block->u_ptr = shard->free_blocks;
+  shard->free_blocks = block;
+}
+
+struct mem_block_info* side_table_new_block(void* ptr, size_t size) {
+  struct side_table_shard* shard = __get_shard(__hash(ptr));
+  __shard_lock(shard);
+  if(!shard->free_blocks) {
+    struct mem_block_info* chunk = libmalloc(sizeof(struct mem_block_info) * SIDE_TABLE_BLOCK_CHUNK);
+    for(int i = 0; i < SIDE_TABLE_BLOCK_CHUNK; i++)
+      __free_block_locked(shard, &chunk[i]);
+  }
+  struct mem_block_info* block = shard->free_blocks;
+  shard->free_blocks = block->u_ptr;
+  __shard_unlock(shard);
+
+  block->u_ptr = ptr;
+  block->p_ptr = ptr;
+  block->mem_type = MEM_TYPE_MALLOC;
+  block->total_size = size;
+  block->size = size;
+  block->tail_block = NULL;
+  block->record_info = NULL;
+  block->canary = _NO_CANARY_PATTERN;
+  return block;
+}
+
+void side_table_free_block(struct mem_block_info* block) {
+  struct side_table_shard* shard = __get_shard(__hash(block->u_ptr));
+  __shard_lock(shard);
+  __free_block_locked(shard, block);
+  __shard_unlock(shard);
+}
+
+struct mem_block_info* side_table_insert(struct mem_block_info* block) {
+  uintptr_t key = (uintptr_t) block->u_ptr;
+  uint64_t hash = __hash(block->u_ptr);
+  struct side_table_shard* shard = __get_shard(hash);
+  __shard_lock(shard);
+
+  struct side_table_entry* entry = __find_entry(shard, hash, key);
+  if(entry) {
+    /* the previous buffer at this address was freed behind our back (eg.
+     * before numamma was initialized)
+     */
+    struct mem_block_info* stale = entry->block != block ? entry->block : NULL;
+    entry->block = block;
+    __shard_unlock(shard);
+    return stale;
+  }
+
+  if((shard->nb_entries + shard->nb_tombstones + 1) * 2 > shard->capacity)
+    __resize_shard(shard);
+  __insert_entry(shard->entries, shard->capacity, hash, key, block);
+  shard->nb_entries++;
+  __shard_unlock(shard);
+  return NULL;
+}
+
+struct mem_block_info* side_table_lookup(void* ptr) {
+  uint64_t hash = __hash(ptr);
+  struct side_table_shard* shard = __get_shard(hash);
+  __shard_lock(shard);
+  struct side_table_entry* entry = __find_entry(shard, hash, (uintptr_t) ptr);
+  struct mem_block_info* retval = entry ? entry->block : NULL;
+  __shard_unlock(shard);
+  return retval;
+}
+
+struct mem_block_info* side_table_remove(void* ptr) {
+  uint64_t hash = __hash(ptr);
+  struct side_table_shard* shard = __get_shard(hash);
+  __shard_lock(shard);
+  struct side_table_entry* entry = __find_entry(shard, hash, (uintptr_t) ptr);
+  struct mem_block_info* retval = NULL;
+  if(entry) {
+    retval = entry->block;
+    entry->key = TOMBSTONE_KEY;
+    entry->block = NULL;
+    shard->nb_entries--;
+    shard->nb_tombstones++;
+  }
+  __shard_unlock(shard);
+  return retval;
+}
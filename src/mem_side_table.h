@@ -0,0 +1,32 @@
+#ifndef MEM_SIDE_TABLE_H
+#define MEM_SIDE_TABLE_H
+
+/* Out-of-band allocation metadata.
+ *
+ * When NUMAMMA_SIDE_TABLE is set, buffers are allocated without header nor
+ * canary, and their mem_block_info is stored in a hash table indexed by the
+ * address returned to the application. The table is split into shards, each
+ * protected by its own lock.
+ */
+#include "mem_intercept.h"
+
+/* allocate a mem_block_info that describes the buffer [ptr, ptr+size[ */
+struct mem_block_info* side_table_new_block(void* ptr, size_t size);
+
+/* release a mem_block_info allocated by side_table_new_block */
+void side_table_free_block(struct mem_block_info* block);
+
+/* register block (indexed by block->u_ptr).
+ * If another block is already registered at the same address (eg. the buffer
+ * was freed behind our back), it is unregistered and returned so that the
+ * caller can record its deallocation and release it. Otherwise, return NULL
+ */
+struct mem_block_info* side_table_insert(struct mem_block_info* block);
+
+/* return the block registered at address ptr, or NULL */
+struct mem_block_info* side_table_lookup(void* ptr);
+
+/* unregister the block registered at address ptr and return it (or NULL) */
+struct mem_block_info* side_table_remove(void* ptr);
+
+#endif	/* MEM_SIDE_TABLE_H */
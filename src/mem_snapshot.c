@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <semaphore.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "mem_snapshot.h"
+#include "mem_intercept.h"
+#include "mem_analyzer.h"
+#include "mem_tools.h"
+
+static sem_t snapshot_sem;
+static pthread_t snapshot_thread;
+static _Atomic int snapshot_running = 0;
+static _Atomic int snapshot_stop = 0;
+static unsigned nb_snapshots = 0;
+
+static void __snapshot_signal_handler(int signo) {
+  /* sem_post is async-signal-safe: the snapshot is written by the snapshot thread */
+  sem_post(&snapshot_sem);
+}
+
+static void __write_snapshot(void) {
+  char basename[STRING_LEN];
+  char filename[4096];
+  char tmp_filename[4096 + 8];
+  snprintf(basename, STRING_LEN, "snapshot_%u.jsonl", nb_snapshots);
+  create_log_filename(basename, filename, 4096);
+
+  /* the snapshot appears once it is complete */
+  snprintf(tmp_filename, sizeof(tmp_filename), "%s.tmp", filename);
+  ma_snapshot(tmp_filename, nb_snapshots);
+  if(rename(tmp_filename, filename) < 0)
+    fprintf(stderr, "[NumaMMA] failed to write %s: %s\n", filename, strerror(errno));
+  nb_snapshots++;
+}
+
+static void* __snapshot_function(void* arg) {
+  /* the allocations of the snapshot thread are not recorded, and the
+   * signals are handled by the application threads
+   */
+  is_recurse_unsafe++;
+  sigset_t mask;
+  sigfillset(&mask);
+  pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+  for(;;) {
+    int ret;
+    if(settings.snapshot_interval > 0) {
+      struct timespec deadline;
+      clock_gettime(CLOCK_REALTIME, &deadline);
+      deadline.tv_sec += settings.snapshot_interval;
+      while((ret = sem_timedwait(&snapshot_sem, &deadline)) < 0 && errno == EINTR)
+	;
+    } else {
+      while((ret = sem_wait(&snapshot_sem)) < 0 && errno == EINTR)
+	;
+    }
+    if(atomic_load(&snapshot_stop))
+      break;
+    __write_snapshot();
+  }
+  return NULL;
+}
+
+void snapshot_init(void) {
+  if(settings.snapshot_interval <= 0 && !settings.snapshot_signal)
+    return;
+
+  sem_init(&snapshot_sem, 0, 0);
+  /* libpthread_create: the snapshot thread is not an application thread */
+  if(libpthread_create(&snapshot_thread, NULL, __snapshot_function, NULL) != 0) {
+    fprintf(stderr, "[NumaMMA] cannot create the snapshot thread\n");
+    return;
+  }
+  atomic_store(&snapshot_running, 1);
+
+  if(settings.snapshot_signal) {
+    struct sigaction s;
+    memset(&s, 0, sizeof(s));
+    s.sa_handler = __snapshot_signal_handler;
+    s.sa_flags = SA_RESTART;
+    sigemptyset(&s.sa_mask);
+    if(sigaction(SIGUSR2, &s, NULL) < 0)
+      perror("sigaction failed");
+  }
+}
+
+void snapshot_finalize(void) {
+  if(!atomic_load(&snapshot_running))
+    return;
+  if(settings.snapshot_signal)
+    signal(SIGUSR2, SIG_IGN);
+  atomic_store(&snapshot_stop, 1);
+  sem_post(&snapshot_sem);
+  pthread_join(snapshot_thread, NULL);
+  atomic_store(&snapshot_running, 0);
+}
@@ -0,0 +1,20 @@
+#ifndef MEM_SNAPSHOT_H
+#define MEM_SNAPSHOT_H
+
+/* Snapshots of the report while the application runs.
+ *
+ * A background thread writes snapshot_<N>.jsonl in the output directory
+ * every settings.snapshot_interval seconds, and/or when the process
+ * receives SIGUSR2 (settings.snapshot_signal). A snapshot has the format of
+ * report.jsonl (see mem_report.h), starting with a "snapshot" line, and
+ * its counters are either cumulative or since the previous snapshot
+ * (settings.snapshot_mode).
+ */
+
+/* start the snapshot thread if snapshots are enabled */
+void snapshot_init(void);
+
+/* stop the snapshot thread */
+void snapshot_finalize(void);
+
+#endif	/* MEM_SNAPSHOT_H */
@@ -0,0 +1,149 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "mem_strings.h"
+#include "mem_tools.h"
+
+/* the strings are copied in blocks of STRING_BLOCK_SIZE bytes */
+#define STRING_BLOCK_SIZE (64*1024)
+/* strings larger than this get their own block */
+#define STRING_MAX_INLINE (STRING_BLOCK_SIZE/4)
+
+/* id -> string: a two-level table of STRING_PAGE_SIZE strings per page */
+#define STRING_PAGE_SHIFT 12
+#define STRING_PAGE_SIZE (1 << STRING_PAGE_SHIFT)
+#define STRING_MAX_PAGES 4096
+
+#define STRING_INDEX_MIN_CAPACITY 1024
+
+/* a slot of the hash index */
+struct string_slot {
+  string_id_t id;		/* STRING_ID_NONE if the slot is empty */
+  uint32_t hash;
+};
+
+/* pages are published with a release store, so that string_get can read them without locking */
+static _Atomic(const char**) string_pages[STRING_MAX_PAGES];
+static string_id_t next_string_id = 1;
+
+static char* block_cursor = NULL;
+static char* block_end = NULL;
+
+/* the hash index is an open addressing hash table (with linear probing) */
+static struct string_slot* index_slots = NULL;
+static size_t index_capacity = 0;	/* always a power of 2 */
+
+static pthread_mutex_t strings_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* copy str in the blob */
+static const char* __copy_string(const char* str, size_t len) {
+  char* retval;
+  if(len + 1 > STRING_MAX_INLINE) {
+    retval = mem_arena_alloc(len + 1);
+  } else {
+    if(block_cursor + len + 1 > block_end) {
+      block_cursor = mem_arena_alloc(STRING_BLOCK_SIZE);
+      block_end = block_cursor + STRING_BLOCK_SIZE;
+    }
+    retval = block_cursor;
+    block_cursor += len + 1;
+  }
+  memcpy(retval, str, len + 1);
+  return retval;
+}
+
+/* insert (id, hash) in a table that does not contain id */
+static void __index_insert(struct string_slot* slots, size_t capacity,
+			   string_id_t id, uint32_t hash) {
+  size_t mask = capacity - 1;
+  size_t i = hash & mask;
+  while(slots[i].id != STRING_ID_NONE)
+    i = (i + 1) & mask;
+  slots[i].id = id;
+  slots[i].hash = hash;
+}
+
+static void __index_grow() {
+  size_t new_capacity = index_capacity ? index_capacity * 2 : STRING_INDEX_MIN_CAPACITY;
+  struct string_slot* new_slots = mem_arena_alloc(sizeof(struct string_slot) * new_capacity);
+  memset(new_slots, 0, sizeof(struct string_slot) * new_capacity);
+  for(size_t i = 0; i < index_capacity; i++) {
+    if(index_slots[i].id != STRING_ID_NONE)
+      __index_insert(new_slots, new_capacity, index_slots[i].id, index_slots[i].hash);
+  }
+  if(index_slots)
+    mem_arena_free(index_slots, sizeof(struct string_slot) * index_capacity);
+  index_slots = new_slots;
+  index_capacity = new_capacity;
+}
+
+/* register str as the string identified by id */
+static void __set_string(string_id_t id, const char* str) {
+  size_t page_no = id >> STRING_PAGE_SHIFT;
+  const char** page = atomic_load_explicit(&string_pages[page_no], memory_order_relaxed);
+  if(!page) {
+    page = mem_arena_alloc(sizeof(const char*) * STRING_PAGE_SIZE);
+    atomic_store_explicit(&string_pages[page_no], page, memory_order_release);
+  }
+  page[id & (STRING_PAGE_SIZE - 1)] = str;
+}
+
+string_id_t string_intern(const char* str) {
+  if(!str)
+    return STRING_ID_NONE;
+  uint32_t hash = hash_string(0, str);
+  string_id_t retval = STRING_ID_NONE;
+
+  pthread_mutex_lock(&strings_lock);
+  if(index_capacity) {
+    size_t mask = index_capacity - 1;
+    for(size_t i = hash & mask; index_slots[i].id != STRING_ID_NONE; i = (i + 1) & mask) {
+      if(index_slots[i].hash == hash &&
+	 strcmp(string_get(index_slots[i].id), str) == 0) {
+	retval = index_slots[i].id;
+	goto out;
+      }
+    }
+  }
+
+  /* this is a new string */
+  if(next_string_id >> STRING_PAGE_SHIFT >= STRING_MAX_PAGES) {
+    fprintf(stderr, "numamma: too many strings\n");
+    abort();
+  }
+  if((next_string_id + 1) * 2 > index_capacity)
+    __index_grow();
+  retval = next_string_id++;
+  __set_string(retval, __copy_string(str, strlen(str)));
+  __index_insert(index_slots, index_capacity, retval, hash);
+
+ out:
+  pthread_mutex_unlock(&strings_lock);
+  return retval;
+}
+
+const char* string_get(string_id_t id) {
+  if(id == STRING_ID_NONE)
+    return NULL;
+  const char** page = atomic_load_explicit(&string_pages[id >> STRING_PAGE_SHIFT],
+					   memory_order_acquire);
+  if(!page)
+    /* the strings were released */
+    return NULL;
+  return page[id & (STRING_PAGE_SIZE - 1)];
+}
+
+void string_release() {
+  pthread_mutex_lock(&strings_lock);
+  for(size_t i = 0; i < STRING_MAX_PAGES; i++)
+    atomic_store_explicit(&string_pages[i], NULL, memory_order_release);
+  next_string_id = 1;
+  block_cursor = NULL;
+  block_end = NULL;
+  index_slots = NULL;
+  index_capacity = 0;
+  pthread_mutex_unlock(&strings_lock);
+}
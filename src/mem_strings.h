@@ -0,0 +1,30 @@
+#ifndef MEM_STRINGS_H
+#define MEM_STRINGS_H
+
+/* Interned strings.
+ *
+ * Each distinct string is stored once in an append-only blob and is
+ * identified by a compact id. Strings are never moved nor freed, so the
+ * pointer returned by string_get remains valid until numamma terminates.
+ */
+#include <stdint.h>
+
+typedef uint32_t string_id_t;
+
+/* the id of "no string". string_get returns NULL for this id */
+#define STRING_ID_NONE 0
+
+/* return the id of str. The string is copied the first time it is interned.
+ * This function is thread-safe
+ */
+string_id_t string_intern(const char* str);
+
+/* return the string identified by id. This function does not take any lock */
+const char* string_get(string_id_t id);
+
+/* forget all the strings (before the arenas that contain them are
+ * released). string_get returns NULL for the previous ids
+ */
+void string_release();
+
+#endif	/* MEM_STRINGS_H */
@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "mem_threads.h"
+#include "mem_tools.h"
+
+#define THREAD_TABLE_MIN_CAPACITY 64
+
+/* rank -> record */
+struct rank_table {
+  size_t capacity;
+  struct thread_record* records[];
+};
+
+/* tid -> rank: an open addressing hash table (with linear probing). Each
+ * slot contains (tid << 32 | rank), so that readers see consistent pairs
+ */
+struct tid_table {
+  size_t capacity;		/* always a power of 2 */
+  _Atomic uint64_t slots[];
+};
+
+#define TID_SLOT(tid, rank) (((uint64_t)(uint32_t)(tid) << 32) | (uint32_t)(rank))
+#define TID_SLOT_TID(slot) ((pid_t)((slot) >> 32))
+#define TID_SLOT_RANK(slot) ((unsigned)((slot) & 0xffffffff))
+
+/* The tables are only modified by thread_registry_add (that holds
+ * registry_lock). When a table is full, a larger copy is published, and the
+ * old table is kept since readers may still be using it
+ */
+static struct rank_table* _Atomic rank_table = NULL;
+static struct tid_table* _Atomic tid_table = NULL;
+static _Atomic unsigned nb_threads = 0;
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline size_t __tid_hash(pid_t tid) {
+  return hash_combine(0, tid);
+}
+
+/* insert (tid, rank) in table. If a terminated thread had the same tid, its
+ * slot is overwritten
+ */
+static void __tid_insert(struct tid_table* table, pid_t tid, unsigned rank) {
+  size_t mask = table->capacity - 1;
+  size_t i = __tid_hash(tid) & mask;
+  uint64_t slot;
+  while((slot = atomic_load_explicit(&table->slots[i], memory_order_relaxed)) &&
+	TID_SLOT_TID(slot) != tid)
+    i = (i + 1) & mask;
+  atomic_store_explicit(&table->slots[i], TID_SLOT(tid, rank), memory_order_release);
+}
+
+/* make sure that the tables can hold one more thread. registry_lock must be held */
+static void __grow_tables(unsigned nb) {
+  struct rank_table* ranks = atomic_load_explicit(&rank_table, memory_order_relaxed);
+  if(!ranks || nb + 1 > ranks->capacity) {
+    size_t capacity = ranks ? ranks->capacity * 2 : THREAD_TABLE_MIN_CAPACITY;
+    struct rank_table* new_ranks = mem_arena_alloc(sizeof(struct rank_table) +
+						   sizeof(struct thread_record*) * capacity);
+    new_ranks->capacity = capacity;
+    memset(new_ranks->records, 0, sizeof(struct thread_record*) * capacity);
+    if(ranks)
+      memcpy(new_ranks->records, ranks->records, sizeof(struct thread_record*) * nb);
+    atomic_store_explicit(&rank_table, new_ranks, memory_order_release);
+  }
+
+  struct tid_table* tids = atomic_load_explicit(&tid_table, memory_order_relaxed);
+  if(!tids || (nb + 1) * 2 > tids->capacity) {
+    size_t capacity = tids ? tids->capacity * 2 : THREAD_TABLE_MIN_CAPACITY;
+    struct tid_table* new_tids = mem_arena_alloc(sizeof(struct tid_table) +
+						 sizeof(_Atomic uint64_t) * capacity);
+    new_tids->capacity = capacity;
+    for(size_t i = 0; i < capacity; i++)
+      atomic_init(&new_tids->slots[i], 0);
+    for(size_t i = 0; tids && i < tids->capacity; i++) {
+      uint64_t slot = atomic_load_explicit(&tids->slots[i], memory_order_relaxed);
+      if(slot)
+	__tid_insert(new_tids, TID_SLOT_TID(slot), TID_SLOT_RANK(slot));
+    }
+    atomic_store_explicit(&tid_table, new_tids, memory_order_release);
+  }
+}
+
+struct thread_record* thread_registry_add(pid_t tid) {
+  struct thread_record* record = mem_arena_alloc(sizeof(struct thread_record));
+  record->tid = tid;
+  atomic_init(&record->sm, NULL);
+  atomic_init(&record->sm_wr, NULL);
+  atomic_init(&record->nb_collectors, 0);
+
+  pthread_mutex_lock(&registry_lock);
+  unsigned nb = atomic_load_explicit(&nb_threads, memory_order_relaxed);
+  __grow_tables(nb);
+  record->rank = nb;
+  atomic_load_explicit(&rank_table, memory_order_relaxed)->records[nb] = record;
+  __tid_insert(atomic_load_explicit(&tid_table, memory_order_relaxed), tid, nb);
+  /* publish the record */
+  atomic_store_explicit(&nb_threads, nb + 1, memory_order_release);
+  pthread_mutex_unlock(&registry_lock);
+  return record;
+}
+
+struct thread_record* thread_registry_get(unsigned rank) {
+  /* the rank table is published before nb_threads, so reading nb_threads
+   * first guarantees that the table contains the record
+   */
+  if(rank >= atomic_load_explicit(&nb_threads, memory_order_acquire))
+    return NULL;
+  return atomic_load_explicit(&rank_table, memory_order_acquire)->records[rank];
+}
+
+struct thread_record* thread_registry_find(pid_t tid) {
+  struct tid_table* table = atomic_load_explicit(&tid_table, memory_order_acquire);
+  if(!table)
+    return NULL;
+  size_t mask = table->capacity - 1;
+  for(size_t i = __tid_hash(tid) & mask; ; i = (i + 1) & mask) {
+    uint64_t slot = atomic_load_explicit(&table->slots[i], memory_order_acquire);
+    if(!slot)
+      return NULL;
+    if(TID_SLOT_TID(slot) == tid)
+      return thread_registry_get(TID_SLOT_RANK(slot));
+  }
+}
+
+unsigned thread_registry_size(void) {
+  return atomic_load_explicit(&nb_threads, memory_order_acquire);
+}
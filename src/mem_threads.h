@@ -0,0 +1,43 @@
+#ifndef MEM_THREADS_H
+#define MEM_THREADS_H
+
+/* Registry of the threads that are analyzed.
+ *
+ * Each thread gets a rank when it registers (0 for the first one). A
+ * thread can be found from its rank or from its tid without taking any
+ * lock. The registry grows without bounds: records never move, and the
+ * tables that index them are replaced (not modified) when they are full.
+ */
+#include <sys/types.h>
+
+struct numap_sampling_measure;
+
+struct thread_record {
+  unsigned rank;
+  pid_t tid;
+  /* sampling buffers of the thread (see mem_sampling.c), NULL if the
+   * thread is not sampled
+   */
+  struct numap_sampling_measure* _Atomic sm;
+  struct numap_sampling_measure* _Atomic sm_wr;
+  /* number of threads that are collecting the samples of the thread. The
+   * buffers are released once it drops to 0
+   */
+  _Atomic unsigned nb_collectors;
+};
+
+/* register the thread tid and return its record */
+struct thread_record* thread_registry_add(pid_t tid);
+
+/* return the thread whose rank is rank, or NULL */
+struct thread_record* thread_registry_get(unsigned rank);
+
+/* return the thread whose tid is tid, or NULL. If the tid was reused by
+ * the kernel, return the thread that registered last
+ */
+struct thread_record* thread_registry_find(pid_t tid);
+
+/* return the number of threads that registered so far */
+unsigned thread_registry_size(void);
+
+#endif	/* MEM_THREADS_H */
@@ -1,11 +1,17 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <execinfo.h>
+#include <dlfcn.h>
+#include <link.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #include "numamma.h"
 #include "mem_tools.h"
 #include "mem_intercept.h"
-#include "hash.h"
+#include "btree.h"
 
 #define HAVE_LIBBACKTRACE 1
 #if HAVE_LIBBACKTRACE
@@ -14,8 +20,6 @@
 #endif
 
 
-struct ht_node* symbols=NULL;
-
 void print_backtrace(int backtrace_max_depth) {
   if(!IS_RECURSE_SAFE)
     return;
@@ -47,26 +51,121 @@ void print_backtrace(int backtrace_max_depth) {
 
 
 #if HAVE_LIBBACKTRACE
-__thread char current_frame[4096];
+/* libbacktrace states are meant to be created once and never freed */
+static struct backtrace_state *backtrace_state = NULL;
+static pthread_once_t backtrace_state_once = PTHREAD_ONCE_INIT;
 
 static void error_callback(void *data, const char *msg, int errnum)
 {
   fprintf(stderr, "ERROR: %s (%d)", msg, errnum);
 }
 
+static void __create_backtrace_state() {
+  backtrace_state = backtrace_create_state (NULL, BACKTRACE_SUPPORTS_THREADS,
+					    error_callback, NULL);
+}
+
+static struct backtrace_state* __get_backtrace_state() {
+  pthread_once(&backtrace_state_once, __create_backtrace_state);
+  return backtrace_state;
+}
+
 static int backtrace_callback (void *data, uintptr_t pc,
 			       const char *filename, int lineno,
 			       const char *function) {
+  char* frame = data;
   if(!function) {
     /* symbol can't be resolved */
-    current_frame[0]='\0';
+    frame[0]='\0';
   } else {
-    snprintf(current_frame, 4096, "%s:%d(%s)", filename, lineno, function);
+    snprintf(frame, STRING_LEN, "%s:%d(%s)", filename, lineno, function);
   }
   return 0;
 }
 #endif /* HAVE_LIBBACKTRACE */
 
+/* the symbol cache is split into shards in order to reduce contention */
+#define SYMBOL_SHARDS 64
+struct symbol_shard {
+  pthread_rwlock_t lock;
+  struct btree symbols;
+} __attribute__ ((aligned (64)));
+
+static struct symbol_shard symbol_cache[SYMBOL_SHARDS];
+static pthread_once_t symbol_cache_once = PTHREAD_ONCE_INIT;
+
+static void __init_symbol_cache() {
+  for(int i=0; i<SYMBOL_SHARDS; i++) {
+    pthread_rwlock_init(&symbol_cache[i].lock, NULL);
+    bt_init(&symbol_cache[i].symbols);
+  }
+}
+
+static struct symbol_shard* __get_symbol_shard(void* rip) {
+  pthread_once(&symbol_cache_once, __init_symbol_cache);
+  return &symbol_cache[hash_combine(0, (uint64_t)rip) % SYMBOL_SHARDS];
+}
+
+void symbol_cache_release() {
+  pthread_once(&symbol_cache_once, __init_symbol_cache);
+  for(int i=0; i<SYMBOL_SHARDS; i++) {
+    pthread_rwlock_wrlock(&symbol_cache[i].lock);
+    bt_init(&symbol_cache[i].symbols);
+    pthread_rwlock_unlock(&symbol_cache[i].lock);
+  }
+}
+
+/* search for rip in the symbol cache. The cache stores the id of the interned symbol */
+static string_id_t __lookup_symbol(void* rip) {
+  struct symbol_shard* shard = __get_symbol_shard(rip);
+  pthread_rwlock_rdlock(&shard->lock);
+  string_id_t retval = (uintptr_t) bt_get_value(&shard->symbols, (uint64_t) rip);
+  pthread_rwlock_unlock(&shard->lock);
+  return retval;
+}
+
+/* add (rip, symbol) to the symbol cache */
+static string_id_t __insert_symbol(void* rip, string_id_t symbol) {
+  struct symbol_shard* shard = __get_symbol_shard(rip);
+  pthread_rwlock_wrlock(&shard->lock);
+  if(!bt_contains_key(&shard->symbols, (uint64_t) rip))
+    bt_insert(&shard->symbols, (uint64_t) rip, (void*)(uintptr_t) symbol);
+  pthread_rwlock_unlock(&shard->lock);
+  return symbol;
+}
+
+/* resolve the name of the function located at rip (without using the cache) */
+static string_id_t __resolve_symbol(void* rip) {
+  if(!rip) {
+    return string_intern("???");
+  }
+
+  if(settings.defer_symbols) {
+    /* the address is resolved after the execution by numamma-symbolize */
+    char frame[STRING_LEN];
+    snprintf(frame, STRING_LEN, DEFERRED_SYMBOL_FORMAT, (uintptr_t) rip);
+    return string_intern(frame);
+  }
+
+#if HAVE_LIBBACKTRACE
+  char frame[STRING_LEN];
+  frame[0] = '\0';
+  backtrace_pcinfo (__get_backtrace_state(), (uintptr_t) rip,
+		    backtrace_callback,
+		    error_callback,
+		    frame);
+  if(frame[0] != '\0') {
+    return string_intern(frame);
+  }
+#endif
+  /* symbol can't be resolved by libbacktrace, use the symbol name */
+  char **functions;
+  functions = backtrace_symbols(&rip, 1);
+  string_id_t retval = string_intern(functions[0]);
+  free(functions);
+  return retval;
+}
+
 void** get_caller_rip(int depth, int* size_callstack, void** caller_rip) {
     static int max_depth = 20;
     int backtrace_depth=max_depth+1;
@@ -88,84 +187,256 @@ void** get_caller_rip(int depth, int* size_callstack, void** caller_rip) {
     return buffer;
 }
 
-char* get_caller_function_from_rip(void* rip) {
-  char* retval = NULL;
-
+string_id_t get_caller_function_from_rip(void* rip) {
   /* check if the function corresponding to rip is already known */
-  retval = ht_get_value(symbols, (uint64_t) rip);
+  string_id_t retval = __lookup_symbol(rip);
   if(retval)
     return retval;
 
-  if(!rip) {
-    retval = libmalloc(sizeof(char)*16);
-    sprintf(retval, "???");
-    symbols = ht_insert(symbols, (uint64_t) rip, retval);
-    return retval;
-  }
+  return __insert_symbol(rip, __resolve_symbol(rip));
+}
 
-#if HAVE_LIBBACKTRACE
-  struct backtrace_state *state = backtrace_create_state (NULL, BACKTRACE_SUPPORTS_THREADS,
-							  error_callback, NULL);
+struct symbol_request {
+  void* rip;
+  uintptr_t module_base;
+  int index;
+};
 
-#endif
-#if HAVE_LIBBACKTRACE
-  backtrace_pcinfo (state, (uintptr_t) rip,
-		    backtrace_callback,
-		    error_callback,
-		    NULL);
-  if(current_frame[0] != '\0') {
-    retval = libmalloc(sizeof(char)*4096);
-    sprintf(retval, "%s", current_frame);
-    symbols = ht_insert(symbols, (uint64_t) rip, retval);
-    return retval;
+static int __compare_symbol_requests(const void* a, const void* b) {
+  const struct symbol_request* req_a = a;
+  const struct symbol_request* req_b = b;
+  if(req_a->module_base != req_b->module_base)
+    return req_a->module_base < req_b->module_base ? -1 : 1;
+  if(req_a->rip != req_b->rip)
+    return (uintptr_t)req_a->rip < (uintptr_t)req_b->rip ? -1 : 1;
+  return 0;
+}
+
+void get_caller_functions_from_rips(void** rips, int nb_rips, string_id_t* symbols) {
+  if(nb_rips <= 0)
+    return;
+
+  /* sort the addresses by module so that libbacktrace explores the debug
+   * information of each module in one pass, and resolve each address only once
+   */
+  struct symbol_request* requests = libmalloc(sizeof(struct symbol_request) * nb_rips);
+  int nb_requests = 0;
+  for(int i=0; i<nb_rips; i++) {
+    symbols[i] = __lookup_symbol(rips[i]);
+    if(symbols[i])
+      continue;
+    Dl_info info;
+    requests[nb_requests].rip = rips[i];
+    requests[nb_requests].module_base = 0;
+    if(rips[i] && dladdr(rips[i], &info))
+      requests[nb_requests].module_base = (uintptr_t)info.dli_fbase;
+    requests[nb_requests].index = i;
+    nb_requests++;
   }
-#endif
-  /* symbol can't be resolved by libbacktrace, use the symbol name */
-  char **functions;
-  functions = backtrace_symbols(&rip, 1);
-  retval = libmalloc(sizeof(char)*4096);
-  sprintf(retval, "%s", functions[0]);
-  free(functions);
-  symbols = ht_insert(symbols, (uint64_t) rip, retval);
-  return retval;
+  qsort(requests, nb_requests, sizeof(struct symbol_request), __compare_symbol_requests);
+
+  string_id_t symbol = STRING_ID_NONE;
+  for(int i=0; i<nb_requests; i++) {
+    if(i == 0 || requests[i].rip != requests[i-1].rip) {
+      symbol = __insert_symbol(requests[i].rip, __resolve_symbol(requests[i].rip));
+    }
+    symbols[requests[i].index] = symbol;
+  }
+  libfree(requests);
 }
 
-char* get_caller_function(int depth) {
+string_id_t get_caller_function(int depth) {
   int backtrace_depth=depth+1;
   void* buffer[backtrace_depth];
   /* get pointers to functions */
 
   int nb_calls = backtrace(buffer, backtrace_depth);
+  if(nb_calls < depth) {
+    return get_caller_function_from_rip(NULL);
+  }
+  return get_caller_function_from_rip(buffer[depth]);
+}
 
-#if HAVE_LIBBACKTRACE
-  struct backtrace_state *state = backtrace_create_state (NULL, BACKTRACE_SUPPORTS_THREADS,
-							  error_callback, NULL);
-#endif
+/* search for the NT_GNU_BUILD_ID note in a PT_NOTE segment and print it in hex into build_id */
+static int __get_build_id(const uint8_t* notes, size_t size, char* build_id, size_t build_id_len) {
+  size_t pos = 0;
+  while(pos + sizeof(ElfW(Nhdr)) <= size) {
+    const ElfW(Nhdr)* note = (const ElfW(Nhdr)*) (notes + pos);
+    size_t name_size = (note->n_namesz + 3) & ~3;
+    size_t desc_size = (note->n_descsz + 3) & ~3;
+    const uint8_t* desc = notes + pos + sizeof(ElfW(Nhdr)) + name_size;
+    if(note->n_type == NT_GNU_BUILD_ID && note->n_namesz == 4 &&
+       memcmp(notes + pos + sizeof(ElfW(Nhdr)), "GNU", 4) == 0) {
+      if(2*note->n_descsz + 1 > build_id_len)
+	return 0;
+      for(int i=0; i<note->n_descsz; i++)
+	sprintf(&build_id[2*i], "%02x", desc[i]);
+      return 1;
+    }
+    pos += sizeof(ElfW(Nhdr)) + name_size + desc_size;
+  }
+  return 0;
+}
 
-  char* retval = NULL;
-  if(nb_calls < depth) {
-    retval = libmalloc(sizeof(char)*16);
-    sprintf(retval, "???");
-    return retval;
+static int __print_module(struct dl_phdr_info *info, size_t size, void *data) {
+  FILE* f = data;
+  uintptr_t start = UINTPTR_MAX;
+  uintptr_t end = 0;
+  char build_id[STRING_LEN];
+  snprintf(build_id, STRING_LEN, "-");
+
+  for(int i=0; i<info->dlpi_phnum; i++) {
+    const ElfW(Phdr)* phdr = &info->dlpi_phdr[i];
+    uintptr_t seg_start = info->dlpi_addr + phdr->p_vaddr;
+    if(phdr->p_type == PT_LOAD) {
+      if(seg_start < start)
+	start = seg_start;
+      if(seg_start + phdr->p_memsz > end)
+	end = seg_start + phdr->p_memsz;
+    } else if(phdr->p_type == PT_NOTE && build_id[0] == '-') {
+      if(!__get_build_id((const uint8_t*) seg_start, phdr->p_memsz, build_id, STRING_LEN))
+	snprintf(build_id, STRING_LEN, "-");
+    }
   }
+  if(start >= end)
+    return 0;
 
-#if HAVE_LIBBACKTRACE
-  backtrace_pcinfo (state, (uintptr_t) buffer[depth],
-		    backtrace_callback,
-		    error_callback,
-		    NULL);
-  if(current_frame[0] != '\0') {
-    retval = libmalloc(sizeof(char)*4096);
-    sprintf(retval, "%s", current_frame);
-    return retval;
+  const char* path = info->dlpi_name;
+  char exe_path[STRING_LEN];
+  if(!path || path[0] == '\0') {
+    /* the main program has an empty name */
+    ssize_t len = readlink("/proc/self/exe", exe_path, STRING_LEN-1);
+    if(len < 0)
+      len = 0;
+    exe_path[len] = '\0';
+    path = exe_path;
   }
-#endif
-  /* symbol can't be resolved by libbacktrace, use the symbol name */
-  char **functions;
-  functions = backtrace_symbols(buffer, nb_calls);
-  retval = libmalloc(sizeof(char)*4096);
-  sprintf(retval, "%s", functions[depth]);
-  free(functions);
 
-    return retval;
+  fprintf(f, "0x%"PRIxPTR"\t0x%"PRIxPTR"\t0x%"PRIxPTR"\t%s\t%s\n",
+	  start, end, (uintptr_t) info->dlpi_addr, build_id, path);
+  return 0;
+}
+
+void print_module_map(FILE* f) {
+  fprintf(f, "#start\tend\tload_base\tbuild_id\tpath\n");
+  dl_iterate_phdr(__print_module, f);
+}
+
+/* the address range of a loaded module, sorted by start address */
+struct module_range {
+  uintptr_t start;
+  uintptr_t end;
+  uintptr_t load_base;
+  uint64_t name_hash;		/* hash of the file name (without the directory) */
+};
+
+static struct module_range* module_ranges = NULL;
+static int nb_module_ranges = 0;
+static int max_module_ranges = 0;
+/* number of modules loaded by the process when module_ranges was filled */
+static unsigned long long module_ranges_adds = 0;
+static pthread_rwlock_t module_ranges_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static int __add_module_range(struct dl_phdr_info *info, size_t size, void *data) {
+  uintptr_t start = UINTPTR_MAX;
+  uintptr_t end = 0;
+  for(int i=0; i<info->dlpi_phnum; i++) {
+    const ElfW(Phdr)* phdr = &info->dlpi_phdr[i];
+    uintptr_t seg_start = info->dlpi_addr + phdr->p_vaddr;
+    if(phdr->p_type == PT_LOAD) {
+      if(seg_start < start)
+	start = seg_start;
+      if(seg_start + phdr->p_memsz > end)
+	end = seg_start + phdr->p_memsz;
+    }
+  }
+  if(start >= end)
+    return 0;
+
+  if(nb_module_ranges == max_module_ranges) {
+    max_module_ranges = max_module_ranges ? 2 * max_module_ranges : 64;
+    struct module_range* ranges = libmalloc(sizeof(struct module_range) * max_module_ranges);
+    if(module_ranges) {
+      memcpy(ranges, module_ranges, sizeof(struct module_range) * nb_module_ranges);
+      libfree(module_ranges);
+    }
+    module_ranges = ranges;
+  }
+
+  /* the main program has an empty name. The directory is ignored so that
+   * the key does not depend on where the application is installed
+   */
+  const char* name = info->dlpi_name ? info->dlpi_name : "";
+  const char* slash = strrchr(name, '/');
+  struct module_range* range = &module_ranges[nb_module_ranges++];
+  range->start = start;
+  range->end = end;
+  range->load_base = info->dlpi_addr;
+  range->name_hash = hash_string(0, slash ? slash + 1 : name);
+  return 0;
+}
+
+static int __compare_module_ranges(const void* a, const void* b) {
+  const struct module_range* range_a = a;
+  const struct module_range* range_b = b;
+  if(range_a->start != range_b->start)
+    return range_a->start < range_b->start ? -1 : 1;
+  return 0;
+}
+
+static int __get_module_adds(struct dl_phdr_info *info, size_t size, void *data) {
+  *(unsigned long long*)data = info->dlpi_adds;
+  return 1;
+}
+
+/* fill module_ranges, unless no module was loaded since the last call */
+static void __load_module_ranges() {
+  unsigned long long adds = 0;
+  dl_iterate_phdr(__get_module_adds, &adds);
+  if(module_ranges && adds == module_ranges_adds)
+    return;
+  module_ranges_adds = adds;
+  nb_module_ranges = 0;
+  dl_iterate_phdr(__add_module_range, NULL);
+  qsort(module_ranges, nb_module_ranges, sizeof(struct module_range), __compare_module_ranges);
+}
+
+static struct module_range* __find_module_range(uintptr_t rip) {
+  int first = 0;
+  int last = nb_module_ranges - 1;
+  while(first <= last) {
+    int middle = (first + last) / 2;
+    if(rip < module_ranges[middle].start)
+      last = middle - 1;
+    else if(rip >= module_ranges[middle].end)
+      first = middle + 1;
+    else
+      return &module_ranges[middle];
+  }
+  return NULL;
+}
+
+uint64_t get_callstack_key(void** rips, int nb_rips, size_t size) {
+  uint64_t key = hash_combine(0, size);
+  pthread_rwlock_rdlock(&module_ranges_lock);
+  int reloaded = 0;
+  for(int i=0; i<nb_rips; i++) {
+    uintptr_t rip = (uintptr_t) rips[i];
+    struct module_range* range = __find_module_range(rip);
+    if(!range && !reloaded) {
+      /* the module may have been loaded after the last lookup */
+      pthread_rwlock_unlock(&module_ranges_lock);
+      pthread_rwlock_wrlock(&module_ranges_lock);
+      __load_module_ranges();
+      reloaded = 1;
+      range = __find_module_range(rip);
+    }
+    if(range)
+      key = hash_combine(hash_combine(key, range->name_hash), rip - range->load_base);
+    else
+      key = hash_combine(key, rip);
+  }
+  pthread_rwlock_unlock(&module_ranges_lock);
+  /* 0 means that the object has no key */
+  return key ? key : 1;
 }
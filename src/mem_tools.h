@@ -1,8 +1,13 @@
 #ifndef MEM_TOOLS_H
 #define MEM_TOOLS_H
+#include <stdio.h>
+#include <inttypes.h>
 #include <time.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include "mem_intercept.h"
+#include "mem_arena.h"
+#include "mem_strings.h"
 
 #define  ENABLE_TICKS 1
 
@@ -10,13 +15,65 @@
 void** get_caller_rip(int depth, int* size_callstack, void** caller_rip);
 
 /* return the name (function name +line) of the instruction that called the current function */
-char* get_caller_function(int depth);
+string_id_t get_caller_function(int depth);
 
-/* return the name (function name +line) of the instruction located at address rip */
-char* get_caller_function_from_rip(void* rip);
+/* return the name (function name +line) of the instruction located at address rip.
+ * The result is an interned string (see mem_strings.h). This function is thread-safe
+ */
+string_id_t get_caller_function_from_rip(void* rip);
+
+/* fill symbols[i] with the name of the instruction located at address rips[i].
+ * The addresses are sorted by module and resolved at once
+ */
+void get_caller_functions_from_rips(void** rips, int nb_rips, string_id_t* symbols);
+
+/* empty the cache of the symbols (before the arenas that contain it are
+ * released)
+ */
+void symbol_cache_release();
 
 void print_backtraceo(int backtrace_max_depth);
 
+/* when symbols are deferred, addresses are named after this format until
+ * numamma-symbolize replaces them
+ */
+#define DEFERRED_SYMBOL_FORMAT "@0x%"PRIxPTR
+
+/* print the address range, load base, build-id and path of each loaded module */
+void print_module_map(FILE* f);
+
+/* return a key of the allocation site made of the nb_rips addresses of
+ * rips and of size. Each address is replaced with the name of its module
+ * and its offset in the module, so the key does not depend on where the
+ * modules are loaded: the same allocation site has the same key in every
+ * run of the application
+ */
+uint64_t get_callstack_key(void** rips, int nb_rips, size_t size);
+
+/* format of the stable key of an object: the key of its allocation site
+ * (see get_callstack_key), and the rank of the object among the
+ * allocations from this site (starting from 1, or 0 if unknown)
+ */
+#define OBJECT_KEY_FORMAT "%016"PRIx64"-%u"
+#define OBJECT_KEY_LEN 32
+
+/* mix value into hash */
+static inline uint64_t hash_combine(uint64_t hash, uint64_t value) {
+  value *= 0xff51afd7ed558ccdULL;
+  value ^= value >> 33;
+  hash ^= value + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+  return hash;
+}
+
+/* mix the characters of str into hash */
+static inline uint64_t hash_string(uint64_t hash, const char* str) {
+  while(*str) {
+    hash ^= (uint8_t)*str++;
+    hash *= 0x100000001b3ULL;
+  }
+  return hash_combine(hash, 0);
+}
+
 
 static inline uint64_t new_date() {
   struct timespec t;
@@ -122,19 +179,26 @@ struct mem_allocator {
   unsigned long nb_allocated; /* number of blocks allocated in this buffer */
   unsigned long nb_free; /* number of available blocks */
   pthread_spinlock_t lock;
+  int is_local; /* set by mem_allocator_init_local */
+  pthread_t owner; /* the only thread that allocates blocks if is_local is set */
+  void* _Atomic remote_blocks; /* blocks freed by other threads than owner */
 };
 
-static void mem_allocator_init(struct mem_allocator **mem,
-			       size_t block_size,
-			       unsigned long nb_blocks) {
-  *mem = libmalloc(sizeof(struct mem_allocator));
+static void __mem_allocator_init(struct mem_allocator **mem,
+				 size_t block_size,
+				 unsigned long nb_blocks,
+				 int is_local) {
+  *mem = mem_arena_alloc(sizeof(struct mem_allocator));
   (*mem)->next_mem = NULL;
-  (*mem)->buffer_addr = libmalloc(block_size * nb_blocks);
+  (*mem)->buffer_addr = mem_arena_alloc(block_size * nb_blocks);
   (*mem)->first_block = (*mem)->buffer_addr;
   (*mem)->block_size = block_size;
   (*mem)->nb_allocated = nb_blocks;
   (*mem)->nb_free = nb_blocks;
   pthread_spin_init(&(*mem)->lock, PTHREAD_PROCESS_PRIVATE);
+  (*mem)->is_local = is_local;
+  (*mem)->owner = pthread_self();
+  atomic_init(&(*mem)->remote_blocks, NULL);
   int i;
   void**ptr = (*mem)->first_block;
   /* create a linked list of blocks */
@@ -145,15 +209,55 @@ static void mem_allocator_init(struct mem_allocator **mem,
   *ptr = NULL;
 }
 
+/* create an allocator that can be used by any thread */
+static void mem_allocator_init(struct mem_allocator **mem,
+			       size_t block_size,
+			       unsigned long nb_blocks) {
+  __mem_allocator_init(mem, block_size, nb_blocks, 0);
+}
+
+/* create an allocator from which only the current thread allocates blocks.
+ * Allocating does not take any lock. Blocks can be freed by any thread
+ */
+static void mem_allocator_init_local(struct mem_allocator **mem,
+				     size_t block_size,
+				     unsigned long nb_blocks) {
+  __mem_allocator_init(mem, block_size, nb_blocks, 1);
+}
+
 static void mem_allocator_finalize(struct mem_allocator *mem) {
   if(mem) {
     mem_allocator_finalize(mem->next_mem);
-    libfree(mem->buffer_addr);
-    free(mem);
+    mem_arena_free(mem->buffer_addr, mem->block_size * mem->nb_allocated);
+    mem_arena_free(mem, sizeof(struct mem_allocator));
+  }
+}
+
+/* fast path of mem_allocator_alloc for the owner of a local allocator */
+static void* __mem_allocator_alloc_local(struct mem_allocator *mem) {
+  while(!mem->first_block) {
+    /* reclaim the blocks that were freed by other threads */
+    mem->first_block = atomic_exchange_explicit(&mem->remote_blocks, NULL,
+						memory_order_acquire);
+    if(mem->first_block)
+      break;
+    if(mem->next_mem == NULL) {
+      /* no more blocks in the current mem block, allocate a new one */
+      __mem_allocator_init(&mem->next_mem, mem->block_size, mem->nb_allocated, 1);
+    }
+    mem = mem->next_mem;
   }
+  void* retval = mem->first_block;
+  mem->first_block = *(void**)mem->first_block;
+  return retval;
 }
 
 static void* mem_allocator_alloc(struct mem_allocator *mem) {
+  if(mem->is_local) {
+    assert(pthread_equal(mem->owner, pthread_self()));
+    return __mem_allocator_alloc_local(mem);
+  }
+
   pthread_spin_lock(&mem->lock);
   while(mem->nb_free == 0) {
     /* find a mem block with available blocks */
@@ -186,6 +290,22 @@ static void* mem_allocator_alloc(struct mem_allocator *mem) {
 
 static void mem_allocator_free(struct mem_allocator *mem, void* ptr) {
   assert(mem);
+  if(mem->is_local) {
+    if(pthread_equal(mem->owner, pthread_self())) {
+      *(void**)ptr = mem->first_block;
+      mem->first_block = ptr;
+      return;
+    }
+    /* the owner takes the whole list at once, so pushing with a CAS is safe */
+    void* head = atomic_load_explicit(&mem->remote_blocks, memory_order_relaxed);
+    do {
+      *(void**)ptr = head;
+    } while(!atomic_compare_exchange_weak_explicit(&mem->remote_blocks, &head, ptr,
+						   memory_order_release,
+						   memory_order_relaxed));
+    return;
+  }
+
   pthread_spin_lock(&mem->lock);
   *(void**)ptr = mem->first_block;
   mem->first_block = ptr;
@@ -0,0 +1,659 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "mem_trace.h"
+
+/* size of the header of a chunk: nb_records, payload size, stream, first timestamp */
+#define CHUNK_HEADER_SIZE (3*sizeof(uint32_t) + sizeof(uint64_t))
+/* maximum size of a varint-encoded 64-bit integer */
+#define VARINT_MAX_SIZE 10
+/* maximum size of an encoded sample */
+#define RECORD_MAX_SIZE (3*sizeof(uint32_t) + 2*sizeof(uint8_t) + 2*VARINT_MAX_SIZE)
+/* initial capacity of the sample buffer of a trace */
+#define TRACE_MIN_RECORDS 256
+
+/* dictionary of memory levels. level_codes[key] is the code of key + 1 (or 0) */
+static _Atomic uint8_t level_codes[TRACE_LEVEL_KEYS];
+static char* level_names[TRACE_MAX_LEVELS];
+static unsigned nb_levels = 0;
+static pthread_mutex_t level_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* samples of the current chunk of a stream */
+struct trace_stream {
+  struct trace_record* records;
+  size_t nb_records;
+  size_t capacity;
+};
+
+struct trace_index {
+  struct trace_index_entry* entries;
+  size_t nb_entries;
+  size_t max_entries;
+};
+
+struct trace_writer {
+  struct trace_output* output;
+  enum trace_kind kind;
+  pthread_mutex_t lock;
+
+  struct trace_stream* streams;
+  size_t nb_streams;
+  size_t chunk_records;
+
+  /* scratch buffers, large enough for the largest stream */
+  size_t scratch_capacity;
+  uint8_t* chunk_buffer;	/* encoded chunk */
+  uint32_t* object_ids;		/* used for building the index */
+
+  uint64_t* chunk_offsets;
+  size_t nb_chunks;
+  size_t max_chunks;
+
+  struct trace_index index;	/* chunks of each object */
+  struct trace_index stream_index; /* chunks of each stream */
+};
+
+uint8_t trace_level_code(uint32_t key, const char* (*get_name)(uint32_t key)) {
+  key %= TRACE_LEVEL_KEYS;
+  uint8_t code = atomic_load_explicit(&level_codes[key], memory_order_acquire);
+  if(code)
+    return code - 1;
+
+  pthread_mutex_lock(&level_lock);
+  code = atomic_load_explicit(&level_codes[key], memory_order_relaxed);
+  if(!code) {
+    const char* name = get_name(key);
+    /* the levels that have the same name share a code */
+    for(unsigned i = 0; i < nb_levels; i++) {
+      if(strcmp(level_names[i], name) == 0) {
+	code = i + 1;
+	break;
+      }
+    }
+    if(!code) {
+      if(nb_levels < TRACE_MAX_LEVELS - 1) {
+	level_names[nb_levels] = strdup(name);
+	code = ++nb_levels;
+      } else {
+	/* the dictionary is full: the last code gathers the remaining levels */
+	if(nb_levels < TRACE_MAX_LEVELS)
+	  level_names[nb_levels++] = strdup("Other");
+	code = TRACE_MAX_LEVELS;
+      }
+    }
+    atomic_store_explicit(&level_codes[key], code, memory_order_release);
+  }
+  pthread_mutex_unlock(&level_lock);
+  return code - 1;
+}
+
+const char* trace_level_name(uint8_t code) {
+  if(code < nb_levels)
+    return level_names[code];
+  return "Unknown";
+}
+
+static void __write_at(int fd, const void* buffer, size_t size, uint64_t offset) {
+  const uint8_t* ptr = buffer;
+  while(size > 0) {
+    ssize_t ret = pwrite(fd, ptr, size, offset);
+    if(ret < 0) {
+      if(errno == EINTR)
+	continue;
+      fprintf(stderr, "[NumaMMA] failed to write a trace: %s\n", strerror(errno));
+      abort();
+    }
+    ptr += ret;
+    size -= ret;
+    offset += ret;
+  }
+}
+
+static struct trace_output* __new_output(int fd, int own_fd, int direct, uint64_t offset) {
+  struct trace_output* output = malloc(sizeof(struct trace_output));
+  output->fd = fd;
+  output->own_fd = own_fd;
+  output->direct = direct;
+  output->offset = offset;
+  output->used = 0;
+  if(posix_memalign((void**)&output->buffer, TRACE_DIRECT_IO_ALIGN, TRACE_OUTPUT_BUFFER_SIZE)) {
+    fprintf(stderr, "[NumaMMA] cannot allocate a trace buffer\n");
+    abort();
+  }
+  return output;
+}
+
+struct trace_output* trace_output_open(const char* filename, int flags) {
+  int direct = 0;
+  int fd = -1;
+  if(flags & TRACE_DIRECT_IO) {
+    fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+    /* some filesystems (eg. tmpfs) do not support O_DIRECT */
+    direct = (fd >= 0);
+  }
+  if(fd < 0)
+    fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if(fd < 0)
+    return NULL;
+  return __new_output(fd, 1, direct, 0);
+}
+
+struct trace_output* trace_output_open_fd(int fd) {
+  off_t offset = lseek(fd, 0, SEEK_END);
+  return __new_output(fd, 0, 0, offset < 0 ? 0 : offset);
+}
+
+void trace_output_write(struct trace_output* output, const void* data, size_t size) {
+  const uint8_t* ptr = data;
+  while(size > 0) {
+    size_t len = TRACE_OUTPUT_BUFFER_SIZE - output->used;
+    if(len > size)
+      len = size;
+    memcpy(output->buffer + output->used, ptr, len);
+    output->used += len;
+    ptr += len;
+    size -= len;
+    if(output->used == TRACE_OUTPUT_BUFFER_SIZE) {
+      __write_at(output->fd, output->buffer, output->used, output->offset);
+      output->offset += output->used;
+      output->used = 0;
+    }
+  }
+}
+
+void trace_output_close(struct trace_output* output) {
+  if(output->used) {
+    if(output->direct) {
+      /* O_DIRECT only writes full blocks: pad the last one, and truncate the file */
+      size_t padded = (output->used + TRACE_DIRECT_IO_ALIGN - 1) & ~(size_t)(TRACE_DIRECT_IO_ALIGN - 1);
+      memset(output->buffer + output->used, 0, padded - output->used);
+      __write_at(output->fd, output->buffer, padded, output->offset);
+      if(ftruncate(output->fd, output->offset + output->used) < 0)
+	fprintf(stderr, "[NumaMMA] failed to truncate a trace: %s\n", strerror(errno));
+    } else {
+      __write_at(output->fd, output->buffer, output->used, output->offset);
+    }
+  }
+  if(output->own_fd)
+    close(output->fd);
+  free(output->buffer);
+  free(output);
+}
+
+static inline uint8_t* __put_varint(uint8_t* ptr, uint64_t value) {
+  while(value >= 0x80) {
+    *ptr++ = (value & 0x7f) | 0x80;
+    value >>= 7;
+  }
+  *ptr++ = value;
+  return ptr;
+}
+
+static inline const uint8_t* __get_varint(const uint8_t* ptr, const uint8_t* end, uint64_t* value) {
+  uint64_t res = 0;
+  for(int shift = 0; ptr < end && shift < 64; shift += 7) {
+    uint8_t byte = *ptr++;
+    res |= (uint64_t)(byte & 0x7f) << shift;
+    if(!(byte & 0x80)) {
+      *value = res;
+      return ptr;
+    }
+  }
+  return NULL;
+}
+
+static inline uint64_t __zigzag(int64_t value) {
+  return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static inline int64_t __unzigzag(uint64_t value) {
+  return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+#define PUT_COLUMN(ptr, field, type) do {			\
+    type* __col = (type*)(ptr);					\
+    for(size_t __i = 0; __i < n; __i++)				\
+      __col[__i] = s->records[__i].field;			\
+    (ptr) += n * sizeof(type);					\
+  } while(0)
+
+static int __compare_ids(const void* a, const void* b) {
+  uint32_t id_a = *(const uint32_t*)a;
+  uint32_t id_b = *(const uint32_t*)b;
+  return (id_a > id_b) - (id_a < id_b);
+}
+
+static void __index_add(struct trace_index* index, uint32_t id, uint32_t chunk) {
+  if(index->nb_entries >= index->max_entries) {
+    index->max_entries = index->max_entries ? index->max_entries * 2 : 1024;
+    index->entries = realloc(index->entries, sizeof(struct trace_index_entry) * index->max_entries);
+  }
+  index->entries[index->nb_entries].id = id;
+  index->entries[index->nb_entries].chunk = chunk;
+  index->nb_entries++;
+}
+
+/* add the objects of the current chunk of s to the index */
+static void __index_chunk(struct trace_writer* trace, struct trace_stream* s) {
+  size_t n = s->nb_records;
+  for(size_t i = 0; i < n; i++)
+    trace->object_ids[i] = s->records[i].object_id;
+  qsort(trace->object_ids, n, sizeof(uint32_t), __compare_ids);
+
+  for(size_t i = 0; i < n; i++) {
+    if(i > 0 && trace->object_ids[i] == trace->object_ids[i-1])
+      continue;
+    __index_add(&trace->index, trace->object_ids[i], trace->nb_chunks);
+  }
+}
+
+/* encode the current chunk of a stream and write it. trace->lock must be held */
+static void __flush_chunk(struct trace_writer* trace, uint32_t stream) {
+  struct trace_stream* s = &trace->streams[stream];
+  size_t n = s->nb_records;
+  if(n == 0)
+    return;
+
+  uint8_t* ptr = trace->chunk_buffer + CHUNK_HEADER_SIZE;
+  PUT_COLUMN(ptr, thread_rank, uint32_t);
+  PUT_COLUMN(ptr, object_id, uint32_t);
+  PUT_COLUMN(ptr, weight, uint32_t);
+  PUT_COLUMN(ptr, level, uint8_t);
+  PUT_COLUMN(ptr, access_type, uint8_t);
+
+  uint64_t prev_timestamp = s->records[0].timestamp;
+  for(size_t i = 0; i < n; i++) {
+    ptr = __put_varint(ptr, __zigzag(s->records[i].timestamp - prev_timestamp));
+    prev_timestamp = s->records[i].timestamp;
+  }
+  for(size_t i = 0; i < n; i++)
+    ptr = __put_varint(ptr, s->records[i].offset);
+
+  uint32_t header[3] = {n, (ptr - trace->chunk_buffer) - CHUNK_HEADER_SIZE, stream};
+  memcpy(trace->chunk_buffer, header, sizeof(header));
+  memcpy(trace->chunk_buffer + sizeof(header), &s->records[0].timestamp, sizeof(uint64_t));
+
+  if(trace->nb_chunks >= trace->max_chunks) {
+    trace->max_chunks = trace->max_chunks ? trace->max_chunks * 2 : 64;
+    trace->chunk_offsets = realloc(trace->chunk_offsets, sizeof(uint64_t) * trace->max_chunks);
+  }
+  __index_chunk(trace, s);
+  __index_add(&trace->stream_index, stream, trace->nb_chunks);
+  trace->chunk_offsets[trace->nb_chunks++] = trace_output_tell(trace->output);
+
+  trace_output_write(trace->output, trace->chunk_buffer, ptr - trace->chunk_buffer);
+  s->nb_records = 0;
+}
+
+struct trace_writer* trace_writer_open(const char* filename,
+				       enum trace_kind kind,
+				       size_t chunk_records,
+				       int flags) {
+  struct trace_output* output = trace_output_open(filename, flags);
+  if(!output)
+    return NULL;
+
+  struct trace_writer* trace = malloc(sizeof(struct trace_writer));
+  memset(trace, 0, sizeof(struct trace_writer));
+  trace->output = output;
+  trace->kind = kind;
+  pthread_mutex_init(&trace->lock, NULL);
+  trace->chunk_records = chunk_records;
+
+  uint32_t header[2] = {TRACE_VERSION, kind};
+  trace_output_write(output, TRACE_MAGIC, TRACE_MAGIC_LEN);
+  trace_output_write(output, header, sizeof(header));
+  return trace;
+}
+
+/* make room for one more sample in a stream. trace->lock must be held */
+static struct trace_stream* __reserve(struct trace_writer* trace, uint32_t stream) {
+  if(stream >= trace->nb_streams) {
+    size_t nb_streams = trace->nb_streams ? trace->nb_streams : 16;
+    while(nb_streams <= stream)
+      nb_streams *= 2;
+    trace->streams = realloc(trace->streams, sizeof(struct trace_stream) * nb_streams);
+    memset(&trace->streams[trace->nb_streams], 0,
+	   sizeof(struct trace_stream) * (nb_streams - trace->nb_streams));
+    trace->nb_streams = nb_streams;
+  }
+
+  struct trace_stream* s = &trace->streams[stream];
+  if(s->nb_records < s->capacity)
+    return s;
+
+  if(s->capacity < trace->chunk_records) {
+    /* the buffers grow up to chunk_records samples, so that the streams
+     * with few samples (eg. most of the call sites) remain small in memory
+     */
+    s->capacity = s->capacity ? s->capacity * 2 : TRACE_MIN_RECORDS;
+    if(s->capacity > trace->chunk_records)
+      s->capacity = trace->chunk_records;
+    s->records = realloc(s->records, sizeof(struct trace_record) * s->capacity);
+    if(s->capacity > trace->scratch_capacity) {
+      trace->scratch_capacity = s->capacity;
+      trace->object_ids = realloc(trace->object_ids, sizeof(uint32_t) * s->capacity);
+      trace->chunk_buffer = realloc(trace->chunk_buffer, CHUNK_HEADER_SIZE + RECORD_MAX_SIZE * s->capacity);
+    }
+  } else {
+    __flush_chunk(trace, stream);
+  }
+  return s;
+}
+
+void trace_writer_append(struct trace_writer* trace,
+			 uint32_t stream,
+			 const struct trace_record* record) {
+  pthread_mutex_lock(&trace->lock);
+  struct trace_stream* s = __reserve(trace, stream);
+  s->records[s->nb_records++] = *record;
+  pthread_mutex_unlock(&trace->lock);
+}
+
+static int __compare_index_entries(const void* a, const void* b) {
+  const struct trace_index_entry* e_a = a;
+  const struct trace_index_entry* e_b = b;
+  if(e_a->id != e_b->id)
+    return (e_a->id > e_b->id) - (e_a->id < e_b->id);
+  return (e_a->chunk > e_b->chunk) - (e_a->chunk < e_b->chunk);
+}
+
+void trace_writer_close(struct trace_writer* trace) {
+  pthread_mutex_lock(&trace->lock);
+  for(size_t i = 0; i < trace->nb_streams; i++)
+    __flush_chunk(trace, i);
+
+  qsort(trace->index.entries, trace->index.nb_entries, sizeof(struct trace_index_entry),
+	__compare_index_entries);
+  qsort(trace->stream_index.entries, trace->stream_index.nb_entries, sizeof(struct trace_index_entry),
+	__compare_index_entries);
+
+  /* build the footer */
+  pthread_mutex_lock(&level_lock);
+  size_t footer_size = 3*sizeof(uint64_t) + sizeof(uint32_t)
+    + sizeof(uint64_t) * trace->nb_chunks
+    + sizeof(struct trace_index_entry) * trace->index.nb_entries
+    + sizeof(struct trace_index_entry) * trace->stream_index.nb_entries
+    + 2*sizeof(uint64_t) /* footer offset + magic */;
+  for(unsigned i = 0; i < nb_levels; i++)
+    footer_size += sizeof(uint16_t) + strlen(level_names[i]);
+
+  uint8_t* footer = malloc(footer_size);
+  uint8_t* ptr = footer;
+#define PUT(value, type) do { type __v = (value); memcpy(ptr, &__v, sizeof(type)); ptr += sizeof(type); } while(0)
+  PUT(trace->nb_chunks, uint64_t);
+  memcpy(ptr, trace->chunk_offsets, sizeof(uint64_t) * trace->nb_chunks);
+  ptr += sizeof(uint64_t) * trace->nb_chunks;
+  PUT(trace->index.nb_entries, uint64_t);
+  memcpy(ptr, trace->index.entries, sizeof(struct trace_index_entry) * trace->index.nb_entries);
+  ptr += sizeof(struct trace_index_entry) * trace->index.nb_entries;
+  PUT(trace->stream_index.nb_entries, uint64_t);
+  memcpy(ptr, trace->stream_index.entries, sizeof(struct trace_index_entry) * trace->stream_index.nb_entries);
+  ptr += sizeof(struct trace_index_entry) * trace->stream_index.nb_entries;
+  PUT(nb_levels, uint32_t);
+  for(unsigned i = 0; i < nb_levels; i++) {
+    uint16_t len = strlen(level_names[i]);
+    PUT(len, uint16_t);
+    memcpy(ptr, level_names[i], len);
+    ptr += len;
+  }
+  pthread_mutex_unlock(&level_lock);
+  PUT(trace_output_tell(trace->output), uint64_t);
+  memcpy(ptr, TRACE_MAGIC, TRACE_MAGIC_LEN);
+  ptr += TRACE_MAGIC_LEN;
+#undef PUT
+
+  trace_output_write(trace->output, footer, ptr - footer);
+  free(footer);
+  trace_output_close(trace->output);
+  pthread_mutex_unlock(&trace->lock);
+
+  pthread_mutex_destroy(&trace->lock);
+  for(size_t i = 0; i < trace->nb_streams; i++)
+    free(trace->streams[i].records);
+  free(trace->streams);
+  free(trace->object_ids);
+  free(trace->chunk_buffer);
+  free(trace->chunk_offsets);
+  free(trace->index.entries);
+  free(trace->stream_index.entries);
+  free(trace);
+}
+
+/* read size bytes at offset. return 0 on success */
+static int __read_at(int fd, void* buffer, size_t size, uint64_t offset) {
+  uint8_t* ptr = buffer;
+  while(size > 0) {
+    ssize_t ret = pread(fd, ptr, size, offset);
+    if(ret < 0 && errno == EINTR)
+      continue;
+    if(ret <= 0)
+      return -1;
+    ptr += ret;
+    size -= ret;
+    offset += ret;
+  }
+  return 0;
+}
+
+struct trace_reader* trace_reader_open(const char* filename) {
+  int fd = open(filename, O_RDONLY);
+  if(fd < 0) {
+    fprintf(stderr, "cannot open %s: %s\n", filename, strerror(errno));
+    return NULL;
+  }
+
+  char magic[TRACE_MAGIC_LEN];
+  uint32_t header[2];
+  off_t file_size = lseek(fd, 0, SEEK_END);
+  uint64_t footer_offset;
+  if(file_size < (off_t)(TRACE_MAGIC_LEN + sizeof(header) + sizeof(uint64_t) + TRACE_MAGIC_LEN) ||
+     __read_at(fd, magic, TRACE_MAGIC_LEN, 0) ||
+     memcmp(magic, TRACE_MAGIC, TRACE_MAGIC_LEN) != 0 ||
+     __read_at(fd, header, sizeof(header), TRACE_MAGIC_LEN) ||
+     __read_at(fd, &footer_offset, sizeof(footer_offset), file_size - TRACE_MAGIC_LEN - sizeof(uint64_t)) ||
+     __read_at(fd, magic, TRACE_MAGIC_LEN, file_size - TRACE_MAGIC_LEN) ||
+     memcmp(magic, TRACE_MAGIC, TRACE_MAGIC_LEN) != 0 ||
+     footer_offset >= (uint64_t)file_size) {
+    fprintf(stderr, "%s is not a numamma trace (or it is truncated)\n", filename);
+    close(fd);
+    return NULL;
+  }
+  if(header[0] != TRACE_VERSION || header[1] >= TRACE_KIND_MAX) {
+    fprintf(stderr, "%s: unsupported trace version %u\n", filename, header[0]);
+    close(fd);
+    return NULL;
+  }
+
+  size_t footer_size = file_size - footer_offset;
+  uint8_t* footer = malloc(footer_size);
+  if(__read_at(fd, footer, footer_size, footer_offset)) {
+    fprintf(stderr, "cannot read the footer of %s\n", filename);
+    free(footer);
+    close(fd);
+    return NULL;
+  }
+
+  struct trace_reader* trace = malloc(sizeof(struct trace_reader));
+  memset(trace, 0, sizeof(struct trace_reader));
+  trace->fd = fd;
+  trace->kind = header[1];
+
+  const uint8_t* ptr = footer;
+  const uint8_t* end = footer + footer_size - sizeof(uint64_t) - TRACE_MAGIC_LEN;
+#define GET(var, size) do {					\
+    if(ptr + (size) > end) goto corrupted;			\
+    memcpy((var), ptr, (size));					\
+    ptr += (size);						\
+  } while(0)
+  uint64_t nb;
+  GET(&nb, sizeof(uint64_t));
+  if(nb > footer_size / sizeof(uint64_t))
+    goto corrupted;
+  trace->nb_chunks = nb;
+  trace->chunk_offsets = malloc(sizeof(uint64_t) * (nb + 1));
+  GET(trace->chunk_offsets, sizeof(uint64_t) * nb);
+  /* the end of the last chunk */
+  trace->chunk_offsets[nb] = footer_offset;
+
+  GET(&nb, sizeof(uint64_t));
+  if(nb > footer_size / sizeof(struct trace_index_entry))
+    goto corrupted;
+  trace->nb_index_entries = nb;
+  trace->index = malloc(sizeof(struct trace_index_entry) * (nb ? nb : 1));
+  GET(trace->index, sizeof(struct trace_index_entry) * nb);
+
+  GET(&nb, sizeof(uint64_t));
+  if(nb != trace->nb_chunks)
+    goto corrupted;		/* each chunk belongs to one stream */
+  trace->nb_stream_entries = nb;
+  trace->stream_index = malloc(sizeof(struct trace_index_entry) * (nb ? nb : 1));
+  GET(trace->stream_index, sizeof(struct trace_index_entry) * nb);
+  trace->chunk_streams = malloc(sizeof(uint32_t) * (nb ? nb : 1));
+  for(size_t i = 0; i < nb; i++) {
+    if(trace->stream_index[i].chunk >= trace->nb_chunks)
+      goto corrupted;
+    trace->chunk_streams[trace->stream_index[i].chunk] = trace->stream_index[i].id;
+  }
+
+  uint32_t nb_names;
+  GET(&nb_names, sizeof(uint32_t));
+  if(nb_names > TRACE_MAX_LEVELS)
+    goto corrupted;
+  for(unsigned i = 0; i < nb_names; i++) {
+    uint16_t len;
+    GET(&len, sizeof(uint16_t));
+    trace->level_names[i] = malloc(len + 1);
+    trace->nb_levels = i + 1;
+    GET(trace->level_names[i], len);
+    trace->level_names[i][len] = '\0';
+  }
+#undef GET
+  free(footer);
+  return trace;
+
+ corrupted:
+  fprintf(stderr, "the footer of %s is corrupted\n", filename);
+  free(footer);
+  trace_reader_close(trace);
+  return NULL;
+}
+
+ssize_t trace_reader_read_chunk(struct trace_reader* trace,
+				size_t chunk,
+				struct trace_record** records,
+				size_t* capacity) {
+  if(chunk >= trace->nb_chunks)
+    return -1;
+  uint64_t offset = trace->chunk_offsets[chunk];
+  uint8_t chunk_header[CHUNK_HEADER_SIZE];
+  if(__read_at(trace->fd, chunk_header, CHUNK_HEADER_SIZE, offset))
+    return -1;
+  uint32_t header[3];
+  uint64_t timestamp;
+  memcpy(header, chunk_header, sizeof(header));
+  memcpy(&timestamp, chunk_header + sizeof(header), sizeof(uint64_t));
+  size_t n = header[0];
+  size_t payload_size = header[1];
+  if(offset + CHUNK_HEADER_SIZE + payload_size > trace->chunk_offsets[chunk+1] ||
+     payload_size < n * (3*sizeof(uint32_t) + 2*sizeof(uint8_t) + 2))
+    return -1;
+
+  uint8_t* payload = malloc(payload_size);
+  if(__read_at(trace->fd, payload, payload_size, offset + CHUNK_HEADER_SIZE)) {
+    free(payload);
+    return -1;
+  }
+
+  if(*capacity < n) {
+    *capacity = n;
+    *records = realloc(*records, sizeof(struct trace_record) * n);
+  }
+  struct trace_record* r = *records;
+
+  const uint8_t* ptr = payload;
+  const uint8_t* end = payload + payload_size;
+#define GET_COLUMN(field, type) do {				\
+    for(size_t __i = 0; __i < n; __i++) {			\
+      type __v;							\
+      memcpy(&__v, ptr + __i * sizeof(type), sizeof(type));	\
+      r[__i].field = __v;					\
+    }								\
+    ptr += n * sizeof(type);					\
+  } while(0)
+  GET_COLUMN(thread_rank, uint32_t);
+  GET_COLUMN(object_id, uint32_t);
+  GET_COLUMN(weight, uint32_t);
+  GET_COLUMN(level, uint8_t);
+  GET_COLUMN(access_type, uint8_t);
+#undef GET_COLUMN
+
+  for(size_t i = 0; i < n && ptr; i++) {
+    uint64_t delta = 0;
+    ptr = __get_varint(ptr, end, &delta);
+    timestamp += __unzigzag(delta);
+    r[i].timestamp = timestamp;
+  }
+  for(size_t i = 0; i < n && ptr; i++)
+    ptr = __get_varint(ptr, end, &r[i].offset);
+
+  free(payload);
+  return ptr ? (ssize_t)n : -1;
+}
+
+/* search the entries of id in a sorted index */
+static size_t __index_lookup(struct trace_index_entry* index,
+			     size_t nb_entries,
+			     uint32_t id,
+			     const struct trace_index_entry** entries) {
+  /* search for the first entry of id */
+  size_t lo = 0, hi = nb_entries;
+  while(lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if(index[mid].id < id)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  size_t nb = 0;
+  while(lo + nb < nb_entries && index[lo + nb].id == id)
+    nb++;
+  *entries = &index[lo];
+  return nb;
+}
+
+size_t trace_reader_object_chunks(struct trace_reader* trace,
+				  uint32_t object_id,
+				  const struct trace_index_entry** entries) {
+  return __index_lookup(trace->index, trace->nb_index_entries, object_id, entries);
+}
+
+size_t trace_reader_stream_chunks(struct trace_reader* trace,
+				  uint32_t stream,
+				  const struct trace_index_entry** entries) {
+  return __index_lookup(trace->stream_index, trace->nb_stream_entries, stream, entries);
+}
+
+const char* trace_reader_level_name(struct trace_reader* trace, uint8_t level) {
+  if(level < trace->nb_levels)
+    return trace->level_names[level];
+  return "Unknown";
+}
+
+void trace_reader_close(struct trace_reader* trace) {
+  close(trace->fd);
+  free(trace->chunk_offsets);
+  free(trace->chunk_streams);
+  free(trace->index);
+  free(trace->stream_index);
+  for(unsigned i = 0; i < trace->nb_levels; i++)
+    free(trace->level_names[i]);
+  free(trace);
+}
@@ -0,0 +1,175 @@
+#ifndef MEM_TRACE_H
+#define MEM_TRACE_H
+
+/* Binary traces of memory samples.
+ *
+ * A trace file starts with a header (TRACE_MAGIC, version and kind of
+ * trace), followed by chunks of samples, and ends with a footer.
+ *
+ * Each chunk contains up to a few thousand samples stored column by column:
+ *  - thread ranks, object ids and weights are 32-bit integers
+ *  - memory levels and access types are 8-bit integers. A memory level is
+ *    an index in the dictionary of levels stored in the footer
+ *  - timestamps are delta-encoded (zigzag varints)
+ *  - offsets are varints
+ *
+ * A trace may multiplex several streams of samples (eg. one per call site):
+ * the samples of a chunk all belong to the same stream, and the chunks of
+ * the streams are interleaved in the file.
+ *
+ * The footer contains the position of each chunk, the dictionary of memory
+ * levels and, for each object and for each stream, the list of chunks that
+ * contain its samples.
+ * The last 16 bytes of the file are the position of the footer followed by
+ * TRACE_MAGIC. Integers are stored in the byte order of the machine.
+ */
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#define TRACE_MAGIC "NMMTRACE"
+#define TRACE_MAGIC_LEN 8
+#define TRACE_VERSION 2
+
+/* maximum number of memory levels in the dictionary (the codes are 8-bit) */
+#define TRACE_MAX_LEVELS 255
+/* number of keys that can be associated with a memory level (see trace_level_code) */
+#define TRACE_LEVEL_KEYS (1<<14)
+
+enum trace_kind {
+  TRACE_KIND_OBJECTS,		/* samples of all the objects */
+  TRACE_KIND_CALL_SITE,		/* samples of the objects of the call sites (one stream per site) */
+  TRACE_KIND_UNMATCHED,		/* samples that match no object (the offset is the address) */
+  TRACE_KIND_MAX
+};
+
+struct trace_record {
+  uint64_t timestamp;
+  uint64_t offset;		/* offset in the object */
+  uint32_t thread_rank;
+  uint32_t object_id;
+  uint32_t weight;
+  uint8_t level;		/* see trace_level_code */
+  uint8_t access_type;		/* ACCESS_READ or ACCESS_WRITE */
+};
+
+/* return the code of the memory level identified by key (eg. the mem_lvl
+ * field of a perf sample). get_name is only called the first time key is
+ * seen. The dictionary is shared by all the traces of the process.
+ */
+uint8_t trace_level_code(uint32_t key, const char* (*get_name)(uint32_t key));
+
+/* return the name of a code returned by trace_level_code */
+const char* trace_level_name(uint8_t code);
+
+
+/* A buffered output file. The data is written by blocks of
+ * TRACE_OUTPUT_BUFFER_SIZE bytes.
+ */
+#define TRACE_OUTPUT_BUFFER_SIZE (1024*1024)
+/* alignment of the buffers and of the writes when O_DIRECT is used */
+#define TRACE_DIRECT_IO_ALIGN 4096
+
+/* flags of trace_output_open and trace_writer_open */
+#define TRACE_DIRECT_IO 1	/* bypass the page cache (if the filesystem supports it) */
+
+struct trace_output {
+  int fd;
+  int own_fd;			/* if set, fd is closed by trace_output_close */
+  int direct;			/* set if fd was opened with O_DIRECT */
+  uint64_t offset;		/* position of buffer in the file */
+  size_t used;
+  uint8_t* buffer;
+};
+
+/* create a file. return NULL (and set errno) if the file cannot be created */
+struct trace_output* trace_output_open(const char* filename, int flags);
+
+/* write at the end of an already open file. fd is not closed by trace_output_close */
+struct trace_output* trace_output_open_fd(int fd);
+
+void trace_output_write(struct trace_output* output, const void* data, size_t size);
+
+/* return the position in the file of the next byte written */
+static inline uint64_t trace_output_tell(struct trace_output* output) {
+  return output->offset + output->used;
+}
+
+/* write the buffered data, and free output */
+void trace_output_close(struct trace_output* output);
+
+
+struct trace_writer;
+
+/* create a trace. Samples are written by chunks of chunk_records samples.
+ * flags is a combination of TRACE_* flags.
+ * return NULL (and set errno) if the file cannot be created
+ */
+struct trace_writer* trace_writer_open(const char* filename,
+				       enum trace_kind kind,
+				       size_t chunk_records,
+				       int flags);
+
+/* add a sample to a stream of a trace. The streams are numbered from 0, and
+ * each one buffers up to chunk_records samples. This function is thread-safe
+ */
+void trace_writer_append(struct trace_writer* trace,
+			 uint32_t stream,
+			 const struct trace_record* record);
+
+/* write the pending samples and the footer, and free the trace */
+void trace_writer_close(struct trace_writer* trace);
+
+
+struct trace_index_entry {
+  uint32_t id;			/* object id or stream */
+  uint32_t chunk;
+};
+
+struct trace_reader {
+  int fd;
+  enum trace_kind kind;
+
+  size_t nb_chunks;
+  uint64_t* chunk_offsets;
+  uint32_t* chunk_streams;	/* stream of each chunk */
+
+  /* sorted by object id, then by chunk */
+  size_t nb_index_entries;
+  struct trace_index_entry* index;
+
+  /* sorted by stream, then by chunk */
+  size_t nb_stream_entries;
+  struct trace_index_entry* stream_index;
+
+  unsigned nb_levels;
+  char* level_names[TRACE_MAX_LEVELS];
+};
+
+/* open a trace. return NULL (and print an error message) if filename is not a valid trace */
+struct trace_reader* trace_reader_open(const char* filename);
+
+/* decode a chunk into *records (reallocated if *capacity is too small).
+ * return the number of samples in the chunk, or -1 if the chunk is corrupted
+ */
+ssize_t trace_reader_read_chunk(struct trace_reader* trace,
+				size_t chunk,
+				struct trace_record** records,
+				size_t* capacity);
+
+/* set *entries to the index entries of object_id and return their number */
+size_t trace_reader_object_chunks(struct trace_reader* trace,
+				  uint32_t object_id,
+				  const struct trace_index_entry** entries);
+
+/* set *entries to the index entries of a stream and return their number */
+size_t trace_reader_stream_chunks(struct trace_reader* trace,
+				  uint32_t stream,
+				  const struct trace_index_entry** entries);
+
+/* return the name of a memory level */
+const char* trace_reader_level_name(struct trace_reader* trace, uint8_t level);
+
+void trace_reader_close(struct trace_reader* trace);
+
+#endif	/* MEM_TRACE_H */
@@ -4,10 +4,26 @@
 #include <argp.h>
 #include <unistd.h>
 #include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #include "numamma.h"
+#include "numamma_diff.h"
 
 #define ONLINE_ANALYSIS -1
+#define CALLSITE_KEY -2
+#define CALLSITE_DEPTH -3
+#define DEFER_SYMBOLS -4
+#define ALLOC_THRESHOLD -5
+#define ALLOC_SAMPLING -6
+#define ALLOC_SAMPLING_PERIOD -7
+#define SIDE_TABLE -8
+#define DUMP_FORMAT -9
+#define DUMP_DIRECT_IO -10
+#define SNAPSHOT_INTERVAL -11
+#define SNAPSHOT_SIGNAL -12
+#define SNAPSHOT_MODE -13
+#define CONTROL_SOCKET -14
 
 // todo : make better string length checks, for now this is not safe from buffer overflows
 #define STRING_LENGTH 4096
@@ -19,7 +35,7 @@ const char numap_libdir[] = "";
 const char *program_version = "numamma";
 const char *program_bug_address = "";
 static char doc[] = "Numamma description";
-static char args_doc[] = "target_application [TARGET OPTIONS]";
+static char args_doc[] = "target_application [TARGET OPTIONS]\nctl PID COMMAND\ndiff RUN_A RUN_B";
 const char * argp_program_version="NumaMMA dev";
 
 // long name, key, arg, option flags, doc, group
@@ -34,6 +50,10 @@ static struct argp_option options[] = {
 	{"flush", 'f', "yes|no", OPTION_ARG_OPTIONAL, "Flush the sample buffer when full (default: yes)"},
 	{"buffer-size", 's', "SIZE", 0, "Set the sample buffer size (default: 128 KB per thread)"},
 	{"canary-check", 'c', 0, 0, "Check for memory corruption (default: disabled)"},
+	{"side-table", SIDE_TABLE, 0, 0, "Store allocation metadata out of band instead of adding a header to each buffer (default: disabled)"},
+	{"alloc-threshold", ALLOC_THRESHOLD, "SIZE", 0, "Always record the allocations of at least SIZE bytes, and sample smaller ones (default: 0, all allocations are recorded)"},
+	{"alloc-sampling", ALLOC_SAMPLING, "none|count|bytes", 0, "Select how allocations smaller than the threshold are sampled (default: count)"},
+	{"alloc-sampling-period", ALLOC_SAMPLING_PERIOD, "N", 0, "Record one small allocation out of N (count), or one every N bytes (bytes) (default: 100)"},
 
 	{0, 0, 0, 0, "Report options:"},
 	{"outputdir", 'o', "dir", 0, "Specify the directory where files are written (default: /tmp/numamma_$USER"},
@@ -43,6 +63,15 @@ static struct argp_option options[] = {
 	{"dump", 'd', 0, 0, "Dump the collected memory access (default: disabled)"},
 	{"dump-unmatched", 'u', 0, 0, "Dump the samples that did not match a memory object (default: disabled)"},
 	{"no-dump-single-items", 'n', 0, 0, "If dump is enable, disable the dumping of per callsite data (one file each) (default: disabled)"},
+	{"dump-format", DUMP_FORMAT, "text|binary", 0, "Select the format of the sample dumps (default: binary)"},
+	{"dump-direct-io", DUMP_DIRECT_IO, 0, 0, "Write the sample dumps with O_DIRECT, bypassing the page cache (default: disabled)"},
+	{"callsite-key", CALLSITE_KEY, "stack_size|stack|top|caller", 0, "Select how memory objects are grouped into call sites (default: stack_size)"},
+	{"callsite-depth", CALLSITE_DEPTH, "N", 0, "Number of frames used to identify call sites with --callsite-key=top (default: 1)"},
+	{"defer-symbols", DEFER_SYMBOLS, 0, 0, "Record raw addresses and let numamma-symbolize resolve them after the run (default: disabled)"},
+	{"snapshot-interval", SNAPSHOT_INTERVAL, "N", 0, "Write a snapshot of the report every N seconds (default: 0, disabled)"},
+	{"snapshot-on-signal", SNAPSHOT_SIGNAL, 0, 0, "Write a snapshot of the report when the application receives SIGUSR2 (default: disabled)"},
+	{"snapshot-mode", SNAPSHOT_MODE, "cumulative|interval", 0, "Report the counters since the beginning of the execution, or since the previous snapshot (default: cumulative)"},
+	{"control-socket", CONTROL_SOCKET, 0, 0, "Answer the queries of 'numamma ctl <pid>' while the application runs (default: disabled)"},
 	{0}
 };
 
@@ -100,6 +129,53 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
   case 'n':
     settings->dump_single_items = 0;
     break;
+  case DUMP_FORMAT:
+    settings->dump_format = dump_format_from_string(arg);
+    if(settings->dump_format < 0)
+      argp_error(state, "invalid dump format '%s'", arg);
+    break;
+  case DUMP_DIRECT_IO:
+    settings->dump_direct_io = 1;
+    break;
+  case CALLSITE_KEY:
+    settings->callsite_key = callsite_key_from_string(arg);
+    if(settings->callsite_key < 0)
+      argp_error(state, "invalid call site key '%s'", arg);
+    break;
+  case CALLSITE_DEPTH:
+    settings->callsite_depth = atoi(arg);
+    break;
+  case DEFER_SYMBOLS:
+    settings->defer_symbols = 1;
+    break;
+  case SIDE_TABLE:
+    settings->side_table = 1;
+    break;
+  case ALLOC_THRESHOLD:
+    settings->alloc_threshold = atol(arg);
+    break;
+  case ALLOC_SAMPLING:
+    settings->alloc_sampling = alloc_sampling_from_string(arg);
+    if(settings->alloc_sampling < 0)
+      argp_error(state, "invalid allocation sampling policy '%s'", arg);
+    break;
+  case ALLOC_SAMPLING_PERIOD:
+    settings->alloc_sampling_period = atol(arg);
+    break;
+  case SNAPSHOT_INTERVAL:
+    settings->snapshot_interval = atoi(arg);
+    break;
+  case SNAPSHOT_SIGNAL:
+    settings->snapshot_signal = 1;
+    break;
+  case SNAPSHOT_MODE:
+    settings->snapshot_mode = snapshot_mode_from_string(arg);
+    if(settings->snapshot_mode < 0)
+      argp_error(state, "invalid snapshot mode '%s'", arg);
+    break;
+  case CONTROL_SOCKET:
+    settings->control_socket = 1;
+    break;
 
   case ARGP_KEY_NO_ARGS:
     argp_usage(state);
@@ -116,9 +192,55 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
 
 static struct argp argp = { options, parse_opt, args_doc, doc };
 
+/* numamma ctl PID COMMAND: send COMMAND to the control socket of a process
+ * that runs with --control-socket, and print the answer
+ */
+static int numamma_ctl(int argc, char **argv) {
+  if(argc < 3) {
+    fprintf(stderr, "Usage: numamma ctl PID status|top [N] [LEVEL] [SECONDS]|heatmap ID [LEVEL]|start|stop\n");
+    return EXIT_FAILURE;
+  }
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  snprintf(addr.sun_path, sizeof(addr.sun_path), CONTROL_SOCKET_PATH_FORMAT, atoi(argv[1]));
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+    fprintf(stderr, "Could not connect to %s: %s (was the application started with --control-socket?)\n",
+	    addr.sun_path, strerror(errno));
+    return EXIT_FAILURE;
+  }
+
+  char query[STRING_LENGTH] = "";
+  for(int i = 2; i < argc; i++) {
+    if(i > 2)
+      strncat(query, " ", sizeof(query) - strlen(query) - 1);
+    strncat(query, argv[i], sizeof(query) - strlen(query) - 1);
+  }
+  strncat(query, "\n", sizeof(query) - strlen(query) - 1);
+  if(write(fd, query, strlen(query)) < 0) {
+    fprintf(stderr, "Could not send the query: %s\n", strerror(errno));
+    return EXIT_FAILURE;
+  }
+
+  char buffer[STRING_LENGTH];
+  ssize_t len;
+  while((len = read(fd, buffer, sizeof(buffer))) > 0)
+    fwrite(buffer, 1, len, stdout);
+  close(fd);
+  return EXIT_SUCCESS;
+}
+
 int main(int argc, char **argv) {
   struct numamma_settings settings;
 
+  if(argc > 1 && strcmp(argv[1], "ctl") == 0)
+    return numamma_ctl(argc - 1, argv + 1);
+  if(argc > 1 && strcmp(argv[1], "diff") == 0)
+    return numamma_diff(argc - 1, argv + 1);
+
   // Default values
   settings.verbose = SETTINGS_VERBOSE_DEFAULT;
 
@@ -136,6 +258,19 @@ int main(int argc, char **argv) {
   settings.dump = SETTINGS_DUMP_DEFAULT;
   settings.dump_unmatched = SETTINGS_DUMP_UNMATCHED_DEFAULT;
   settings.dump_single_items = SETTINGS_DUMP_SINGLE_ITEMS;
+  settings.dump_format = SETTINGS_DUMP_FORMAT_DEFAULT;
+  settings.dump_direct_io = SETTINGS_DUMP_DIRECT_IO_DEFAULT;
+  settings.callsite_key = SETTINGS_CALLSITE_KEY_DEFAULT;
+  settings.callsite_depth = SETTINGS_CALLSITE_DEPTH_DEFAULT;
+  settings.defer_symbols = SETTINGS_DEFER_SYMBOLS_DEFAULT;
+  settings.side_table = SETTINGS_SIDE_TABLE_DEFAULT;
+  settings.alloc_threshold = SETTINGS_ALLOC_THRESHOLD_DEFAULT;
+  settings.alloc_sampling = SETTINGS_ALLOC_SAMPLING_DEFAULT;
+  settings.alloc_sampling_period = SETTINGS_ALLOC_SAMPLING_PERIOD_DEFAULT;
+  settings.snapshot_interval = SETTINGS_SNAPSHOT_INTERVAL_DEFAULT;
+  settings.snapshot_signal = SETTINGS_SNAPSHOT_SIGNAL_DEFAULT;
+  settings.snapshot_mode = SETTINGS_SNAPSHOT_MODE_DEFAULT;
+  settings.control_socket = SETTINGS_CONTROL_SOCKET_DEFAULT;
 
   // first divide argv between numamma options and target file and options
   // optionnal todo : better target detection : it should be possible to specify both --option=value and --option value, but for now the latter is not interpreted as such
@@ -196,6 +331,19 @@ int main(int argc, char **argv) {
   setenv_int("NUMAMMA_DUMP", settings.dump, 1);
   setenv_int("NUMAMMA_DUMP_UNMATCHED", settings.dump_unmatched, 1);
   setenv_int("NUMAMMA_DUMP_SINGLE_ITEMS", settings.dump_single_items, 1);
+  setenv("NUMAMMA_DUMP_FORMAT", dump_format_names[settings.dump_format], 1);
+  setenv_int("NUMAMMA_DUMP_DIRECT_IO", settings.dump_direct_io, 1);
+  setenv("NUMAMMA_CALLSITE_KEY", callsite_key_names[settings.callsite_key], 1);
+  setenv_int("NUMAMMA_CALLSITE_DEPTH", settings.callsite_depth, 1);
+  setenv_int("NUMAMMA_DEFER_SYMBOLS", settings.defer_symbols, 1);
+  setenv_int("NUMAMMA_SIDE_TABLE", settings.side_table, 1);
+  setenv_size_t("NUMAMMA_ALLOC_THRESHOLD", settings.alloc_threshold, 1);
+  setenv("NUMAMMA_ALLOC_SAMPLING", alloc_sampling_names[settings.alloc_sampling], 1);
+  setenv_size_t("NUMAMMA_ALLOC_SAMPLING_PERIOD", settings.alloc_sampling_period, 1);
+  setenv_int("NUMAMMA_SNAPSHOT_INTERVAL", settings.snapshot_interval, 1);
+  setenv_int("NUMAMMA_SNAPSHOT_SIGNAL", settings.snapshot_signal, 1);
+  setenv("NUMAMMA_SNAPSHOT_MODE", snapshot_mode_names[settings.snapshot_mode], 1);
+  setenv_int("NUMAMMA_CONTROL_SOCKET", settings.control_socket, 1);
 
   extern char** environ;
   int ret;
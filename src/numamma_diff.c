@@ -0,0 +1,763 @@
+/* numamma diff: compare the call sites (or the objects) of two runs.
+ *
+ * The call_site lines of the report.jsonl of each run (or of
+ * symbolized_report.jsonl, if numamma-symbolize was run) are loaded in a
+ * hash table, indexed by a key that does not depend on the addresses of
+ * the run: the symbolized call stack (without the line numbers, unless -l
+ * is set, so that a code change elsewhere in a file does not break the
+ * matching), the memory type, and the power of 2 of the size. The call
+ * sites of a run that have the same key are merged.
+ *
+ * With -o, the object lines are compared instead, indexed by their stable
+ * key (see OBJECT_KEY_FORMAT). The objects that have no key are ignored,
+ * and the objects of a run that have the same key (eg. small objects whose
+ * ordinal is unknown) are merged.
+ *
+ * The counters are sampled: each sample represents settings.sampling_rate
+ * accesses. The significance of a change is estimated with a z-test:
+ *  - total weight: the number of samples is a Poisson process, so the
+ *    variance of the estimated total weight is rate^2 * n * E[w^2]
+ *  - remote share: two-proportion test on the number of samples that hit
+ *    the local and remote memory
+ *  - latency: test on the average weight of the samples
+ * The report only stores the number of samples, and the min, max and sum
+ * of the weights for each memory level, so the variance of the weights is
+ * estimated by assuming that the standard deviation in a memory level is a
+ * quarter of its range. The p-values are corrected for the number of
+ * compared call sites (Bonferroni).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <math.h>
+#include <sys/stat.h>
+
+#include "numamma_diff.h"
+
+#define STRING_LEN 4096
+/* maximum length of the path of a field (eg. read.local_ram_miss.count) */
+#define PATH_LEN 256
+
+/* the memory levels of the report (see __report_counters in mem_analyzer.c) */
+static const char* level_names[] = {
+  "cache1_hit", "cache2_hit", "cache3_hit", "lfb_hit", "local_ram_hit",
+  "remote_ram_hit", "remote_cache_hit", "io_memory_hit", "uncached_memory_hit",
+  "cache1_miss", "cache2_miss", "cache3_miss", "lfb_miss", "local_ram_miss",
+  "remote_ram_miss", "remote_cache_miss", "io_memory_miss", "uncached_memory_miss",
+};
+#define NB_LEVELS (sizeof(level_names)/sizeof(level_names[0]))
+
+/* the levels that count as local or remote memory in the remote share */
+static const char* local_levels[] = {"local_ram_hit", "local_ram_miss", NULL};
+static const char* remote_levels[] = {"remote_ram_hit", "remote_ram_miss",
+				      "remote_cache_hit", "remote_cache_miss", NULL};
+
+struct level_stats {
+  uint64_t count;
+  uint64_t min_weight;
+  uint64_t max_weight;
+  uint64_t sum_weight;
+};
+
+/* counters of the read and write accesses to a call site */
+struct site_stats {
+  unsigned nb_sites;		/* number of call sites merged. 0 if the site is not in the run */
+  uint64_t nb_mallocs;
+  uint64_t count;
+  uint64_t weight;
+  struct level_stats levels[NB_LEVELS];
+};
+
+struct diff_entry {
+  char* key;			/* callstack \t mem_type \t size class, or the key of an object */
+  char* label;			/* objects: memory type and size */
+  uint64_t hash;
+  struct site_stats runs[2];
+  /* results */
+  double weight[2];		/* estimated total weight */
+  double weight_p;
+  double remote_share[2];
+  double remote_p;
+  double latency[2];
+  double latency_p;
+};
+
+/* open addressing hash table */
+struct diff_table {
+  size_t size;			/* power of 2 */
+  size_t nb_entries;
+  struct diff_entry** entries;
+};
+
+struct run {
+  char filename[STRING_LEN];
+  uint64_t sampling_rate;
+  unsigned nb_sites;		/* number of call sites (or objects) */
+  unsigned nb_unkeyed;		/* number of objects without a key */
+  int deferred_symbols;		/* set if some frames were not symbolized */
+};
+
+/* a line of the report */
+struct report_line {
+  char type[32];
+  char* callstack;
+  char* caller;
+  char mem_type[32];
+  char key[64];
+  uint64_t size;
+  uint64_t sampling_rate;
+  struct site_stats stats;
+};
+
+static int keep_line_numbers = 0;
+static int compare_objects = 0;
+
+static void usage(void) {
+  fprintf(stderr, "Usage: numamma diff [-n N] [-a alpha] [-l] [-o] RUN_A RUN_B\n");
+  fprintf(stderr, "\tRUN_A, RUN_B\toutput directories of numamma (or report.jsonl files)\n");
+  fprintf(stderr, "\t-n N\t\tprint the N call sites whose weight changed the most (default: 20, 0: all)\n");
+  fprintf(stderr, "\t-a alpha\tmark the changes whose corrected p-value is lower than alpha (default: 0.01)\n");
+  fprintf(stderr, "\t-l\t\tkeep the line numbers of the call stacks when matching the call sites\n");
+  fprintf(stderr, "\t-o\t\tcompare the objects instead of the call sites, matched by their key\n");
+}
+
+static uint64_t __hash(const char* str) {
+  /* FNV-1a */
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for(const unsigned char* c = (const unsigned char*)str; *c; c++) {
+    h ^= *c;
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
+static void __table_init(struct diff_table* t) {
+  t->size = 1024;
+  t->nb_entries = 0;
+  t->entries = calloc(t->size, sizeof(struct diff_entry*));
+}
+
+static void __table_insert(struct diff_table* t, struct diff_entry* entry) {
+  size_t mask = t->size - 1;
+  size_t i = entry->hash & mask;
+  while(t->entries[i])
+    i = (i + 1) & mask;
+  t->entries[i] = entry;
+}
+
+/* return the entry of key. The entry is created if needed */
+static struct diff_entry* __table_get(struct diff_table* t, const char* key) {
+  uint64_t hash = __hash(key);
+  size_t mask = t->size - 1;
+  size_t i = hash & mask;
+  while(t->entries[i]) {
+    if(t->entries[i]->hash == hash && strcmp(t->entries[i]->key, key) == 0)
+      return t->entries[i];
+    i = (i + 1) & mask;
+  }
+
+  struct diff_entry* entry = calloc(1, sizeof(struct diff_entry));
+  entry->key = strdup(key);
+  entry->hash = hash;
+  if(++t->nb_entries * 2 > t->size) {
+    struct diff_table old = *t;
+    t->size *= 2;
+    t->entries = calloc(t->size, sizeof(struct diff_entry*));
+    for(size_t j = 0; j < old.size; j++)
+      if(old.entries[j])
+	__table_insert(t, old.entries[j]);
+    free(old.entries);
+  }
+  __table_insert(t, entry);
+  return entry;
+}
+
+static int __level_index(const char* name, size_t len) {
+  for(unsigned i = 0; i < NB_LEVELS; i++)
+    if(strlen(level_names[i]) == len && strncmp(level_names[i], name, len) == 0)
+      return i;
+  return -1;
+}
+
+static void __set_string(char** dest, const char* value) {
+  free(*dest);
+  *dest = strdup(value);
+}
+
+/* store a field of the report in line */
+static void __line_field(struct report_line* line, const char* path, const char* str, uint64_t value) {
+  if(str) {
+    if(strcmp(path, "type") == 0)
+      snprintf(line->type, sizeof(line->type), "%s", str);
+    else if(strcmp(path, "callstack") == 0)
+      __set_string(&line->callstack, str);
+    else if(strcmp(path, "caller") == 0)
+      __set_string(&line->caller, str);
+    else if(strcmp(path, "mem_type") == 0)
+      snprintf(line->mem_type, sizeof(line->mem_type), "%s", str);
+    else if(strcmp(path, "key") == 0)
+      snprintf(line->key, sizeof(line->key), "%s", str);
+    return;
+  }
+
+  if(strcmp(path, "size") == 0) {
+    line->size = value;
+    return;
+  }
+  if(strcmp(path, "nb_mallocs") == 0) {
+    line->stats.nb_mallocs = value;
+    return;
+  }
+  if(strcmp(path, "sampling_rate") == 0) {
+    line->sampling_rate = value;
+    return;
+  }
+
+  /* read.total_count, write.local_ram_miss.sum_weight, ... */
+  const char* field;
+  if(strncmp(path, "read.", 5) == 0)
+    field = path + 5;
+  else if(strncmp(path, "write.", 6) == 0)
+    field = path + 6;
+  else
+    return;
+
+  if(strcmp(field, "total_count") == 0) {
+    line->stats.count += value;
+    return;
+  }
+  if(strcmp(field, "total_weight") == 0) {
+    line->stats.weight += value;
+    return;
+  }
+  const char* dot = strchr(field, '.');
+  if(!dot)
+    return;
+  int level = __level_index(field, dot - field);
+  if(level < 0)
+    return;
+  struct level_stats* l = &line->stats.levels[level];
+  if(strcmp(dot + 1, "count") == 0)
+    l->count += value;
+  else if(strcmp(dot + 1, "sum_weight") == 0)
+    l->sum_weight += value;
+  else if(strcmp(dot + 1, "min_weight") == 0) {
+    if(!l->min_weight || value < l->min_weight)
+      l->min_weight = value;
+  } else if(strcmp(dot + 1, "max_weight") == 0) {
+    if(value > l->max_weight)
+      l->max_weight = value;
+  }
+}
+
+static const char* __skip_spaces(const char* p) {
+  while(*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')
+    p++;
+  return p;
+}
+
+/* parse the string that starts at p (a '"') into buffer. Return the
+ * position after the string, or NULL
+ */
+static const char* __parse_string(const char* p, char* buffer) {
+  if(*p != '"')
+    return NULL;
+  p++;
+  char* out = buffer;
+  while(*p != '"') {
+    if(!*p)
+      return NULL;
+    if(*p == '\\') {
+      p++;
+      switch(*p) {
+      case 'n': *out++ = '\n'; break;
+      case 't': *out++ = '\t'; break;
+      case 'u': {
+	/* the report only escapes control characters */
+	char hex[5] = {0};
+	strncpy(hex, p + 1, 4);
+	*out++ = (char)strtol(hex, NULL, 16);
+	p += strlen(hex);
+	break;
+      }
+      case '\0': return NULL;
+      default: *out++ = *p; break;
+      }
+      p++;
+    } else {
+      *out++ = *p++;
+    }
+  }
+  *out = '\0';
+  return p + 1;
+}
+
+/* parse the value that starts at p, and store its fields in line. path
+ * is the path of the value (eg. read.local_ram_miss). Return the position
+ * after the value, or NULL
+ */
+static const char* __parse_value(const char* p, char* path, char* buffer, struct report_line* line) {
+  p = __skip_spaces(p);
+  if(*p == '{') {
+    size_t path_len = strlen(path);
+    p = __skip_spaces(p + 1);
+    if(*p == '}')
+      return p + 1;
+    for(;;) {
+      p = __parse_string(__skip_spaces(p), buffer);
+      if(!p)
+	return NULL;
+      p = __skip_spaces(p);
+      if(*p != ':')
+	return NULL;
+      snprintf(path + path_len, PATH_LEN - path_len, "%s%s", path_len ? "." : "", buffer);
+      p = __parse_value(p + 1, path, buffer, line);
+      path[path_len] = '\0';
+      if(!p)
+	return NULL;
+      p = __skip_spaces(p);
+      if(*p == '}')
+	return p + 1;
+      if(*p != ',')
+	return NULL;
+      p++;
+    }
+  }
+  if(*p == '[') {
+    p = __skip_spaces(p + 1);
+    if(*p == ']')
+      return p + 1;
+    for(;;) {
+      p = __parse_value(p, path, buffer, line);
+      if(!p)
+	return NULL;
+      p = __skip_spaces(p);
+      if(*p == ']')
+	return p + 1;
+      if(*p != ',')
+	return NULL;
+      p++;
+    }
+  }
+  if(*p == '"') {
+    p = __parse_string(p, buffer);
+    if(p)
+      __line_field(line, path, buffer, 0);
+    return p;
+  }
+  if(strncmp(p, "true", 4) == 0)
+    return p + 4;
+  if(strncmp(p, "false", 5) == 0)
+    return p + 5;
+  if(strncmp(p, "null", 4) == 0)
+    return p + 4;
+
+  char* end;
+  uint64_t value = strtoull(p, &end, 10);
+  if(end == p && *p != '-')
+    return NULL;
+  if(*end == '.' || *end == 'e' || *end == 'E' || *p == '-') {
+    /* the counters are integers */
+    strtod(p, &end);
+    if(end == p)
+      return NULL;
+  } else {
+    __line_field(line, path, NULL, value);
+  }
+  return end;
+}
+
+/* write in key the frames of callstack, without the line numbers unless
+ * keep_line_numbers is set. A frame is file:line(function), or
+ * module(+offset) [address] if it could not be resolved
+ */
+static void __normalize_callstack(const char* callstack, char* key, size_t key_len, struct run* run) {
+  size_t len = 0;
+  key[0] = '\0';
+  while(*callstack && len + 1 < key_len) {
+    size_t frame_len = strcspn(callstack, ";");
+    const char* frame = callstack;
+    callstack += frame_len;
+    if(*callstack == ';')
+      callstack++;
+
+    if(frame[0] == '@')
+      /* deferred symbol: the address depends on the run */
+      run->deferred_symbols = 1;
+
+    /* drop the address of the unresolved frames */
+    const char* address = strstr(frame, " [0x");
+    if(address && address < frame + frame_len)
+      frame_len = address - frame;
+
+    if(!keep_line_numbers) {
+      const char* paren = memchr(frame, '(', frame_len);
+      if(paren && frame[frame_len - 1] == ')' && paren > frame && paren[-1] >= '0' && paren[-1] <= '9') {
+	/* file:line(function) -> function */
+	frame_len -= paren + 1 - frame + 1;
+	frame = paren + 1;
+      }
+    }
+    len += snprintf(&key[len], key_len - len, "%s%.*s", len ? ";" : "", (int)frame_len, frame);
+  }
+}
+
+static int __size_class(uint64_t size) {
+  return size ? 64 - __builtin_clzll(size) : 0;
+}
+
+/* return the path of the report of a run */
+static int __find_report(const char* path, char* filename) {
+  struct stat st;
+  if(stat(path, &st) < 0) {
+    fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+  if(!S_ISDIR(st.st_mode)) {
+    snprintf(filename, STRING_LEN, "%s", path);
+    return 0;
+  }
+  snprintf(filename, STRING_LEN, "%s/symbolized_report.jsonl", path);
+  if(access(filename, R_OK) == 0)
+    return 0;
+  snprintf(filename, STRING_LEN, "%s/report.jsonl", path);
+  return 0;
+}
+
+/* load the call sites (or the objects) of a run in table */
+static int __load_run(const char* path, int run_index, struct run* run, struct diff_table* table) {
+  if(__find_report(path, run->filename) < 0)
+    return -1;
+  FILE* f = fopen(run->filename, "r");
+  if(!f) {
+    fprintf(stderr, "Cannot open %s: %s\n", run->filename, strerror(errno));
+    return -1;
+  }
+
+  char* buffer = NULL;
+  size_t buffer_size = 0;
+  char* key = NULL;
+  size_t key_size = 0;
+  char* line_str = NULL;
+  size_t line_size = 0;
+  ssize_t len;
+  unsigned line_number = 0;
+  while((len = getline(&line_str, &line_size, f)) > 0) {
+    line_number++;
+    /* the type is the first field of a line */
+    int is_settings = strncmp(line_str, "{\"type\":\"settings\"", 18) == 0;
+    if(!is_settings &&
+       (compare_objects ? strncmp(line_str, "{\"type\":\"object\"", 16) :
+	strncmp(line_str, "{\"type\":\"call_site\"", 19)) != 0)
+      continue;
+
+    if(buffer_size < (size_t)len + 1) {
+      buffer_size = len + 1;
+      buffer = realloc(buffer, buffer_size);
+    }
+    struct report_line line;
+    memset(&line, 0, sizeof(line));
+    char field_path[PATH_LEN] = "";
+    if(!__parse_value(line_str, field_path, buffer, &line)) {
+      fprintf(stderr, "%s:%u: cannot parse the line\n", run->filename, line_number);
+      free(line.callstack);
+      free(line.caller);
+      continue;
+    }
+
+    if(is_settings) {
+      run->sampling_rate = line.sampling_rate;
+      continue;
+    }
+
+    struct diff_entry* entry;
+    if(compare_objects) {
+      if(!line.key[0]) {
+	run->nb_unkeyed++;
+	free(line.callstack);
+	free(line.caller);
+	continue;
+      }
+      entry = __table_get(table, line.key);
+      if(!entry->label) {
+	char label[128];
+	snprintf(label, sizeof(label), "%s, size %" PRIu64, line.mem_type, line.size);
+	entry->label = strdup(label);
+      }
+    } else {
+      const char* callstack = line.callstack ? line.callstack : line.caller ? line.caller : "???";
+      if(key_size < strlen(callstack) + 64) {
+	key_size = strlen(callstack) + 64;
+	key = realloc(key, key_size);
+      }
+      __normalize_callstack(callstack, key, key_size - 48, run);
+      size_t key_len = strlen(key);
+      snprintf(&key[key_len], key_size - key_len, "\t%s\t%d", line.mem_type, __size_class(line.size));
+      entry = __table_get(table, key);
+    }
+    struct site_stats* stats = &entry->runs[run_index];
+    stats->nb_sites++;
+    stats->nb_mallocs += line.stats.nb_mallocs;
+    stats->count += line.stats.count;
+    stats->weight += line.stats.weight;
+    for(unsigned i = 0; i < NB_LEVELS; i++) {
+      struct level_stats* l = &stats->levels[i];
+      struct level_stats* from = &line.stats.levels[i];
+      if(!from->count)
+	continue;
+      if(!l->count || from->min_weight < l->min_weight)
+	l->min_weight = from->min_weight;
+      if(from->max_weight > l->max_weight)
+	l->max_weight = from->max_weight;
+      l->count += from->count;
+      l->sum_weight += from->sum_weight;
+    }
+    run->nb_sites++;
+    free(line.callstack);
+    free(line.caller);
+  }
+  free(line_str);
+  free(buffer);
+  free(key);
+  fclose(f);
+
+  if(!run->sampling_rate)
+    run->sampling_rate = 1;
+  return 0;
+}
+
+/* estimate the second moment of the weight of the samples of a call site */
+static double __weight_second_moment(struct site_stats* stats) {
+  double count = 0;
+  double moment = 0;
+  for(unsigned i = 0; i < NB_LEVELS; i++) {
+    struct level_stats* l = &stats->levels[i];
+    if(!l->count)
+      continue;
+    double mean = (double)l->sum_weight / l->count;
+    double stddev = (double)(l->max_weight - l->min_weight) / 4;
+    moment += l->count * (stddev * stddev + mean * mean);
+    count += l->count;
+  }
+  if(count)
+    return moment / count;
+  /* no information about the levels: assume an exponential distribution */
+  double mean = stats->count ? (double)stats->weight / stats->count : 0;
+  return 2 * mean * mean;
+}
+
+static double __p_value(double z) {
+  return erfc(fabs(z) / sqrt(2));
+}
+
+/* count the samples that hit the local/remote memory */
+static uint64_t __count_levels(struct site_stats* stats, const char** levels) {
+  uint64_t count = 0;
+  for(int i = 0; levels[i]; i++)
+    count += stats->levels[__level_index(levels[i], strlen(levels[i]))].count;
+  return count;
+}
+
+static void __compare(struct diff_entry* entry, struct run* runs) {
+  double weight_var[2];
+  double latency_var[2];
+  double remote[2];
+  double remote_total[2];
+
+  for(int r = 0; r < 2; r++) {
+    struct site_stats* stats = &entry->runs[r];
+    double rate = runs[r].sampling_rate;
+    double moment = __weight_second_moment(stats);
+    entry->weight[r] = rate * stats->weight;
+    weight_var[r] = rate * rate * stats->count * moment;
+
+    entry->latency[r] = stats->count ? (double)stats->weight / stats->count : NAN;
+    latency_var[r] = stats->count ? (moment - entry->latency[r] * entry->latency[r]) / stats->count : NAN;
+    if(latency_var[r] < 0)
+      latency_var[r] = 0;
+
+    remote[r] = __count_levels(stats, remote_levels);
+    remote_total[r] = remote[r] + __count_levels(stats, local_levels);
+    entry->remote_share[r] = remote_total[r] ? remote[r] / remote_total[r] : NAN;
+  }
+
+  double delta = entry->weight[1] - entry->weight[0];
+  double var = weight_var[0] + weight_var[1];
+  entry->weight_p = var > 0 ? __p_value(delta / sqrt(var)) : (delta ? 0 : 1);
+
+  entry->latency_p = NAN;
+  if(!isnan(entry->latency[0]) && !isnan(entry->latency[1])) {
+    delta = entry->latency[1] - entry->latency[0];
+    var = latency_var[0] + latency_var[1];
+    entry->latency_p = var > 0 ? __p_value(delta / sqrt(var)) : (delta ? 0 : 1);
+  }
+
+  entry->remote_p = NAN;
+  if(remote_total[0] && remote_total[1]) {
+    double p = (remote[0] + remote[1]) / (remote_total[0] + remote_total[1]);
+    var = p * (1 - p) * (1 / remote_total[0] + 1 / remote_total[1]);
+    delta = entry->remote_share[1] - entry->remote_share[0];
+    entry->remote_p = var > 0 ? __p_value(delta / sqrt(var)) : (delta ? 0 : 1);
+  }
+}
+
+static int __compare_entries(const void* a, const void* b) {
+  const struct diff_entry* entry_a = *(const struct diff_entry**)a;
+  const struct diff_entry* entry_b = *(const struct diff_entry**)b;
+  double delta_a = fabs(entry_a->weight[1] - entry_a->weight[0]);
+  double delta_b = fabs(entry_b->weight[1] - entry_b->weight[0]);
+  if(delta_a != delta_b)
+    return delta_a > delta_b ? -1 : 1;
+  return strcmp(entry_a->key, entry_b->key);
+}
+
+/* print a p-value corrected for the number of tests */
+static void __print_p_value(double p, double nb_tests, double alpha) {
+  if(isnan(p)) {
+    printf(" %8s ", "-");
+    return;
+  }
+  p = fmin(1, p * nb_tests);
+  printf(" %8.2g%c", p, p < alpha ? '*' : ' ');
+}
+
+static void __print_entry(struct diff_entry* entry, double nb_tests, double alpha) {
+  for(int r = 0; r < 2; r++) {
+    if(entry->runs[r].nb_sites)
+      printf("%11.4g ", entry->weight[r]);
+    else
+      printf("%11s ", "-");
+  }
+  if(entry->runs[0].nb_sites && entry->weight[0])
+    printf("%+8.1f%%", 100 * (entry->weight[1] - entry->weight[0]) / entry->weight[0]);
+  else
+    printf("%9s", entry->runs[0].nb_sites ? "-" : "new");
+  __print_p_value(entry->weight_p, nb_tests, alpha);
+
+  for(int r = 0; r < 2; r++) {
+    if(isnan(entry->remote_share[r]))
+      printf("%7s", "-");
+    else
+      printf("%6.1f%%", 100 * entry->remote_share[r]);
+  }
+  __print_p_value(entry->remote_p, nb_tests, alpha);
+
+  for(int r = 0; r < 2; r++) {
+    if(isnan(entry->latency[r]))
+      printf("%8s", "-");
+    else
+      printf("%8.1f", entry->latency[r]);
+  }
+  __print_p_value(entry->latency_p, nb_tests, alpha);
+
+  if(entry->label) {
+    printf("  %s (%s)\n", entry->key, entry->label);
+    return;
+  }
+
+  /* the key is callstack \t mem_type \t size class */
+  char* callstack = entry->key;
+  char* mem_type = strchr(callstack, '\t');
+  *mem_type++ = '\0';
+  char* size_class = strchr(mem_type, '\t');
+  *size_class++ = '\0';
+  int c = atoi(size_class);
+  printf("  %s (%s, size ", callstack, mem_type);
+  if(c)
+    printf("%" PRIu64 "-%" PRIu64 ")\n", (uint64_t)1 << (c - 1), ((uint64_t)1 << (c - 1)) * 2 - 1);
+  else
+    printf("0)\n");
+  mem_type[-1] = '\t';
+  size_class[-1] = '\t';
+}
+
+int numamma_diff(int argc, char** argv) {
+  int nb_lines = 20;
+  double alpha = 0.01;
+  int opt;
+  optind = 1;
+  while((opt = getopt(argc, argv, "n:a:loh")) != -1) {
+    switch(opt) {
+    case 'n':
+      nb_lines = atoi(optarg);
+      break;
+    case 'a':
+      alpha = atof(optarg);
+      break;
+    case 'l':
+      keep_line_numbers = 1;
+      break;
+    case 'o':
+      compare_objects = 1;
+      break;
+    default:
+      usage();
+      return EXIT_FAILURE;
+    }
+  }
+  if(optind != argc - 2) {
+    usage();
+    return EXIT_FAILURE;
+  }
+
+  struct diff_table table;
+  __table_init(&table);
+  struct run runs[2];
+  memset(runs, 0, sizeof(runs));
+  for(int r = 0; r < 2; r++)
+    if(__load_run(argv[optind + r], r, &runs[r], &table) < 0)
+      return EXIT_FAILURE;
+
+  struct diff_entry** entries = malloc(sizeof(struct diff_entry*) * (table.nb_entries + 1));
+  size_t nb_entries = 0;
+  unsigned nb_matched = 0;
+  unsigned nb_only[2] = {0, 0};
+  for(size_t i = 0; i < table.size; i++) {
+    struct diff_entry* entry = table.entries[i];
+    if(!entry)
+      continue;
+    __compare(entry, runs);
+    if(entry->runs[0].nb_sites && entry->runs[1].nb_sites)
+      nb_matched++;
+    else
+      nb_only[entry->runs[0].nb_sites ? 0 : 1]++;
+    entries[nb_entries++] = entry;
+  }
+  qsort(entries, nb_entries, sizeof(struct diff_entry*), __compare_entries);
+
+  const char* items = compare_objects ? "objects" : "call sites";
+  for(int r = 0; r < 2; r++) {
+    printf("Run %c: %s (%u %s, sampling rate: %" PRIu64 ")\n",
+	   'A' + r, runs[r].filename, runs[r].nb_sites, items, runs[r].sampling_rate);
+    if(runs[r].deferred_symbols)
+      fprintf(stderr, "Warning: the symbols of run %c were not resolved, so its call sites cannot be matched. Run numamma-symbolize first\n", 'A' + r);
+    if(runs[r].nb_unkeyed)
+      fprintf(stderr, "Warning: %u objects of run %c have no key and were ignored\n",
+	      runs[r].nb_unkeyed, 'A' + r);
+  }
+  printf("%u %s matched, %u only in run A, %u only in run B\n",
+	 nb_matched, items, nb_only[0], nb_only[1]);
+
+  printf("\n%11s %11s %9s %9s  %6s %6s %9s  %7s %7s %9s  %s\n",
+	 "weight A", "weight B", "change", "p", "rmt A", "rmt B", "p", "lat A", "lat B", "p",
+	 compare_objects ? "object" : "call site");
+  for(size_t i = 0; i < nb_entries && (nb_lines <= 0 || i < (size_t)nb_lines); i++)
+    __print_entry(entries[i], nb_entries, alpha);
+  printf("\nweight: estimated total weight (sum of the weights of the samples x sampling rate)\n"
+	 "rmt: share of the samples that hit remote memory among the samples that hit memory\n"
+	 "lat: average weight of the samples\n"
+	 "p: p-value of the change, corrected for %zu tests (*: lower than %g)\n", nb_entries, alpha);
+
+  for(size_t i = 0; i < nb_entries; i++) {
+    free(entries[i]->key);
+    free(entries[i]->label);
+    free(entries[i]);
+  }
+  free(entries);
+  free(table.entries);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,16 @@
+#ifndef NUMAMMA_DIFF_H
+#define NUMAMMA_DIFF_H
+
+/* numamma diff [-n N] [-a alpha] [-l] [-o] RUN_A RUN_B: compare the call
+ * sites of two runs (output directories or report.jsonl files).
+ *
+ * The call sites are matched by their symbolized call stack, their memory
+ * type and the power of 2 of their size. With -o, the objects are compared
+ * instead, matched by their stable key. For each call site (or object),
+ * numamma diff prints the change in estimated total weight, in share of
+ * remote memory accesses, and in average latency, with the p-value of each
+ * change.
+ */
+int numamma_diff(int argc, char** argv);
+
+#endif	/* NUMAMMA_DIFF_H */
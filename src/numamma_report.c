@@ -0,0 +1,1225 @@
+/* numamma-report: compute aggregates of the sample dumps written by numamma.
+ *
+ * The dump (binary trace or text dump) is read once, by several threads:
+ * the chunks of a binary trace, or ranges of lines of a text dump, are
+ * distributed among the threads. Each thread aggregates its samples in
+ * private hash tables that are merged at the end, so the memory usage
+ * depends on the size of the aggregates, not on the size of the dump.
+ *
+ * The aggregates are:
+ *  - pages: number of accesses of each thread to each page of each object
+ *  - timeline: number of accesses to each page of each object during each
+ *    time interval
+ *  - levels: number of accesses of each thread to each memory level
+ * They are written as CSV (or as a compact binary table with -f binary),
+ * and are small enough to be plotted by the scripts.
+ *
+ * With -T, numamma-report also writes a pyramid of tiles (prefix.tiles)
+ * that a viewer can zoom into, reading only the tiles it displays. At
+ * level L of the pyramid, a cell covers 2^L time intervals and 2^L pages
+ * of an object, and a tile is a square of TILE_SIZE x TILE_SIZE cells.
+ * The top level of the pyramid of an object fits in a single tile. A tile
+ * only stores the cells that were accessed, and each cell has several
+ * channels: all the accesses, the accesses of each thread, and the
+ * accesses to each memory level. The channels of the threads and memory
+ * levels are only stored from level channel_level (-C), so that the fine
+ * levels, which have about one cell per sample, stay small.
+ *
+ * The tile cells do not have to fit in memory: each thread sorts its cells
+ * by batches of TILES_RUN_ENTRIES, and writes them to a temporary file.
+ * The sorted runs are then merged, and the pyramid of each object is built
+ * from its cells in time order: only the current column of tiles of each
+ * level is kept in memory.
+ *
+ * The tiles file starts with a struct tiles_header, followed by the tiles
+ * (arrays of struct tile_cell). The footer contains the number of tiles,
+ * the index of the tiles (struct tile_index_entry, sorted by id, level and
+ * position), the number of memory levels and their names
+ * (TILES_NAME_LEN bytes each). The last 16 bytes of the file are the
+ * position of the footer followed by TILES_MAGIC. Integers are stored in
+ * the byte order of the machine.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mem_trace.h"
+
+#define STRING_LEN 4096
+/* magic number of the binary aggregates */
+#define AGGREGATE_MAGIC "NMMAGGR1"
+/* length of the column names in the binary aggregates */
+#define AGGREGATE_NAME_LEN 16
+
+#define TILES_MAGIC "NMMTILES"
+#define TILES_VERSION 2
+/* number of cells of the side of a tile */
+#define TILE_SIZE 256
+#define TILE_SHIFT 8
+#define TILES_NAME_LEN 32
+/* maximum number of levels of the pyramid */
+#define TILES_MAX_LEVELS 64
+/* number of tile cells in a sorted run */
+#define TILES_RUN_ENTRIES (1 << 18)
+/* number of entries read at once from a sorted run */
+#define TILES_READ_ENTRIES 1024
+
+/* channels of the cells */
+#define TILE_CHANNEL_ALL 0
+#define TILE_CHANNEL_THREAD 0x4000	/* | thread rank */
+#define TILE_CHANNEL_LEVEL 0x8000	/* | memory level */
+#define TILE_CHANNEL_MASK 0x3fff
+
+struct tiles_header {
+  char magic[8];		/* TILES_MAGIC */
+  uint32_t version;
+  uint32_t tile_size;		/* TILE_SIZE */
+  uint64_t interval;		/* duration (in ns) of a cell at level 0 */
+  uint64_t page_size;		/* size (in bytes) of a cell at level 0 */
+  uint64_t start_time;		/* timestamp of the first cell */
+  uint32_t nb_levels;		/* number of levels of the pyramid */
+  uint32_t by_site;		/* set if the ids are call sites, otherwise objects */
+  uint32_t channel_level;	/* first level with the thread and memory level channels */
+  uint32_t reserved;
+};
+
+struct tile_cell {
+  uint8_t x;			/* time */
+  uint8_t y;			/* offset */
+  uint16_t channel;		/* TILE_CHANNEL_* */
+  uint32_t count;		/* saturated at UINT32_MAX */
+  uint64_t weight;
+};
+
+struct tile_index_entry {
+  uint32_t id;			/* object or call site */
+  uint32_t level;
+  uint32_t tx;			/* position of the tile (in tiles) */
+  uint32_t ty;
+  uint64_t offset;		/* position of the cells in the file */
+  uint64_t nb_cells;
+};
+
+enum aggregate {
+  AGGREGATE_PAGES,		/* key: (id, page, thread) */
+  AGGREGATE_TIMELINE,		/* key: (id, time interval, page) */
+  AGGREGATE_LEVELS,		/* key: (thread, level, access type) */
+  AGGREGATE_TILES,		/* key: (id, time interval, page << 16 | channel). The
+				 * thread and level channels are rounded down to
+				 * cells of level channel_level */
+  AGGREGATE_MAX
+};
+
+static const char* aggregate_names[] = {"pages", "timeline", "levels", "tiles"};
+
+/* kinds of text dumps (a text dump of call sites may contain a single site) */
+enum input_kind {
+  INPUT_OBJECTS,		/* thread_rank timestamp object_id offset ... */
+  INPUT_SITES,			/* site_id thread_rank timestamp offset ... */
+  INPUT_SITE,			/* thread_rank timestamp offset ... */
+  INPUT_UNMATCHED,		/* thread_rank timestamp address ... */
+};
+
+struct agg_entry {
+  uint64_t key[3];
+  uint64_t count;
+  uint64_t weight;
+};
+
+/* open addressing hash table. Empty slots have a count of 0 */
+struct agg_table {
+  size_t size;			/* power of 2 */
+  size_t nb_entries;
+  struct agg_entry* entries;
+};
+
+/* sorted tile cells written to a temporary file */
+struct tile_run {
+  int fd;
+  uint64_t offset;		/* position of the next entry */
+  uint64_t nb_entries;		/* number of entries left */
+  /* entries read from the file */
+  struct agg_entry* buffer;
+  size_t pos;
+  size_t len;
+};
+
+struct worker {
+  pthread_t tid;
+  struct agg_table tables[AGGREGATE_MAX];
+  /* the tile cells that were moved to the temporary file */
+  int tiles_fd;
+  uint64_t tiles_size;
+  struct tile_run* runs;
+  size_t nb_runs;
+  uint64_t min_timestamp;
+  uint64_t nb_samples;
+  /* text dumps: the part of the file parsed by this worker */
+  const char* start;
+  const char* end;
+  int error;
+};
+
+/* settings */
+static int nb_threads = 0;
+static uint64_t page_size = 4096;
+static uint64_t interval = 10*1000*1000;	/* 10 ms */
+static int binary_output = 0;
+static int tiles = 0;
+static unsigned channel_level = 4;
+static int object_filter = 0;
+static uint32_t object_id = 0;
+static int site_filter = 0;
+static uint32_t site_id = 0;
+
+/* binary trace */
+static struct trace_reader* trace = NULL;
+static enum trace_kind trace_kind;
+static size_t nb_chunks = 0;
+static const struct trace_index_entry* chunk_entries = NULL;
+static _Atomic size_t next_chunk = 0;
+
+/* text dump */
+static enum input_kind input_kind;
+
+/* names of the memory levels found in the dump */
+static char* level_names[TRACE_MAX_LEVELS];
+static unsigned nb_levels = 0;
+static pthread_mutex_t level_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void usage(const char* prog) {
+  fprintf(stderr, "usage: %s [-j nb_threads] [-p page_size] [-t interval_ns] [-f csv|binary] [-c site_id] [-i object_id] [-o prefix] [-T] [-C level] dump_file\n", prog);
+  fprintf(stderr, "\t-j nb_threads\tnumber of threads (default: number of cores)\n");
+  fprintf(stderr, "\t-p page_size\tsize of the pages in bytes (default: 4096)\n");
+  fprintf(stderr, "\t-t interval_ns\tlength of the time intervals of the timeline (default: 10000000)\n");
+  fprintf(stderr, "\t-f csv|binary\tformat of the pages and timeline aggregates (default: csv)\n");
+  fprintf(stderr, "\t-c site_id\tonly process the samples of a call site\n");
+  fprintf(stderr, "\t-i object_id\tonly process the samples of an object\n");
+  fprintf(stderr, "\t-o prefix\twrite prefix.pages.csv, etc. (default: dump_file without extension)\n");
+  fprintf(stderr, "\t-T\t\talso write a pyramid of tiles (prefix.tiles)\n");
+  fprintf(stderr, "\t-C level\tfirst level of the tiles with the thread and memory level channels (default: 4)\n");
+}
+
+static uint64_t __hash(const uint64_t key[3]) {
+  uint64_t h = key[0] * 0x9E3779B97F4A7C15ULL;
+  h ^= key[1] + 0x632BE59BD9B4E019ULL + (h << 6) + (h >> 2);
+  h ^= key[2] + 0x8CB92BA72F3D8DD7ULL + (h << 6) + (h >> 2);
+  h ^= h >> 33;
+  h *= 0xFF51AFD7ED558CCDULL;
+  h ^= h >> 33;
+  return h;
+}
+
+static void __table_init(struct agg_table* t) {
+  t->size = 1024;
+  t->nb_entries = 0;
+  t->entries = calloc(t->size, sizeof(struct agg_entry));
+}
+
+static void __table_add(struct agg_table* t, const uint64_t key[3], uint64_t count, uint64_t weight);
+static void __spill_tiles(struct worker* w);
+
+static void __table_grow(struct agg_table* t) {
+  struct agg_table old = *t;
+  t->size *= 2;
+  t->nb_entries = 0;
+  t->entries = calloc(t->size, sizeof(struct agg_entry));
+  for(size_t i = 0; i < old.size; i++)
+    if(old.entries[i].count)
+      __table_add(t, old.entries[i].key, old.entries[i].count, old.entries[i].weight);
+  free(old.entries);
+}
+
+static void __table_add(struct agg_table* t, const uint64_t key[3], uint64_t count, uint64_t weight) {
+  size_t mask = t->size - 1;
+  size_t i = __hash(key) & mask;
+  for(;;) {
+    struct agg_entry* e = &t->entries[i];
+    if(!e->count) {
+      memcpy(e->key, key, sizeof(e->key));
+      e->count = count;
+      e->weight = weight;
+      if(++t->nb_entries * 2 > t->size)
+	__table_grow(t);
+      return;
+    }
+    if(e->key[0] == key[0] && e->key[1] == key[1] && e->key[2] == key[2]) {
+      e->count += count;
+      e->weight += weight;
+      return;
+    }
+    i = (i + 1) & mask;
+  }
+}
+
+static void __table_merge(struct agg_table* dest, struct agg_table* src) {
+  for(size_t i = 0; i < src->size; i++)
+    if(src->entries[i].count)
+      __table_add(dest, src->entries[i].key, src->entries[i].count, src->entries[i].weight);
+}
+
+static void __aggregate(struct worker* w, uint32_t id, const struct trace_record* r) {
+  uint64_t page = r->offset / page_size;
+  uint64_t key[3];
+
+  key[0] = id; key[1] = page; key[2] = r->thread_rank;
+  __table_add(&w->tables[AGGREGATE_PAGES], key, 1, r->weight);
+
+  key[0] = id; key[1] = r->timestamp / interval; key[2] = page;
+  __table_add(&w->tables[AGGREGATE_TIMELINE], key, 1, r->weight);
+
+  key[0] = r->thread_rank; key[1] = r->level; key[2] = r->access_type;
+  __table_add(&w->tables[AGGREGATE_LEVELS], key, 1, r->weight);
+
+  if(tiles) {
+    key[0] = id; key[1] = r->timestamp / interval;
+    key[2] = page << 16 | TILE_CHANNEL_ALL;
+    __table_add(&w->tables[AGGREGATE_TILES], key, 1, r->weight);
+    /* the other channels are coarsened to the cells of channel_level */
+    key[1] = key[1] >> channel_level << channel_level;
+    uint64_t coarse_page = page >> channel_level << channel_level;
+    key[2] = coarse_page << 16 | TILE_CHANNEL_THREAD | (r->thread_rank & TILE_CHANNEL_MASK);
+    __table_add(&w->tables[AGGREGATE_TILES], key, 1, r->weight);
+    key[2] = coarse_page << 16 | TILE_CHANNEL_LEVEL | r->level;
+    __table_add(&w->tables[AGGREGATE_TILES], key, 1, r->weight);
+    if(w->tables[AGGREGATE_TILES].nb_entries >= TILES_RUN_ENTRIES)
+      __spill_tiles(w);
+  }
+
+  if(r->timestamp < w->min_timestamp)
+    w->min_timestamp = r->timestamp;
+  w->nb_samples++;
+}
+
+static void* __trace_worker(void* arg) {
+  struct worker* w = arg;
+  struct trace_record* records = NULL;
+  size_t capacity = 0;
+  size_t i;
+  while((i = atomic_fetch_add(&next_chunk, 1)) < nb_chunks) {
+    size_t chunk = chunk_entries ? chunk_entries[i].chunk : i;
+    ssize_t n = trace_reader_read_chunk(trace, chunk, &records, &capacity);
+    if(n < 0) {
+      fprintf(stderr, "chunk %zu is corrupted\n", chunk);
+      w->error = 1;
+      break;
+    }
+    uint32_t stream = trace->chunk_streams[chunk];
+    for(ssize_t j = 0; j < n; j++) {
+      if(object_filter && records[j].object_id != object_id)
+	continue;
+      uint32_t id = trace->kind == TRACE_KIND_CALL_SITE ? stream : records[j].object_id;
+      __aggregate(w, id, &records[j]);
+    }
+  }
+  free(records);
+  return NULL;
+}
+
+/* return the code of a level name (len characters) */
+static uint8_t __level_code(const char* name, size_t len) {
+  pthread_mutex_lock(&level_lock);
+  unsigned i;
+  for(i = 0; i < nb_levels; i++)
+    if(strlen(level_names[i]) == len && strncmp(level_names[i], name, len) == 0)
+      goto out;
+  if(nb_levels == TRACE_MAX_LEVELS) {
+    i = TRACE_MAX_LEVELS - 1;
+    goto out;
+  }
+  level_names[i] = strndup(name, len);
+  nb_levels++;
+ out:
+  pthread_mutex_unlock(&level_lock);
+  return i;
+}
+
+/* a few levels are cached by each thread, so that level_lock is rarely taken */
+#define LEVEL_CACHE_SIZE 32
+struct level_cache {
+  unsigned nb_entries;
+  struct {
+    char name[64];
+    uint8_t code;
+  } entries[LEVEL_CACHE_SIZE];
+};
+
+static uint8_t __cached_level_code(struct level_cache* cache, const char* name, size_t len) {
+  for(unsigned i = 0; i < cache->nb_entries; i++)
+    if(strncmp(cache->entries[i].name, name, len) == 0 && cache->entries[i].name[len] == '\0')
+      return cache->entries[i].code;
+  uint8_t code = __level_code(name, len);
+  if(cache->nb_entries < LEVEL_CACHE_SIZE && len < sizeof(cache->entries[0].name)) {
+    memcpy(cache->entries[cache->nb_entries].name, name, len);
+    cache->entries[cache->nb_entries].name[len] = '\0';
+    cache->entries[cache->nb_entries].code = code;
+    cache->nb_entries++;
+  }
+  return code;
+}
+
+static const char* __skip_spaces(const char* p, const char* end) {
+  while(p < end && (*p == ' ' || *p == '\t'))
+    p++;
+  return p;
+}
+
+/* parse an unsigned integer (decimal, or hexadecimal with 0x) */
+static const char* __parse_u64(const char* p, const char* end, uint64_t* value) {
+  p = __skip_spaces(p, end);
+  uint64_t v = 0;
+  const char* start = p;
+  if(end - p > 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
+    p += 2;
+    start = p;
+    for(; p < end; p++) {
+      int d;
+      if(*p >= '0' && *p <= '9') d = *p - '0';
+      else if(*p >= 'a' && *p <= 'f') d = *p - 'a' + 10;
+      else if(*p >= 'A' && *p <= 'F') d = *p - 'A' + 10;
+      else break;
+      v = v * 16 + d;
+    }
+  } else {
+    for(; p < end && *p >= '0' && *p <= '9'; p++)
+      v = v * 10 + (*p - '0');
+  }
+  *value = v;
+  return p == start ? NULL : p;
+}
+
+static const char* __parse_word(const char* p, const char* end, const char** word, size_t* len) {
+  p = __skip_spaces(p, end);
+  *word = p;
+  while(p < end && *p != ' ' && *p != '\t' && *p != '\n')
+    p++;
+  *len = p - *word;
+  return *len ? p : NULL;
+}
+
+/* parse a line of a text dump. return -1 if the line is not a sample */
+static int __parse_line(const char* p, const char* end, struct level_cache* cache,
+			uint32_t* id, struct trace_record* r) {
+  uint64_t v[4];
+  const char* level;
+  size_t level_len;
+  const char* access;
+  size_t access_len;
+  uint64_t weight;
+  int nb_ints = (input_kind == INPUT_SITE || input_kind == INPUT_UNMATCHED) ? 3 : 4;
+
+  for(int i = 0; i < nb_ints; i++)
+    if(!(p = __parse_u64(p, end, &v[i])))
+      return -1;
+  if(!(p = __parse_word(p, end, &level, &level_len)) ||
+     !(p = __parse_u64(p, end, &weight)) ||
+     !(p = __parse_word(p, end, &access, &access_len)))
+    return -1;
+
+  switch(input_kind) {
+  case INPUT_OBJECTS:
+    r->thread_rank = v[0]; r->timestamp = v[1]; r->object_id = v[2]; r->offset = v[3];
+    *id = r->object_id;
+    break;
+  case INPUT_SITES:
+    *id = v[0]; r->thread_rank = v[1]; r->timestamp = v[2]; r->offset = v[3];
+    r->object_id = 0;
+    break;
+  case INPUT_SITE:
+    *id = site_id; r->thread_rank = v[0]; r->timestamp = v[1]; r->offset = v[2];
+    r->object_id = 0;
+    break;
+  case INPUT_UNMATCHED:
+    *id = 0; r->thread_rank = v[0]; r->timestamp = v[1]; r->offset = v[2];
+    r->object_id = 0;
+    break;
+  }
+  r->weight = weight;
+  r->access_type = access[0] == 'w';
+  r->level = __cached_level_code(cache, level, level_len);
+  return 0;
+}
+
+static void* __text_worker(void* arg) {
+  struct worker* w = arg;
+  struct level_cache cache = { .nb_entries = 0 };
+  const char* p = w->start;
+  while(p < w->end) {
+    const char* eol = memchr(p, '\n', w->end - p);
+    if(!eol)
+      eol = w->end;
+    if(*p != '#') {
+      uint32_t id = 0;
+      struct trace_record r;
+      if(__parse_line(p, eol, &cache, &id, &r) == 0) {
+	if(!(object_filter && input_kind == INPUT_OBJECTS && r.object_id != object_id) &&
+	   !(site_filter && input_kind == INPUT_SITES && id != site_id))
+	  __aggregate(w, id, &r);
+      }
+    }
+    p = eol + 1;
+  }
+  return NULL;
+}
+
+/* find the kind of a text dump from its header */
+static int __text_kind(const char* data, size_t size) {
+  const char* p = data;
+  const char* end = data + size;
+  while(p < end && *p == '#') {
+    const char* eol = memchr(p, '\n', end - p);
+    if(!eol)
+      eol = end;
+    size_t len = eol - p;
+#define IS_HEADER(h) (len >= strlen(h) && strncmp(p, h, strlen(h)) == 0)
+    if(IS_HEADER("#site_id ")) {
+      input_kind = INPUT_SITES;
+      return 0;
+    } else if(IS_HEADER("#thread_rank timestamp object_id ")) {
+      input_kind = INPUT_OBJECTS;
+      return 0;
+    } else if(IS_HEADER("#thread_rank timestamp offset ")) {
+      input_kind = INPUT_SITE;
+      return 0;
+    } else if(IS_HEADER("#thread_rank timestamp address ")) {
+      input_kind = INPUT_UNMATCHED;
+      return 0;
+    }
+#undef IS_HEADER
+    p = eol + 1;
+  }
+  return -1;
+}
+
+static int __is_trace(const char* filename) {
+  char magic[TRACE_MAGIC_LEN];
+  int fd = open(filename, O_RDONLY);
+  if(fd < 0)
+    return 0;
+  int ret = read(fd, magic, TRACE_MAGIC_LEN) == TRACE_MAGIC_LEN &&
+    memcmp(magic, TRACE_MAGIC, TRACE_MAGIC_LEN) == 0;
+  close(fd);
+  return ret;
+}
+
+static void __run_workers(struct worker* workers, void* (*function)(void*)) {
+  for(int i = 0; i < nb_threads; i++)
+    pthread_create(&workers[i].tid, NULL, function, &workers[i]);
+  for(int i = 0; i < nb_threads; i++)
+    pthread_join(workers[i].tid, NULL);
+}
+
+static int __process_trace(const char* filename, struct worker* workers) {
+  trace = trace_reader_open(filename);
+  if(!trace)
+    return -1;
+  if((trace->kind == TRACE_KIND_UNMATCHED && object_filter) ||
+     (trace->kind != TRACE_KIND_CALL_SITE && site_filter)) {
+    fprintf(stderr, "%s cannot be filtered this way\n", filename);
+    return -1;
+  }
+
+  /* the chunks to read */
+  nb_chunks = trace->nb_chunks;
+  if(site_filter && trace->kind == TRACE_KIND_CALL_SITE)
+    nb_chunks = trace_reader_stream_chunks(trace, site_id, &chunk_entries);
+  else if(object_filter)
+    nb_chunks = trace_reader_object_chunks(trace, object_id, &chunk_entries);
+
+  for(unsigned i = 0; i < trace->nb_levels; i++)
+    level_names[i] = strdup(trace->level_names[i]);
+  nb_levels = trace->nb_levels;
+
+  __run_workers(workers, __trace_worker);
+  trace_kind = trace->kind;
+  trace_reader_close(trace);
+  trace = NULL;
+  return 0;
+}
+
+static int __process_text(const char* filename, struct worker* workers) {
+  int fd = open(filename, O_RDONLY);
+  struct stat st;
+  if(fd < 0 || fstat(fd, &st) < 0) {
+    fprintf(stderr, "cannot open %s: %s\n", filename, strerror(errno));
+    return -1;
+  }
+  size_t size = st.st_size;
+  if(size == 0) {
+    close(fd);
+    return 0;
+  }
+  const char* data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(data == MAP_FAILED) {
+    fprintf(stderr, "cannot map %s: %s\n", filename, strerror(errno));
+    return -1;
+  }
+  madvise((void*)data, size, MADV_SEQUENTIAL);
+
+  if(__text_kind(data, size) < 0) {
+    fprintf(stderr, "%s is not a numamma dump\n", filename);
+    return -1;
+  }
+  if((object_filter && input_kind != INPUT_OBJECTS) ||
+     (site_filter && input_kind != INPUT_SITES && input_kind != INPUT_SITE)) {
+    fprintf(stderr, "%s cannot be filtered this way\n", filename);
+    return -1;
+  }
+
+  /* each thread parses a range of lines */
+  const char* start = data;
+  for(int i = 0; i < nb_threads; i++) {
+    const char* end = data + size * (i + 1) / nb_threads;
+    if(i < nb_threads - 1) {
+      const char* eol = memchr(end, '\n', data + size - end);
+      end = eol ? eol + 1 : data + size;
+    }
+    if(end < start)
+      end = start;
+    workers[i].start = start;
+    workers[i].end = end;
+    start = end;
+  }
+
+  __run_workers(workers, __text_worker);
+  munmap((void*)data, size);
+  return 0;
+}
+
+static int __compare_entries(const void* a, const void* b) {
+  const struct agg_entry* ea = a;
+  const struct agg_entry* eb = b;
+  for(int i = 0; i < 3; i++) {
+    if(ea->key[i] < eb->key[i]) return -1;
+    if(ea->key[i] > eb->key[i]) return 1;
+  }
+  return 0;
+}
+
+/* return the entries of a table, sorted with compare */
+static struct agg_entry* __sorted_entries(struct agg_table* t,
+					  int (*compare)(const void*, const void*)) {
+  struct agg_entry* entries = malloc(sizeof(struct agg_entry) * (t->nb_entries + 1));
+  size_t n = 0;
+  for(size_t i = 0; i < t->size; i++)
+    if(t->entries[i].count)
+      entries[n++] = t->entries[i];
+  qsort(entries, n, sizeof(struct agg_entry), compare);
+  return entries;
+}
+
+static FILE* __open_output(const char* prefix, enum aggregate aggregate, int binary) {
+  char filename[STRING_LEN];
+  if(snprintf(filename, sizeof(filename), "%s.%s.%s", prefix, aggregate_names[aggregate],
+	      binary ? "bin" : "csv") >= (int)sizeof(filename)) {
+    fprintf(stderr, "%s: file name too long\n", prefix);
+    return NULL;
+  }
+  FILE* f = fopen(filename, "w");
+  if(!f)
+    fprintf(stderr, "cannot create %s: %s\n", filename, strerror(errno));
+  else
+    printf("%s\n", filename);
+  return f;
+}
+
+/* write the pages or the timeline aggregate. The timestamps are relative to
+ * the first sample
+ */
+static int __write_aggregate(const char* prefix, enum aggregate aggregate,
+			     struct agg_table* t, const char* columns[3],
+			     uint64_t min_interval) {
+  FILE* f = __open_output(prefix, aggregate, binary_output);
+  if(!f)
+    return -1;
+  struct agg_entry* entries = __sorted_entries(t, __compare_entries);
+
+  if(binary_output) {
+    /* header: magic, number of columns, number of rows, and the column names.
+     * then, each row is nb_columns 64-bit integers
+     */
+    uint32_t nb_columns = 5;
+    uint32_t reserved = 0;
+    uint64_t nb_rows = t->nb_entries;
+    fwrite(AGGREGATE_MAGIC, 1, strlen(AGGREGATE_MAGIC), f);
+    fwrite(&nb_columns, sizeof(nb_columns), 1, f);
+    fwrite(&reserved, sizeof(reserved), 1, f);
+    fwrite(&nb_rows, sizeof(nb_rows), 1, f);
+    const char* names[5] = {columns[0], columns[1], columns[2], "count", "weight"};
+    for(int i = 0; i < 5; i++) {
+      char name[AGGREGATE_NAME_LEN] = {0};
+      strncpy(name, names[i], AGGREGATE_NAME_LEN - 1);
+      fwrite(name, 1, AGGREGATE_NAME_LEN, f);
+    }
+  } else {
+    fprintf(f, "%s,%s,%s,count,weight\n", columns[0], columns[1], columns[2]);
+  }
+
+  for(size_t i = 0; i < t->nb_entries; i++) {
+    struct agg_entry* e = &entries[i];
+    uint64_t row[5] = {e->key[0], e->key[1], e->key[2], e->count, e->weight};
+    if(aggregate == AGGREGATE_TIMELINE)
+      row[1] = (row[1] - min_interval) * interval;
+    if(binary_output)
+      fwrite(row, sizeof(uint64_t), 5, f);
+    else
+      fprintf(f, "%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 "\n",
+	      row[0], row[1], row[2], row[3], row[4]);
+  }
+  free(entries);
+  fclose(f);
+  return 0;
+}
+
+/* the levels aggregate is small: it is always written as CSV */
+static int __write_levels(const char* prefix, struct agg_table* t) {
+  FILE* f = __open_output(prefix, AGGREGATE_LEVELS, 0);
+  if(!f)
+    return -1;
+  struct agg_entry* entries = __sorted_entries(t, __compare_entries);
+  fprintf(f, "thread,level,access,count,weight\n");
+  for(size_t i = 0; i < t->nb_entries; i++) {
+    struct agg_entry* e = &entries[i];
+    const char* level = e->key[1] < nb_levels ? level_names[e->key[1]] : "unknown";
+    fprintf(f, "%" PRIu64 ",%s,%c,%" PRIu64 ",%" PRIu64 "\n",
+	    e->key[0], level, e->key[2] ? 'w' : 'r', e->count, e->weight);
+  }
+  free(entries);
+  fclose(f);
+  return 0;
+}
+
+/* return a temporary file for the tile cells of a worker. The file is
+ * created next to the output, since it may be larger than /tmp
+ */
+static int __tiles_tmpfile(const char* prefix) {
+  char filename[STRING_LEN];
+  if(snprintf(filename, sizeof(filename), "%s.%s.XXXXXX", prefix,
+	      aggregate_names[AGGREGATE_TILES]) >= (int)sizeof(filename)) {
+    fprintf(stderr, "%s: file name too long\n", prefix);
+    return -1;
+  }
+  int fd = mkstemp(filename);
+  if(fd < 0) {
+    fprintf(stderr, "cannot create %s: %s\n", filename, strerror(errno));
+    return -1;
+  }
+  unlink(filename);
+  return fd;
+}
+
+/* write the tile cells of a worker to its temporary file as a sorted run,
+ * and empty its table
+ */
+static void __spill_tiles(struct worker* w) {
+  struct agg_table* t = &w->tables[AGGREGATE_TILES];
+  if(!t->nb_entries || w->error)
+    return;
+  struct agg_entry* entries = __sorted_entries(t, __compare_entries);
+  const char* p = (const char*)entries;
+  size_t size = sizeof(struct agg_entry) * t->nb_entries;
+  uint64_t offset = w->tiles_size;
+  while(size > 0) {
+    ssize_t n = pwrite(w->tiles_fd, p, size, offset);
+    if(n < 0) {
+      fprintf(stderr, "cannot write the tiles: %s\n", strerror(errno));
+      w->error = 1;
+      free(entries);
+      return;
+    }
+    p += n;
+    size -= n;
+    offset += n;
+  }
+  free(entries);
+
+  w->runs = realloc(w->runs, sizeof(struct tile_run) * (w->nb_runs + 1));
+  struct tile_run* run = &w->runs[w->nb_runs++];
+  memset(run, 0, sizeof(*run));
+  run->fd = w->tiles_fd;
+  run->offset = w->tiles_size;
+  run->nb_entries = t->nb_entries;
+  w->tiles_size = offset;
+
+  free(t->entries);
+  __table_init(t);
+}
+
+/* make sure that the next entry of a run is in its buffer. return 1 if
+ * there is an entry, 0 at the end of the run, and -1 on error
+ */
+static int __run_fill(struct tile_run* run) {
+  if(run->pos < run->len)
+    return 1;
+  if(!run->nb_entries)
+    return 0;
+  if(!run->buffer)
+    run->buffer = malloc(sizeof(struct agg_entry) * TILES_READ_ENTRIES);
+  size_t n = run->nb_entries < TILES_READ_ENTRIES ? run->nb_entries : TILES_READ_ENTRIES;
+  size_t size = sizeof(struct agg_entry) * n;
+  if(pread(run->fd, run->buffer, size, run->offset) != (ssize_t)size) {
+    fprintf(stderr, "cannot read the tiles: %s\n", strerror(errno));
+    return -1;
+  }
+  run->offset += size;
+  run->nb_entries -= n;
+  run->pos = 0;
+  run->len = n;
+  return 1;
+}
+
+static int __compare_runs(struct tile_run* a, struct tile_run* b) {
+  return __compare_entries(&a->buffer[a->pos], &b->buffer[b->pos]);
+}
+
+/* restore the order of the heap of runs, when the entry of heap[i] grew */
+static void __heap_down(struct tile_run** heap, size_t n, size_t i) {
+  for(;;) {
+    size_t min = i;
+    size_t left = 2 * i + 1;
+    size_t right = left + 1;
+    if(left < n && __compare_runs(heap[left], heap[min]) < 0)
+      min = left;
+    if(right < n && __compare_runs(heap[right], heap[min]) < 0)
+      min = right;
+    if(min == i)
+      return;
+    struct tile_run* tmp = heap[i];
+    heap[i] = heap[min];
+    heap[min] = tmp;
+    i = min;
+  }
+}
+
+static int __compare_tiles(const void* a, const void* b) {
+  const struct tile_index_entry* ta = a;
+  const struct tile_index_entry* tb = b;
+  uint32_t ka[4] = {ta->id, ta->level, ta->tx, ta->ty};
+  uint32_t kb[4] = {tb->id, tb->level, tb->tx, tb->ty};
+  for(int i = 0; i < 4; i++) {
+    if(ka[i] < kb[i]) return -1;
+    if(ka[i] > kb[i]) return 1;
+  }
+  return 0;
+}
+
+/* sort the cells of the tiles by id, tile, cell and channel */
+static int __compare_cells(const void* a, const void* b) {
+  const struct agg_entry* ea = a;
+  const struct agg_entry* eb = b;
+  uint64_t ka[6] = {ea->key[0], ea->key[1] >> TILE_SHIFT, ea->key[2] >> (16 + TILE_SHIFT),
+		    ea->key[1], ea->key[2] >> 16, ea->key[2] & 0xffff};
+  uint64_t kb[6] = {eb->key[0], eb->key[1] >> TILE_SHIFT, eb->key[2] >> (16 + TILE_SHIFT),
+		    eb->key[1], eb->key[2] >> 16, eb->key[2] & 0xffff};
+  for(int i = 0; i < 6; i++) {
+    if(ka[i] < kb[i]) return -1;
+    if(ka[i] > kb[i]) return 1;
+  }
+  return 0;
+}
+
+/* the pyramid of the object that is being written. The cells of the
+ * object come in time order, so each level only keeps the cells of its
+ * current column of tiles: the column is written (and its cells are added
+ * to the next level) once the cells come after its end. The keys of the
+ * cells are (id, x, y << 16 | channel)
+ */
+struct pyramid {
+  FILE* f;
+  uint32_t id;
+  uint64_t origin;		/* first time interval of the tiles */
+  uint64_t max_x;		/* last time interval (relative to origin) of the object */
+  uint64_t max_y;		/* last page of the object */
+  unsigned nb_levels;		/* number of levels that may contain cells */
+  struct agg_table levels[TILES_MAX_LEVELS];
+  uint64_t column_end[TILES_MAX_LEVELS]; /* end of the current column (in intervals of level 0) */
+  uint32_t height;		/* number of levels of the highest pyramid */
+  struct tile_index_entry* index;
+  size_t nb_tiles;
+  size_t max_tiles;
+};
+
+/* return the end (in intervals of level 0) of the column of tiles of x */
+static uint64_t __column_end(uint64_t x, unsigned level) {
+  uint64_t column = (x >> TILE_SHIFT) + 1;
+  unsigned shift = TILE_SHIFT + level;
+  if(shift >= 64 || column > UINT64_MAX >> shift)
+    return UINT64_MAX;
+  return column << shift;
+}
+
+static void __pyramid_add(struct pyramid* p, unsigned level, const uint64_t key[3],
+			  uint64_t count, uint64_t weight) {
+  struct agg_table* t = &p->levels[level];
+  if(!t->entries)
+    __table_init(t);
+  if(!t->nb_entries)
+    p->column_end[level] = __column_end(key[1], level);
+  __table_add(t, key, count, weight);
+  if(level >= p->nb_levels)
+    p->nb_levels = level + 1;
+}
+
+/* write the tiles of the current column of a level */
+static void __write_tiles_level(struct pyramid* p, struct agg_table* t, uint32_t level) {
+  struct agg_entry* entries = __sorted_entries(t, __compare_cells);
+  size_t first = 0;
+  for(size_t i = 1; i <= t->nb_entries; i++) {
+    if(i < t->nb_entries) {
+      struct agg_entry* e = &entries[i];
+      struct agg_entry* head = &entries[first];
+      if(e->key[1] >> TILE_SHIFT == head->key[1] >> TILE_SHIFT &&
+	 e->key[2] >> (16 + TILE_SHIFT) == head->key[2] >> (16 + TILE_SHIFT))
+	continue;
+    }
+
+    /* entries [first, i[ belong to the same tile */
+    struct agg_entry* head = &entries[first];
+    if(p->nb_tiles == p->max_tiles) {
+      p->max_tiles = p->max_tiles ? p->max_tiles * 2 : 1024;
+      p->index = realloc(p->index, sizeof(struct tile_index_entry) * p->max_tiles);
+    }
+    struct tile_index_entry* tile = &p->index[p->nb_tiles++];
+    tile->id = head->key[0];
+    tile->level = level;
+    tile->tx = head->key[1] >> TILE_SHIFT;
+    tile->ty = head->key[2] >> (16 + TILE_SHIFT);
+    tile->offset = ftello(p->f);
+    tile->nb_cells = i - first;
+
+    for(size_t j = first; j < i; j++) {
+      struct tile_cell cell = {
+	.x = entries[j].key[1] & (TILE_SIZE - 1),
+	.y = (entries[j].key[2] >> 16) & (TILE_SIZE - 1),
+	.channel = entries[j].key[2] & 0xffff,
+	.count = entries[j].count > UINT32_MAX ? UINT32_MAX : entries[j].count,
+	.weight = entries[j].weight,
+      };
+      fwrite(&cell, sizeof(cell), 1, p->f);
+    }
+    first = i;
+  }
+  free(entries);
+}
+
+/* write the current column of a level. Unless it is the top of the
+ * pyramid, its cells are coarsened into the next level
+ */
+static void __flush_column(struct pyramid* p, unsigned level, int top) {
+  struct agg_table* t = &p->levels[level];
+  if(!t->nb_entries)
+    return;
+  __write_tiles_level(p, t, level);
+  if(!top && level + 1 < TILES_MAX_LEVELS) {
+    for(size_t i = 0; i < t->size; i++) {
+      struct agg_entry* e = &t->entries[i];
+      if(!e->count)
+	continue;
+      uint64_t y = e->key[2] >> 16;
+      uint64_t key[3] = {e->key[0], e->key[1] >> 1, (y >> 1) << 16 | (e->key[2] & 0xffff)};
+      __pyramid_add(p, level + 1, key, e->count, e->weight);
+    }
+  }
+  free(t->entries);
+  memset(t, 0, sizeof(*t));
+}
+
+/* add a cell of the current object (e->key[1] is an absolute time interval) */
+static void __pyramid_add_cell(struct pyramid* p, const struct agg_entry* e) {
+  uint64_t x = e->key[1] - p->origin;
+  uint64_t page = e->key[2] >> 16;
+  uint64_t channel = e->key[2] & 0xffff;
+  if(x > p->max_x)
+    p->max_x = x;
+  if(page > p->max_y)
+    p->max_y = page;
+
+  /* the columns that end before x are complete */
+  for(unsigned level = 0; level < p->nb_levels; level++)
+    if(p->levels[level].nb_entries && x >= p->column_end[level])
+      __flush_column(p, level, 0);
+
+  if(channel == TILE_CHANNEL_ALL) {
+    uint64_t key[3] = {e->key[0], x, e->key[2]};
+    __pyramid_add(p, 0, key, e->count, e->weight);
+  } else {
+    uint64_t key[3] = {e->key[0], x >> channel_level,
+		       (page >> channel_level) << 16 | channel};
+    __pyramid_add(p, channel_level, key, e->count, e->weight);
+  }
+}
+
+/* write the remaining columns of the current object, up to the first
+ * level that fits in a single tile (and has all the channels)
+ */
+static void __pyramid_finish(struct pyramid* p) {
+  unsigned top = 0;
+  while((p->max_x >> top) >= TILE_SIZE || (p->max_y >> top) >= TILE_SIZE)
+    top++;
+  if(top < channel_level)
+    top = channel_level;
+  for(unsigned level = 0; level <= top; level++)
+    __flush_column(p, level, level == top);
+  if(top + 1 > p->height)
+    p->height = top + 1;
+  p->max_x = p->max_y = 0;
+  p->nb_levels = 0;
+}
+
+/* write the tiles from the sorted runs of the workers */
+static int __write_tiles(const char* prefix, struct worker* workers,
+			 uint64_t min_interval, int by_site) {
+  char filename[STRING_LEN];
+  if(snprintf(filename, sizeof(filename), "%s.%s", prefix,
+	      aggregate_names[AGGREGATE_TILES]) >= (int)sizeof(filename)) {
+    fprintf(stderr, "%s: file name too long\n", prefix);
+    return -1;
+  }
+  FILE* f = fopen(filename, "w");
+  if(!f) {
+    fprintf(stderr, "cannot create %s: %s\n", filename, strerror(errno));
+    return -1;
+  }
+  printf("%s\n", filename);
+
+  struct pyramid* p = calloc(1, sizeof(struct pyramid));
+  p->f = f;
+  /* the cells of the other channels are aligned on the cells of channel_level */
+  p->origin = min_interval >> channel_level << channel_level;
+
+  struct tiles_header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, TILES_MAGIC, sizeof(header.magic));
+  header.version = TILES_VERSION;
+  header.tile_size = TILE_SIZE;
+  header.interval = interval;
+  header.page_size = page_size;
+  header.start_time = p->origin * interval;
+  header.by_site = by_site;
+  header.channel_level = channel_level;
+  fwrite(&header, sizeof(header), 1, f);
+
+  /* merge the sorted runs: the cells come sorted by object and time */
+  size_t nb_runs = 0;
+  for(int i = 0; i < nb_threads; i++)
+    nb_runs += workers[i].nb_runs;
+  struct tile_run** heap = malloc(sizeof(struct tile_run*) * (nb_runs + 1));
+  size_t n = 0;
+  int ret = 0;
+  for(int i = 0; i < nb_threads; i++)
+    for(size_t j = 0; j < workers[i].nb_runs; j++) {
+      int r = __run_fill(&workers[i].runs[j]);
+      if(r < 0)
+	ret = -1;
+      else if(r > 0)
+	heap[n++] = &workers[i].runs[j];
+    }
+  for(size_t i = n; i-- > 0; )
+    __heap_down(heap, n, i);
+
+  int has_object = 0;
+  while(n > 0 && ret == 0) {
+    struct agg_entry e = heap[0]->buffer[heap[0]->pos];
+    e.count = 0;
+    e.weight = 0;
+    /* the same cell may come from several runs */
+    while(n > 0 && __compare_entries(&heap[0]->buffer[heap[0]->pos], &e) == 0) {
+      struct tile_run* run = heap[0];
+      e.count += run->buffer[run->pos].count;
+      e.weight += run->buffer[run->pos].weight;
+      run->pos++;
+      int r = __run_fill(run);
+      if(r < 0) {
+	ret = -1;
+	break;
+      }
+      if(r == 0)
+	heap[0] = heap[--n];
+      __heap_down(heap, n, 0);
+    }
+    if(has_object && e.key[0] != p->id)
+      __pyramid_finish(p);
+    p->id = e.key[0];
+    has_object = 1;
+    __pyramid_add_cell(p, &e);
+  }
+  if(has_object && ret == 0)
+    __pyramid_finish(p);
+  free(heap);
+  header.nb_levels = p->height;
+
+  /* the footer */
+  uint64_t footer_offset = ftello(f);
+  uint64_t nb_tiles = p->nb_tiles;
+  fwrite(&nb_tiles, sizeof(nb_tiles), 1, f);
+  qsort(p->index, p->nb_tiles, sizeof(struct tile_index_entry), __compare_tiles);
+  fwrite(p->index, sizeof(struct tile_index_entry), p->nb_tiles, f);
+  uint32_t n_levels = nb_levels;
+  fwrite(&n_levels, sizeof(n_levels), 1, f);
+  for(unsigned i = 0; i < nb_levels; i++) {
+    char name[TILES_NAME_LEN] = {0};
+    strncpy(name, level_names[i], TILES_NAME_LEN - 1);
+    fwrite(name, 1, TILES_NAME_LEN, f);
+  }
+  fwrite(&footer_offset, sizeof(footer_offset), 1, f);
+  fwrite(TILES_MAGIC, 1, strlen(TILES_MAGIC), f);
+
+  /* the number of levels is only known now */
+  fseeko(f, 0, SEEK_SET);
+  fwrite(&header, sizeof(header), 1, f);
+
+  for(unsigned i = 0; i < TILES_MAX_LEVELS; i++)
+    free(p->levels[i].entries);
+  free(p->index);
+  free(p);
+  if(fclose(f) != 0) {
+    fprintf(stderr, "cannot write %s: %s\n", filename, strerror(errno));
+    return -1;
+  }
+  return ret;
+}
+
+int main(int argc, char** argv) {
+  const char* prefix = NULL;
+  int opt;
+  while((opt = getopt(argc, argv, "j:p:t:f:c:i:o:TC:h")) != -1) {
+    switch(opt) {
+    case 'j':
+      nb_threads = atoi(optarg);
+      break;
+    case 'p':
+      page_size = strtoull(optarg, NULL, 10);
+      break;
+    case 't':
+      interval = strtoull(optarg, NULL, 10);
+      break;
+    case 'f':
+      if(strcmp(optarg, "binary") == 0)
+	binary_output = 1;
+      else if(strcmp(optarg, "csv") == 0)
+	binary_output = 0;
+      else {
+	usage(argv[0]);
+	return EXIT_FAILURE;
+      }
+      break;
+    case 'c':
+      site_filter = 1;
+      site_id = strtoul(optarg, NULL, 10);
+      break;
+    case 'i':
+      object_filter = 1;
+      object_id = strtoul(optarg, NULL, 10);
+      break;
+    case 'o':
+      prefix = optarg;
+      break;
+    case 'T':
+      tiles = 1;
+      break;
+    case 'C':
+      channel_level = strtoul(optarg, NULL, 10);
+      break;
+    default:
+      usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if(optind != argc - 1 || page_size == 0 || interval == 0 ||
+     channel_level >= TILES_MAX_LEVELS) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  const char* filename = argv[optind];
+
+  if(nb_threads <= 0)
+    nb_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  if(nb_threads <= 0)
+    nb_threads = 1;
+
+  /* default prefix: the dump file without its extension */
+  char default_prefix[STRING_LEN];
+  if(!prefix) {
+    snprintf(default_prefix, sizeof(default_prefix), "%s", filename);
+    char* dot = strrchr(default_prefix, '.');
+    char* slash = strrchr(default_prefix, '/');
+    if(dot && (!slash || dot > slash))
+      *dot = '\0';
+    prefix = default_prefix;
+  }
+
+  struct worker* workers = calloc(nb_threads, sizeof(struct worker));
+  for(int i = 0; i < nb_threads; i++) {
+    for(int j = 0; j < AGGREGATE_MAX; j++)
+      __table_init(&workers[i].tables[j]);
+    workers[i].min_timestamp = UINT64_MAX;
+    workers[i].tiles_fd = -1;
+    if(tiles && (workers[i].tiles_fd = __tiles_tmpfile(prefix)) < 0)
+      return EXIT_FAILURE;
+  }
+
+  int is_trace = __is_trace(filename);
+  int ret = is_trace ? __process_trace(filename, workers) : __process_text(filename, workers);
+  if(ret < 0)
+    return EXIT_FAILURE;
+
+  /* the tile cells are merged from the temporary files */
+  if(tiles)
+    for(int i = 0; i < nb_threads; i++)
+      __spill_tiles(&workers[i]);
+
+  /* merge the aggregates of the threads */
+  struct worker* total = &workers[0];
+  for(int i = 1; i < nb_threads; i++) {
+    for(int j = 0; j < AGGREGATE_MAX; j++) {
+      __table_merge(&total->tables[j], &workers[i].tables[j]);
+      free(workers[i].tables[j].entries);
+    }
+    if(workers[i].min_timestamp < total->min_timestamp)
+      total->min_timestamp = workers[i].min_timestamp;
+    total->nb_samples += workers[i].nb_samples;
+    total->error |= workers[i].error;
+  }
+  if(total->error)
+    return EXIT_FAILURE;
+
+  /* the call site traces are aggregated by site, the other ones by object */
+  int by_site = is_trace ? trace_kind == TRACE_KIND_CALL_SITE :
+    (input_kind == INPUT_SITES || input_kind == INPUT_SITE);
+  const char* id_name = by_site ? "site" : "object";
+  const char* page_columns[3] = {id_name, "page", "thread"};
+  const char* timeline_columns[3] = {id_name, "time", "page"};
+  uint64_t min_interval = total->nb_samples ? total->min_timestamp / interval : 0;
+
+  if(__write_aggregate(prefix, AGGREGATE_PAGES, &total->tables[AGGREGATE_PAGES],
+		       page_columns, min_interval) < 0 ||
+     __write_aggregate(prefix, AGGREGATE_TIMELINE, &total->tables[AGGREGATE_TIMELINE],
+		       timeline_columns, min_interval) < 0 ||
+     __write_levels(prefix, &total->tables[AGGREGATE_LEVELS]) < 0)
+    return EXIT_FAILURE;
+  if(tiles && __write_tiles(prefix, workers, min_interval, by_site) < 0)
+    return EXIT_FAILURE;
+
+  fprintf(stderr, "%" PRIu64 " samples\n", total->nb_samples);
+  for(int j = 0; j < AGGREGATE_MAX; j++)
+    free(total->tables[j].entries);
+  for(int i = 0; i < nb_threads; i++) {
+    for(size_t j = 0; j < workers[i].nb_runs; j++)
+      free(workers[i].runs[j].buffer);
+    free(workers[i].runs);
+    if(workers[i].tiles_fd >= 0)
+      close(workers[i].tiles_fd);
+  }
+  free(workers);
+  return EXIT_SUCCESS;
+}
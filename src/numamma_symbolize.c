@@ -0,0 +1,460 @@
+/* numamma-symbolize: resolve the addresses recorded by numamma when
+ * symbols are deferred (NUMAMMA_DEFER_SYMBOLS=1).
+ *
+ * The tool reads the module map (modules.dat) and the list of addresses
+ * (rips.dat) from a numamma output directory, resolves the addresses with
+ * addr2line (one process per chunk of addresses of a module, in parallel),
+ * writes symbols.dat, and creates a symbolized copy of the log files.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <ctype.h>
+#include <elf.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <stdatomic.h>
+
+#include "mem_report.h"
+
+#define STRING_LEN 4096
+/* number of addresses passed to one addr2line process */
+#define CHUNK_SIZE 256
+
+struct module {
+  uintptr_t start;
+  uintptr_t end;
+  uintptr_t load_base;
+  char build_id[STRING_LEN];
+  char path[STRING_LEN];
+  int checked;
+  int usable;
+};
+
+struct symbol {
+  uintptr_t rip;
+  int module;
+  char* name;
+};
+
+struct task {
+  int module;
+  int first;			/* index of the first symbol */
+  int nb_symbols;
+};
+
+static struct module* modules = NULL;
+static int nb_modules = 0;
+static struct symbol* symbols = NULL;
+static int nb_symbols = 0;
+static struct task* tasks = NULL;
+static int nb_tasks = 0;
+static _Atomic int next_task = 0;
+
+static const char* sysroot = "";
+static int verbose = 0;
+
+static void usage(const char* prog) {
+  fprintf(stderr, "usage: %s [-j nb_threads] [-r sysroot] [-v] output_dir\n", prog);
+  fprintf(stderr, "\t-j nb_threads\tnumber of addr2line processes to run in parallel (default: number of CPUs)\n");
+  fprintf(stderr, "\t-r sysroot\tprefix added to the module paths (when symbolizing on another machine)\n");
+  fprintf(stderr, "\t-v\t\tverbose mode\n");
+}
+
+static void* xmalloc(size_t size) {
+  void* retval = malloc(size);
+  if(!retval) {
+    fprintf(stderr, "failed to allocate %zu bytes\n", size);
+    abort();
+  }
+  return retval;
+}
+
+static void* xrealloc(void* ptr, size_t size) {
+  void* retval = realloc(ptr, size);
+  if(!retval) {
+    fprintf(stderr, "failed to allocate %zu bytes\n", size);
+    abort();
+  }
+  return retval;
+}
+
+/* read the build-id of the ELF file located at path (64-bit ELF only) */
+static int read_build_id(const char* path, char* build_id, size_t len) {
+  int fd = open(path, O_RDONLY);
+  if(fd < 0)
+    return 0;
+
+  int found = 0;
+  Elf64_Ehdr ehdr;
+  if(pread(fd, &ehdr, sizeof(ehdr), 0) != sizeof(ehdr) ||
+     memcmp(ehdr.e_ident, ELFMAG, SELFMAG) != 0 ||
+     ehdr.e_ident[EI_CLASS] != ELFCLASS64)
+    goto out;
+
+  for(int i=0; i<ehdr.e_phnum && !found; i++) {
+    Elf64_Phdr phdr;
+    if(pread(fd, &phdr, sizeof(phdr), ehdr.e_phoff + i*ehdr.e_phentsize) != sizeof(phdr))
+      break;
+    if(phdr.p_type != PT_NOTE)
+      continue;
+
+    uint8_t* notes = xmalloc(phdr.p_filesz);
+    if(pread(fd, notes, phdr.p_filesz, phdr.p_offset) == phdr.p_filesz) {
+      size_t pos = 0;
+      while(pos + sizeof(Elf64_Nhdr) <= phdr.p_filesz) {
+	Elf64_Nhdr* note = (Elf64_Nhdr*) (notes + pos);
+	size_t name_size = (note->n_namesz + 3) & ~3;
+	size_t desc_size = (note->n_descsz + 3) & ~3;
+	uint8_t* desc = notes + pos + sizeof(Elf64_Nhdr) + name_size;
+	if(note->n_type == NT_GNU_BUILD_ID && note->n_namesz == 4 &&
+	   memcmp(notes + pos + sizeof(Elf64_Nhdr), "GNU", 4) == 0 &&
+	   2*note->n_descsz + 1 <= len &&
+	   desc + note->n_descsz <= notes + phdr.p_filesz) {
+	  for(int j=0; j<note->n_descsz; j++)
+	    sprintf(&build_id[2*j], "%02x", desc[j]);
+	  found = 1;
+	  break;
+	}
+	pos += sizeof(Elf64_Nhdr) + name_size + desc_size;
+      }
+    }
+    free(notes);
+  }
+ out:
+  close(fd);
+  return found;
+}
+
+static void load_modules(const char* dir) {
+  char filename[STRING_LEN];
+  snprintf(filename, STRING_LEN, "%s/modules.dat", dir);
+  FILE* f = fopen(filename, "r");
+  if(!f) {
+    fprintf(stderr, "cannot open %s: %s\n", filename, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  char line[3*STRING_LEN];
+  int allocated = 0;
+  while(fgets(line, sizeof(line), f)) {
+    if(line[0] == '#')
+      continue;
+    if(nb_modules == allocated) {
+      allocated = allocated ? 2*allocated : 64;
+      modules = xrealloc(modules, sizeof(struct module) * allocated);
+    }
+    struct module* m = &modules[nb_modules];
+    char path[STRING_LEN];
+    if(sscanf(line, "%"SCNxPTR"\t%"SCNxPTR"\t%"SCNxPTR"\t%4095s\t%4095[^\n]",
+	      &m->start, &m->end, &m->load_base, m->build_id, path) != 5)
+      continue;
+    snprintf(m->path, STRING_LEN, "%s%s", sysroot, path);
+    m->checked = 0;
+    m->usable = 0;
+    nb_modules++;
+  }
+  fclose(f);
+}
+
+/* make sure the module on this machine is the one that was used during the execution */
+static int check_module(struct module* m) {
+  if(m->checked)
+    return m->usable;
+  m->checked = 1;
+  if(access(m->path, R_OK) != 0) {
+    if(verbose)
+      fprintf(stderr, "warning: cannot access %s\n", m->path);
+    return 0;
+  }
+  if(strcmp(m->build_id, "-") != 0) {
+    char build_id[STRING_LEN];
+    if(!read_build_id(m->path, build_id, STRING_LEN) ||
+       strcmp(build_id, m->build_id) != 0) {
+      fprintf(stderr, "warning: build-id mismatch for %s. Its symbols are not resolved\n", m->path);
+      return 0;
+    }
+  }
+  m->usable = 1;
+  return 1;
+}
+
+static int find_module(uintptr_t rip) {
+  for(int i=0; i<nb_modules; i++) {
+    if(modules[i].start <= rip && rip < modules[i].end)
+      return i;
+  }
+  return -1;
+}
+
+static int compare_symbols(const void* a, const void* b) {
+  const struct symbol* sa = a;
+  const struct symbol* sb = b;
+  if(sa->module != sb->module)
+    return sa->module < sb->module ? -1 : 1;
+  if(sa->rip != sb->rip)
+    return sa->rip < sb->rip ? -1 : 1;
+  return 0;
+}
+
+static int compare_rips(const void* a, const void* b) {
+  const struct symbol* sa = a;
+  const struct symbol* sb = b;
+  if(sa->rip != sb->rip)
+    return sa->rip < sb->rip ? -1 : 1;
+  return 0;
+}
+
+static void load_rips(const char* dir) {
+  char filename[STRING_LEN];
+  snprintf(filename, STRING_LEN, "%s/rips.dat", dir);
+  FILE* f = fopen(filename, "r");
+  if(!f) {
+    fprintf(stderr, "cannot open %s: %s\n", filename, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  char line[STRING_LEN];
+  int allocated = 0;
+  while(fgets(line, sizeof(line), f)) {
+    uintptr_t rip;
+    if(line[0] == '#' || sscanf(line, "%"SCNxPTR, &rip) != 1)
+      continue;
+    if(nb_symbols == allocated) {
+      allocated = allocated ? 2*allocated : 1024;
+      symbols = xrealloc(symbols, sizeof(struct symbol) * allocated);
+    }
+    symbols[nb_symbols].rip = rip;
+    symbols[nb_symbols].module = find_module(rip);
+    symbols[nb_symbols].name = NULL;
+    nb_symbols++;
+  }
+  fclose(f);
+
+  /* group the addresses by module, and split each module into chunks */
+  qsort(symbols, nb_symbols, sizeof(struct symbol), compare_symbols);
+  tasks = xmalloc(sizeof(struct task) * (nb_symbols + 1));
+  for(int i=0; i<nb_symbols; ) {
+    int module = symbols[i].module;
+    int first = i;
+    while(i < nb_symbols && symbols[i].module == module && i - first < CHUNK_SIZE)
+      i++;
+    if(module < 0 || !check_module(&modules[module]))
+      continue;
+    tasks[nb_tasks].module = module;
+    tasks[nb_tasks].first = first;
+    tasks[nb_tasks].nb_symbols = i - first;
+    nb_tasks++;
+  }
+}
+
+static void strip_newline(char* str) {
+  size_t len = strlen(str);
+  while(len > 0 && (str[len-1] == '\n' || str[len-1] == '\r'))
+    str[--len] = '\0';
+}
+
+/* resolve the addresses of a task with addr2line. addr2line is executed
+ * without a shell, so the module path does not need to be escaped
+ */
+static void resolve_task(struct task* t) {
+  struct module* m = &modules[t->module];
+  char** argv = xmalloc(sizeof(char*) * (t->nb_symbols + 6));
+  char* addresses = xmalloc(t->nb_symbols * 24);
+  int argc = 0;
+  argv[argc++] = "addr2line";
+  argv[argc++] = "-C";
+  argv[argc++] = "-f";
+  argv[argc++] = "-e";
+  argv[argc++] = m->path;
+  for(int i=0; i<t->nb_symbols; i++) {
+    struct symbol* s = &symbols[t->first + i];
+    argv[argc] = &addresses[i * 24];
+    snprintf(argv[argc], 24, "0x%"PRIxPTR, s->rip - m->load_base);
+    argc++;
+  }
+  argv[argc] = NULL;
+
+  /* the pipe is closed on exec so that the addr2line processes of the other
+   * workers do not keep it open
+   */
+  int fds[2];
+  if(pipe2(fds, O_CLOEXEC) < 0) {
+    fprintf(stderr, "failed to run addr2line: %s\n", strerror(errno));
+    goto out;
+  }
+  pid_t pid = fork();
+  if(pid < 0) {
+    fprintf(stderr, "failed to run addr2line: %s\n", strerror(errno));
+    close(fds[0]);
+    close(fds[1]);
+    goto out;
+  }
+  if(pid == 0) {
+    dup2(fds[1], STDOUT_FILENO);
+    execvp(argv[0], argv);
+    _exit(127);
+  }
+  close(fds[1]);
+  FILE* p = fdopen(fds[0], "r");
+  if(!p) {
+    fprintf(stderr, "failed to run addr2line: %s\n", strerror(errno));
+    close(fds[0]);
+    waitpid(pid, NULL, 0);
+    goto out;
+  }
+
+  /* addr2line prints two lines per address: the function and file:line */
+  char function[STRING_LEN];
+  char location[STRING_LEN];
+  for(int i=0; i<t->nb_symbols; i++) {
+    if(!fgets(function, STRING_LEN, p) || !fgets(location, STRING_LEN, p))
+      break;
+    strip_newline(function);
+    strip_newline(location);
+    if(strcmp(function, "??") == 0)
+      continue;
+    char name[3*STRING_LEN];
+    /* use the same format as libbacktrace in numamma */
+    snprintf(name, sizeof(name), "%s(%s)", location, function);
+    symbols[t->first + i].name = strdup(name);
+  }
+  fclose(p);
+  waitpid(pid, NULL, 0);
+ out:
+  free(addresses);
+  free(argv);
+}
+
+static void* worker(void* arg) {
+  int task_id;
+  while((task_id = atomic_fetch_add(&next_task, 1)) < nb_tasks) {
+    resolve_task(&tasks[task_id]);
+  }
+  return NULL;
+}
+
+static const char* get_symbol(uintptr_t rip) {
+  struct symbol key = {.rip = rip};
+  struct symbol* s = bsearch(&key, symbols, nb_symbols, sizeof(struct symbol), compare_rips);
+  if(s)
+    return s->name;
+  return NULL;
+}
+
+/* copy file, replacing the deferred symbols (@0x...) with their names. If
+ * json is set, the names are escaped since the symbols are in JSON strings
+ */
+static void symbolize_file(const char* dir, const char* basename, int json) {
+  char filename[STRING_LEN];
+  char out_filename[STRING_LEN];
+  snprintf(filename, STRING_LEN, "%s/%s", dir, basename);
+  snprintf(out_filename, STRING_LEN, "%s/symbolized_%s", dir, basename);
+  FILE* f = fopen(filename, "r");
+  if(!f)
+    return;
+  FILE* out = fopen(out_filename, "w");
+  if(!out) {
+    fprintf(stderr, "cannot open %s: %s\n", out_filename, strerror(errno));
+    fclose(f);
+    return;
+  }
+
+  char* line = NULL;
+  size_t line_len = 0;
+  while(getline(&line, &line_len, f) > 0) {
+    char* cur = line;
+    char* token;
+    while((token = strstr(cur, "@0x"))) {
+      fwrite(cur, 1, token - cur, out);
+      char* end = token + 3;
+      while(isxdigit(*end))
+	end++;
+      const char* name = get_symbol(strtoull(token + 1, NULL, 16));
+      if(name && json)
+	report_escape(out, name);
+      else if(name)
+	fputs(name, out);
+      else
+	fwrite(token, 1, end - token, out);
+      cur = end;
+    }
+    fputs(cur, out);
+  }
+  free(line);
+  fclose(f);
+  fclose(out);
+  printf("%s written\n", out_filename);
+}
+
+int main(int argc, char** argv) {
+  int nb_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  int opt;
+  while((opt = getopt(argc, argv, "j:r:vh")) != -1) {
+    switch(opt) {
+    case 'j':
+      nb_threads = atoi(optarg);
+      break;
+    case 'r':
+      sysroot = optarg;
+      break;
+    case 'v':
+      verbose = 1;
+      break;
+    default:
+      usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if(optind != argc - 1) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  if(nb_threads < 1)
+    nb_threads = 1;
+  const char* dir = argv[optind];
+
+  load_modules(dir);
+  load_rips(dir);
+  if(verbose)
+    printf("%d addresses in %d modules (%d tasks)\n", nb_symbols, nb_modules, nb_tasks);
+
+  if(nb_threads > nb_tasks)
+    nb_threads = nb_tasks > 0 ? nb_tasks : 1;
+  pthread_t tids[nb_threads];
+  for(int i=0; i<nb_threads; i++)
+    pthread_create(&tids[i], NULL, worker, NULL);
+  for(int i=0; i<nb_threads; i++)
+    pthread_join(tids[i], NULL);
+
+  /* write the symbol table, sorted by address */
+  qsort(symbols, nb_symbols, sizeof(struct symbol), compare_rips);
+  char filename[STRING_LEN];
+  snprintf(filename, STRING_LEN, "%s/symbols.dat", dir);
+  FILE* f = fopen(filename, "w");
+  if(!f) {
+    fprintf(stderr, "cannot open %s: %s\n", filename, strerror(errno));
+    return EXIT_FAILURE;
+  }
+  int nb_resolved = 0;
+  for(int i=0; i<nb_symbols; i++) {
+    if(symbols[i].name) {
+      fprintf(f, "0x%"PRIxPTR"\t%s\n", symbols[i].rip, symbols[i].name);
+      nb_resolved++;
+    }
+  }
+  fclose(f);
+  printf("%d/%d addresses resolved. %s written\n", nb_resolved, nb_symbols, filename);
+
+  symbolize_file(dir, "call_sites.log", 0);
+  symbolize_file(dir, "all_memory_objects.dat", 0);
+  symbolize_file(dir, "buffers.log", 0);
+  symbolize_file(dir, "report.jsonl", 1);
+  return EXIT_SUCCESS;
+}
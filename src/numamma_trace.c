@@ -0,0 +1,186 @@
+/* numamma-trace: export the binary traces written by numamma
+ * (NUMAMMA_DUMP_FORMAT=binary) to the text format.
+ *
+ * The text is the same as the one written with NUMAMMA_DUMP_FORMAT=text, so
+ * the output can be processed by the plotting scripts. With -i, only the
+ * samples of one object are exported: the index of the trace is used so
+ * that only the chunks that contain the object are read.
+ *
+ * The samples of all the call sites are multiplexed in callsite_dumps.trace.
+ * -c extracts the samples of one call site (in the format of a per-site
+ * dump), and only reads the chunks of this site.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "mem_trace.h"
+
+static void usage(const char* prog) {
+  fprintf(stderr, "usage: %s [-c site_id] [-i object_id] [-o output_file] [-s] trace_file\n", prog);
+  fprintf(stderr, "\t-c site_id\tonly export the samples of a call site\n");
+  fprintf(stderr, "\t-i object_id\tonly export the samples of an object\n");
+  fprintf(stderr, "\t-o output_file\twrite the text to output_file (default: stdout)\n");
+  fprintf(stderr, "\t-s\t\tonly print a summary of the trace\n");
+}
+
+static const char* kind_names[] = {"objects", "call site", "unmatched samples"};
+
+/* if set, the samples of a call site trace are prefixed with their site */
+static int print_site = 0;
+
+static void print_header(FILE* f, enum trace_kind kind) {
+  switch(kind) {
+  case TRACE_KIND_OBJECTS:
+    fprintf(f, "#thread_rank timestamp object_id offset mem_level access_weight access_type\n");
+    break;
+  case TRACE_KIND_CALL_SITE:
+    if(print_site)
+      fprintf(f, "#site_id ");
+    else
+      fprintf(f, "#");
+    fprintf(f, "thread_rank timestamp offset mem_level access_weight access_type\n");
+    break;
+  case TRACE_KIND_UNMATCHED:
+    fprintf(f, "#thread_rank timestamp address mem_level access_weight access_type\n");
+    break;
+  default:
+    break;
+  }
+}
+
+static void print_record(FILE* f, struct trace_reader* trace, uint32_t site,
+			 struct trace_record* r) {
+  const char* level = trace_reader_level_name(trace, r->level);
+  char access = r->access_type == 0 ? 'r' : 'w';
+  switch(trace->kind) {
+  case TRACE_KIND_OBJECTS:
+    fprintf(f, "%u %" PRIu64 " %u %" PRIu64 " %s %u %c\n",
+	    r->thread_rank, r->timestamp, r->object_id, r->offset, level, r->weight, access);
+    break;
+  case TRACE_KIND_CALL_SITE:
+    if(print_site)
+      fprintf(f, "%u ", site);
+    fprintf(f, "%u %" PRIu64 " %" PRIu64 " %s %u %c\n",
+	    r->thread_rank, r->timestamp, r->offset, level, r->weight, access);
+    break;
+  case TRACE_KIND_UNMATCHED:
+    fprintf(f, "%u %" PRIu64 " 0x%" PRIx64 " %s %u %c\n",
+	    r->thread_rank, r->timestamp, r->offset, level, r->weight, access);
+    break;
+  default:
+    break;
+  }
+}
+
+int main(int argc, char** argv) {
+  int summary = 0;
+  int filter = 0;
+  uint32_t object_id = 0;
+  int site_filter = 0;
+  uint32_t site_id = 0;
+  const char* output = NULL;
+  int opt;
+  while((opt = getopt(argc, argv, "c:i:o:sh")) != -1) {
+    switch(opt) {
+    case 'c':
+      site_filter = 1;
+      site_id = strtoul(optarg, NULL, 10);
+      break;
+    case 'i':
+      filter = 1;
+      object_id = strtoul(optarg, NULL, 10);
+      break;
+    case 'o':
+      output = optarg;
+      break;
+    case 's':
+      summary = 1;
+      break;
+    default:
+      usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if(optind != argc - 1) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  struct trace_reader* trace = trace_reader_open(argv[optind]);
+  if(!trace)
+    return EXIT_FAILURE;
+
+  FILE* f = stdout;
+  if(output) {
+    f = fopen(output, "w");
+    if(!f) {
+      fprintf(stderr, "cannot open %s: %s\n", output, strerror(errno));
+      return EXIT_FAILURE;
+    }
+  }
+
+  /* the chunks to read */
+  size_t nb_chunks = trace->nb_chunks;
+  const struct trace_index_entry* entries = NULL;
+  if(site_filter)
+    nb_chunks = trace_reader_stream_chunks(trace, site_id, &entries);
+  else if(filter)
+    nb_chunks = trace_reader_object_chunks(trace, object_id, &entries);
+  print_site = !site_filter;
+
+  if(!summary)
+    print_header(f, trace->kind);
+
+  struct trace_record* records = NULL;
+  size_t capacity = 0;
+  uint64_t nb_samples = 0;
+  for(size_t i = 0; i < nb_chunks; i++) {
+    size_t chunk = entries ? entries[i].chunk : i;
+    ssize_t n = trace_reader_read_chunk(trace, chunk, &records, &capacity);
+    if(n < 0) {
+      fprintf(stderr, "chunk %zu of %s is corrupted\n", chunk, argv[optind]);
+      return EXIT_FAILURE;
+    }
+    for(ssize_t j = 0; j < n; j++) {
+      if(filter && records[j].object_id != object_id)
+	continue;
+      nb_samples++;
+      if(!summary)
+	print_record(f, trace, trace->chunk_streams[chunk], &records[j]);
+    }
+  }
+
+  if(summary) {
+    size_t nb_objects = 0;
+    for(size_t i = 0; i < trace->nb_index_entries; i++) {
+      if(i == 0 || trace->index[i].id != trace->index[i-1].id)
+	nb_objects++;
+    }
+    size_t nb_streams = 0;
+    for(size_t i = 0; i < trace->nb_stream_entries; i++) {
+      if(i == 0 || trace->stream_index[i].id != trace->stream_index[i-1].id)
+	nb_streams++;
+    }
+    fprintf(f, "kind: %s\n", kind_names[trace->kind]);
+    fprintf(f, "chunks: %zu\n", trace->nb_chunks);
+    fprintf(f, "samples: %" PRIu64 "\n", nb_samples);
+    fprintf(f, "objects: %zu\n", nb_objects);
+    if(trace->kind == TRACE_KIND_CALL_SITE)
+      fprintf(f, "call sites: %zu\n", nb_streams);
+    fprintf(f, "memory levels:");
+    for(unsigned i = 0; i < trace->nb_levels; i++)
+      fprintf(f, " %s", trace->level_names[i]);
+    fprintf(f, "\n");
+  }
+
+  free(records);
+  if(output)
+    fclose(f);
+  trace_reader_close(trace);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,24 @@
+#!/bin/bash
+# Run test_realloc with numamma, and check that the versions of the
+# reallocated buffers are attached to a single call site that counts all
+# the allocations
+
+NB_BUFFERS=8
+OUTPUT_DIR=$(mktemp -d)
+trap "rm -rf $OUTPUT_DIR" EXIT
+
+cd "$(dirname "$0")"
+make -s test_realloc || exit 1
+numamma -o "$OUTPUT_DIR" ./test_realloc > /dev/null || exit 1
+
+python3 - "$OUTPUT_DIR/report.jsonl" $NB_BUFFERS <<'END'
+import json
+import sys
+sites = [line for line in map(json.loads, open(sys.argv[1]))
+         if line['type'] == 'call_site' and 'alloc_buffer' in (line['caller'] or '')]
+if len(sites) != 1:
+    sys.exit('FAIL: %d call sites for alloc_buffer (expected 1)' % len(sites))
+if sites[0]['nb_mallocs'] != int(sys.argv[2]):
+    sys.exit('FAIL: %d allocations (expected %s)' % (sites[0]['nb_mallocs'], sys.argv[2]))
+print('PASS')
+END
@@ -0,0 +1,53 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Allocate buffers from a single call site, and grow them with realloc.
+ * When run with numamma, all the versions of the buffers must be attached
+ * to the call site of alloc_buffer, which counts NB_BUFFERS allocations
+ * (see check_realloc.sh)
+ */
+
+#define NB_BUFFERS 8
+#define BUFFER_SIZE (1024*1024)
+#define NB_ITER 10
+
+char* alloc_buffer(size_t buffer_size) {
+  return malloc(buffer_size);
+}
+
+/* touch all the bytes of a buffer */
+char use_buffer(char* buffer, size_t buffer_size) {
+  char res = 0;
+  for(int iter=0; iter<NB_ITER; iter++) {
+    for(size_t i=0; i<buffer_size; i++) {
+      res = (res + buffer[i])%128;
+      buffer[i] = res;
+    }
+  }
+  return res;
+}
+
+int main(int argc, char**argv) {
+  char* buffers[NB_BUFFERS];
+  char res = 0;
+
+  for(int i=0; i<NB_BUFFERS; i++) {
+    buffers[i] = alloc_buffer(BUFFER_SIZE);
+    memset(buffers[i], i, BUFFER_SIZE);
+  }
+
+  for(int i=0; i<NB_BUFFERS; i++) {
+    res += use_buffer(buffers[i], BUFFER_SIZE);
+    /* grow the buffer (this usually moves it), then shrink it */
+    buffers[i] = realloc(buffers[i], 4*BUFFER_SIZE);
+    res += use_buffer(buffers[i], 4*BUFFER_SIZE);
+    buffers[i] = realloc(buffers[i], BUFFER_SIZE/2);
+    res += use_buffer(buffers[i], BUFFER_SIZE/2);
+  }
+
+  for(int i=0; i<NB_BUFFERS; i++)
+    free(buffers[i]);
+  printf("res = %d\n", res);
+  return 0;
+}
@@ -0,0 +1,535 @@
+#include "btree.h"
+#include "tools_allocator.h"
+#include <string.h>
+#include <inttypes.h>
+
+/* number of objects allocated at once by a pool */
+#define BT_POOL_CHUNK 64
+/* alignment of the objects allocated by a pool */
+#define BT_POOL_ALIGN 64
+/* size of a chunk. The first BT_POOL_ALIGN bytes are used for chaining the chunks */
+#define BT_POOL_CHUNK_SIZE(pool) (BT_POOL_ALIGN * 2 + (pool)->object_size * BT_POOL_CHUNK)
+
+_Static_assert(sizeof(struct bt_leaf) <= BT_NODE_SIZE, "struct bt_leaf is too large");
+_Static_assert(sizeof(struct bt_inner) <= BT_NODE_SIZE, "struct bt_inner is too large");
+
+/* allocate an object from a pool */
+static void* __bt_pool_alloc(struct bt_pool* pool) {
+  if(!pool->free_list) {
+    char* chunk = tools_alloc(BT_POOL_CHUNK_SIZE(pool));
+    *(void**)chunk = pool->chunks;
+    pool->chunks = chunk;
+
+    uintptr_t first = ((uintptr_t)chunk + BT_POOL_ALIGN + BT_POOL_ALIGN - 1) & ~((uintptr_t)BT_POOL_ALIGN - 1);
+    for(int i = BT_POOL_CHUNK - 1; i >= 0; i--) {
+      void** obj = (void**)(first + i * pool->object_size);
+      *obj = pool->free_list;
+      pool->free_list = obj;
+    }
+  }
+  void** obj = pool->free_list;
+  pool->free_list = *obj;
+  return obj;
+}
+
+/* return an object to its pool */
+static void __bt_pool_free(struct bt_pool* pool, void* obj) {
+  *(void**)obj = pool->free_list;
+  pool->free_list = obj;
+}
+
+/* free all the chunks of a pool */
+static void __bt_pool_release(struct bt_pool* pool) {
+  while(pool->chunks) {
+    void* next = *(void**)pool->chunks;
+    tools_free(pool->chunks, BT_POOL_CHUNK_SIZE(pool));
+    pool->chunks = next;
+  }
+  pool->free_list = NULL;
+}
+
+static struct bt_leaf* __bt_new_leaf(struct btree* tree) {
+  struct bt_leaf* leaf = __bt_pool_alloc(&tree->node_pool);
+  leaf->nb_keys = 0;
+  leaf->prev = NULL;
+  leaf->next = NULL;
+  return leaf;
+}
+
+static struct bt_inner* __bt_new_inner(struct btree* tree) {
+  struct bt_inner* inner = __bt_pool_alloc(&tree->node_pool);
+  inner->nb_keys = 0;
+  return inner;
+}
+
+static struct bt_entry* __bt_new_entry(struct btree* tree, void* value, struct bt_entry* next) {
+  struct bt_entry* e = __bt_pool_alloc(&tree->entry_pool);
+  e->value = value;
+  e->next = next;
+  return e;
+}
+
+/* return the index of the child of inner that may contain key */
+static inline int __bt_inner_search(struct bt_inner* inner, uint64_t key) {
+  int i = 0;
+  while(i < inner->nb_keys && inner->keys[i] <= key)
+    i++;
+  return i;
+}
+
+/* return the index of the first key of leaf that is greater or equal to key */
+static inline int __bt_leaf_search(struct bt_leaf* leaf, uint64_t key) {
+  int i = 0;
+  while(i < leaf->nb_keys && leaf->keys[i] < key)
+    i++;
+  return i;
+}
+
+/* return the leaf that may contain key */
+static struct bt_leaf* __bt_find_leaf(struct btree* tree, uint64_t key) {
+  if(!tree->height)
+    return NULL;
+  void* node = tree->root;
+  for(int h = tree->height; h > 1; h--) {
+    struct bt_inner* inner = node;
+    node = inner->children[__bt_inner_search(inner, key)];
+  }
+  return node;
+}
+
+void bt_init(struct btree* tree) {
+  struct btree empty = BTREE_INITIALIZER;
+  *tree = empty;
+}
+
+void bt_release(struct btree* tree) {
+  __bt_pool_release(&tree->node_pool);
+  __bt_pool_release(&tree->entry_pool);
+  bt_init(tree);
+}
+
+/* insert (key, value) at position pos of leaf, that is not full */
+static void __bt_leaf_insert_at(struct btree* tree, struct bt_leaf* leaf, int pos,
+				uint64_t key, void* value) {
+  memmove(&leaf->keys[pos + 1], &leaf->keys[pos], sizeof(uint64_t) * (leaf->nb_keys - pos));
+  memmove(&leaf->entries[pos + 1], &leaf->entries[pos], sizeof(struct bt_entry*) * (leaf->nb_keys - pos));
+  leaf->keys[pos] = key;
+  leaf->entries[pos] = __bt_new_entry(tree, value, NULL);
+  leaf->nb_keys++;
+  tree->nb_keys++;
+}
+
+/* insert (key, child) in inner, that is not full. child contains the keys that are >= key */
+static void __bt_inner_insert(struct bt_inner* inner, uint64_t key, void* child) {
+  int pos = __bt_inner_search(inner, key);
+  memmove(&inner->keys[pos + 1], &inner->keys[pos], sizeof(uint64_t) * (inner->nb_keys - pos));
+  memmove(&inner->children[pos + 2], &inner->children[pos + 1], sizeof(void*) * (inner->nb_keys - pos));
+  inner->keys[pos] = key;
+  inner->children[pos + 1] = child;
+  inner->nb_keys++;
+}
+
+/* insert (key, value) in the subtree node.
+ * If node is split, return the new (right) node and set split_key to its smallest key
+ */
+static void* __bt_insert(struct btree* tree, void* node, int height,
+			 uint64_t key, void* value, uint64_t* split_key) {
+  if(height == 1) {
+    struct bt_leaf* leaf = node;
+    int pos = __bt_leaf_search(leaf, key);
+    if(pos < leaf->nb_keys && leaf->keys[pos] == key) {
+      /* the key already exists: add a value */
+      leaf->entries[pos] = __bt_new_entry(tree, value, leaf->entries[pos]);
+      return NULL;
+    }
+
+    if(leaf->nb_keys < BT_LEAF_ORDER) {
+      __bt_leaf_insert_at(tree, leaf, pos, key, value);
+      return NULL;
+    }
+
+    /* the leaf is full: split it */
+    struct bt_leaf* right = __bt_new_leaf(tree);
+    int mid = BT_LEAF_ORDER / 2;
+    right->nb_keys = leaf->nb_keys - mid;
+    memcpy(right->keys, &leaf->keys[mid], sizeof(uint64_t) * right->nb_keys);
+    memcpy(right->entries, &leaf->entries[mid], sizeof(struct bt_entry*) * right->nb_keys);
+    leaf->nb_keys = mid;
+
+    right->prev = leaf;
+    right->next = leaf->next;
+    if(leaf->next)
+      leaf->next->prev = right;
+    else
+      tree->last_leaf = right;
+    leaf->next = right;
+
+    if(pos <= mid)
+      __bt_leaf_insert_at(tree, leaf, pos, key, value);
+    else
+      __bt_leaf_insert_at(tree, right, pos - mid, key, value);
+    *split_key = right->keys[0];
+    return right;
+  }
+
+  struct bt_inner* inner = node;
+  int child_index = __bt_inner_search(inner, key);
+  uint64_t child_split_key;
+  void* new_child = __bt_insert(tree, inner->children[child_index], height - 1,
+				key, value, &child_split_key);
+  if(!new_child)
+    return NULL;
+
+  if(inner->nb_keys < BT_INNER_ORDER) {
+    __bt_inner_insert(inner, child_split_key, new_child);
+    return NULL;
+  }
+
+  /* the inner node is full: split it. The middle key moves to the parent */
+  struct bt_inner* right = __bt_new_inner(tree);
+  int mid = BT_INNER_ORDER / 2;
+  *split_key = inner->keys[mid];
+  right->nb_keys = inner->nb_keys - mid - 1;
+  memcpy(right->keys, &inner->keys[mid + 1], sizeof(uint64_t) * right->nb_keys);
+  memcpy(right->children, &inner->children[mid + 1], sizeof(void*) * (right->nb_keys + 1));
+  inner->nb_keys = mid;
+
+  if(child_split_key < *split_key)
+    __bt_inner_insert(inner, child_split_key, new_child);
+  else
+    __bt_inner_insert(right, child_split_key, new_child);
+  return right;
+}
+
+void bt_insert(struct btree* tree, uint64_t key, void* value) {
+  if(!tree->height) {
+    struct bt_leaf* leaf = __bt_new_leaf(tree);
+    tree->root = leaf;
+    tree->height = 1;
+    tree->first_leaf = leaf;
+    tree->last_leaf = leaf;
+  }
+
+  uint64_t split_key;
+  void* right = __bt_insert(tree, tree->root, tree->height, key, value, &split_key);
+  if(right) {
+    /* the root was split */
+    struct bt_inner* new_root = __bt_new_inner(tree);
+    new_root->nb_keys = 1;
+    new_root->keys[0] = split_key;
+    new_root->children[0] = tree->root;
+    new_root->children[1] = right;
+    tree->root = new_root;
+    tree->height++;
+  }
+}
+
+/* remove value (or all the values if remove_all is set) from the entries of key.
+ * Nodes are not merged: a node is freed when it becomes empty.
+ * Return 1 if the subtree node becomes empty. found is set to 1 if key was found
+ */
+static int __bt_remove(struct btree* tree, void* node, int height,
+		       uint64_t key, void* value, int remove_all, int* found) {
+  if(height == 1) {
+    struct bt_leaf* leaf = node;
+    int pos = __bt_leaf_search(leaf, key);
+    if(pos >= leaf->nb_keys || leaf->keys[pos] != key)
+      return 0;
+
+    struct bt_entry** p_entry = &leaf->entries[pos];
+    while(*p_entry) {
+      struct bt_entry* e = *p_entry;
+      if(remove_all || e->value == value) {
+	*p_entry = e->next;
+	__bt_pool_free(&tree->entry_pool, e);
+	*found = 1;
+	if(!remove_all)
+	  break;
+      } else {
+	p_entry = &e->next;
+      }
+    }
+    if(leaf->entries[pos])
+      /* there are other values associated to key, don't remove the key! */
+      return 0;
+
+    leaf->nb_keys--;
+    tree->nb_keys--;
+    memmove(&leaf->keys[pos], &leaf->keys[pos + 1], sizeof(uint64_t) * (leaf->nb_keys - pos));
+    memmove(&leaf->entries[pos], &leaf->entries[pos + 1], sizeof(struct bt_entry*) * (leaf->nb_keys - pos));
+    if(leaf->nb_keys)
+      return 0;
+
+    /* the leaf is empty: unlink it */
+    if(leaf->prev)
+      leaf->prev->next = leaf->next;
+    else
+      tree->first_leaf = leaf->next;
+    if(leaf->next)
+      leaf->next->prev = leaf->prev;
+    else
+      tree->last_leaf = leaf->prev;
+    __bt_pool_free(&tree->node_pool, leaf);
+    return 1;
+  }
+
+  struct bt_inner* inner = node;
+  int child_index = __bt_inner_search(inner, key);
+  if(!__bt_remove(tree, inner->children[child_index], height - 1, key, value, remove_all, found))
+    return 0;
+
+  /* the child is empty: remove it as well as one of the keys that surround it */
+  if(!inner->nb_keys) {
+    __bt_pool_free(&tree->node_pool, inner);
+    return 1;
+  }
+  int key_index = child_index > 0 ? child_index - 1 : 0;
+  memmove(&inner->keys[key_index], &inner->keys[key_index + 1],
+	  sizeof(uint64_t) * (inner->nb_keys - key_index - 1));
+  memmove(&inner->children[child_index], &inner->children[child_index + 1],
+	  sizeof(void*) * (inner->nb_keys - child_index));
+  inner->nb_keys--;
+  return 0;
+}
+
+static int __bt_remove_generic(struct btree* tree, uint64_t key, void* value, int remove_all) {
+  if(!tree->height)
+    return 0;
+  int found = 0;
+  if(__bt_remove(tree, tree->root, tree->height, key, value, remove_all, &found)) {
+    /* the tree is empty */
+    tree->root = NULL;
+    tree->height = 0;
+    return found;
+  }
+
+  /* shrink the tree while the root has only one child */
+  while(tree->height > 1 && ((struct bt_inner*)tree->root)->nb_keys == 0) {
+    struct bt_inner* old_root = tree->root;
+    tree->root = old_root->children[0];
+    tree->height--;
+    __bt_pool_free(&tree->node_pool, old_root);
+  }
+  return found;
+}
+
+int bt_remove_key_value(struct btree* tree, uint64_t key, void* value) {
+  return __bt_remove_generic(tree, key, value, 0);
+}
+
+int bt_remove_key(struct btree* tree, uint64_t key) {
+  return __bt_remove_generic(tree, key, NULL, 1);
+}
+
+struct bt_entry* bt_get_entry(struct btree* tree, uint64_t key) {
+  struct bt_leaf* leaf = __bt_find_leaf(tree, key);
+  if(!leaf)
+    return NULL;
+  int pos = __bt_leaf_search(leaf, key);
+  if(pos < leaf->nb_keys && leaf->keys[pos] == key)
+    return leaf->entries[pos];
+  return NULL;
+}
+
+void* bt_get_value(struct btree* tree, uint64_t key) {
+  struct bt_entry* e = bt_get_entry(tree, key);
+  if(e)
+    return e->value;
+  return NULL;
+}
+
+int bt_contains_key(struct btree* tree, uint64_t key) {
+  return bt_get_entry(tree, key) != NULL;
+}
+
+int bt_lower_key(struct btree* tree, uint64_t key, struct bt_iter* iter) {
+  struct bt_leaf* leaf = __bt_find_leaf(tree, key);
+  if(!leaf)
+    return 0;
+  int pos = __bt_leaf_search(leaf, key);
+  iter->leaf = leaf;
+  if(pos < leaf->nb_keys && leaf->keys[pos] == key) {
+    iter->index = pos;
+    return 1;
+  }
+  /* all the keys before pos are lower than key */
+  iter->index = pos;
+  return bt_prev(iter);
+}
+
+int bt_upper_key(struct btree* tree, uint64_t key, struct bt_iter* iter) {
+  struct bt_leaf* leaf = __bt_find_leaf(tree, key);
+  if(!leaf)
+    return 0;
+  iter->leaf = leaf;
+  iter->index = __bt_leaf_search(leaf, key);
+  if(iter->index < leaf->nb_keys)
+    return 1;
+  iter->index = leaf->nb_keys - 1;
+  return bt_next(iter);
+}
+
+int bt_first(struct btree* tree, struct bt_iter* iter) {
+  iter->leaf = tree->first_leaf;
+  iter->index = 0;
+  return iter->leaf != NULL;
+}
+
+void bt_bulk_load(struct btree* tree, const uint64_t* keys, void** values, size_t nb_keys) {
+  if(tree->height || !nb_keys) {
+    /* the tree is not empty: insert the keys one by one */
+    for(size_t i = 0; i < nb_keys; i++)
+      bt_insert(tree, keys[i], values[i]);
+    return;
+  }
+
+  /* build the leaves */
+  size_t max_nodes = nb_keys / BT_LEAF_ORDER + 1;
+  void** nodes = tools_alloc(sizeof(void*) * max_nodes);
+  uint64_t* min_keys = tools_alloc(sizeof(uint64_t) * max_nodes);
+  size_t nb_nodes = 0;
+  struct bt_leaf* leaf = NULL;
+  for(size_t i = 0; i < nb_keys; i++) {
+    if(leaf && leaf->keys[leaf->nb_keys - 1] == keys[i]) {
+      leaf->entries[leaf->nb_keys - 1] = __bt_new_entry(tree, values[i], leaf->entries[leaf->nb_keys - 1]);
+      continue;
+    }
+    if(!leaf || leaf->nb_keys == BT_LEAF_ORDER) {
+      struct bt_leaf* new_leaf = __bt_new_leaf(tree);
+      new_leaf->prev = leaf;
+      if(leaf)
+	leaf->next = new_leaf;
+      else
+	tree->first_leaf = new_leaf;
+      leaf = new_leaf;
+      nodes[nb_nodes] = leaf;
+      min_keys[nb_nodes] = keys[i];
+      nb_nodes++;
+    }
+    leaf->keys[leaf->nb_keys] = keys[i];
+    leaf->entries[leaf->nb_keys] = __bt_new_entry(tree, values[i], NULL);
+    leaf->nb_keys++;
+    tree->nb_keys++;
+  }
+  tree->last_leaf = leaf;
+  tree->height = 1;
+
+  /* build the upper levels */
+  while(nb_nodes > 1) {
+    size_t nb_parents = 0;
+    for(size_t i = 0; i < nb_nodes; i += BT_INNER_ORDER + 1) {
+      struct bt_inner* inner = __bt_new_inner(tree);
+      size_t nb_children = nb_nodes - i;
+      if(nb_children > BT_INNER_ORDER + 1)
+	nb_children = BT_INNER_ORDER + 1;
+      inner->children[0] = nodes[i];
+      for(size_t j = 1; j < nb_children; j++) {
+	inner->keys[j - 1] = min_keys[i + j];
+	inner->children[j] = nodes[i + j];
+      }
+      inner->nb_keys = nb_children - 1;
+      nodes[nb_parents] = inner;
+      min_keys[nb_parents] = min_keys[i];
+      nb_parents++;
+    }
+    nb_nodes = nb_parents;
+    tree->height++;
+  }
+  tree->root = nodes[0];
+  tools_free(nodes, sizeof(void*) * max_nodes);
+  tools_free(min_keys, sizeof(uint64_t) * max_nodes);
+}
+
+size_t bt_size(struct btree* tree) {
+  return tree->nb_keys;
+}
+
+static void __bt_print(void* node, int height, int depth) {
+  if(height == 1) {
+    struct bt_leaf* leaf = node;
+    for(int i = 0; i < leaf->nb_keys; i++) {
+      printf("%*s%" PRIu64 ":", depth * 2, "", leaf->keys[i]);
+      for(struct bt_entry* e = leaf->entries[i]; e; e = e->next)
+	printf(" %p", e->value);
+      printf("\n");
+    }
+    return;
+  }
+  struct bt_inner* inner = node;
+  for(int i = 0; i <= inner->nb_keys; i++) {
+    if(i > 0)
+      printf("%*s[%" PRIu64 "]\n", depth * 2, "", inner->keys[i - 1]);
+    __bt_print(inner->children[i], height - 1, depth + 1);
+  }
+}
+
+void bt_print(struct btree* tree) {
+  if(tree->height)
+    __bt_print(tree->root, tree->height, 0);
+}
+
+/* check that the keys of the subtree node are in [min, max[ and
+ * return the number of keys
+ */
+static size_t __bt_check(void* node, int height, uint64_t min, int has_min,
+			 uint64_t max, int has_max, struct bt_leaf** prev_leaf) {
+  if(height == 1) {
+    struct bt_leaf* leaf = node;
+    if(leaf->nb_keys <= 0 || leaf->nb_keys > BT_LEAF_ORDER) {
+      fprintf(stderr, "Error: leaf %p contains %d keys\n", leaf, leaf->nb_keys);
+      abort();
+    }
+    if(leaf->prev != *prev_leaf || (*prev_leaf && (*prev_leaf)->next != leaf)) {
+      fprintf(stderr, "Error: leaf %p is not correctly chained\n", leaf);
+      abort();
+    }
+    *prev_leaf = leaf;
+    for(int i = 0; i < leaf->nb_keys; i++) {
+      uint64_t key = leaf->keys[i];
+      if((has_min && key < min) || (has_max && key >= max) ||
+	 (i > 0 && key <= leaf->keys[i - 1]) || !leaf->entries[i]) {
+	fprintf(stderr, "Error: invalid key %" PRIu64 " in leaf %p\n", key, leaf);
+	abort();
+      }
+    }
+    return leaf->nb_keys;
+  }
+
+  struct bt_inner* inner = node;
+  if(inner->nb_keys < 0 || inner->nb_keys > BT_INNER_ORDER) {
+    fprintf(stderr, "Error: inner node %p contains %d keys\n", inner, inner->nb_keys);
+    abort();
+  }
+  size_t nb_keys = 0;
+  for(int i = 0; i <= inner->nb_keys; i++) {
+    if(i < inner->nb_keys &&
+       ((has_min && inner->keys[i] < min) || (has_max && inner->keys[i] >= max) ||
+	(i > 0 && inner->keys[i] <= inner->keys[i - 1]))) {
+      fprintf(stderr, "Error: invalid key %" PRIu64 " in inner node %p\n", inner->keys[i], inner);
+      abort();
+    }
+    uint64_t child_min = i > 0 ? inner->keys[i - 1] : min;
+    int child_has_min = i > 0 ? 1 : has_min;
+    uint64_t child_max = i < inner->nb_keys ? inner->keys[i] : max;
+    int child_has_max = i < inner->nb_keys ? 1 : has_max;
+    nb_keys += __bt_check(inner->children[i], height - 1, child_min, child_has_min,
+			  child_max, child_has_max, prev_leaf);
+  }
+  return nb_keys;
+}
+
+void bt_check(struct btree* tree) {
+  if(!tree->height) {
+    if(tree->nb_keys || tree->first_leaf || tree->last_leaf) {
+      fprintf(stderr, "Error: empty tree with %zu keys\n", tree->nb_keys);
+      abort();
+    }
+    return;
+  }
+  struct bt_leaf* last_leaf = NULL;
+  size_t nb_keys = __bt_check(tree->root, tree->height, 0, 0, 0, 0, &last_leaf);
+  if(nb_keys != tree->nb_keys || last_leaf != tree->last_leaf || last_leaf->next) {
+    fprintf(stderr, "Error: the tree contains %zu keys instead of %zu\n", nb_keys, tree->nb_keys);
+    abort();
+  }
+}
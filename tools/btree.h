@@ -0,0 +1,156 @@
+#ifndef BTREE_H
+#define BTREE_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+/* B+tree that maps 64-bit keys to lists of values.
+ *
+ * Nodes are 256 bytes (4 cache lines) and are allocated from a per-tree
+ * pool. The keys of a node are stored contiguously, so a search only
+ * touches a few cache lines per level. The values are stored in the
+ * leaves, which are chained, so browsing the tree in key order is a
+ * sequential scan of the leaves.
+ *
+ * As in hash.h, several values can be associated with the same key.
+ */
+
+#define BT_NODE_SIZE 256
+/* number of keys in a leaf/inner node so that it fits in BT_NODE_SIZE bytes */
+#define BT_LEAF_ORDER 14
+#define BT_INNER_ORDER 15
+
+/* each key is associated with a list of entries */
+struct bt_entry {
+  void* value;
+  struct bt_entry* next;
+};
+
+struct bt_leaf {
+  int nb_keys;
+  struct bt_leaf* prev;
+  struct bt_leaf* next;
+  uint64_t keys[BT_LEAF_ORDER];
+  struct bt_entry* entries[BT_LEAF_ORDER];
+} __attribute__ ((aligned (64)));
+
+struct bt_inner {
+  int nb_keys;
+  /* children[i] contains the keys k such that keys[i-1] <= k < keys[i] */
+  uint64_t keys[BT_INNER_ORDER];
+  void* children[BT_INNER_ORDER + 1];
+} __attribute__ ((aligned (64)));
+
+/* a pool of fixed-size objects */
+struct bt_pool {
+  size_t object_size;
+  void* free_list;
+  void* chunks;			/* list of the allocated chunks */
+};
+
+struct btree {
+  void* root;			/* a leaf if height == 1 */
+  int height;			/* 0 if the tree is empty */
+  size_t nb_keys;
+  struct bt_leaf* first_leaf;
+  struct bt_leaf* last_leaf;
+  struct bt_pool node_pool;
+  struct bt_pool entry_pool;
+};
+
+#define BTREE_INITIALIZER {NULL, 0, 0, NULL, NULL,			\
+      {BT_NODE_SIZE, NULL, NULL}, {sizeof(struct bt_entry), NULL, NULL}}
+
+/* a position in the tree */
+struct bt_iter {
+  struct bt_leaf* leaf;
+  int index;
+};
+
+void bt_init(struct btree* tree);
+
+/* Free the tree */
+void bt_release(struct btree* tree);
+
+/* insert a (key, value) in the tree */
+void bt_insert(struct btree* tree, uint64_t key, void* value);
+
+/* remove a (key,value) from the tree.
+ * return 1 if it was found
+ */
+int bt_remove_key_value(struct btree* tree, uint64_t key, void* value);
+
+/* remove a key (and all its values) from the tree.
+ * return 1 if it was found
+ */
+int bt_remove_key(struct btree* tree, uint64_t key);
+
+/* return the entries associated with key */
+struct bt_entry* bt_get_entry(struct btree* tree, uint64_t key);
+
+/* return a value associated with key */
+void* bt_get_value(struct btree* tree, uint64_t key);
+
+/* return 1 if the tree contains the key */
+int bt_contains_key(struct btree* tree, uint64_t key);
+
+/* set iter to the greatest key that is lower or equal to key.
+ * return 0 if there is no such key
+ */
+int bt_lower_key(struct btree* tree, uint64_t key, struct bt_iter* iter);
+
+/* set iter to the smallest key that is greater or equal to key.
+ * return 0 if there is no such key
+ */
+int bt_upper_key(struct btree* tree, uint64_t key, struct bt_iter* iter);
+
+/* set iter to the first key of the tree. return 0 if the tree is empty */
+int bt_first(struct btree* tree, struct bt_iter* iter);
+
+/* move iter to the next (or previous) key. return 0 at the end of the tree */
+static inline int bt_next(struct bt_iter* iter) {
+  if(++iter->index < iter->leaf->nb_keys)
+    return 1;
+  iter->leaf = iter->leaf->next;
+  iter->index = 0;
+  return iter->leaf != NULL;
+}
+
+static inline int bt_prev(struct bt_iter* iter) {
+  if(--iter->index >= 0)
+    return 1;
+  iter->leaf = iter->leaf->prev;
+  if(!iter->leaf)
+    return 0;
+  iter->index = iter->leaf->nb_keys - 1;
+  return 1;
+}
+
+static inline uint64_t bt_iter_key(struct bt_iter* iter) {
+  return iter->leaf->keys[iter->index];
+}
+
+static inline struct bt_entry* bt_iter_entries(struct bt_iter* iter) {
+  return iter->leaf->entries[iter->index];
+}
+
+/* browse the keys of the tree in increasing order */
+#define FOREACH_BTREE(tree, iter)		\
+  for(int __bt_ok = bt_first(tree, &(iter));	\
+      __bt_ok;					\
+      __bt_ok = bt_next(&(iter)))
+
+/* fill an empty tree with nb_keys sorted (key, value).
+ * This is much faster than inserting the keys one by one, and the leaves are full
+ */
+void bt_bulk_load(struct btree* tree, const uint64_t* keys, void** values, size_t nb_keys);
+
+/* return the number of keys stored in the tree */
+size_t bt_size(struct btree* tree);
+
+void bt_print(struct btree* tree);
+
+/* check if a tree is consistent */
+void bt_check(struct btree* tree);
+
+#endif /* BTREE_H */
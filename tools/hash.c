@@ -1,4 +1,5 @@
 #include "hash.h"
+#include "tools_allocator.h"
 #include <inttypes.h>
 
 #define max(a, b) (((a) > (b))? (a) : (b))
@@ -93,7 +94,7 @@ void *ht_get_value(struct ht_node *node, uint64_t key) {
 
 /* allocate and initialize a node */
 struct ht_node* __ht_new_node(uint64_t key, void *value) {
-  struct ht_node* n = malloc(sizeof(struct ht_node));
+  struct ht_node* n = tools_alloc(sizeof(struct ht_node));
   n->key = key;
   n->entries = NULL;
   n->left = NULL;
@@ -106,7 +107,7 @@ struct ht_node* __ht_new_node(uint64_t key, void *value) {
 
 /* allocate and initialize a node */
 static struct ht_entry* __ht_new_entry(struct ht_node* node, void *value) {
-  struct ht_entry* e = malloc(sizeof(struct ht_entry));
+  struct ht_entry* e = tools_alloc(sizeof(struct ht_entry));
   e->value = value;
   e->next = node->entries;
   node->entries = e;
@@ -119,10 +120,10 @@ static void __ht_free_node(struct ht_node* node) {
     struct ht_entry *e= node->entries;
     while(e) {
       node->entries = e->next;
-      free(e);
+      tools_free(e, sizeof(struct ht_entry));
       e = node->entries;
     }
-    free(node);
+    tools_free(node, sizeof(struct ht_node));
   }
 }
 
@@ -280,18 +281,18 @@ static struct ht_node* __ht_remove_key_generic(struct ht_node* node, uint64_t ke
       /* remove the first entry */
       e = to_remove->entries;
       to_remove->entries= e->next;
-      free(e);
-    }
-
-    /* browse the list of entries and remove value */
-    while(e->next) {
-      if( e->next->value == value) {
-	struct ht_entry *tmp = e->next;
-	e->next = tmp->next;
-	free(tmp);
-	break;
+      tools_free(e, sizeof(struct ht_entry));
+    } else {
+      /* browse the list of entries and remove value */
+      while(e->next) {
+	if( e->next->value == value) {
+	  struct ht_entry *tmp = e->next;
+	  e->next = tmp->next;
+	  tools_free(tmp, sizeof(struct ht_entry));
+	  break;
+	}
+	e = e->next;
       }
-      e = e->next;
     }
     if(to_remove->entries) {
       /* there are other values associated to key, don't remove the key! */
@@ -308,7 +309,7 @@ static struct ht_node* __ht_remove_key_generic(struct ht_node* node, uint64_t ke
       /* removing the root */
       node = NULL;
     }
-    free(to_remove);
+    tools_free(to_remove, sizeof(struct ht_node));
   } else if (!to_remove->right || !to_remove->left) {
     /* to_remove has 1 child */
     if(parent) {
@@ -324,7 +325,7 @@ static struct ht_node* __ht_remove_key_generic(struct ht_node* node, uint64_t ke
       else
 	node = to_remove->left;
     }
-    free(to_remove);
+    tools_free(to_remove, sizeof(struct ht_node));
   } else {
     /* to_remove has 2 children */
     struct ht_node* succ = to_remove->right;
@@ -407,7 +408,7 @@ void ht_release(struct ht_node *node) {
   if(node) {
     ht_release(node->left);
     ht_release(node->right);
-    free(node);
+    __ht_free_node(node);
   }
 }
 
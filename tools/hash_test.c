@@ -5,6 +5,7 @@
 #include <inttypes.h>
 #include <sys/time.h>
 #include "hash.h"
+#include "btree.h"
 
 struct list {
   uint64_t key;
@@ -80,11 +81,195 @@ struct ht_node* delete_random_value(struct ht_node* root) {
 }
 
 
+static double get_duration(struct timeval* t1, struct timeval* t2) {
+  return ((t2->tv_sec-t1->tv_sec)*1e6 + (t2->tv_usec-t1->tv_usec))/1e6;
+}
+
+/* perform random insert/remove/lower_key on a btree, and compare the results with a hashtable */
+void test_btree(int nb_op) {
+  struct btree tree;
+  bt_init(&tree);
+  struct ht_node* ref = NULL;
+  uint64_t key_range = nb_op;
+
+  for(int i=0; i<nb_op; i++) {
+    uint64_t key = lrand48() % key_range;
+    long op = lrand48() % 10;
+    if(op < 5) {
+      void* value = (void*)(uintptr_t)(lrand48() % 4 + 1);
+      bt_insert(&tree, key, value);
+      ref = ht_insert(ref, key, value);
+    } else if(op < 7) {
+      void* value = ht_get_value(ref, key);
+      int found = bt_remove_key_value(&tree, key, value);
+      if(found != (value != NULL)) {
+	printf("Error while removing %" PRIu64 " from the btree\n", key);
+	abort();
+      }
+      if(value)
+	ref = ht_remove_key_value(ref, key, value);
+    } else if(op < 8) {
+      bt_remove_key(&tree, key);
+      ref = ht_remove_key(ref, key);
+    } else {
+      struct bt_iter it;
+      struct ht_node* n = ht_lower_key(ref, key);
+      int found = bt_lower_key(&tree, key, &it);
+      if(found != (n != NULL) || (n && bt_iter_key(&it) != n->key)) {
+	printf("Error: bt_lower_key(%" PRIu64 ") returned an invalid key\n", key);
+	abort();
+      }
+    }
+
+    if(i % 1000 == 0) {
+      bt_check(&tree);
+      if(bt_size(&tree) != ht_size(ref)) {
+	printf("Error: the btree contains %zu keys. It should contain %d\n", bt_size(&tree), ht_size(ref));
+	abort();
+      }
+    }
+  }
+  bt_check(&tree);
+
+  /* the btree and the hashtable should contain the same keys in the same order */
+  struct bt_iter it;
+  struct ht_node* n = __ht_min_node(ref);
+  FOREACH_BTREE(&tree, it) {
+    if(!n || n->key != bt_iter_key(&it)) {
+      printf("Error: the btree and the hashtable differ\n");
+      abort();
+    }
+    n = __ht_next_node(n);
+  }
+  if(n) {
+    printf("Error: the btree and the hashtable differ\n");
+    abort();
+  }
+
+  /* check bulk loading */
+  struct btree bulk;
+  bt_init(&bulk);
+  size_t nb_keys = ht_size(ref);
+  uint64_t* keys = malloc(sizeof(uint64_t) * nb_keys);
+  void** values = malloc(sizeof(void*) * nb_keys);
+  size_t j = 0;
+  FOREACH_BTREE(&tree, it) {
+    keys[j] = bt_iter_key(&it);
+    values[j] = bt_iter_entries(&it)->value;
+    j++;
+  }
+  bt_bulk_load(&bulk, keys, values, nb_keys);
+  bt_check(&bulk);
+  for(j=0; j<nb_keys; j++) {
+    if(bt_get_value(&bulk, keys[j]) != values[j]) {
+      printf("Error: bulk loading failed for key %" PRIu64 "\n", keys[j]);
+      abort();
+    }
+  }
+
+  free(keys);
+  free(values);
+  bt_release(&bulk);
+  bt_release(&tree);
+  ht_release(ref);
+  printf("btree: %d random operations checked\n", nb_op);
+}
+
+/* compare the performance of the AVL tree and of the btree */
+void benchmark(long nb_keys) {
+  struct timeval t1, t2;
+  uint64_t* keys = malloc(sizeof(uint64_t) * nb_keys);
+  for(long i=0; i<nb_keys; i++)
+    keys[i] = ((uint64_t)lrand48() << 31) | lrand48();
+  uint64_t sum = 0;
+
+  printf("benchmark with %ld keys:\n", nb_keys);
+
+  struct ht_node* root = NULL;
+  gettimeofday(&t1, NULL);
+  for(long i=0; i<nb_keys; i++)
+    root = ht_insert(root, keys[i], &keys[i]);
+  gettimeofday(&t2, NULL);
+  printf("\tAVL insert:\t%lf s\n", get_duration(&t1, &t2));
+
+  gettimeofday(&t1, NULL);
+  for(long i=0; i<nb_keys; i++) {
+    struct ht_node* n = ht_lower_key(root, keys[i] + 1);
+    sum += n->key;
+  }
+  gettimeofday(&t2, NULL);
+  printf("\tAVL lower_key:\t%lf s\n", get_duration(&t1, &t2));
+
+  struct ht_node* n;
+  gettimeofday(&t1, NULL);
+  FOREACH_HASH(root, n) {
+    sum += n->key;
+  }
+  gettimeofday(&t2, NULL);
+  printf("\tAVL iterate:\t%lf s\n", get_duration(&t1, &t2));
+  ht_release(root);
+
+  struct btree tree;
+  bt_init(&tree);
+  gettimeofday(&t1, NULL);
+  for(long i=0; i<nb_keys; i++)
+    bt_insert(&tree, keys[i], &keys[i]);
+  gettimeofday(&t2, NULL);
+  printf("\tbtree insert:\t%lf s\n", get_duration(&t1, &t2));
+
+  gettimeofday(&t1, NULL);
+  for(long i=0; i<nb_keys; i++) {
+    struct bt_iter it;
+    bt_lower_key(&tree, keys[i] + 1, &it);
+    sum += bt_iter_key(&it);
+  }
+  gettimeofday(&t2, NULL);
+  printf("\tbtree lower_key:\t%lf s\n", get_duration(&t1, &t2));
+
+  struct bt_iter it;
+  long j = 0;
+  gettimeofday(&t1, NULL);
+  FOREACH_BTREE(&tree, it) {
+    sum += bt_iter_key(&it);
+    keys[j++] = bt_iter_key(&it);
+  }
+  gettimeofday(&t2, NULL);
+  printf("\tbtree iterate:\t%lf s\n", get_duration(&t1, &t2));
+  bt_release(&tree);
+
+  /* keys are now sorted */
+  void** values = malloc(sizeof(void*) * j);
+  for(long i=0; i<j; i++)
+    values[i] = &keys[i];
+  gettimeofday(&t1, NULL);
+  bt_bulk_load(&tree, keys, values, j);
+  gettimeofday(&t2, NULL);
+  printf("\tbtree bulk load:\t%lf s\n", get_duration(&t1, &t2));
+  bt_release(&tree);
+
+  /* print sum so that the compiler does not optimize the loops away */
+  printf("(checksum: %" PRIx64 ")\n", sum);
+  free(values);
+  free(keys);
+}
+
 /* Code de test des fonctions ci-dessus */
 int main(int argc, char**argv) {
   int seed= 1;
-  if(argc>1)
-    seed=atoi(argv[1]);
+  int c;
+  int run_benchmark = 0;
+  long nb_keys = 10000000;
+  while((c = getopt(argc, argv, "bn:")) != -1) {
+    switch(c) {
+    case 'b': run_benchmark = 1; break;
+    case 'n': nb_keys = atol(optarg); break;
+    default:
+      fprintf(stderr, "usage: %s [-b] [-n nb_keys] [seed]\n", argv[0]);
+      return 1;
+    }
+  }
+  if(optind < argc)
+    seed=atoi(argv[optind]);
   struct ht_node *root = NULL;
   srand48(seed);
   int i;
@@ -120,5 +305,9 @@ int main(int argc, char**argv) {
 
   /* Liberation */
   ht_release(root);
+
+  test_btree(100000);
+  if(run_benchmark)
+    benchmark(nb_keys);
   return 0;
 }
@@ -0,0 +1,26 @@
+#include "tools_allocator.h"
+
+static void* __default_alloc(size_t size) {
+  return malloc(size);
+}
+
+static void __default_free(void* ptr, size_t size) {
+  free(ptr);
+}
+
+static void* (*tools_alloc_fn)(size_t size) = __default_alloc;
+static void (*tools_free_fn)(void* ptr, size_t size) = __default_free;
+
+void tools_set_allocator(void* (*alloc_fn)(size_t size),
+			 void (*free_fn)(void* ptr, size_t size)) {
+  tools_alloc_fn = alloc_fn;
+  tools_free_fn = free_fn;
+}
+
+void* tools_alloc(size_t size) {
+  return tools_alloc_fn(size);
+}
+
+void tools_free(void* ptr, size_t size) {
+  tools_free_fn(ptr, size);
+}
@@ -0,0 +1,18 @@
+#ifndef TOOLS_ALLOCATOR_H
+#define TOOLS_ALLOCATOR_H
+#include <stdlib.h>
+
+/* The data structures of numamma-tools (hash.h, btree.h) allocate their
+ * nodes with tools_alloc. By default, it uses malloc/free. An application
+ * can replace the allocator (eg. numamma uses its per-thread arenas). This
+ * has to be done before any data structure is created.
+ */
+void tools_set_allocator(void* (*alloc_fn)(size_t size),
+			 void (*free_fn)(void* ptr, size_t size));
+
+void* tools_alloc(size_t size);
+
+/* size is the size that was passed to tools_alloc */
+void tools_free(void* ptr, size_t size);
+
+#endif	/* TOOLS_ALLOCATOR_H */